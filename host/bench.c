@@ -0,0 +1,886 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * slbounce-bench - Time the data preparation and DT paths on the host.
+ *
+ * Runs the real slbounce sources on top of host/mock.c, so the numbers
+ * are only good for comparing changes to the code, not for guessing
+ * how long a device takes. Works fine under perf and valgrind.
+ *
+ * SMCs can be answered from a log recorded on a device (-r), which
+ * makes sl-smc a regression test for the SL calls, and everything
+ * the benchmarks call can be recorded into a log (-w).
+ *
+ * The DT benchmarks time the dtbhack.efi pipeline stage by stage, for
+ * one dtb (-d) or for every .dtb in a directory (-D), i.e. the dtbs of
+ * the supported boards from a kernel build. The results can be saved
+ * (-o) and later compared against (-b), a benchmark that got slower
+ * than the threshold (-T) makes the exit code 3.
+ *
+ * Usage: slbounce-bench [-C dir] [-t tcblaunch] [-d dtb | -D dir] [-n iters]
+ *                       [-m descs] [-r log [-l]] [-w log] [-o file]
+ *                       [-b file [-T pct]] [bench...]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <libfdt.h>
+
+#include "winnt.h"
+
+#include "util.h"
+#include "sl.h"
+#include "dtq.h"
+#include "dtfixup.h"
+#include "dtbhack.h"
+#include "dtslim.h"
+#include "flush.h"
+#include "smclog.h"
+#include "mock.h"
+
+#define BENCH_TCB_DEFAULT	"tcblaunch.exe"
+#define BENCH_TCB_PAGES		512
+#define BENCH_DTB_SLACK		(256 * 1024)
+#define BENCH_CORPUS_MAX	64
+#define BENCH_BASE_MAX		1024
+#define BENCH_NAME_MAX		64
+#define BENCH_THRESHOLD		10.0	/* Percent the min may grow by. */
+
+/* Benchmarks with available() need a dtb and run once for each. */
+struct bench {
+	const char *name;
+	int (*available)(void);
+	void (*prepare)(void);	/* Before every iteration, not timed. */
+	void (*run)(void);
+	void (*finish)(void);	/* After every iteration, not timed. */
+};
+
+static EFI_FILE_HANDLE bench_volume;
+static CHAR16 bench_tcb_name[256];
+
+static UINT8 *bench_tcb;
+static UINT64 bench_tcb_size;
+static UINT8 *bench_tcb_load;
+static EFI_FILE_HANDLE bench_tcb_file;
+
+static UINT8 *bench_dtb;
+static UINTN bench_dtb_size;
+static UINT8 *bench_dtb_work;
+static UINT8 *bench_dtb_slim;
+static const char *bench_dtb_label = "-";
+
+/* In dtbo.s */
+extern const UINT8 dtbo_sc7180_symbols[];
+extern const UINT8 dtbo_sc7180_el2[];
+extern const UINT8 dtbo_sc8280xp_symbols[];
+extern const UINT8 dtbo_sc8280xp_el2[];
+extern const UINT8 dtbo_x1e_el2[];
+
+/* The overlays dtfixup applies, see dtfixup_socs in src/dtfixup.c. */
+static const struct bench_soc {
+	const char *compatible;
+	const UINT8 *symbols;
+	const UINT8 *el2;
+} bench_socs[] = {
+	{ "qcom,sc7180",	dtbo_sc7180_symbols,	dtbo_sc7180_el2 },
+	{ "qcom,sc8280xp",	dtbo_sc8280xp_symbols,	dtbo_sc8280xp_el2 },
+	{ "qcom,x1e80100",	NULL,			dtbo_x1e_el2 },
+};
+
+static const struct bench_soc *bench_soc;
+static BOOLEAN bench_need_symbols;
+static UINT8 *bench_dtbo_work;
+
+/* Results of an earlier run to compare against. */
+struct bench_base {
+	char dtb[BENCH_NAME_MAX];
+	char name[BENCH_NAME_MAX];
+	double min;
+};
+
+static struct bench_base bench_base[BENCH_BASE_MAX];
+static int bench_base_cnt = 0;
+static double bench_threshold = BENCH_THRESHOLD;
+static int bench_regressions = 0;
+static FILE *bench_out;
+
+static UINT8 *bench_replay;
+
+static struct sl_smc_params *bench_smc_data;
+static uint64_t bench_pe_data, bench_pe_size, bench_arg_data, bench_arg_size;
+
+/* The same lookups as sl_is_allowed_by_fdt() in bounce_main.c */
+static struct dtq_query bench_el2_queries[] = {
+	{ .path = "/chosen", .prop = "dtbhack-el2-overlay" },
+	{ .compatible = "qcom,adreno", .name = "zap-shader", .prop = "status" },
+};
+
+static volatile int bench_sl_allowed;
+
+static struct dtq_query bench_queries[] = {
+	{ .path = "/", .prop = "model" },
+	{ .path = "/chosen", .prop = "bootargs" },
+	{ .compatible = "qcom,adreno", .name = "zap-shader", .prop = "status" },
+	{ .compatible = "qcom,rmtfs-mem", .prop = "reg" },
+	{ .compatible = "qcom,cmd-db", .prop = "reg" },
+};
+
+#define BENCH_QUERY_CNT	(sizeof(bench_queries) / sizeof(bench_queries[0]))
+
+/*
+ * Make up a PE that passes the checks in sl.c, for when there is
+ * no tcblaunch.exe around. Sizes are close to the real one.
+ */
+static UINT8 *bench_fake_tcb(UINT64 *size)
+{
+	static const struct {
+		const char *name;
+		DWORD rva;
+		DWORD raw_size;
+	} sections[] = {
+		{ ".text",	0x1000,		0xd0000 },
+		{ ".rdata",	0xd1000,	0x30000 },
+		{ ".data",	0x101000,	0x8000 },
+		{ ".reloc",	0x109000,	0x2000 },
+	};
+	PIMAGE_DOS_HEADER dos;
+	PIMAGE_NT_HEADERS64 nt;
+	PIMAGE_SECTION_HEADER sec;
+	PWIN_CERTIFICATE cert;
+	DWORD file_off = 0x400, cert_size = 0x4030;
+	UINT8 *pe;
+	uint32_t seed = 1;
+	UINT64 total = file_off, i;
+	int j;
+
+	for (j = 0; j < sizeof(sections) / sizeof(sections[0]); j++)
+		total += sections[j].raw_size;
+	total += cert_size;
+
+	pe = calloc(1, total);
+	if (!pe)
+		return NULL;
+
+	/* Not compressible, like real code. */
+	for (i = file_off; i < total; i++) {
+		seed = seed * 1103515245 + 12345;
+		pe[i] = seed >> 16;
+	}
+
+	dos = (PIMAGE_DOS_HEADER)pe;
+	dos->e_magic = IMAGE_DOS_SIGNATURE;
+	dos->e_lfanew = 0x80;
+
+	nt = (PIMAGE_NT_HEADERS64)(pe + dos->e_lfanew);
+	nt->Signature = IMAGE_NT_SIGNATURE;
+	nt->FileHeader.Machine = 0xaa64;
+	nt->FileHeader.NumberOfSections = sizeof(sections) / sizeof(sections[0]);
+	nt->FileHeader.SizeOfOptionalHeader = sizeof(nt->OptionalHeader);
+	nt->OptionalHeader.Magic = 0x20b;
+	nt->OptionalHeader.SizeOfHeaders = file_off;
+	nt->OptionalHeader.SizeOfImage = 0x10b000;
+	nt->OptionalHeader.Subsystem = IMAGE_SUBSYSTEM_WINDOWS_BOOT_APPLICATION;
+	nt->OptionalHeader.NumberOfRvaAndSizes = IMAGE_NUMBEROF_DIRECTORY_ENTRIES;
+
+	/* sl_load_pe() expects the section table at a fixed place. */
+	sec = (PIMAGE_SECTION_HEADER)((UINT8 *)nt + 0x108);
+	for (j = 0; j < sizeof(sections) / sizeof(sections[0]); j++) {
+		strncpy((char *)sec[j].Name, sections[j].name, IMAGE_SIZEOF_SHORT_NAME);
+		sec[j].Misc.VirtualSize = sections[j].raw_size;
+		sec[j].VirtualAddress = sections[j].rva;
+		sec[j].SizeOfRawData = sections[j].raw_size;
+		sec[j].PointerToRawData = file_off;
+		file_off += sections[j].raw_size;
+	}
+
+	nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY].VirtualAddress = file_off;
+	nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY].Size = cert_size;
+
+	cert = (PWIN_CERTIFICATE)(pe + file_off);
+	cert->dwLength = cert_size;
+	cert->wRevision = 0x200;
+	cert->wCertificateType = 2;
+
+	*size = total;
+	return pe;
+}
+
+static int bench_have_dtb(void)
+{
+	return bench_dtb != NULL;
+}
+
+static int bench_have_soc(void)
+{
+	return bench_dtb && bench_soc;
+}
+
+static int bench_have_symbols(void)
+{
+	return bench_have_soc() && bench_need_symbols;
+}
+
+/* file-read: FileOpen() + FileRead() of tcblaunch, lz4 if that's what is there. */
+static void bench_file_read_run(void)
+{
+	EFI_FILE_HANDLE file = FileOpen(bench_volume, bench_tcb_name);
+	UINT64 size = FileSize(file);
+	UINT8 *data = AllocatePool(size);
+
+	FileRead(file, data, size);
+	FileClose(file);
+	FreePool(data);
+}
+
+/* pe-load: sl_load_pe() + sl_get_cert_entry() */
+static void bench_pe_load_run(void)
+{
+	UINT8 *cert;
+	UINT64 cert_size;
+
+	sl_load_pe(bench_tcb_load, BENCH_TCB_PAGES * 4096, bench_tcb, bench_tcb_size);
+	sl_get_cert_entry(bench_tcb, &cert, &cert_size);
+}
+
+/* create-data: the whole sl_create_data() including reading the file */
+static void bench_create_data_prepare(void)
+{
+	bench_tcb_file = FileOpen(bench_volume, bench_tcb_name);
+}
+
+static void bench_create_data_run(void)
+{
+	struct sl_smc_params *smcdata;
+	uint64_t pe_data, pe_size, arg_data, arg_size;
+	EFI_STATUS status;
+
+	status = sl_create_data(bench_tcb_file, &smcdata, &pe_data, &pe_size, &arg_data, &arg_size);
+	if (EFI_ERROR(status)) {
+		fprintf(stderr, "sl_create_data() failed: 0x%llx\n", (unsigned long long)status);
+		exit(1);
+	}
+}
+
+static void bench_create_data_finish(void)
+{
+	FileClose(bench_tcb_file);
+	mock_free_all_pages();
+}
+
+/* dtq: the EBS-time lookups */
+static void bench_dtq_run(void)
+{
+	dtq_run(bench_dtb, bench_queries, BENCH_QUERY_CNT);
+}
+
+/* sl-allowed: the EBS-time policy check */
+static void bench_sl_allowed_run(void)
+{
+	struct dtq_query *el2 = &bench_el2_queries[0], *zap = &bench_el2_queries[1];
+
+	bench_sl_allowed = !dtq_run(bench_dtb, bench_el2_queries, 2) &&
+			   (el2->value || (zap->value && zap->len > 0 &&
+					   !strncmp(zap->value, "disabled", zap->len)));
+}
+
+static void bench_dt_die(const char *what, int ret)
+{
+	fprintf(stderr, "%s: %s failed: %d\n", bench_dtb_label, what, ret);
+	exit(1);
+}
+
+/* Copy the dtb into the work buffer and open it like dtbhack.efi does. */
+static void bench_dt_open(void)
+{
+	int ret;
+
+	memcpy(bench_dtb_work, bench_dtb, bench_dtb_size);
+
+	ret = fdt_open_into(bench_dtb_work, bench_dtb_work, bench_dtb_size + BENCH_DTB_SLACK);
+	if (ret)
+		bench_dt_die("fdt_open_into()", ret);
+}
+
+static void bench_dt_overlay(const UINT8 *dtbo)
+{
+	int ret;
+
+	memcpy(bench_dtbo_work, dtbo, fdt_totalsize(dtbo));
+
+	ret = fdt_overlay_apply(bench_dtb_work, bench_dtbo_work);
+	if (ret)
+		bench_dt_die("fdt_overlay_apply()", ret);
+}
+
+/* fdt-check: fdt_check_header() of the file as read */
+static void bench_fdt_check_run(void)
+{
+	int ret = fdt_check_header(bench_dtb);
+
+	if (ret)
+		bench_dt_die("fdt_check_header()", ret);
+}
+
+/* fdt-open: fdt_open_into() with the room for the updates */
+static void bench_fdt_open_prepare(void)
+{
+	memcpy(bench_dtb_work, bench_dtb, bench_dtb_size);
+}
+
+static void bench_fdt_open_run(void)
+{
+	int ret = fdt_open_into(bench_dtb_work, bench_dtb_work, bench_dtb_size + BENCH_DTB_SLACK);
+
+	if (ret)
+		bench_dt_die("fdt_open_into()", ret);
+}
+
+/* overlay-symbols, overlay-el2: the built-in overlays for the soc, as "make dtbs" builds them */
+static void bench_overlay_symbols_prepare(void)
+{
+	bench_dt_open();
+	memcpy(bench_dtbo_work, bench_soc->symbols, fdt_totalsize(bench_soc->symbols));
+}
+
+static void bench_overlay_el2_prepare(void)
+{
+	bench_dt_open();
+	if (bench_need_symbols)
+		bench_dt_overlay(bench_soc->symbols);
+	memcpy(bench_dtbo_work, bench_soc->el2, fdt_totalsize(bench_soc->el2));
+}
+
+static void bench_overlay_run(void)
+{
+	int ret = fdt_overlay_apply(bench_dtb_work, bench_dtbo_work);
+
+	if (ret)
+		bench_dt_die("fdt_overlay_apply()", ret);
+}
+
+/*
+ * soc-fixups: dtbhack_soc_fixups(), without DTBHACK_RESERVE_MEMORY since
+ * the cmd-db copy reads the memory the dtb points at.
+ */
+static void bench_soc_fixups_run(void)
+{
+	dtbhack_soc_fixups(bench_dtb_work, DTBHACK_FIXUPS);
+}
+
+static void bench_soc_fixups_finish(void)
+{
+	mock_free_all_pages();
+}
+
+/* zap-shader: dtbhack_zap_zap_shader() */
+static void bench_zap_shader_run(void)
+{
+	dtbhack_zap_zap_shader(bench_dtb_work);
+}
+
+/* fdt-pack: fdt_pack() after the NOPs of the zap shader removal */
+static void bench_fdt_pack_prepare(void)
+{
+	bench_dt_open();
+	dtbhack_zap_zap_shader(bench_dtb_work);
+}
+
+static void bench_fdt_pack_run(void)
+{
+	int ret = fdt_pack(bench_dtb_work);
+
+	if (ret)
+		bench_dt_die("fdt_pack()", ret);
+}
+
+/* dt-slim: dtbhack.efi --slim of the packed dtb */
+static void bench_dt_slim_prepare(void)
+{
+	bench_fdt_pack_prepare();
+	bench_fdt_pack_run();
+}
+
+static void bench_dt_slim_run(void)
+{
+	struct dtslim_stats stats;
+
+	if (EFI_ERROR(dtslim(bench_dtb_work, bench_dtb_slim, bench_dtb_size + BENCH_DTB_SLACK, &stats)))
+		bench_dt_die("dtslim()", 0);
+}
+
+/* dt-fixup: EFI_DT_FIXUP_PROTOCOL as a loader would call it */
+static void bench_dt_fixup_prepare(void)
+{
+	memcpy(bench_dtb_work, bench_dtb, bench_dtb_size);
+}
+
+static void bench_dt_fixup_run(void)
+{
+	UINTN size = bench_dtb_size + BENCH_DTB_SLACK;
+	EFI_STATUS status;
+
+	status = dtfixup_apply(bench_dtb_work, &size, EFI_DT_APPLY_FIXUPS);
+	if (EFI_ERROR(status)) {
+		fprintf(stderr, "dtfixup_apply() failed: 0x%llx\n", (unsigned long long)status);
+		exit(1);
+	}
+}
+
+static void bench_dt_fixup_finish(void)
+{
+	mock_free_all_pages();
+}
+
+/* flush: the EBS memory map flush */
+static void bench_flush_run(void)
+{
+	EFI_MEMORY_DESCRIPTOR *map;
+	UINTN map_size, desc_size;
+
+	mock_get_memory_map(&map, &map_size, &desc_size);
+	flush_memory_map(map, map_size, desc_size);
+}
+
+/* sl-smc: the SL calls slbounce makes, as in sl_install() and the EBS hook */
+static void bench_sl_smc_prepare(void)
+{
+	bench_create_data_prepare();
+	if (EFI_ERROR(sl_create_data(bench_tcb_file, &bench_smc_data, &bench_pe_data, &bench_pe_size,
+				     &bench_arg_data, &bench_arg_size))) {
+		fprintf(stderr, "sl_create_data() failed\n");
+		exit(1);
+	}
+
+	if (bench_replay)
+		smclog_replay_rewind();
+}
+
+static void bench_sl_smc_run(void)
+{
+	static const enum sl_cmd cmds[] = { SL_CMD_IS_AVAILABLE, SL_CMD_AUTH, SL_CMD_LAUNCH };
+	int i;
+
+	for (i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++)
+		sl_smc(bench_smc_data, cmds[i], bench_pe_data, bench_pe_size, bench_arg_data, bench_arg_size);
+}
+
+static const struct bench benches[] = {
+	{ "file-read",		NULL,		NULL,				bench_file_read_run,	NULL },
+	{ "pe-load",		NULL,		NULL,				bench_pe_load_run,	NULL },
+	{ "create-data",	NULL,		bench_create_data_prepare,	bench_create_data_run,	bench_create_data_finish },
+	{ "dtq",		bench_have_dtb,	NULL,				bench_dtq_run,		NULL },
+	{ "dt-fixup",		bench_have_dtb,	bench_dt_fixup_prepare,		bench_dt_fixup_run,	bench_dt_fixup_finish },
+	{ "flush",		NULL,		NULL,				bench_flush_run,	NULL },
+	{ "sl-smc",		NULL,		bench_sl_smc_prepare,		bench_sl_smc_run,	bench_create_data_finish },
+	{ "sl-allowed",		bench_have_dtb,	NULL,				bench_sl_allowed_run,	NULL },
+	/* The dtbhack.efi stages, in order. */
+	{ "fdt-check",		bench_have_dtb,	NULL,				bench_fdt_check_run,	NULL },
+	{ "fdt-open",		bench_have_dtb,	bench_fdt_open_prepare,		bench_fdt_open_run,	NULL },
+	{ "overlay-symbols",	bench_have_symbols, bench_overlay_symbols_prepare, bench_overlay_run,	NULL },
+	{ "overlay-el2",	bench_have_soc,	bench_overlay_el2_prepare,	bench_overlay_run,	NULL },
+	{ "soc-fixups",		bench_have_soc,	bench_dt_open,			bench_soc_fixups_run,	bench_soc_fixups_finish },
+	{ "zap-shader",		bench_have_dtb,	bench_dt_open,			bench_zap_shader_run,	NULL },
+	{ "fdt-pack",		bench_have_dtb,	bench_fdt_pack_prepare,		bench_fdt_pack_run,	NULL },
+	{ "dt-slim",		bench_have_dtb,	bench_dt_slim_prepare,		bench_dt_slim_run,	NULL },
+};
+
+#define BENCH_CNT	(sizeof(benches) / sizeof(benches[0]))
+
+/*
+ * Print how the min compares to the baseline, the min is what
+ * is least affected by the rest of the host.
+ */
+static void bench_compare(const char *name, double min)
+{
+	double diff;
+	int i;
+
+	for (i = 0; i < bench_base_cnt; i++)
+		if (!strcmp(bench_base[i].dtb, bench_dtb_label) && !strcmp(bench_base[i].name, name))
+			break;
+
+	if (i == bench_base_cnt || bench_base[i].min <= 0) {
+		printf(" %9s", "new");
+		return;
+	}
+
+	diff = (min - bench_base[i].min) * 100 / bench_base[i].min;
+	printf(" %+8.1f%%", diff);
+
+	if (diff > bench_threshold) {
+		printf(" !");
+		bench_regressions++;
+	}
+}
+
+static void bench_one(const struct bench *b, int iters)
+{
+	uint64_t start, t, min = UINT64_MAX, total = 0;
+	int i;
+
+	mock_reset_stats();
+
+	for (i = 0; i < iters; i++) {
+		if (b->prepare)
+			b->prepare();
+
+		start = mock_time_ns();
+		b->run();
+		t = mock_time_ns() - start;
+
+		if (b->finish)
+			b->finish();
+
+		total += t;
+		if (t < min)
+			min = t;
+	}
+
+	printf("%-16s %8d %12.3f %12.3f %8.1f %8.1f %12.1f", b->name, iters,
+	       min / 1000.0, total / 1000.0 / iters,
+	       (double)mock_stats.smc_calls / iters,
+	       (double)mock_stats.flush_calls / iters,
+	       (double)mock_stats.flush_bytes / 1024 / iters);
+
+	if (bench_base_cnt)
+		bench_compare(b->name, min / 1000.0);
+	printf("\n");
+
+	if (bench_out)
+		fprintf(bench_out, "%s %s %d %.3f %.3f\n", bench_dtb_label, b->name, iters,
+			min / 1000.0, total / 1000.0 / iters);
+}
+
+static BOOLEAN bench_selected(const struct bench *b, int argc, char **argv)
+{
+	int j;
+
+	if (optind == argc)
+		return TRUE;
+
+	for (j = optind; j < argc; j++)
+		if (!strcmp(argv[j], b->name))
+			return TRUE;
+
+	return FALSE;
+}
+
+/* Run the selected benchmarks that need a dtb (@dt) or the ones that don't. */
+static void bench_all(BOOLEAN dt, int iters, int argc, char **argv)
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_CNT; i++) {
+		if (!bench_selected(&benches[i], argc, argv))
+			continue;
+
+		if (!!benches[i].available != dt)
+			continue;
+
+		if (benches[i].available && !benches[i].available())
+			continue;
+
+		bench_one(&benches[i], iters);
+	}
+}
+
+static int bench_load_tcb(const char *name)
+{
+	EFI_FILE_HANDLE file;
+	UINTN i;
+
+	for (i = 0; name[i] && i < sizeof(bench_tcb_name) / sizeof(CHAR16) - 1; i++)
+		bench_tcb_name[i] = name[i];
+	bench_tcb_name[i] = 0;
+
+	file = FileOpen(bench_volume, bench_tcb_name);
+	if (!file) {
+		if (strcmp(name, BENCH_TCB_DEFAULT)) {
+			fprintf(stderr, "Can't open %s\n", name);
+			return -1;
+		}
+
+		fprintf(stderr, "No %s, using a made up one\n", name);
+		bench_tcb = bench_fake_tcb(&bench_tcb_size);
+		if (!bench_tcb)
+			return -1;
+
+		return mock_add_file(BENCH_TCB_DEFAULT, bench_tcb, bench_tcb_size) ? -1 : 0;
+	}
+
+	bench_tcb_size = FileSize(file);
+	bench_tcb = malloc(bench_tcb_size);
+	if (!bench_tcb) {
+		FileClose(file);
+		return -1;
+	}
+
+	FileRead(file, bench_tcb, bench_tcb_size);
+	FileClose(file);
+
+	return 0;
+}
+
+static int bench_load_dtb(const char *name)
+{
+	const char *label = strrchr(name, '/');
+	UINTN dtbo_max = 0, i;
+
+	free(bench_dtb);
+	free(bench_dtb_work);
+	free(bench_dtb_slim);
+
+	bench_dtb = mock_read_file(name, &bench_dtb_size, 0);
+	if (!bench_dtb)
+		return -1;
+
+	if (fdt_check_header(bench_dtb)) {
+		fprintf(stderr, "%s is not a dtb\n", name);
+		return -1;
+	}
+
+	bench_dtb_label = label ? label + 1 : name;
+	bench_dtb_work = malloc(bench_dtb_size + BENCH_DTB_SLACK);
+	bench_dtb_slim = malloc(bench_dtb_size + BENCH_DTB_SLACK);
+	if (!bench_dtb_work || !bench_dtb_slim)
+		return -1;
+
+	bench_soc = NULL;
+	for (i = 0; i < sizeof(bench_socs) / sizeof(bench_socs[0]); i++) {
+		if (bench_socs[i].symbols && fdt_totalsize(bench_socs[i].symbols) > dtbo_max)
+			dtbo_max = fdt_totalsize(bench_socs[i].symbols);
+		if (fdt_totalsize(bench_socs[i].el2) > dtbo_max)
+			dtbo_max = fdt_totalsize(bench_socs[i].el2);
+
+		if (!bench_soc && !fdt_node_check_compatible(bench_dtb, 0, bench_socs[i].compatible))
+			bench_soc = &bench_socs[i];
+	}
+
+	/* Like dtfixup, the symbols overlay is only for dtbs built without them. */
+	bench_need_symbols = bench_soc && bench_soc->symbols &&
+			     fdt_path_offset(bench_dtb, "/__symbols__") < 0;
+
+	if (!bench_dtbo_work)
+		bench_dtbo_work = malloc(dtbo_max);
+
+	return bench_dtbo_work ? 0 : -1;
+}
+
+/* Baselines are the output of -o, "dtb bench iters min avg" per line. */
+static int bench_load_base(const char *name)
+{
+	char line[256];
+	struct bench_base *b;
+	FILE *fp;
+
+	fp = fopen(name, "r");
+	if (!fp) {
+		perror(name);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) && bench_base_cnt < BENCH_BASE_MAX) {
+		b = &bench_base[bench_base_cnt];
+		if (line[0] == '#')
+			continue;
+
+		if (sscanf(line, "%63s %63s %*d %lf", b->dtb, b->name, &b->min) == 3)
+			bench_base_cnt++;
+	}
+
+	fclose(fp);
+
+	if (!bench_base_cnt) {
+		fprintf(stderr, "%s: no results\n", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_load_replay(const char *name, BOOLEAN delay)
+{
+	EFI_STATUS status;
+	UINTN size;
+
+	bench_replay = mock_read_file(name, &size, 0);
+	if (!bench_replay)
+		return -1;
+
+	status = smclog_replay_init(bench_replay, size, delay);
+	if (EFI_ERROR(status)) {
+		fprintf(stderr, "%s is not a usable SMC log: 0x%llx\n", name, (unsigned long long)status);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int bench_save_log(const char *name)
+{
+	const struct smclog_header *log = smclog_get();
+	FILE *fp = fopen(name, "wb");
+
+	if (!fp) {
+		perror(name);
+		return -1;
+	}
+
+	if (fwrite(log, 1, log->size, fp) != log->size) {
+		fprintf(stderr, "Can't write %s\n", name);
+		fclose(fp);
+		return -1;
+	}
+
+	if (log->dropped)
+		fprintf(stderr, "%s: %u calls didn't fit\n", name, log->dropped);
+
+	return fclose(fp) ? -1 : 0;
+}
+
+static void usage(const char *argv0)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"Usage: %s [options] [bench...]\n"
+		"  -C DIR   directory to load files from, like the ESP (default .)\n"
+		"  -t FILE  tcblaunch.exe to use, relative to DIR (default %s)\n"
+		"  -d DTB   dtb for the DT benchmarks\n"
+		"  -D DIR   run the DT benchmarks for every .dtb in DIR\n"
+		"  -n N     iterations (default 100)\n"
+		"  -m N     descriptors in the memory map (default 128)\n"
+		"  -r LOG   answer SMCs from a log recorded with SLBOUNCE_SMCLOG\n"
+		"  -l       with -r, also take as long as the device did\n"
+		"  -w LOG   record the SMCs into a log\n"
+		"  -o FILE  save the results as a baseline\n"
+		"  -b FILE  compare the results to a baseline\n"
+		"  -T PCT   slowdown of the min that is a regression (default %.0f)\n"
+		"  -v       don't hide the slbounce console output\n"
+		"Benchmarks:",
+		argv0, BENCH_TCB_DEFAULT, BENCH_THRESHOLD);
+	for (i = 0; i < BENCH_CNT; i++)
+		fprintf(stderr, " %s", benches[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *root = ".", *tcb = BENCH_TCB_DEFAULT, *dtb = NULL, *corpus = NULL;
+	const char *replay = NULL, *record = NULL, *out = NULL, *base = NULL;
+	int iters = 100, descs = 128, verbose = 0, delay = 0, dtb_cnt = 0;
+	char *dtbs[BENCH_CORPUS_MAX];
+	int opt, i;
+
+	while ((opt = getopt(argc, argv, "C:t:d:D:n:m:r:lw:o:b:T:vh")) != -1) {
+		switch (opt) {
+		case 'C': root = optarg; break;
+		case 't': tcb = optarg; break;
+		case 'd': dtb = optarg; break;
+		case 'D': corpus = optarg; break;
+		case 'n': iters = atoi(optarg); break;
+		case 'm': descs = atoi(optarg); break;
+		case 'r': replay = optarg; break;
+		case 'l': delay = 1; break;
+		case 'w': record = optarg; break;
+		case 'o': out = optarg; break;
+		case 'b': base = optarg; break;
+		case 'T': bench_threshold = atof(optarg); break;
+		case 'v': verbose = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (iters <= 0 || descs <= 0 || (dtb && corpus)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (corpus) {
+		dtb_cnt = mock_find_dtbs(corpus, dtbs, BENCH_CORPUS_MAX);
+		if (dtb_cnt < 0)
+			return 1;
+	} else if (dtb) {
+		dtbs[dtb_cnt++] = (char *)dtb;
+	}
+
+	if (base && bench_load_base(base))
+		return 1;
+
+	if (out) {
+		bench_out = fopen(out, "w");
+		if (!bench_out) {
+			perror(out);
+			return 1;
+		}
+		fprintf(bench_out, "# dtb bench iters min-us avg-us\n");
+	}
+
+	mock_init(root);
+	mock_set_memory_map(descs, 1);
+
+	bench_volume = GetVolume(mock_image);
+	if (!bench_volume || bench_load_tcb(tcb))
+		return 1;
+
+	bench_tcb_load = malloc(BENCH_TCB_PAGES * 4096);
+	if (!bench_tcb_load)
+		return 1;
+
+	dtq_prepare(bench_queries, BENCH_QUERY_CNT);
+	dtq_prepare(bench_el2_queries, 2);
+
+	/* Recording goes on top of replay, so a replayed run can be diffed. */
+	if (replay && bench_load_replay(replay, delay))
+		return 1;
+
+	if (record && EFI_ERROR(smclog_record_init()))
+		return 1;
+
+	printf("%-16s %8s %12s %12s %8s %8s %12s%s\n",
+	       "bench", "iters", "min us", "avg us", "smc/it", "flush/it", "flush KiB/it",
+	       bench_base_cnt ? "   vs base" : "");
+
+	mock_quiet = !verbose;
+
+	bench_all(FALSE, iters, argc, argv);
+
+	for (i = 0; i < dtb_cnt; i++) {
+		if (bench_load_dtb(dtbs[i]))
+			return 1;
+
+		printf("%s (%lu KiB):\n", bench_dtb_label, (unsigned long)bench_dtb_size / 1024);
+		bench_all(TRUE, iters, argc, argv);
+	}
+
+	if (record && bench_save_log(record))
+		return 1;
+
+	if (bench_out && fclose(bench_out)) {
+		perror(out);
+		return 1;
+	}
+
+	if (replay && smclog_replay_mismatches()) {
+		fprintf(stderr, "%lu SMCs didn't match %s\n",
+			(unsigned long)smclog_replay_mismatches(), replay);
+		return 2;
+	}
+
+	if (bench_regressions) {
+		fprintf(stderr, "%d benchmarks got more than %.0f%% slower than %s\n",
+			bench_regressions, bench_threshold, base);
+		return 3;
+	}
+
+	return 0;
+}
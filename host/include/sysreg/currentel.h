@@ -0,0 +1,23 @@
+#ifndef HOST_SYSREG_CURRENTEL_H
+#define HOST_SYSREG_CURRENTEL_H
+
+#include <stdint.h>
+
+/*
+ * Stand-in for arm64-sysreg-lib in host builds, the harness always
+ * runs "in EL1".
+ */
+union currentel {
+	struct {
+		uint64_t		: 2;
+		uint64_t el		: 2;
+	};
+	uint64_t bits;
+};
+
+static inline union currentel read_currentel(void)
+{
+	return (union currentel){ .el = 1 };
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef HOST_SYSREG_DAIF_H
+#define HOST_SYSREG_DAIF_H
+
+#include <stdint.h>
+
+/*
+ * Stand-in for arm64-sysreg-lib in host builds. There are no
+ * interrupts to mask, the state is only kept for the callers.
+ */
+union daif {
+	struct {
+		uint64_t		: 6;
+		uint64_t f		: 1;
+		uint64_t i		: 1;
+		uint64_t a		: 1;
+		uint64_t d		: 1;
+	};
+	uint64_t bits;
+};
+
+extern union daif host_daif;
+
+static inline union daif read_daif(void)
+{
+	return host_daif;
+}
+
+static inline void unsafe_write_daif(union daif val)
+{
+	host_daif = val;
+}
+
+#endif
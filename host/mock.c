@@ -0,0 +1,772 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * Just enough of UEFI for the slbounce sources to run on the host.
+ *
+ * gnu-efi's libefi is linked as-is and talks to the tables below, so
+ * Print(), AllocatePool() and friends behave like on a device. Files
+ * come from a host directory, pages and pools from malloc.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "mock.h"
+
+#define MOCK_PROTOCOLS_MAX	32
+#define MOCK_TABLES_MAX		16
+#define MOCK_FILES_MAX		16
+#define MOCK_PATH_MAX		1024
+
+/* Bigger than the struct like most firmware, so nobody gets to assume. */
+#define MOCK_DESC_SIZE		48
+
+struct mock_protocol {
+	EFI_HANDLE handle;
+	EFI_GUID guid;
+	VOID *iface;
+};
+
+struct mock_pages {
+	EFI_PHYSICAL_ADDRESS addr;
+	UINTN pages;
+	EFI_MEMORY_TYPE type;
+	struct mock_pages *next;
+};
+
+struct mock_file {
+	/* Must be first since we hand out a pointer to it. */
+	EFI_FILE_PROTOCOL proto;
+	BOOLEAN dir;
+	BOOLEAN owned;		/* data was read from the disk. */
+	UINT8 *data;
+	UINTN size;
+	UINT64 pos;
+	char name[MOCK_PATH_MAX];
+};
+
+struct mock_mem_file {
+	const char *name;
+	const void *data;
+	UINTN size;
+};
+
+static const char *mock_root = ".";
+
+BOOLEAN mock_quiet = FALSE;
+
+static struct mock_protocol mock_protocols[MOCK_PROTOCOLS_MAX];
+static int mock_protocol_cnt = 0;
+
+static EFI_CONFIGURATION_TABLE mock_tables[MOCK_TABLES_MAX];
+
+static struct mock_mem_file mock_mem_files[MOCK_FILES_MAX];
+static int mock_mem_file_cnt = 0;
+
+static struct mock_pages *mock_pages_list = NULL;
+
+static UINT8 *mock_map = NULL;
+static UINTN mock_map_size = 0;
+
+/* Handles only need to be unique. */
+static UINT8 mock_handles[MOCK_PROTOCOLS_MAX];
+static int mock_handle_cnt = 0;
+
+EFI_HANDLE mock_image;
+static EFI_HANDLE mock_device;
+
+EFI_SYSTEM_TABLE mock_st;
+static EFI_BOOT_SERVICES mock_bs;
+static EFI_RUNTIME_SERVICES mock_rt;
+static SIMPLE_TEXT_OUTPUT_INTERFACE mock_conout;
+static SIMPLE_TEXT_OUTPUT_MODE mock_conout_mode;
+static EFI_LOADED_IMAGE mock_loaded_image;
+static EFI_FILE_IO_INTERFACE mock_fs;
+
+static EFI_HANDLE mock_new_handle(void)
+{
+	if (mock_handle_cnt == MOCK_PROTOCOLS_MAX) {
+		fprintf(stderr, "mock: out of handles\n");
+		abort();
+	}
+
+	return &mock_handles[mock_handle_cnt++];
+}
+
+static EFI_STATUS EFIAPI mock_unsupported(void)
+{
+	return EFI_UNSUPPORTED;
+}
+
+/* Point every service of a table to mock_unsupported(). */
+static void mock_fill_table(VOID *table, UINTN size)
+{
+	VOID **slot = (VOID **)((UINT8 *)table + sizeof(EFI_TABLE_HEADER));
+	VOID **end = (VOID **)((UINT8 *)table + size);
+
+	while (slot < end)
+		*slot++ = (VOID *)mock_unsupported;
+}
+
+/*
+ * Console
+ */
+
+static EFI_STATUS EFIAPI mock_output_string(SIMPLE_TEXT_OUTPUT_INTERFACE *This, CHAR16 *String)
+{
+	if (mock_quiet)
+		return EFI_SUCCESS;
+
+	for (; *String; String++) {
+		if (*String == L'\r')
+			continue;
+		putchar(*String < 0x80 ? *String : '?');
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_set_attribute(SIMPLE_TEXT_OUTPUT_INTERFACE *This, UINTN Attribute)
+{
+	mock_conout_mode.Attribute = Attribute;
+	return EFI_SUCCESS;
+}
+
+/*
+ * Memory
+ */
+
+static EFI_STATUS EFIAPI mock_allocate_pages(EFI_ALLOCATE_TYPE Type, EFI_MEMORY_TYPE MemoryType,
+					     UINTN NoPages, EFI_PHYSICAL_ADDRESS *Memory)
+{
+	struct mock_pages *p;
+	VOID *mem;
+
+	/* Host memory is wherever malloc puts it, limits can't be honored. */
+	if (Type == AllocateAddress)
+		return EFI_NOT_FOUND;
+
+	if (posix_memalign(&mem, EFI_PAGE_SIZE, NoPages * EFI_PAGE_SIZE))
+		return EFI_OUT_OF_RESOURCES;
+
+	p = malloc(sizeof(*p));
+	if (!p) {
+		free(mem);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	/* Firmware doesn't clear the pages either. */
+	memset(mem, 0xa5, NoPages * EFI_PAGE_SIZE);
+
+	p->addr = (EFI_PHYSICAL_ADDRESS)mem;
+	p->pages = NoPages;
+	p->type = MemoryType;
+	p->next = mock_pages_list;
+	mock_pages_list = p;
+
+	mock_stats.pages_allocated += NoPages;
+	*Memory = p->addr;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_free_pages(EFI_PHYSICAL_ADDRESS Memory, UINTN NoPages)
+{
+	struct mock_pages **pp, *p;
+
+	for (pp = &mock_pages_list; *pp; pp = &(*pp)->next) {
+		p = *pp;
+		if (p->addr != Memory)
+			continue;
+
+		if (p->pages != NoPages)
+			return EFI_INVALID_PARAMETER;
+
+		*pp = p->next;
+		mock_stats.pages_allocated -= p->pages;
+		free((VOID *)p->addr);
+		free(p);
+		return EFI_SUCCESS;
+	}
+
+	return EFI_NOT_FOUND;
+}
+
+/**
+ * mock_free_all_pages() - Release every page allocation that is still around.
+ *
+ * For benchmarks of code that hands its pages over to the OS.
+ */
+/* Reserved memory is handed over to the OS, so it is left alone. */
+void mock_free_all_pages(void)
+{
+	struct mock_pages **pp = &mock_pages_list, *p;
+
+	while (*pp) {
+		p = *pp;
+		if (p->type == EfiReservedMemoryType) {
+			pp = &p->next;
+			continue;
+		}
+
+		*pp = p->next;
+		mock_stats.pages_allocated -= p->pages;
+		free((VOID *)p->addr);
+		free(p);
+	}
+}
+
+static EFI_STATUS EFIAPI mock_allocate_pool(EFI_MEMORY_TYPE PoolType, UINTN Size, VOID **Buffer)
+{
+	*Buffer = malloc(Size ? Size : 1);
+	if (!*Buffer)
+		return EFI_OUT_OF_RESOURCES;
+
+	mock_stats.pool_allocs++;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_free_pool(VOID *Buffer)
+{
+	free(Buffer);
+	return EFI_SUCCESS;
+}
+
+/**
+ * mock_set_memory_map() - Make up a memory map of a device.
+ * @count: Number of descriptors.
+ * @seed:  Same seed gives the same map.
+ *
+ * Mostly small boot services and loader regions between big
+ * conventional ones, like a WoA laptop right before EBS. The
+ * addresses aren't backed by anything.
+ */
+void mock_set_memory_map(UINTN count, uint32_t seed)
+{
+	static const struct {
+		UINT32 type;
+		UINT64 max_pages;
+	} kinds[] = {
+		{ EfiConventionalMemory,	0x40000 },
+		{ EfiBootServicesData,		0x100 },
+		{ EfiBootServicesCode,		0x40 },
+		{ EfiBootServicesData,		0x10 },
+		{ EfiLoaderData,		0x800 },
+		{ EfiLoaderCode,		0x20 },
+		{ EfiRuntimeServicesData,	0x40 },
+		{ EfiRuntimeServicesCode,	0x20 },
+		{ EfiReservedMemoryType,	0x2000 },
+		{ EfiACPIReclaimMemory,		0x10 },
+		{ EfiMemoryMappedIO,		0x100 },
+	};
+	EFI_MEMORY_DESCRIPTOR *desc;
+	EFI_PHYSICAL_ADDRESS addr = 0x80000000;
+	UINTN i, k;
+
+	free(mock_map);
+	mock_map_size = count * MOCK_DESC_SIZE;
+	mock_map = calloc(count, MOCK_DESC_SIZE);
+	if (!mock_map) {
+		fprintf(stderr, "mock: can't allocate the memory map\n");
+		abort();
+	}
+
+	for (i = 0; i < count; i++) {
+		seed = seed * 1103515245 + 12345;
+		k = (seed >> 16) % (sizeof(kinds) / sizeof(kinds[0]));
+
+		desc = (EFI_MEMORY_DESCRIPTOR *)(mock_map + i * MOCK_DESC_SIZE);
+		desc->Type = kinds[k].type;
+		desc->PhysicalStart = addr;
+		desc->NumberOfPages = 1 + (seed >> 8) % kinds[k].max_pages;
+		desc->Attribute = EFI_MEMORY_WB;
+		if (desc->Type == EfiRuntimeServicesCode || desc->Type == EfiRuntimeServicesData)
+			desc->Attribute |= EFI_MEMORY_RUNTIME;
+
+		addr += desc->NumberOfPages * EFI_PAGE_SIZE;
+	}
+}
+
+void mock_get_memory_map(EFI_MEMORY_DESCRIPTOR **map, UINTN *map_size, UINTN *desc_size)
+{
+	*map = (EFI_MEMORY_DESCRIPTOR *)mock_map;
+	*map_size = mock_map_size;
+	*desc_size = MOCK_DESC_SIZE;
+}
+
+static EFI_STATUS EFIAPI mock_get_memory_map_svc(UINTN *MemoryMapSize, EFI_MEMORY_DESCRIPTOR *MemoryMap,
+						 UINTN *MapKey, UINTN *DescriptorSize, UINT32 *DescriptorVersion)
+{
+	*DescriptorSize = MOCK_DESC_SIZE;
+	*DescriptorVersion = 1;
+
+	if (*MemoryMapSize < mock_map_size) {
+		*MemoryMapSize = mock_map_size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	memcpy(MemoryMap, mock_map, mock_map_size);
+	*MemoryMapSize = mock_map_size;
+	*MapKey = 1;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_exit_boot_services(EFI_HANDLE ImageHandle, UINTN MapKey)
+{
+	return MapKey == 1 ? EFI_SUCCESS : EFI_INVALID_PARAMETER;
+}
+
+/*
+ * Protocols and tables
+ */
+
+static EFI_STATUS mock_add_protocol(EFI_HANDLE handle, EFI_GUID *guid, VOID *iface)
+{
+	if (mock_protocol_cnt == MOCK_PROTOCOLS_MAX)
+		return EFI_OUT_OF_RESOURCES;
+
+	mock_protocols[mock_protocol_cnt].handle = handle;
+	mock_protocols[mock_protocol_cnt].guid = *guid;
+	mock_protocols[mock_protocol_cnt].iface = iface;
+	mock_protocol_cnt++;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_handle_protocol(EFI_HANDLE Handle, EFI_GUID *Protocol, VOID **Interface)
+{
+	int i;
+
+	for (i = 0; i < mock_protocol_cnt; i++) {
+		if (mock_protocols[i].handle != Handle ||
+		    CompareGuid(&mock_protocols[i].guid, Protocol))
+			continue;
+
+		*Interface = mock_protocols[i].iface;
+		return EFI_SUCCESS;
+	}
+
+	return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI mock_locate_protocol(EFI_GUID *Protocol, VOID *Registration, VOID **Interface)
+{
+	int i;
+
+	for (i = 0; i < mock_protocol_cnt; i++) {
+		if (CompareGuid(&mock_protocols[i].guid, Protocol))
+			continue;
+
+		*Interface = mock_protocols[i].iface;
+		return EFI_SUCCESS;
+	}
+
+	return EFI_NOT_FOUND;
+}
+
+static EFI_STATUS EFIAPI mock_install_protocol_interface(EFI_HANDLE *Handle, EFI_GUID *Protocol,
+							 EFI_INTERFACE_TYPE InterfaceType, VOID *Interface)
+{
+	if (!*Handle)
+		*Handle = mock_new_handle();
+
+	return mock_add_protocol(*Handle, Protocol, Interface);
+}
+
+static EFI_STATUS EFIAPI mock_install_configuration_table(EFI_GUID *Guid, VOID *Table)
+{
+	UINTN i;
+
+	for (i = 0; i < mock_st.NumberOfTableEntries; i++) {
+		if (CompareGuid(&mock_tables[i].VendorGuid, Guid))
+			continue;
+
+		if (Table) {
+			mock_tables[i].VendorTable = Table;
+		} else {
+			mock_st.NumberOfTableEntries--;
+			mock_tables[i] = mock_tables[mock_st.NumberOfTableEntries];
+		}
+		return EFI_SUCCESS;
+	}
+
+	if (!Table)
+		return EFI_NOT_FOUND;
+
+	if (mock_st.NumberOfTableEntries == MOCK_TABLES_MAX)
+		return EFI_OUT_OF_RESOURCES;
+
+	mock_tables[i].VendorGuid = *Guid;
+	mock_tables[i].VendorTable = Table;
+	mock_st.NumberOfTableEntries++;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_get_variable(CHAR16 *VariableName, EFI_GUID *VendorGuid, UINT32 *Attributes,
+					   UINTN *DataSize, VOID *Data)
+{
+	return EFI_NOT_FOUND;
+}
+
+/*
+ * Files
+ */
+
+/**
+ * mock_add_file() - Serve a file from memory instead of the disk.
+ * @name: Path as the sources would ask for it, i.e. "tcblaunch.exe".
+ *
+ * The data is not copied and must stay around.
+ */
+EFI_STATUS mock_add_file(const char *name, const void *data, UINTN size)
+{
+	if (mock_mem_file_cnt == MOCK_FILES_MAX)
+		return EFI_OUT_OF_RESOURCES;
+
+	mock_mem_files[mock_mem_file_cnt].name = name;
+	mock_mem_files[mock_mem_file_cnt].data = data;
+	mock_mem_files[mock_mem_file_cnt].size = size;
+	mock_mem_file_cnt++;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_file_open(EFI_FILE_HANDLE This, EFI_FILE_HANDLE *NewHandle, CHAR16 *FileName,
+					UINT64 OpenMode, UINT64 Attributes);
+
+static EFI_STATUS EFIAPI mock_file_close(EFI_FILE_HANDLE This)
+{
+	struct mock_file *f = (struct mock_file *)This;
+
+	if (f->owned)
+		free(f->data);
+	free(f);
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_file_read(EFI_FILE_HANDLE This, UINTN *BufferSize, VOID *Buffer)
+{
+	struct mock_file *f = (struct mock_file *)This;
+	UINTN left = f->size - f->pos;
+
+	if (f->dir) {
+		*BufferSize = 0;
+		return EFI_SUCCESS;
+	}
+
+	if (*BufferSize > left)
+		*BufferSize = left;
+
+	memcpy(Buffer, f->data + f->pos, *BufferSize);
+	f->pos += *BufferSize;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_file_get_position(EFI_FILE_HANDLE This, UINT64 *Position)
+{
+	struct mock_file *f = (struct mock_file *)This;
+
+	*Position = f->pos;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_file_set_position(EFI_FILE_HANDLE This, UINT64 Position)
+{
+	struct mock_file *f = (struct mock_file *)This;
+
+	if (Position == 0xffffffffffffffffULL)
+		Position = f->size;
+
+	f->pos = Position < f->size ? Position : f->size;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_file_get_info(EFI_FILE_HANDLE This, EFI_GUID *InformationType,
+					    UINTN *BufferSize, VOID *Buffer)
+{
+	struct mock_file *f = (struct mock_file *)This;
+	EFI_GUID info_guid = EFI_FILE_INFO_ID;
+	EFI_FILE_INFO *info = Buffer;
+	UINTN len = strlen(f->name);
+	UINTN size = sizeof(*info) + (len + 1) * sizeof(CHAR16);
+	UINTN i;
+
+	if (CompareGuid(InformationType, &info_guid))
+		return EFI_UNSUPPORTED;
+
+	if (*BufferSize < size) {
+		*BufferSize = size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	memset(info, 0, size);
+	info->Size = size;
+	info->FileSize = f->size;
+	info->PhysicalSize = f->size;
+	info->Attribute = EFI_FILE_READ_ONLY | (f->dir ? EFI_FILE_DIRECTORY : 0);
+	for (i = 0; i < len; i++)
+		info->FileName[i] = f->name[i];
+	info->FileName[len] = 0;
+
+	*BufferSize = size;
+	return EFI_SUCCESS;
+}
+
+static struct mock_file *mock_file_new(const char *name)
+{
+	struct mock_file *f = calloc(1, sizeof(*f));
+
+	if (!f)
+		return NULL;
+
+	mock_fill_table(&f->proto, sizeof(f->proto));
+	f->proto.Revision    = EFI_FILE_HANDLE_REVISION;
+	f->proto.Open        = mock_file_open;
+	f->proto.Close       = mock_file_close;
+	f->proto.Read        = mock_file_read;
+	f->proto.GetPosition = mock_file_get_position;
+	f->proto.SetPosition = mock_file_set_position;
+	f->proto.GetInfo     = mock_file_get_info;
+	snprintf(f->name, sizeof(f->name), "%s", name);
+
+	return f;
+}
+
+static int mock_file_load(struct mock_file *f, const char *path)
+{
+	FILE *fp;
+	long size;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return -1;
+
+	if (fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET))
+		goto error;
+
+	f->data = malloc(size ? size : 1);
+	if (!f->data)
+		goto error;
+
+	if (fread(f->data, 1, size, fp) != (size_t)size) {
+		free(f->data);
+		goto error;
+	}
+
+	f->size = size;
+	f->owned = TRUE;
+	fclose(fp);
+
+	return 0;
+
+error:
+	fclose(fp);
+	return -1;
+}
+
+/* Files can only be opened from the root, which is enough for slbounce. */
+static EFI_STATUS EFIAPI mock_file_open(EFI_FILE_HANDLE This, EFI_FILE_HANDLE *NewHandle, CHAR16 *FileName,
+					UINT64 OpenMode, UINT64 Attributes)
+{
+	char name[MOCK_PATH_MAX], path[MOCK_PATH_MAX * 2];
+	struct mock_file *f;
+	UINTN i, len = 0;
+	int j;
+
+	if (OpenMode != EFI_FILE_MODE_READ)
+		return EFI_WRITE_PROTECTED;
+
+	while (*FileName == L'\\')
+		FileName++;
+
+	for (i = 0; FileName[i] && len < sizeof(name) - 1; i++)
+		name[len++] = FileName[i] == L'\\' ? '/' : (char)FileName[i];
+	name[len] = '\0';
+
+	f = mock_file_new(name);
+	if (!f)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (j = 0; j < mock_mem_file_cnt; j++) {
+		if (strcmp(mock_mem_files[j].name, name))
+			continue;
+
+		f->data = (UINT8 *)mock_mem_files[j].data;
+		f->size = mock_mem_files[j].size;
+		*NewHandle = &f->proto;
+		return EFI_SUCCESS;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", mock_root, name);
+	if (mock_file_load(f, path)) {
+		free(f);
+		return EFI_NOT_FOUND;
+	}
+
+	*NewHandle = &f->proto;
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI mock_open_volume(EFI_FILE_IO_INTERFACE *This, EFI_FILE_HANDLE *Root)
+{
+	struct mock_file *f = mock_file_new("");
+
+	if (!f)
+		return EFI_OUT_OF_RESOURCES;
+
+	f->dir = TRUE;
+	*Root = &f->proto;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * mock_init() - Set up the firmware and initialize libefi with it.
+ * @root: Host directory that is the "ESP" slbounce loads files from.
+ */
+void mock_init(const char *root)
+{
+	EFI_GUID lip_guid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+	EFI_GUID fs_guid = EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+
+	mock_root = root;
+
+	mock_fill_table(&mock_bs, sizeof(mock_bs));
+	mock_bs.Hdr.Signature = EFI_BOOT_SERVICES_SIGNATURE;
+	mock_bs.AllocatePages = mock_allocate_pages;
+	mock_bs.FreePages = mock_free_pages;
+	mock_bs.GetMemoryMap = mock_get_memory_map_svc;
+	mock_bs.AllocatePool = mock_allocate_pool;
+	mock_bs.FreePool = mock_free_pool;
+	mock_bs.HandleProtocol = mock_handle_protocol;
+	mock_bs.LocateProtocol = mock_locate_protocol;
+	mock_bs.InstallProtocolInterface = mock_install_protocol_interface;
+	mock_bs.InstallConfigurationTable = mock_install_configuration_table;
+	mock_bs.ExitBootServices = mock_exit_boot_services;
+
+	mock_fill_table(&mock_rt, sizeof(mock_rt));
+	mock_rt.Hdr.Signature = EFI_RUNTIME_SERVICES_SIGNATURE;
+	mock_rt.GetVariable = mock_get_variable;
+
+	mock_fill_table(&mock_conout, sizeof(mock_conout));
+	mock_conout.OutputString = mock_output_string;
+	mock_conout.SetAttribute = mock_set_attribute;
+	mock_conout.Mode = &mock_conout_mode;
+
+	mock_st.Hdr.Signature = EFI_SYSTEM_TABLE_SIGNATURE;
+	mock_st.FirmwareVendor = L"slbounce host mock";
+	mock_st.ConOut = &mock_conout;
+	mock_st.StdErr = &mock_conout;
+	mock_st.BootServices = &mock_bs;
+	mock_st.RuntimeServices = &mock_rt;
+	mock_st.ConfigurationTable = mock_tables;
+	mock_st.NumberOfTableEntries = 0;
+
+	mock_image = mock_new_handle();
+	mock_device = mock_new_handle();
+
+	mock_loaded_image.Revision = 0x1000;
+	mock_loaded_image.SystemTable = &mock_st;
+	mock_loaded_image.DeviceHandle = mock_device;
+	mock_loaded_image.ImageCodeType = EfiLoaderCode;
+	mock_loaded_image.ImageDataType = EfiLoaderData;
+
+	mock_fs.Revision = EFI_FILE_IO_INTERFACE_REVISION;
+	mock_fs.OpenVolume = mock_open_volume;
+
+	mock_add_protocol(mock_image, &lip_guid, &mock_loaded_image);
+	mock_add_protocol(mock_device, &fs_guid, &mock_fs);
+
+	if (!mock_map)
+		mock_set_memory_map(64, 1);
+
+	InitializeLib(mock_image, &mock_st);
+}
+
+/* Read a host file, extra bytes of room are allocated after it. */
+UINT8 *mock_read_file(const char *name, UINTN *size, UINTN extra)
+{
+	FILE *fp = fopen(name, "rb");
+	UINT8 *data = NULL;
+	long len;
+
+	if (!fp) {
+		perror(name);
+		return NULL;
+	}
+
+	if (fseek(fp, 0, SEEK_END) || (len = ftell(fp)) <= 0 || fseek(fp, 0, SEEK_SET))
+		goto error;
+
+	data = malloc(len + extra);
+	if (!data)
+		goto error;
+
+	if (fread(data, 1, len, fp) != len)
+		goto error;
+
+	fclose(fp);
+	*size = len;
+	return data;
+
+error:
+	fprintf(stderr, "Can't read %s\n", name);
+	free(data);
+	fclose(fp);
+	return NULL;
+}
+
+static int mock_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Find the dtbs in @dir, sorted so runs line up. */
+int mock_find_dtbs(const char *dir, char **paths, int max)
+{
+	struct dirent *ent;
+	int cnt = 0;
+	size_t len;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) {
+		perror(dir);
+		return -1;
+	}
+
+	while ((ent = readdir(d)) && cnt < max) {
+		len = strlen(ent->d_name);
+		if (len < 5 || strcmp(ent->d_name + len - 4, ".dtb"))
+			continue;
+
+		paths[cnt] = malloc(strlen(dir) + len + 2);
+		if (!paths[cnt])
+			break;
+
+		sprintf(paths[cnt++], "%s/%s", dir, ent->d_name);
+	}
+
+	closedir(d);
+
+	if (!cnt) {
+		fprintf(stderr, "No .dtb files in %s\n", dir);
+		return -1;
+	}
+
+	qsort(paths, cnt, sizeof(*paths), mock_name_cmp);
+
+	return cnt;
+}
@@ -0,0 +1,56 @@
+#ifndef MOCK_H
+#define MOCK_H
+
+#include <stdint.h>
+#include <efi.h>
+
+/*
+ * Host-side stand-ins for the firmware and the CPU so the slbounce
+ * sources can run as a normal Linux program (see host/bench.c and
+ * host/test.c).
+ *
+ * Memory returned by the mocked boot services is plain host memory,
+ * "physical" addresses are the host pointers.
+ */
+
+#define MOCK_SMC_LOG_MAX	256
+
+struct mock_smc_call {
+	uint64_t args[6];
+	uint64_t ret;
+};
+
+struct mock_stats {
+	uint64_t smc_calls;
+	uint64_t flush_calls;
+	uint64_t flush_bytes;
+	uint64_t pages_allocated;	/* Currently allocated, not the total. */
+	uint64_t pool_allocs;
+};
+
+/* mock.c, the firmware */
+extern EFI_HANDLE mock_image;
+extern BOOLEAN mock_quiet;		/* Drop console output. */
+extern EFI_SYSTEM_TABLE mock_st;
+
+void mock_init(const char *root);
+EFI_STATUS mock_add_file(const char *name, const void *data, UINTN size);
+void mock_set_memory_map(UINTN count, uint32_t seed);
+void mock_get_memory_map(EFI_MEMORY_DESCRIPTOR **map, UINTN *map_size, UINTN *desc_size);
+void mock_free_all_pages(void);
+
+/* Files of the host, not the "ESP". */
+UINT8 *mock_read_file(const char *name, UINTN *size, UINTN extra);
+int mock_find_dtbs(const char *dir, char **paths, int max);
+
+/*
+ * mock_arch.c, the cpu. SMCs go to the smc_set_backend() backend,
+ * by default everything returns 0.
+ */
+extern struct mock_stats mock_stats;
+extern struct mock_smc_call mock_smc_log[MOCK_SMC_LOG_MAX];
+
+void mock_reset_stats(void);
+uint64_t mock_time_ns(void);
+
+#endif
@@ -0,0 +1,218 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * Host replacement for arch.c and trans.s.
+ *
+ * SMCs and cache maintenance are only recorded, SMCs are answered
+ * by the smc_set_backend() backend. The arch timer is CLOCK_MONOTONIC
+ * counting in nanoseconds.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <efi.h>
+
+#include <sysreg/daif.h>
+
+#include "arch.h"
+#include "mock.h"
+
+struct mock_stats mock_stats;
+struct mock_smc_call mock_smc_log[MOCK_SMC_LOG_MAX];
+
+union daif host_daif;
+
+uint64_t tb_jmp_buf[21];
+uint64_t tb_el2_state[EL2_STATE_CNT];
+
+/* The "real" backend on the host, everything succeeds. */
+static uint64_t mock_smc_default(const uint64_t args[6])
+{
+	return 0;
+}
+
+static smc_backend_t mock_smc_backend = mock_smc_default;
+
+smc_backend_t smc_set_backend(smc_backend_t backend)
+{
+	smc_backend_t old = mock_smc_backend;
+
+	mock_smc_backend = backend ? backend : mock_smc_default;
+
+	return old;
+}
+
+void mock_reset_stats(void)
+{
+	uint64_t pages = mock_stats.pages_allocated;
+
+	memset(&mock_stats, 0, sizeof(mock_stats));
+	mock_stats.pages_allocated = pages;
+}
+
+uint64_t mock_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t host_read_sysreg(const char *reg)
+{
+	if (!strcmp(reg, "cntfrq_el0"))
+		return 1000000000;
+
+	if (!strcmp(reg, "cntvct_el0"))
+		return mock_time_ns();
+
+	return 0;
+}
+
+uint64_t arch_counter(void)
+{
+	return mock_time_ns();
+}
+
+/* No PMU on the host, the cache behaviour is not the device's anyway. */
+int pmu_hw_init(const uint16_t *events, int count)
+{
+	return -1;
+}
+
+void pmu_hw_read(uint64_t *vals, int count)
+{
+}
+
+void pmu_hw_restore(void)
+{
+}
+
+/* There are no page tables to track writes in either. */
+int mmu_hw_dirty_enable(void)
+{
+	return -1;
+}
+
+void mmu_hw_tlb_flush(void)
+{
+}
+
+int crc32_hw_supported(void)
+{
+	return 1;
+}
+
+/* Same result as the crc32x instructions, just slower. */
+uint32_t crc32_hw(uint32_t crc, uint64_t start, uint64_t size)
+{
+	const uint8_t *p = (const uint8_t *)start;
+	uint64_t i;
+	int j;
+
+	crc = ~crc;
+
+	for (i = 0; i < size; i++) {
+		crc ^= p[i];
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+uint64_t arch_fetch_add(uint64_t *ptr, uint64_t val)
+{
+	return __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
+}
+
+uint64_t dcache_line_size(void)
+{
+	return 64;
+}
+
+void clear_dcache_range(uint64_t start, uint64_t size)
+{
+	mock_stats.flush_calls++;
+	mock_stats.flush_bytes += size;
+}
+
+void clean_dcache_range(uint64_t start, uint64_t size)
+{
+	mock_stats.flush_calls++;
+	mock_stats.flush_bytes += size;
+}
+
+void clear_dcache_all(void)
+{
+	mock_stats.flush_calls++;
+}
+
+/* Roughly what the flush model assumes for the devices. */
+uint64_t dcache_total_size(void)
+{
+	return 12 * 1024 * 1024;
+}
+
+/* No "dc zva" on the host. */
+uint64_t dcache_zva_size(void)
+{
+	return 0;
+}
+
+void zero_dcache_range(uint64_t start, uint64_t size)
+{
+	memset((void *)start, 0, size);
+}
+
+uint64_t smc6(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, uint64_t x5)
+{
+	struct mock_smc_call *call = &mock_smc_log[mock_stats.smc_calls % MOCK_SMC_LOG_MAX];
+
+	call->args[0] = x0;
+	call->args[1] = x1;
+	call->args[2] = x2;
+	call->args[3] = x3;
+	call->args[4] = x4;
+	call->args[5] = x5;
+	call->ret = mock_smc_backend(call->args);
+
+	mock_stats.smc_calls++;
+
+	return call->ret;
+}
+
+uint64_t smc(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3)
+{
+	return smc6(x0, x1, x2, x3, 0, 0);
+}
+
+void psci_off(void)
+{
+}
+
+void psci_reboot(void)
+{
+}
+
+void el2_state_init(int e2h)
+{
+}
+
+int el2_check_state(struct el2_check *out, int max)
+{
+	return 0;
+}
+
+/* Only the address is used, tcblaunch never gets to jump here. */
+void tb_entry(void)
+{
+}
+
+void tb_el2_setup(void)
+{
+}
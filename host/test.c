@@ -0,0 +1,698 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * slbounce-test - Check the host-buildable sources against references.
+ *
+ * Runs the real slbounce sources on top of host/mock.c, same as
+ * slbounce-bench. The lz4 decoder is checked against frames made by
+ * the lz4 cli, dtq against libfdt, dtslim against what it must keep,
+ * and the EBS flush against the ranges it must and mustn't flush.
+ *
+ * The DT tests run on a small tree built here that has the corner
+ * cases, and with -D also on every .dtb in a directory, i.e. the dtbs
+ * of the supported boards from a kernel build. The exit code is 1 if
+ * any check failed.
+ *
+ * Usage: slbounce-test [-D dir] [-v] [test...]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+#include "lz4.h"
+#include "dtq.h"
+#include "dtslim.h"
+#include "flush.h"
+#include "mock.h"
+#include "lz4_frames.h"
+
+#define TEST_CORPUS_MAX		64
+#define TEST_DTB_SIZE		(16 * 1024)
+#define TEST_DTB_SLACK		(64 * 1024)
+#define TEST_PATH_MAX		256
+
+struct test {
+	const char *name;
+	BOOLEAN dt;		/* Runs for every dtb. */
+	void (*run)(const void *fdt);
+};
+
+static const char *test_cur;
+static const char *test_dtb_label = "-";
+static int test_checks;
+static int test_failures;
+
+#define check(cond)	test_check(cond, #cond, __LINE__)
+
+static int test_check(int ok, const char *what, int line)
+{
+	test_checks++;
+	if (ok)
+		return 1;
+
+	fprintf(stderr, "FAIL %s (%s): test.c:%d: %s\n", test_cur, test_dtb_label, line, what);
+	test_failures++;
+
+	return 0;
+}
+
+/* lz4 */
+
+static void test_lz4_gen_text(UINT8 *buf, UINTN size)
+{
+	UINTN off = 0;
+	int i;
+
+	for (i = 0; off < size; i++)
+		off += sprintf((char *)buf + off, "slbounce lz4 test line %d\n", i);
+}
+
+static void test_lz4_gen_random(UINT8 *buf, UINTN size)
+{
+	uint32_t x = 1;
+	UINTN i;
+
+	for (i = 0; i < size; i++) {
+		x = (x * 1103515245 + 12345) & 0x7fffffff;
+		buf[i] = x >> 16;
+	}
+}
+
+static void test_lz4_gen_pattern(UINT8 *buf, UINTN size)
+{
+	UINTN i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = i % 251;
+}
+
+static const struct {
+	const char *name;
+	const UINT8 *frame;
+	UINTN frame_size;
+	UINTN size;
+	void (*gen)(UINT8 *buf, UINTN size);
+} test_lz4_frames[] = {
+	{ "text.lz4", test_lz4_text, sizeof(test_lz4_text), 1030, test_lz4_gen_text },
+	{ "text-bcsum.lz4", test_lz4_text_bcsum, sizeof(test_lz4_text_bcsum), 1030, test_lz4_gen_text },
+	{ "random.lz4", test_lz4_random, sizeof(test_lz4_random), 300, test_lz4_gen_random },
+	{ "pattern.lz4", test_lz4_pattern, sizeof(test_lz4_pattern), 100000, test_lz4_gen_pattern },
+};
+
+#define TEST_LZ4_FRAMES	(sizeof(test_lz4_frames) / sizeof(test_lz4_frames[0]))
+
+/* Read all of @file in odd sized pieces, so reads end mid-block. */
+static UINTN test_lz4_read(EFI_FILE_HANDLE file, UINT8 *buf, UINTN size)
+{
+	UINTN off = 0, len, piece = 1;
+
+	while (off < size) {
+		len = size - off < piece ? size - off : piece;
+		len = FileRead(file, buf + off, len);
+		if (!len)
+			break;
+		off += len;
+		piece = piece * 3 + 7;
+	}
+
+	return off;
+}
+
+static void test_lz4_run(const void *fdt)
+{
+	EFI_FILE_HANDLE volume = GetVolume(mock_image);
+	CHAR16 name[TEST_PATH_MAX];
+	EFI_FILE_HANDLE file;
+	UINT8 *want, *got, extra;
+	unsigned int i;
+
+	for (i = 0; i < TEST_LZ4_FRAMES; i++)
+		mock_add_file(test_lz4_frames[i].name, test_lz4_frames[i].frame,
+			      test_lz4_frames[i].frame_size);
+
+	/* The .lz4 is also found by the plain name. */
+	mock_add_file("plain.lz4", test_lz4_text, sizeof(test_lz4_text));
+
+	for (i = 0; i < TEST_LZ4_FRAMES; i++) {
+		UINTN size = test_lz4_frames[i].size;
+
+		want = malloc(size + 64);
+		got = malloc(size);
+		test_lz4_frames[i].gen(want, size);
+
+		SPrint(name, sizeof(name), L"%a", test_lz4_frames[i].name);
+		file = FileOpen(volume, name);
+		if (!check(file != NULL))
+			goto next;
+
+		check(FileSize(file) == size);
+		check(test_lz4_read(file, got, size) == size);
+		check(!memcmp(want, got, size));
+		check(FileRead(file, &extra, 1) == 0);
+
+		/* Rewinding decodes again from the start. */
+		check(!EFI_ERROR(uefi_call_wrapper(file->SetPosition, 2, file, 0)));
+		check(FileRead(file, got, size) == size);
+		check(!memcmp(want, got, size));
+
+		FileClose(file);
+next:
+		free(want);
+		free(got);
+	}
+
+	file = FileOpen(volume, L"plain");
+	if (check(file != NULL)) {
+		check(FileSize(file) == 1030);
+		FileClose(file);
+	}
+}
+
+static void test_lz4_block_run(const void *fdt)
+{
+	/* "abcd" and a 6 byte overlapping match of it, then "!". */
+	static const UINT8 good[] = { 0x42, 'a', 'b', 'c', 'd', 0x04, 0x00, 0x10, '!' };
+	static const UINT8 far[] = { 0x10, 'a', 0x05, 0x00 };
+	static const UINT8 cut[] = { 0x40, 'a', 'b' };
+	UINT8 out[16];
+
+	check(Lz4DecompressBlock(good, sizeof(good), out, sizeof(out)) == 11);
+	check(!memcmp(out, "abcdabcdab!", 11));
+
+	/* Doesn't fit, the match reaches before the output, the input ends early. */
+	check(Lz4DecompressBlock(good, sizeof(good), out, 8) == -1);
+	check(Lz4DecompressBlock(far, sizeof(far), out, sizeof(out)) == -1);
+	check(Lz4DecompressBlock(cut, sizeof(cut), out, sizeof(out)) == -1);
+}
+
+/* DT, the built-in tree */
+
+/*
+ * Disabled nodes that are referenced from outside must stay, the
+ * others can go, except under /cpus. References from inside of the
+ * dropped subtree itself don't count.
+ */
+static void *test_make_dtb(void)
+{
+	void *fdt = malloc(TEST_DTB_SIZE);
+	int ret = 0;
+
+	ret |= fdt_create(fdt, TEST_DTB_SIZE);
+	ret |= fdt_add_reservemap_entry(fdt, 0x80000000, 0x100000);
+	ret |= fdt_finish_reservemap(fdt);
+	ret |= fdt_begin_node(fdt, "");
+	ret |= fdt_property_string(fdt, "compatible", "slbounce,test");
+	ret |= fdt_property_cell(fdt, "#address-cells", 1);
+	ret |= fdt_property_cell(fdt, "#size-cells", 0);
+
+	ret |= fdt_begin_node(fdt, "cpus");
+	ret |= fdt_begin_node(fdt, "cpu@0");
+	ret |= fdt_property_string(fdt, "status", "disabled");
+	ret |= fdt_property_cell(fdt, "phandle", 10);
+	ret |= fdt_end_node(fdt);
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_begin_node(fdt, "used@1000");
+	ret |= fdt_property_string(fdt, "compatible", "slbounce,used");
+	ret |= fdt_property_cell(fdt, "reg", 0x1000);
+	ret |= fdt_property_string(fdt, "status", "disabled");
+	ret |= fdt_property_cell(fdt, "phandle", 1);
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_begin_node(fdt, "unused@2000");
+	ret |= fdt_property_string(fdt, "compatible", "slbounce,unused");
+	ret |= fdt_property_cell(fdt, "reg", 0x2000);
+	ret |= fdt_property_string(fdt, "status", "disabled");
+	ret |= fdt_property_cell(fdt, "phandle", 2);
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_begin_node(fdt, "parent@3000");
+	ret |= fdt_property_cell(fdt, "reg", 0x3000);
+	ret |= fdt_property_string(fdt, "status", "disabled");
+	ret |= fdt_begin_node(fdt, "child");
+	ret |= fdt_property_cell(fdt, "phandle", 3);
+	ret |= fdt_end_node(fdt);
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_begin_node(fdt, "self@4000");
+	ret |= fdt_property_cell(fdt, "reg", 0x4000);
+	ret |= fdt_property_string(fdt, "status", "disabled");
+	ret |= fdt_property_cell(fdt, "phandle", 4);
+	ret |= fdt_begin_node(fdt, "loop");
+	ret |= fdt_property_cell(fdt, "clocks", 4);
+	ret |= fdt_end_node(fdt);
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_begin_node(fdt, "consumer");
+	ret |= fdt_property_string(fdt, "compatible", "slbounce,consumer");
+	ret |= fdt_property_cell(fdt, "clocks", 1);
+	ret |= fdt_property_cell(fdt, "power-domains", 3);
+	/* A "reg" never holds a phandle. */
+	ret |= fdt_property_cell(fdt, "reg", 2);
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_begin_node(fdt, "__symbols__");
+	ret |= fdt_property_string(fdt, "unused", "/unused@2000");
+	ret |= fdt_end_node(fdt);
+
+	ret |= fdt_end_node(fdt);
+	ret |= fdt_finish(fdt);
+
+	if (ret) {
+		fprintf(stderr, "Can't build the test dtb\n");
+		exit(1);
+	}
+
+	return fdt;
+}
+
+/* dtq */
+
+/* First node called @name that dtq can see, the same order as it walks. */
+static int test_first_by_name(const void *fdt, const char *name)
+{
+	int node, depth = 0;
+	const char *n;
+
+	for (node = fdt_next_node(fdt, 0, &depth); node >= 0; node = fdt_next_node(fdt, node, &depth)) {
+		if (depth >= DTQ_MAX_DEPTH - 1)
+			continue;
+
+		n = fdt_get_name(fdt, node, NULL);
+		if (n && !strcmp(n, name))
+			return node;
+	}
+
+	return -1;
+}
+
+static const char *test_first_prop(const void *fdt, int node)
+{
+	const struct fdt_property *prop;
+	int off, len;
+
+	off = fdt_first_property_offset(fdt, node);
+	if (off < 0)
+		return "compatible";
+
+	prop = fdt_get_property_by_offset(fdt, off, &len);
+	return prop ? fdt_string(fdt, fdt32_to_cpu(prop->nameoff)) : "compatible";
+}
+
+struct test_dtq_case {
+	int node;
+	const void *value;
+	int len;
+};
+
+static void test_dtq_check(const void *fdt, struct dtq_query *q, struct test_dtq_case *want, int count)
+{
+	int i;
+
+	dtq_prepare(q, count);
+	if (!check(dtq_run(fdt, q, count) == 0))
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (!check(q[i].node == want[i].node) || !check(q[i].value == want[i].value))
+			fprintf(stderr, "  query path=%s name=%s compatible=%s prop=%s\n",
+				q[i].path ? q[i].path : "-", q[i].name ? q[i].name : "-",
+				q[i].compatible ? q[i].compatible : "-", q[i].prop ? q[i].prop : "-");
+		else if (want[i].value)
+			check(q[i].len == want[i].len);
+	}
+}
+
+static void test_dtq_want(const void *fdt, struct test_dtq_case *want, int node, const char *prop)
+{
+	want->node = node;
+	want->value = node >= 0 ? fdt_getprop(fdt, node, prop, &want->len) : NULL;
+}
+
+/*
+ * Look up every node by its path, by its name and by its first
+ * compatible, and compare with what libfdt finds.
+ */
+static void test_dtq_run(const void *fdt)
+{
+	static char paths[DTQ_MAX_QUERIES][TEST_PATH_MAX];
+	struct test_dtq_case want[DTQ_MAX_QUERIES];
+	struct dtq_query q[DTQ_MAX_QUERIES];
+	const char *name, *compat;
+	int node, depth = 0, cnt = 0, found;
+
+	for (node = 0; node >= 0; node = fdt_next_node(fdt, node, &depth)) {
+		if (depth >= DTQ_MAX_DEPTH - 1)
+			continue;
+
+		if (cnt + 3 > DTQ_MAX_QUERIES) {
+			test_dtq_check(fdt, q, want, cnt);
+			cnt = 0;
+		}
+
+		if (fdt_get_path(fdt, node, paths[cnt], TEST_PATH_MAX) == 0) {
+			memset(&q[cnt], 0, sizeof(q[cnt]));
+			q[cnt].path = paths[cnt];
+			q[cnt].prop = test_first_prop(fdt, node);
+			test_dtq_want(fdt, &want[cnt], node, q[cnt].prop);
+			cnt++;
+		}
+
+		name = fdt_get_name(fdt, node, NULL);
+		if (node && name) {
+			memset(&q[cnt], 0, sizeof(q[cnt]));
+			q[cnt].name = name;
+			q[cnt].prop = "reg";
+			test_dtq_want(fdt, &want[cnt], test_first_by_name(fdt, name), "reg");
+			cnt++;
+		}
+
+		compat = fdt_getprop(fdt, node, "compatible", NULL);
+		if (compat) {
+			found = fdt_node_offset_by_compatible(fdt, -1, compat);
+			if (found >= 0 && fdt_node_depth(fdt, found) < DTQ_MAX_DEPTH - 1) {
+				memset(&q[cnt], 0, sizeof(q[cnt]));
+				q[cnt].compatible = compat;
+				q[cnt].prop = "status";
+				test_dtq_want(fdt, &want[cnt], found, "status");
+				cnt++;
+			}
+		}
+	}
+
+	/* Not there at all. */
+	memset(&q[cnt], 0, sizeof(q[cnt]));
+	q[cnt].path = "/slbounce-test/none";
+	want[cnt].node = -1;
+	want[cnt].value = NULL;
+	cnt++;
+
+	test_dtq_check(fdt, q, want, cnt);
+}
+
+/* dtslim */
+
+static void test_dtslim_builtin_run(const void *unused)
+{
+	void *fdt = test_make_dtb(), *out = malloc(TEST_DTB_SIZE);
+	struct dtslim_stats stats;
+	uint64_t addr, size;
+	int node;
+
+	check(dtslim(fdt, out, 64, &stats) == EFI_BUFFER_TOO_SMALL);
+
+	if (!check(dtslim(fdt, out, TEST_DTB_SIZE, &stats) == EFI_SUCCESS) ||
+	    !check(fdt_check_header(out) == 0))
+		goto out;
+
+	check(fdt_path_offset(out, "/cpus/cpu@0") >= 0);
+	check(fdt_path_offset(out, "/parent@3000/child") >= 0);
+	check(fdt_path_offset(out, "/consumer") >= 0);
+	check(fdt_path_offset(out, "/unused@2000") < 0);
+	check(fdt_path_offset(out, "/self@4000") < 0);
+	check(fdt_path_offset(out, "/__symbols__") < 0);
+
+	node = fdt_path_offset(out, "/used@1000");
+	check(node >= 0 && fdt_get_phandle(out, node) == 1);
+
+	check(stats.nodes == 7);
+	check(stats.dropped == 4);
+	check(stats.kept_disabled == 2);
+	check(stats.size_after == fdt_totalsize(out) && stats.size_after < stats.size_before);
+
+	check(fdt_num_mem_rsv(out) == 1);
+	check(fdt_get_mem_rsv(out, 0, &addr, &size) == 0 && addr == 0x80000000 && size == 0x100000);
+
+out:
+	free(out);
+	free(fdt);
+}
+
+/* Properties that hold a phandle in their first cell at least. */
+static const char *const test_phandle_props[] = {
+	"interrupt-parent", "clocks", "power-domains", "resets", "iommus", "phys",
+	"interconnects", "memory-region", "remote-endpoint", "pinctrl-0", "pinctrl-1",
+	"mboxes", "dmas", "operating-points-v2", "next-level-cache", "cpu-idle-states",
+	"qcom,smem-states", "thermal-sensors", "cooling-device",
+};
+
+#define TEST_PHANDLE_PROPS	(sizeof(test_phandle_props) / sizeof(test_phandle_props[0]))
+
+static BOOLEAN test_disabled(const void *fdt, int node)
+{
+	const char *status = fdt_getprop(fdt, node, "status", NULL);
+
+	return status && !strcmp(status, "disabled");
+}
+
+/* Some node on the way from the root to @node is disabled, or is overlay metadata. */
+static BOOLEAN test_droppable(const void *fdt, int node)
+{
+	const char *name;
+
+	for (; node > 0; node = fdt_parent_offset(fdt, node)) {
+		name = fdt_get_name(fdt, node, NULL);
+		if (test_disabled(fdt, node) || (name && name[0] == '_' && name[1] == '_' &&
+		    fdt_parent_offset(fdt, node) == 0))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static BOOLEAN test_cell_used(const void *fdt, uint32_t phandle)
+{
+	const fdt32_t *cell;
+	unsigned int i;
+	int node, len, j;
+
+	for (node = 0; node >= 0; node = fdt_next_node(fdt, node, NULL)) {
+		for (i = 0; i < TEST_PHANDLE_PROPS; i++) {
+			cell = fdt_getprop(fdt, node, test_phandle_props[i], &len);
+			for (j = 0; cell && j < len / 4; j++)
+				if (fdt32_to_cpu(cell[j]) == phandle)
+					return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/*
+ * Everything that is enabled stays, and nothing that is left refers
+ * to a phandle that went away.
+ */
+static void test_dtslim_run(const void *fdt)
+{
+	int size = fdt_totalsize(fdt), node, kept = 0;
+	char path[TEST_PATH_MAX];
+	struct dtslim_stats stats;
+	void *out = malloc(size);
+	uint32_t phandle;
+
+	if (!check(dtslim(fdt, out, size, &stats) == EFI_SUCCESS) ||
+	    !check(fdt_check_header(out) == 0))
+		goto out;
+
+	for (node = 0; node >= 0; node = fdt_next_node(out, node, NULL))
+		kept++;
+	check(stats.nodes == kept);
+
+	for (node = 0; node >= 0; node = fdt_next_node(fdt, node, NULL)) {
+		if (fdt_get_path(fdt, node, path, sizeof(path)))
+			continue;
+
+		if (fdt_path_offset(out, path) >= 0)
+			continue;
+
+		if (!check(test_droppable(fdt, node)))
+			fprintf(stderr, "  %s is gone\n", path);
+
+		phandle = fdt_get_phandle(fdt, node);
+		if (phandle && !check(!test_cell_used(out, phandle)))
+			fprintf(stderr, "  %s is gone, but its phandle 0x%x is used\n", path, phandle);
+	}
+
+out:
+	free(out);
+}
+
+/* EBS flush */
+
+#define TEST_FLUSH_BASE		0x80000000ull
+
+static EFI_MEMORY_DESCRIPTOR test_flush_map[] = {
+	{ .Type = EfiLoaderData,		.PhysicalStart = TEST_FLUSH_BASE,		.NumberOfPages = 16 },
+	{ .Type = EfiBootServicesData,		.PhysicalStart = TEST_FLUSH_BASE + 0x10000,	.NumberOfPages = 16 },
+	{ .Type = EfiConventionalMemory,	.PhysicalStart = TEST_FLUSH_BASE + 0x20000,	.NumberOfPages = 16 },
+	{ .Type = EfiRuntimeServicesData,	.PhysicalStart = TEST_FLUSH_BASE + 0x30000,	.NumberOfPages = 16 },
+	{ .Type = EfiLoaderData,		.PhysicalStart = TEST_FLUSH_BASE + 0x40000,	.NumberOfPages = 4 },
+	{ .Type = EfiMemoryMappedIO,		.PhysicalStart = TEST_FLUSH_BASE + 0x44000,	.NumberOfPages = 4 },
+};
+
+/* All but the conventional and MMIO memory. */
+#define TEST_FLUSH_BYTES	((16 + 16 + 16 + 4) * 4096ull)
+
+static void test_flush_once(uint64_t calls, uint64_t bytes, int line)
+{
+	mock_reset_stats();
+	flush_memory_map(test_flush_map, sizeof(test_flush_map), sizeof(test_flush_map[0]));
+
+	if (!test_check(mock_stats.flush_calls == calls && mock_stats.flush_bytes == bytes,
+			"flushed ranges", line))
+		fprintf(stderr, "  %lu calls, %lu bytes, wanted %lu, %lu\n",
+			(unsigned long)mock_stats.flush_calls, (unsigned long)mock_stats.flush_bytes,
+			(unsigned long)calls, (unsigned long)bytes);
+}
+
+static void test_flush_run(const void *fdt)
+{
+	flush_set_strategy(FLUSH_PER_VA);
+	test_flush_once(4, TEST_FLUSH_BYTES, __LINE__);
+
+	/* The first two and the last two entries are adjacent. */
+	flush_set_strategy(FLUSH_COALESCED);
+	test_flush_once(2, TEST_FLUSH_BYTES, __LINE__);
+
+	/* A clean range in the middle splits the run. */
+	flush_mark_clean(FLUSH_CLEAN_INITRD, TEST_FLUSH_BASE + 0x4000, 0x4000);
+	test_flush_once(3, TEST_FLUSH_BYTES - 0x4000, __LINE__);
+
+	/* A new one replaces it. */
+	flush_mark_clean(FLUSH_CLEAN_INITRD, TEST_FLUSH_BASE + 0x40000, 0x4000);
+	test_flush_once(2, TEST_FLUSH_BYTES - 0x4000, __LINE__);
+
+	/* Freed and reused by the firmware, so it's flushed after all. */
+	test_flush_map[4].Type = EfiBootServicesData;
+	test_flush_once(2, TEST_FLUSH_BYTES, __LINE__);
+	test_flush_map[4].Type = EfiLoaderData;
+	test_flush_once(2, TEST_FLUSH_BYTES, __LINE__);
+
+	/* Stays forgotten, even if the memory is LoaderData again. */
+	flush_set_strategy(FLUSH_PER_VA);
+	flush_mark_clean(FLUSH_CLEAN_INITRD, 0, 0);
+}
+
+static const struct test tests[] = {
+	{ "lz4", FALSE, test_lz4_run },
+	{ "lz4-block", FALSE, test_lz4_block_run },
+	{ "flush", FALSE, test_flush_run },
+	{ "dt-slim-builtin", FALSE, test_dtslim_builtin_run },
+	{ "dtq", TRUE, test_dtq_run },
+	{ "dt-slim", TRUE, test_dtslim_run },
+};
+
+#define TEST_CNT	(sizeof(tests) / sizeof(tests[0]))
+
+static BOOLEAN test_selected(const struct test *t, int argc, char **argv)
+{
+	int i;
+
+	if (optind == argc)
+		return TRUE;
+
+	for (i = optind; i < argc; i++)
+		if (!strcmp(argv[i], t->name))
+			return TRUE;
+
+	return FALSE;
+}
+
+static void test_all(const void *fdt, int argc, char **argv)
+{
+	int checks, failures;
+	unsigned int i;
+
+	for (i = 0; i < TEST_CNT; i++) {
+		if (tests[i].dt != (fdt != NULL) || !test_selected(&tests[i], argc, argv))
+			continue;
+
+		test_cur = tests[i].name;
+		checks = test_checks;
+		failures = test_failures;
+
+		tests[i].run(fdt);
+
+		printf("%-4s %-16s %-24s %6d checks\n", test_failures == failures ? "ok" : "FAIL",
+		       tests[i].name, test_dtb_label, test_checks - checks);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	unsigned int i;
+
+	fprintf(stderr,
+		"Usage: %s [options] [test...]\n"
+		"  -D DIR   also run the DT tests for every .dtb in DIR\n"
+		"  -v       don't hide the slbounce console output\n"
+		"Tests:",
+		argv0);
+	for (i = 0; i < TEST_CNT; i++)
+		fprintf(stderr, " %s", tests[i].name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *corpus = NULL, *label;
+	char *dtbs[TEST_CORPUS_MAX];
+	int opt, i, dtb_cnt = 0;
+	UINT8 *dtb;
+	UINTN size;
+	void *fdt;
+
+	while ((opt = getopt(argc, argv, "D:vh")) != -1) {
+		switch (opt) {
+		case 'D': corpus = optarg; break;
+		case 'v': mock_quiet = FALSE; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (corpus) {
+		dtb_cnt = mock_find_dtbs(corpus, dtbs, TEST_CORPUS_MAX);
+		if (dtb_cnt < 0)
+			return 1;
+	}
+
+	mock_quiet = TRUE;
+	mock_init(".");
+
+	test_all(NULL, argc, argv);
+
+	fdt = test_make_dtb();
+	test_dtb_label = "built-in";
+	test_all(fdt, argc, argv);
+	free(fdt);
+
+	for (i = 0; i < dtb_cnt; i++) {
+		dtb = mock_read_file(dtbs[i], &size, TEST_DTB_SLACK);
+		if (!dtb)
+			return 1;
+
+		label = strrchr(dtbs[i], '/');
+		test_dtb_label = label ? label + 1 : dtbs[i];
+
+		test_cur = "fdt";
+		if (check(fdt_check_header(dtb) == 0))
+			test_all(dtb, argc, argv);
+
+		free(dtb);
+	}
+
+	printf("%d checks, %d failed\n", test_checks, test_failures);
+
+	return test_failures ? 1 : 0;
+}
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <libfdt.h>
+
+#include "stub.h"
+
+/* Secure Configuration Register */
+#define SCR_EL3_NS		(1 << 0)
+#define SCR_EL3_RES1		(3 << 4)
+#define SCR_EL3_HCE		(1 << 8)
+#define SCR_EL3_RW		(1 << 10)
+
+#define HCR_EL2_RW		(1ull << 31)
+#define SCTLR_EL2_RES1		0x30c50830
+#define SCTLR_EL1_RES1		0x30d00800
+#define CPTR_EL2_RES1		0x33ff
+#define CNTHCTL_EL2_EL1PCEN	(3 << 0)	/* EL1PCTEN | EL1PCEN */
+
+/* ICC_SRE_EL3/EL2: SRE | DFB | DIB | Enable */
+#define ICC_SRE_ALL		0xf
+
+#define GICD_CTLR		0x0000
+#define GICD_CTLR_RWP		(1u << 31)
+#define GICD_CTLR_GRP1NS	(1 << 1)
+#define GICD_CTLR_ARE		(3 << 4)	/* ARE_S | ARE_NS */
+#define GICD_TYPER		0x0004
+#define GICD_IGROUPR(n)		(0x0080 + 4 * (n))
+#define GICD_PIDR2		0xffe8
+#define GICR_WAKER		0x0014
+#define GICR_WAKER_SLEEP	(1 << 1)
+#define GICR_WAKER_ASLEEP	(1 << 2)
+#define GICR_SGI_IGROUPR0	(0x10000 + 0x0080)
+
+#define UART_DR			0x00
+#define UART_FR			0x18
+#define UART_FR_TXFF		(1 << 5)
+
+/* Linux arm64 Image header, ArmVirtQemuKernel has one too. */
+#define IMAGE_MAGIC_OFFT	0x38
+#define IMAGE_MAGIC		0x644d5241	// 'ARM\x64'
+
+static uint64_t stub_ram_start, stub_ram_end;
+static unsigned int stub_cpus = 1;
+
+/* Set by the boot cpu once .data and .bss are usable. */
+static volatile uint32_t stub_ready __attribute__((section(".noinit")));
+
+void stub_halt(void)
+{
+	while (1)
+		__asm__ volatile("wfe");
+}
+
+static void stub_putc(char c)
+{
+	while (mmio_read32(STUB_UART_BASE + UART_FR) & UART_FR_TXFF)
+		;
+	mmio_write32(STUB_UART_BASE + UART_DR, c);
+}
+
+static void stub_putn(uint64_t val, unsigned int base, int width, char pad)
+{
+	char buf[24];
+	int i = 0;
+
+	do {
+		buf[i++] = "0123456789abcdef"[val % base];
+		val /= base;
+	} while (val);
+
+	while (width-- > i)
+		stub_putc(pad);
+	while (i--)
+		stub_putc(buf[i]);
+}
+
+/**
+ * stub_print() - Minimal printf to the pl011.
+ *
+ * Knows %s, %c, %d, %u and %x with the l/ll modifiers, zero padding
+ * and width. Lines are prefixed with the time since reset.
+ */
+void stub_print(const char *fmt, ...)
+{
+	uint64_t now = stub_time_us();
+	va_list ap;
+	int64_t sval;
+	uint64_t val;
+	const char *s;
+	int width, lng;
+	char pad;
+
+	stub_putc('[');
+	stub_putn(now / 1000000, 10, 5, ' ');
+	stub_putc('.');
+	stub_putn(now % 1000000, 10, 6, '0');
+	stub_putc(']');
+	stub_putc(' ');
+
+	va_start(ap, fmt);
+	for (; *fmt; fmt++) {
+		if (*fmt != '%') {
+			if (*fmt == '\n')
+				stub_putc('\r');
+			stub_putc(*fmt);
+			continue;
+		}
+
+		fmt++;
+		pad = ' ';
+		if (*fmt == '0') {
+			pad = '0';
+			fmt++;
+		}
+		for (width = 0; *fmt >= '0' && *fmt <= '9'; fmt++)
+			width = width * 10 + *fmt - '0';
+		for (lng = 0; *fmt == 'l'; fmt++)
+			lng++;
+
+		switch (*fmt) {
+		case 's':
+			for (s = va_arg(ap, const char *); *s; s++)
+				stub_putc(*s);
+			break;
+		case 'c':
+			stub_putc(va_arg(ap, int));
+			break;
+		case 'd':
+			sval = lng ? va_arg(ap, int64_t) : va_arg(ap, int);
+			if (sval < 0) {
+				stub_putc('-');
+				sval = -sval;
+			}
+			stub_putn(sval, 10, width, pad);
+			break;
+		case 'u':
+		case 'x':
+			val = lng ? va_arg(ap, uint64_t) : va_arg(ap, unsigned int);
+			stub_putn(val, *fmt == 'x' ? 16 : 10, width, pad);
+			break;
+		case '%':
+			stub_putc('%');
+			break;
+		default:
+			stub_putc('?');
+			break;
+		}
+	}
+	va_end(ap);
+}
+
+uint64_t stub_time_us(void)
+{
+	uint64_t freq = read_sysreg(cntfrq_el0);
+	uint64_t ticks = read_sysreg(cntpct_el0);
+
+	return (ticks / freq) * 1000000 + (ticks % freq) * 1000000 / freq;
+}
+
+/**
+ * stub_ram_valid() - Check that a buffer from the lower EL is in ram.
+ */
+int stub_ram_valid(uint64_t start, uint64_t size)
+{
+	return start >= stub_ram_start && size <= stub_ram_end - start;
+}
+
+unsigned int stub_cpu_count(void)
+{
+	return stub_cpus;
+}
+
+/**
+ * stub_enter_lower() - Start the cpu in non-secure EL1 or EL2.
+ * @cpu:   Index of this cpu.
+ * @entry: Entry point, MMU is off.
+ * @arg:   Passed in x0.
+ * @el:    1 or 2.
+ *
+ * EL2 is set up to not get in the way of EL1, as a hypervisor
+ * without any traps would.
+ */
+void stub_enter_lower(unsigned int cpu, uint64_t entry, uint64_t arg, int el)
+{
+	struct stub_ctx *ctx = (struct stub_ctx *)(stub_stacks + (cpu + 1) * STUB_STACK_SIZE) - 1;
+	int i;
+
+	write_sysreg(scr_el3, SCR_EL3_NS | SCR_EL3_RES1 | SCR_EL3_HCE | SCR_EL3_RW);
+	write_sysreg(cptr_el3, 0);
+	write_sysreg(mdcr_el3, 0);
+
+	write_sysreg(hcr_el2, HCR_EL2_RW);
+	write_sysreg(sctlr_el2, SCTLR_EL2_RES1);
+	write_sysreg(cptr_el2, CPTR_EL2_RES1);
+	write_sysreg(cnthctl_el2, CNTHCTL_EL2_EL1PCEN);
+	write_sysreg(cntvoff_el2, 0);
+	write_sysreg(vttbr_el2, 0);
+	write_sysreg(hstr_el2, 0);
+	write_sysreg(vpidr_el2, read_sysreg(midr_el1));
+	write_sysreg(vmpidr_el2, read_sysreg(mpidr_el1));
+	write_sysreg(mdcr_el2, (read_sysreg(pmcr_el0) >> 11) & 0x1f);
+	write_sysreg(sctlr_el1, SCTLR_EL1_RES1);
+	__asm__ volatile("isb");
+
+	for (i = 0; i < 31; i++)
+		ctx->x[i] = 0;
+	ctx->x[0] = arg;
+	ctx->elr = entry;
+	ctx->spsr = el == 2 ? SPSR_EL2H : SPSR_EL1H;
+
+	stub_eret(ctx);
+}
+
+static void gicd_wait(void)
+{
+	while (mmio_read32(STUB_GICD_BASE + GICD_CTLR) & GICD_CTLR_RWP)
+		;
+}
+
+/* Give all SPIs to the non-secure side. */
+static int stub_gic_dist_init(void)
+{
+	unsigned int i, lines;
+
+	if (((mmio_read32(STUB_GICD_BASE + GICD_PIDR2) >> 4) & 0xf) != 3) {
+		stub_print("stub: only GICv3 is supported, use gic-version=3\n");
+		return -1;
+	}
+
+	mmio_write32(STUB_GICD_BASE + GICD_CTLR, 0);
+	gicd_wait();
+	mmio_write32(STUB_GICD_BASE + GICD_CTLR, GICD_CTLR_ARE);
+	gicd_wait();
+
+	lines = (mmio_read32(STUB_GICD_BASE + GICD_TYPER) & 0x1f) + 1;
+	for (i = 1; i < lines; i++)
+		mmio_write32(STUB_GICD_BASE + GICD_IGROUPR(i), 0xffffffff);
+
+	mmio_write32(STUB_GICD_BASE + GICD_CTLR, GICD_CTLR_ARE | GICD_CTLR_GRP1NS);
+	gicd_wait();
+
+	return 0;
+}
+
+/* Wake the redistributor and let the lower ELs use the cpu interface. */
+static void stub_gic_cpu_init(unsigned int cpu)
+{
+	uint64_t rd = STUB_GICR_BASE + cpu * STUB_GICR_STRIDE;
+
+	mmio_write32(rd + GICR_WAKER, mmio_read32(rd + GICR_WAKER) & ~GICR_WAKER_SLEEP);
+	while (mmio_read32(rd + GICR_WAKER) & GICR_WAKER_ASLEEP)
+		;
+
+	mmio_write32(rd + GICR_SGI_IGROUPR0, 0xffffffff);
+
+	write_sysreg(S3_6_C12_C12_5, ICC_SRE_ALL);	// icc_sre_el3
+	__asm__ volatile("isb");
+	write_sysreg(S3_4_C12_C9_5, ICC_SRE_ALL);	// icc_sre_el2
+	__asm__ volatile("isb");
+}
+
+/* Find the ram and the cpus, add what the payload needs for PSCI. */
+static int stub_fdt_init(void *fdt)
+{
+	const fdt32_t *reg;
+	int offset, len, ret;
+
+	ret = fdt_open_into(fdt, fdt, fdt_totalsize(fdt) + 4096);
+	if (ret)
+		return ret;
+
+	offset = fdt_node_offset_by_prop_value(fdt, -1, "device_type", "memory", sizeof("memory"));
+	reg = fdt_getprop(fdt, offset, "reg", &len);
+	if (!reg || len < 16)
+		return -FDT_ERR_NOTFOUND;
+
+	/* qemu uses two cells for both the address and the size. */
+	stub_ram_start = (uint64_t)fdt32_to_cpu(reg[0]) << 32 | fdt32_to_cpu(reg[1]);
+	stub_ram_end = stub_ram_start + ((uint64_t)fdt32_to_cpu(reg[2]) << 32 | fdt32_to_cpu(reg[3]));
+
+	stub_cpus = 0;
+	offset = fdt_node_offset_by_prop_value(fdt, -1, "device_type", "cpu", sizeof("cpu"));
+	while (offset >= 0) {
+		stub_cpus++;
+		offset = fdt_node_offset_by_prop_value(fdt, offset, "device_type", "cpu", sizeof("cpu"));
+	}
+
+	if (stub_cpus > STUB_CPUS) {
+		stub_print("stub: only the first %u cpus will start\n", STUB_CPUS);
+		stub_cpus = STUB_CPUS;
+	}
+
+	return psci_fdt_fixup(fdt);
+}
+
+/**
+ * stub_exception() - Handle a synchronous exception from the lower EL.
+ */
+void stub_exception(struct stub_ctx *ctx, uint64_t esr)
+{
+	unsigned int cpu = read_sysreg(mpidr_el1) & 0xff;
+	uint32_t fid = ctx->x[0];
+
+	if ((esr >> 26) != ESR_EC_SMC64) {
+		stub_print("stub: unexpected exception from lower EL, esr=0x%lx elr=0x%lx\n",
+			   esr, ctx->elr);
+		stub_halt();
+	}
+
+	sl_observe(fid);
+
+	if (!sl_handle(ctx) && !psci_handle(ctx, cpu))
+		ctx->x[0] = SMCCC_NOT_SUPPORTED;
+}
+
+void stub_panic(uint64_t esr, uint64_t elr, uint64_t far)
+{
+	stub_print("stub: exception in EL3, esr=0x%lx elr=0x%lx far=0x%lx\n", esr, elr, far);
+	stub_halt();
+}
+
+void stub_secondary(unsigned int cpu)
+{
+	while (!stub_ready)
+		__asm__ volatile("wfe");
+
+	stub_gic_cpu_init(cpu);
+	psci_cpu_wait(cpu);
+}
+
+void stub_main(unsigned int cpu)
+{
+	void *fdt = (void *)STUB_DTB_BASE;
+	int ret;
+
+	stub_print("slbounce EL3 stub\n");
+
+	if (stub_gic_dist_init())
+		stub_halt();
+	stub_gic_cpu_init(cpu);
+
+	ret = fdt_check_header(fdt);
+	if (!ret)
+		ret = stub_fdt_init(fdt);
+	if (ret) {
+		stub_print("stub: can't use the dtb at 0x%lx: %d\n", (uint64_t)STUB_DTB_BASE, ret);
+		stub_halt();
+	}
+
+	stub_print("stub: ram 0x%lx-0x%lx, %u cpus\n", stub_ram_start, stub_ram_end, stub_cpus);
+
+	if (mmio_read32(STUB_PAYLOAD_BASE + IMAGE_MAGIC_OFFT) != IMAGE_MAGIC) {
+		stub_print("stub: no payload at 0x%lx, load QEMU_EFI.fd with -device loader\n",
+			   (uint64_t)STUB_PAYLOAD_BASE);
+		stub_halt();
+	}
+
+	stub_ready = 1;
+	__asm__ volatile("dsb sy; sev");
+
+	psci_boot_cpu(cpu);
+
+	stub_print("stub: starting the payload at 0x%lx in EL1\n", (uint64_t)STUB_PAYLOAD_BASE);
+	stub_enter_lower(cpu, STUB_PAYLOAD_BASE, STUB_DTB_BASE, 1);
+}
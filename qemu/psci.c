@@ -0,0 +1,217 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <libfdt.h>
+
+#include "stub.h"
+
+#define PSCI_VERSION		0x84000000
+#define PSCI_CPU_OFF		0x84000002
+#define PSCI_CPU_ON		0x84000003
+#define PSCI_AFFINITY_INFO	0x84000004
+#define PSCI_MIGRATE_INFO_TYPE	0x84000006
+#define PSCI_SYSTEM_OFF		0x84000008
+#define PSCI_SYSTEM_RESET	0x84000009
+#define PSCI_FEATURES		0x8400000a
+
+#define PSCI_SMC64		0x40000000
+
+#define PSCI_SUCCESS		0
+#define PSCI_NOT_SUPPORTED	((uint64_t)-1)
+#define PSCI_INVALID_PARAMS	((uint64_t)-2)
+#define PSCI_ALREADY_ON		((uint64_t)-4)
+#define PSCI_ON_PENDING		((uint64_t)-5)
+
+#define PSCI_MIGRATE_NONE	2	/* No trusted OS to migrate. */
+
+#define GPIO_DIR		0x400
+#define GPIO_PIN_RESET		0
+#define GPIO_PIN_POWEROFF	1
+
+enum psci_state {
+	PSCI_STATE_ON		= 0,
+	PSCI_STATE_OFF		= 1,
+	PSCI_STATE_ON_PENDING	= 2,
+};
+
+struct psci_cpu {
+	volatile uint32_t state;
+	volatile uint64_t entry;
+	volatile uint64_t context;
+};
+
+/* All cpus start OFF, the boot one is marked ON before it leaves. */
+static struct psci_cpu psci_cpus[STUB_CPUS] = {
+	[0 ... STUB_CPUS - 1] = { .state = PSCI_STATE_OFF },
+};
+
+/* qemu wires the secure pl061 to the reset and poweroff requests. */
+static void psci_gpio_pulse(unsigned int pin)
+{
+	uint32_t bit = 1 << pin;
+
+	mmio_write32(STUB_SECURE_GPIO_BASE + GPIO_DIR, bit);
+	mmio_write32(STUB_SECURE_GPIO_BASE + (bit << 2), 0);
+	mmio_write32(STUB_SECURE_GPIO_BASE + (bit << 2), bit);
+
+	stub_halt();
+}
+
+static int psci_cpu_index(uint64_t mpidr)
+{
+	if (mpidr & ~0xffull || (mpidr & 0xff) >= stub_cpu_count())
+		return -1;
+
+	return mpidr & 0xff;
+}
+
+static uint64_t psci_cpu_on(uint64_t mpidr, uint64_t entry, uint64_t context)
+{
+	int idx = psci_cpu_index(mpidr);
+	struct psci_cpu *cpu;
+
+	if (idx < 0 || !stub_ram_valid(entry, 4))
+		return PSCI_INVALID_PARAMS;
+
+	cpu = &psci_cpus[idx];
+	if (cpu->state == PSCI_STATE_ON)
+		return PSCI_ALREADY_ON;
+	if (cpu->state == PSCI_STATE_ON_PENDING)
+		return PSCI_ON_PENDING;
+
+	cpu->entry = entry;
+	cpu->context = context;
+	__asm__ volatile("dsb sy");
+	cpu->state = PSCI_STATE_ON_PENDING;
+	__asm__ volatile("dsb sy; sev");
+
+	return PSCI_SUCCESS;
+}
+
+static uint64_t psci_features(uint32_t fid)
+{
+	switch (fid & ~PSCI_SMC64) {
+	case PSCI_VERSION:
+	case PSCI_CPU_OFF:
+	case PSCI_CPU_ON:
+	case PSCI_AFFINITY_INFO:
+	case PSCI_MIGRATE_INFO_TYPE:
+	case PSCI_SYSTEM_OFF:
+	case PSCI_SYSTEM_RESET:
+	case PSCI_FEATURES:
+		return PSCI_SUCCESS;
+	}
+
+	return PSCI_NOT_SUPPORTED;
+}
+
+/**
+ * psci_handle() - PSCI 1.0, just enough for edk2 and Linux.
+ *
+ * The SMC64 variants are treated the same as SMC32 ones.
+ */
+int psci_handle(struct stub_ctx *ctx, unsigned int cpu)
+{
+	uint32_t fid = ctx->x[0];
+	int idx;
+
+	if ((fid & ~PSCI_SMC64 & ~0x1f) != PSCI_VERSION)
+		return 0;
+
+	switch (fid & ~PSCI_SMC64) {
+	case PSCI_VERSION:
+		ctx->x[0] = 0x10000;
+		break;
+	case PSCI_CPU_ON:
+		ctx->x[0] = psci_cpu_on(ctx->x[1], ctx->x[2], ctx->x[3]);
+		break;
+	case PSCI_CPU_OFF:
+		psci_cpus[cpu].state = PSCI_STATE_OFF;
+		psci_cpu_wait(cpu);
+	case PSCI_AFFINITY_INFO:
+		idx = psci_cpu_index(ctx->x[1]);
+		if (idx < 0 || ctx->x[2])
+			ctx->x[0] = PSCI_INVALID_PARAMS;
+		else
+			ctx->x[0] = psci_cpus[idx].state;
+		break;
+	case PSCI_MIGRATE_INFO_TYPE:
+		ctx->x[0] = PSCI_MIGRATE_NONE;
+		break;
+	case PSCI_SYSTEM_OFF:
+		stub_print("psci: system off\n");
+		psci_gpio_pulse(GPIO_PIN_POWEROFF);
+	case PSCI_SYSTEM_RESET:
+		stub_print("psci: system reset\n");
+		psci_gpio_pulse(GPIO_PIN_RESET);
+	case PSCI_FEATURES:
+		ctx->x[0] = psci_features(ctx->x[1]);
+		break;
+	default:
+		ctx->x[0] = PSCI_NOT_SUPPORTED;
+		break;
+	}
+
+	return 1;
+}
+
+void psci_boot_cpu(unsigned int cpu)
+{
+	psci_cpus[cpu].state = PSCI_STATE_ON;
+}
+
+/**
+ * psci_cpu_wait() - Park the cpu until CPU_ON.
+ *
+ * Once SL "launched" the OS runs in EL2, so cpus are started in
+ * EL2 as well, as they are on a device after tcblaunch.
+ */
+void psci_cpu_wait(unsigned int cpu)
+{
+	struct psci_cpu *c = &psci_cpus[cpu];
+
+	while (c->state != PSCI_STATE_ON_PENDING)
+		__asm__ volatile("wfe");
+
+	c->state = PSCI_STATE_ON;
+
+	stub_enter_lower(cpu, c->entry, c->context, sl_launched ? 2 : 1);
+}
+
+/**
+ * psci_fdt_fixup() - Tell the payload to use PSCI over SMC.
+ *
+ * qemu leaves the psci node out when the firmware runs in EL3.
+ */
+int psci_fdt_fixup(void *fdt)
+{
+	static const char compat[] = "arm,psci-1.0\0arm,psci-0.2";
+	int offset, ret;
+
+	offset = fdt_subnode_offset(fdt, 0, "psci");
+	if (offset < 0)
+		offset = fdt_add_subnode(fdt, 0, "psci");
+	if (offset < 0)
+		return offset;
+
+	ret = fdt_setprop(fdt, offset, "compatible", compat, sizeof(compat));
+	if (ret)
+		return ret;
+
+	ret = fdt_setprop_string(fdt, offset, "method", "smc");
+	if (ret)
+		return ret;
+
+	offset = fdt_node_offset_by_prop_value(fdt, -1, "device_type", "cpu", sizeof("cpu"));
+	while (offset >= 0) {
+		ret = fdt_setprop_string(fdt, offset, "enable-method", "psci");
+		if (ret)
+			return ret;
+
+		offset = fdt_node_offset_by_prop_value(fdt, offset, "device_type", "cpu", sizeof("cpu"));
+	}
+
+	return 0;
+}
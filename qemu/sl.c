@@ -0,0 +1,249 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string.h>
+
+#define SL_FORMAT_ONLY
+#include "sl.h"
+#include "winnt.h"
+
+#include "stub.h"
+
+/*
+ * Results of the SL calls. A device only ever returned 0 to us, so the
+ * errors are our own. Anything non-zero makes slbounce give up.
+ */
+#define SL_OK			0
+#define SL_E_NOT_SUPPORTED	((uint64_t)-1)
+#define SL_E_INVALID		((uint64_t)-2)
+#define SL_E_STATE		((uint64_t)-3)
+
+enum sl_state {
+	SL_STATE_IDLE,
+	SL_STATE_AVAILABLE,
+	SL_STATE_AUTHED,
+	SL_STATE_LAUNCHED,
+};
+
+static const char *const sl_cmd_names[] = {
+	[SL_CMD_IS_AVAILABLE]	= "IS_AVAILABLE",
+	[SL_CMD_AUTH]		= "AUTH",
+	[SL_CMD_RESERVE_MEM]	= "RESERVE_MEM",
+	[SL_CMD_LAUNCH]		= "LAUNCH",
+	[SL_CMD_UNMAP_ALL]	= "UNMAP_ALL",
+};
+
+int sl_launched = 0;
+
+static enum sl_state sl_state = SL_STATE_IDLE;
+static uint64_t sl_auth_pe, sl_auth_arg;
+static uint64_t sl_auth_time, sl_launch_time;
+static int sl_os_seen = 0;
+
+/* The tcblaunch.exe that was loaded by sl_load_pe(), no signature check. */
+static int sl_check_pe(uint64_t pe_data, uint64_t pe_size)
+{
+	PIMAGE_DOS_HEADER dos = (PIMAGE_DOS_HEADER)pe_data;
+	PIMAGE_NT_HEADERS64 nt;
+	PIMAGE_DATA_DIRECTORY security;
+
+	if (!stub_ram_valid(pe_data, pe_size) || (pe_data & 0xfff) || pe_size < 4096)
+		return -1;
+
+	if (dos->e_magic != IMAGE_DOS_SIGNATURE || dos->e_lfanew > 4096 - sizeof(*nt))
+		return -1;
+
+	nt = (PIMAGE_NT_HEADERS64)(pe_data + dos->e_lfanew);
+	if (nt->Signature != IMAGE_NT_SIGNATURE || nt->OptionalHeader.Magic != 0x20b)
+		return -1;
+
+	if (nt->FileHeader.Machine != 0xaa64 || nt->OptionalHeader.SizeOfImage > pe_size)
+		return -1;
+
+	security = &nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
+	if (!security->VirtualAddress || !security->Size)
+		return -1;
+
+	return 0;
+}
+
+/* The layout sl_create_data() promises, see the table in sl.c */
+static int sl_check_tz(uint64_t arg_data, uint64_t arg_size)
+{
+	struct sl_tz_data *tz = (struct sl_tz_data *)arg_data;
+	PWIN_CERTIFICATE cert;
+
+	if (!stub_ram_valid(arg_data, arg_size) || (arg_data & 0xfff) || arg_size < sizeof(*tz))
+		return -1;
+
+	if (tz->version != 1 || tz->this_phys != arg_data || tz->this_size > arg_size)
+		return -1;
+
+	if ((tz->crt_offt & 0xfff) || tz->crt_offt < sizeof(*tz) ||
+	    tz->crt_offt + (uint64_t)tz->crt_pages_cnt * 4096 > tz->cert_offt)
+		return -1;
+
+	if ((uint64_t)tz->cert_offt + tz->cert_size > tz->this_size ||
+	    (uint64_t)tz->tcg_offt + tz->tcg_size > tz->this_size ||
+	    tz->tcg_offt < tz->cert_offt + tz->cert_size)
+		return -1;
+
+	cert = (PWIN_CERTIFICATE)(arg_data + tz->cert_offt);
+	if (tz->cert_size < sizeof(*cert) || cert->dwLength > tz->cert_size ||
+	    cert->wRevision != 0x200 || cert->wCertificateType != 2)
+		return -1;
+
+	/* slbounce passes garbage on purpose, so tcblaunch fails early. */
+	if (!stub_ram_valid(tz->boot_params, tz->boot_params_size) ||
+	    tz->boot_params_size < sizeof(struct sl_boot_params))
+		return -1;
+
+	if (!stub_ram_valid(tz->tb_virt, tz->tb_size) || tz->tb_phys != tz->tb_virt ||
+	    tz->tb_entry_point < tz->tb_virt || tz->tb_entry_point - tz->tb_virt >= tz->tb_size)
+		return -1;
+
+	return 0;
+}
+
+static int sl_check_params(struct sl_smc_params *p, uint64_t cmd)
+{
+	if (p->a != 1 || p->b != 0 || p->version != 0x10 || p->num != cmd)
+		return -1;
+
+	if (sl_check_pe(p->pe_data, p->pe_size))
+		return -2;
+
+	if (sl_check_tz(p->arg_data, p->arg_size))
+		return -3;
+
+	return 0;
+}
+
+/*
+ * Do what tcblaunch does when it fails early: return to tb_entry_point
+ * in EL1 with x0 pointing at tb_data, and leave an EL2 vector behind
+ * that turns "hvc #1" into a return to EL2. The vector goes into the
+ * CRT pages, the memory SL gives to tcblaunch.
+ */
+static void sl_launch(struct stub_ctx *ctx, struct sl_smc_params *p)
+{
+	struct sl_tz_data *tz = (struct sl_tz_data *)p->arg_data;
+	uint64_t vectors = p->arg_data + tz->crt_offt;
+
+	memcpy((void *)vectors, stub_el2_vectors, stub_el2_vectors_end - stub_el2_vectors);
+	__asm__ volatile("dsb sy; ic iallu; dsb sy; isb");
+
+	write_sysreg(vbar_el2, vectors);
+	__asm__ volatile("isb");
+
+	ctx->x[0] = p->arg_data + offsetof(struct sl_tz_data, tb_data);
+	ctx->elr = tz->tb_entry_point;
+	ctx->spsr = SPSR_EL1H;
+
+	sl_launched = 1;
+}
+
+/**
+ * sl_handle() - Secure Launch calls, as slbounce makes them.
+ *
+ * IS_AVAILABLE and AUTH check the buffers, LAUNCH only accepts the
+ * buffers that passed AUTH. Nothing is measured or verified.
+ */
+int sl_handle(struct stub_ctx *ctx)
+{
+	struct sl_smc_params *p = (struct sl_smc_params *)ctx->x[1];
+	uint64_t cmd = ctx->x[2];
+	const char *name = "?";
+	uint64_t ret = SL_OK;
+	int err = 0;
+
+	if ((uint32_t)ctx->x[0] != SMC_SL_ID)
+		return 0;
+
+	if (cmd < sizeof(sl_cmd_names) / sizeof(sl_cmd_names[0]) && sl_cmd_names[cmd])
+		name = sl_cmd_names[cmd];
+
+	if (!stub_ram_valid(ctx->x[1], sizeof(*p)) || (ctx->x[1] & 0xfff)) {
+		stub_print("sl: %s with bad params at 0x%lx\n", name, ctx->x[1]);
+		ctx->x[0] = SL_E_INVALID;
+		return 1;
+	}
+
+	switch (cmd) {
+	case SL_CMD_IS_AVAILABLE:
+		if (sl_state >= SL_STATE_AUTHED) {
+			ret = SL_E_STATE;
+			break;
+		}
+		err = sl_check_params(p, cmd);
+		if (!err)
+			sl_state = SL_STATE_AVAILABLE;
+		break;
+	case SL_CMD_AUTH:
+		if (sl_state != SL_STATE_AVAILABLE) {
+			ret = SL_E_STATE;
+			break;
+		}
+		err = sl_check_params(p, cmd);
+		if (err)
+			break;
+		sl_state = SL_STATE_AUTHED;
+		sl_auth_pe = p->pe_data;
+		sl_auth_arg = p->arg_data;
+		sl_auth_time = stub_time_us();
+		break;
+	case SL_CMD_LAUNCH:
+		if (sl_state != SL_STATE_AUTHED) {
+			ret = SL_E_STATE;
+			break;
+		}
+		/* AUTH took the buffers, only the params are redone. */
+		if (p->a != 1 || p->version != 0x10 || p->num != cmd ||
+		    p->pe_data != sl_auth_pe || p->arg_data != sl_auth_arg) {
+			err = -1;
+			break;
+		}
+		sl_state = SL_STATE_LAUNCHED;
+		sl_launch_time = stub_time_us();
+		stub_print("sl: LAUNCH, %lu us after AUTH, returning to 0x%lx in EL1\n",
+			   sl_launch_time - sl_auth_time,
+			   ((struct sl_tz_data *)p->arg_data)->tb_entry_point);
+		sl_launch(ctx, p);
+		return 1;
+	default:
+		ret = SL_E_NOT_SUPPORTED;
+		break;
+	}
+
+	if (err)
+		ret = SL_E_INVALID;
+
+	stub_print("sl: %s = %ld%s\n", name, (int64_t)ret,
+		   err == -1 ? " (params)" : err == -2 ? " (pe)" : err == -3 ? " (tz data)" : "");
+	ctx->x[0] = ret;
+
+	return 1;
+}
+
+/**
+ * sl_observe() - See every SMC, to time the OS startup.
+ *
+ * AUTH is the first call after ExitBootServices(), the first call
+ * that is not SL after LAUNCH comes from the kernel (PSCI probe).
+ */
+void sl_observe(uint32_t fid)
+{
+	uint64_t now;
+
+	if (!sl_launched || sl_os_seen || fid == SMC_SL_ID)
+		return;
+
+	sl_os_seen = 1;
+	now = stub_time_us();
+
+	stub_print("sl: first SMC from the OS (0x%x), %lu us after AUTH, %lu us after LAUNCH\n",
+		   fid, now - sl_auth_time, now - sl_launch_time);
+}
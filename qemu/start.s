@@ -0,0 +1,232 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/* Must match stub.h */
+.equ	STUB_CPUS,		8
+.equ	STUB_STACK_SIZE,	8192
+.equ	CTX_SIZE,		8 * 34		// struct stub_ctx
+.equ	CTX_X30,		8 * 30
+.equ	CTX_SPSR,		8 * 32
+
+.equ	SCTLR_EL3_RES1,		0x30c50830	// MMU, caches and alignment checks off
+
+.equ	ESR_EC_HVC64,		0x16
+.equ	SPSR_EL2H,		0x3c9
+
+.section .text.start, "ax"
+
+/*
+ * _start() - Reset vector, all cpus come here.
+ *
+ * The boot cpu sets up the data and runs stub_main(), the rest wait
+ * in stub_secondary() for it and then for PSCI CPU_ON.
+ */
+.global _start
+_start:
+	msr	daifset, #0b1111
+
+	ldr	x0, =stub_el3_vectors
+	msr	vbar_el3, x0
+	ldr	x0, =SCTLR_EL3_RES1
+	msr	sctlr_el3, x0
+	isb
+
+	/* qemu numbers the cpus in aff0, up to STUB_CPUS of them. */
+	mrs	x0, mpidr_el1
+	ubfx	x1, x0, #8, #16
+	cbnz	x1, halt
+	ubfx	x1, x0, #32, #8
+	cbnz	x1, halt
+	ubfx	x19, x0, #0, #8
+	cmp	x19, #STUB_CPUS
+	b.hs	halt
+
+	/* The stack is right below the context of this cpu. */
+	ldr	x0, =stub_stacks
+	add	x1, x19, #1
+	mov	x2, #STUB_STACK_SIZE
+	madd	x0, x1, x2, x0
+	sub	sp, x0, #CTX_SIZE
+
+	mov	x0, x19
+	cbnz	x19, 3f
+
+	ldr	x1, =__data_lma
+	ldr	x2, =__data_start
+	ldr	x3, =__data_end
+1:	cmp	x2, x3
+	b.hs	2f
+	ldr	x4, [x1], #8
+	str	x4, [x2], #8
+	b	1b
+
+2:	ldr	x2, =__bss_start
+	ldr	x3, =__bss_end
+1:	cmp	x2, x3
+	b.hs	2f
+	str	xzr, [x2], #8
+	b	1b
+
+2:	mov	x0, x19
+	bl	stub_main
+	b	halt
+
+3:	bl	stub_secondary
+
+.global halt
+halt:
+	wfe
+	b	halt
+
+
+/*
+ * stub_eret() - Enter a lower EL with the given register state.
+ * x0: Pointer to the struct stub_ctx of this cpu.
+ *
+ * The context stays at the top of the stack, so SMCs taken from
+ * the lower EL save the registers right there.
+ */
+.global stub_eret
+stub_eret:
+	mov	sp, x0
+
+	ldp	x30, x0, [sp, #CTX_X30]
+	msr	elr_el3, x0
+	ldr	x0, [sp, #CTX_SPSR]
+	msr	spsr_el3, x0
+
+	ldp	x0, x1, [sp, #16 * 0]
+	ldp	x2, x3, [sp, #16 * 1]
+	ldp	x4, x5, [sp, #16 * 2]
+	ldp	x6, x7, [sp, #16 * 3]
+	ldp	x8, x9, [sp, #16 * 4]
+	ldp	x10, x11, [sp, #16 * 5]
+	ldp	x12, x13, [sp, #16 * 6]
+	ldp	x14, x15, [sp, #16 * 7]
+	ldp	x16, x17, [sp, #16 * 8]
+	ldp	x18, x19, [sp, #16 * 9]
+	ldp	x20, x21, [sp, #16 * 10]
+	ldp	x22, x23, [sp, #16 * 11]
+	ldp	x24, x25, [sp, #16 * 12]
+	ldp	x26, x27, [sp, #16 * 13]
+	ldp	x28, x29, [sp, #16 * 14]
+
+	eret
+
+
+/* lower_sync() - SMC (or anything else) from the lower EL. */
+lower_sync:
+	stp	x0, x1, [sp, #16 * 0]
+	stp	x2, x3, [sp, #16 * 1]
+	stp	x4, x5, [sp, #16 * 2]
+	stp	x6, x7, [sp, #16 * 3]
+	stp	x8, x9, [sp, #16 * 4]
+	stp	x10, x11, [sp, #16 * 5]
+	stp	x12, x13, [sp, #16 * 6]
+	stp	x14, x15, [sp, #16 * 7]
+	stp	x16, x17, [sp, #16 * 8]
+	stp	x18, x19, [sp, #16 * 9]
+	stp	x20, x21, [sp, #16 * 10]
+	stp	x22, x23, [sp, #16 * 11]
+	stp	x24, x25, [sp, #16 * 12]
+	stp	x26, x27, [sp, #16 * 13]
+	stp	x28, x29, [sp, #16 * 14]
+
+	mrs	x0, elr_el3
+	stp	x30, x0, [sp, #CTX_X30]
+	mrs	x0, spsr_el3
+	str	x0, [sp, #CTX_SPSR]
+
+	mov	x0, sp
+	mrs	x1, esr_el3
+	bl	stub_exception
+
+	mov	x0, sp
+	b	stub_eret
+
+
+/* any_other() - Exceptions we don't expect, report and hang. */
+any_other:
+	mrs	x0, esr_el3
+	mrs	x1, elr_el3
+	mrs	x2, far_el3
+	bl	stub_panic
+	b	halt
+
+
+.macro vector target
+	.balign	0x80
+	b	\target
+.endm
+
+.balign	0x800
+stub_el3_vectors:
+	/* Current EL with SP0 */
+	vector	any_other
+	vector	any_other
+	vector	any_other
+	vector	any_other
+	/* Current EL with SPx */
+	vector	any_other
+	vector	any_other
+	vector	any_other
+	vector	any_other
+	/* Lower EL, AArch64 */
+	vector	lower_sync
+	vector	any_other
+	vector	any_other
+	vector	any_other
+	/* Lower EL, AArch32 */
+	vector	any_other
+	vector	any_other
+	vector	any_other
+	vector	any_other
+
+
+/*
+ * EL2 vectors "tcblaunch" leaves behind, copied to ram on LAUNCH.
+ *
+ * The only thing they do is the transition tcblaunch.exe offers on
+ * its error path: hvc #1 from EL1 returns to the next instruction,
+ * but in EL2. Only x0 and x1 are clobbered, as tb_entry() expects.
+ */
+.macro el2_hang
+	.balign	0x80
+1:	wfe
+	b	1b
+.endm
+
+.balign	0x800
+.global stub_el2_vectors
+stub_el2_vectors:
+	.rept	8
+	el2_hang
+	.endr
+
+	/* Lower EL, AArch64, sync */
+	.balign	0x80
+	mrs	x0, esr_el2
+	lsr	x1, x0, #26
+	cmp	x1, #ESR_EC_HVC64
+	b.ne	1f
+	and	x0, x0, #0xffff
+	cmp	x0, #1
+	b.ne	1f
+	mov	x0, #SPSR_EL2H
+	msr	spsr_el2, x0
+	eret
+1:	wfe
+	b	1b
+
+	.rept	7
+	el2_hang
+	.endr
+.global stub_el2_vectors_end
+stub_el2_vectors_end:
+
+
+.section .noinit, "aw", %nobits
+.balign	16
+.global stub_stacks
+stub_stacks:
+	.skip	STUB_CPUS * STUB_STACK_SIZE
@@ -0,0 +1,93 @@
+#ifndef STUB_H
+#define STUB_H
+
+#include <stdint.h>
+
+/*
+ * EL3 firmware for the qemu "virt" machine (secure=on, virtualization=on,
+ * gic-version=3) that stands in for the Qualcomm firmware and tcblaunch.exe.
+ *
+ * It runs from the secure flash with MMU off, keeps its data in the secure
+ * RAM and starts the payload (ArmVirtQemuKernel) in non-secure EL1, so
+ * slbounce gets the same view of the system as on a device.
+ */
+
+#define STUB_CPUS		8
+#define STUB_STACK_SIZE		8192	/* Per cpu, the context is at the top. */
+
+#define STUB_UART_BASE		0x09000000
+#define STUB_GICD_BASE		0x08000000
+#define STUB_GICR_BASE		0x080a0000
+#define STUB_GICR_STRIDE	0x20000
+#define STUB_SECURE_GPIO_BASE	0x090b0000	/* pin 0 resets, pin 1 powers off. */
+#define STUB_DTB_BASE		0x40000000	/* qemu puts the dtb at the start of ram. */
+
+#ifndef STUB_PAYLOAD_BASE
+#define STUB_PAYLOAD_BASE	0x60000000
+#endif
+
+#define SPSR_EL1H		0x3c5	/* EL1h, DAIF masked */
+#define SPSR_EL2H		0x3c9	/* EL2h, DAIF masked */
+
+#define ESR_EC_SMC64		0x17
+
+#define SMCCC_NOT_SUPPORTED	((uint64_t)-1)
+
+/* Lower EL registers, saved on an SMC. Layout is shared with start.s */
+struct stub_ctx {
+	uint64_t x[31];
+	uint64_t elr;
+	uint64_t spsr;
+	uint64_t pad;
+};
+
+#define read_sysreg(reg) ({						\
+	uint64_t __val;							\
+	__asm__ volatile("mrs %0, " #reg : "=r" (__val));		\
+	__val;								\
+})
+
+#define write_sysreg(reg, val) ({					\
+	__asm__ volatile("msr " #reg ", %0" : : "r" ((uint64_t)(val)));	\
+})
+
+static inline uint32_t mmio_read32(uint64_t addr)
+{
+	return *(volatile uint32_t *)addr;
+}
+
+static inline void mmio_write32(uint64_t addr, uint32_t val)
+{
+	*(volatile uint32_t *)addr = val;
+}
+
+/* start.s */
+extern uint8_t stub_stacks[];
+extern const uint8_t stub_el2_vectors[];
+extern const uint8_t stub_el2_vectors_end[];
+
+void stub_eret(struct stub_ctx *ctx) __attribute__((noreturn));
+
+/* main.c */
+void stub_print(const char *fmt, ...);
+uint64_t stub_time_us(void);
+int stub_ram_valid(uint64_t start, uint64_t size);
+unsigned int stub_cpu_count(void);
+void stub_enter_lower(unsigned int cpu, uint64_t entry, uint64_t arg, int el) __attribute__((noreturn));
+void stub_halt(void) __attribute__((noreturn));
+
+/* psci.c */
+/* Returns 0 if this was not a PSCI call. */
+int psci_handle(struct stub_ctx *ctx, unsigned int cpu);
+void psci_boot_cpu(unsigned int cpu);
+void psci_cpu_wait(unsigned int cpu) __attribute__((noreturn));
+int psci_fdt_fixup(void *fdt);
+
+/* sl.c */
+extern int sl_launched;
+
+/* Returns 0 if this was not a Secure Launch call. */
+int sl_handle(struct stub_ctx *ctx);
+void sl_observe(uint32_t fid);
+
+#endif
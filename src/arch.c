@@ -13,11 +13,21 @@
 #include <sysreg/cntp_tval_el0.h>
 
 #include "sl.h"
+#include "soc.h"
 #include "arch.h"
 
+uint64_t dcache_line_size(void)
+{
+#ifdef SOC_DCACHE_LINE
+	return SOC_DCACHE_LINE;
+#else
+	return (1 << read_ctr_el0().dminline) * 4;
+#endif
+}
+
 void clear_dcache_range(uint64_t start, uint64_t size)
 {
-	uint64_t cache_line_size = (1 << read_ctr_el0().dminline) * 4;
+	uint64_t cache_line_size = dcache_line_size();
 	uint64_t i, end = start + size;
 
 	start &= ~(cache_line_size - 1);
@@ -32,6 +42,329 @@ void clear_dcache_range(uint64_t start, uint64_t size)
 	);
 }
 
+/**
+ * clean_dcache_range() - Write dirty lines back to PoC, keep them valid.
+ */
+void clean_dcache_range(uint64_t start, uint64_t size)
+{
+	uint64_t cache_line_size = dcache_line_size();
+	uint64_t i, end = start + size;
+
+	start &= ~(cache_line_size - 1);
+
+	for (i = start; i < end; i += cache_line_size) {
+		__asm__ volatile("dc cvac, %0\n" : : "r" (i) :"memory");
+	}
+
+	__asm__ volatile(
+		"dsb ish\n\t"
+		"isb\n\t"
+	);
+}
+
+/**
+ * clear_dcache_all() - Clean and invalidate all data caches by set/way.
+ *
+ * Only the caches up to the level of coherence are walked, so system
+ * caches outside of the cpu are not affected. Other cpus may still
+ * hold dirty lines, this is not a replacement for clear_dcache_range().
+ */
+void clear_dcache_all(void)
+{
+	uint64_t clidr = read_sysreg(clidr_el1);
+	uint64_t loc = (clidr >> 24) & 0x7;
+	uint64_t level, ccsidr, line_shift, ways, sets, way_shift, way, set;
+
+	for (level = 0; level < loc; level++) {
+		/* Data or unified caches only. */
+		if (((clidr >> (level * 3)) & 0x7) < 2)
+			continue;
+
+		__asm__ volatile("msr csselr_el1, %0\n\tisb\n" : : "r" (level << 1));
+		ccsidr = read_sysreg(ccsidr_el1);
+
+		line_shift = (ccsidr & 0x7) + 4;
+		ways = ((ccsidr >> 3) & 0x3ff) + 1;
+		sets = ((ccsidr >> 13) & 0x7fff) + 1;
+		way_shift = ways > 1 ? __builtin_clz(ways - 1) : 0;
+
+		for (way = 0; way < ways; way++)
+			for (set = 0; set < sets; set++)
+				__asm__ volatile("dc cisw, %0\n" : :
+					"r" ((way << way_shift) | (set << line_shift) | (level << 1)) : "memory");
+	}
+
+	__asm__ volatile(
+		"dsb sy\n\t"
+		"isb\n\t"
+	);
+}
+
+/**
+ * dcache_total_size() - Bytes of data the cpu caches up to LoC can hold.
+ *
+ * This is what clear_dcache_all() walks, system caches are not counted.
+ */
+uint64_t dcache_total_size(void)
+{
+	uint64_t clidr = read_sysreg(clidr_el1);
+	uint64_t loc = (clidr >> 24) & 0x7;
+	uint64_t level, ccsidr, total = 0;
+
+	for (level = 0; level < loc; level++) {
+		if (((clidr >> (level * 3)) & 0x7) < 2)
+			continue;
+
+		__asm__ volatile("msr csselr_el1, %0\n\tisb\n" : : "r" (level << 1));
+		ccsidr = read_sysreg(ccsidr_el1);
+
+		total += (16ull << (ccsidr & 0x7)) * (((ccsidr >> 3) & 0x3ff) + 1) *
+			 (((ccsidr >> 13) & 0x7fff) + 1);
+	}
+
+	return total;
+}
+
+/**
+ * dcache_zva_size() - Size of the block zeroed by "dc zva".
+ *
+ * Returns 0 if "dc zva" is not allowed.
+ */
+uint64_t dcache_zva_size(void)
+{
+	uint64_t dczid = read_sysreg(dczid_el0);
+
+	if (dczid & (1 << 4))
+		return 0;
+
+	return 4 << (dczid & 0xf);
+}
+
+/**
+ * zero_dcache_range() - Zero memory with "dc zva".
+ *
+ * Both start and size must be aligned to dcache_zva_size().
+ */
+void zero_dcache_range(uint64_t start, uint64_t size)
+{
+	uint64_t block = dcache_zva_size();
+	uint64_t i, end = start + size;
+
+	for (i = start; i < end; i += block) {
+		__asm__ volatile("dc zva, %0\n" : : "r" (i) :"memory");
+	}
+
+	__asm__ volatile("dsb ish\n\t");
+}
+
+/* PMEVTYPER<n>_EL0 / PMCCFILTR_EL0: also count in EL2, after the switch. */
+#define PMU_FILTER_NSH		(1 << 27)
+
+#define PMCR_E			(1 << 0)
+#define PMCR_N(pmcr)		(((pmcr) >> 11) & 0x1f)
+#define PMCNTEN_C		(1u << 31)
+
+static struct {
+	int count;
+	uint64_t pmcr;
+	uint64_t cntenset;
+	uint64_t selr;
+	uint64_t ccfiltr;
+	uint64_t ccntr;
+	uint64_t evtyper[PMU_HW_MAX];
+	uint64_t evcntr[PMU_HW_MAX];
+} pmu_saved;
+
+/**
+ * pmu_hw_init() - Program PMUv3 counters, saving their old state.
+ * @events: Event numbers for the event counters.
+ * @count:  Number of events.
+ *
+ * The cycle counter is always enabled as well. Counters keep their
+ * values, only deltas are meaningful. Note that the hyp may trap
+ * PMU accesses from EL1, this can't be detected.
+ *
+ * Return: Number of event counters programmed, -1 if there is no PMU.
+ */
+int pmu_hw_init(const uint16_t *events, int count)
+{
+	uint64_t pmuver = (read_sysreg(id_aa64dfr0_el1) >> 8) & 0xf;
+	uint64_t mask = PMCNTEN_C;
+	int i;
+
+	if (pmuver == 0 || pmuver == 0xf)
+		return -1;
+
+	pmu_saved.pmcr = read_sysreg(pmcr_el0);
+	if (count > PMCR_N(pmu_saved.pmcr))
+		count = PMCR_N(pmu_saved.pmcr);
+	if (count > PMU_HW_MAX)
+		count = PMU_HW_MAX;
+
+	for (i = 0; i < count; i++)
+		mask |= 1 << i;
+
+	pmu_saved.count = count;
+	pmu_saved.cntenset = read_sysreg(pmcntenset_el0);
+	pmu_saved.selr = read_sysreg(pmselr_el0);
+	pmu_saved.ccfiltr = read_sysreg(pmccfiltr_el0);
+	pmu_saved.ccntr = read_sysreg(pmccntr_el0);
+
+	write_sysreg(pmcntenclr_el0, mask);
+
+	for (i = 0; i < count; i++) {
+		write_sysreg(pmselr_el0, i);
+		__asm__ volatile("isb");
+		pmu_saved.evtyper[i] = read_sysreg(pmxevtyper_el0);
+		pmu_saved.evcntr[i] = read_sysreg(pmxevcntr_el0);
+		write_sysreg(pmxevtyper_el0, events[i] | PMU_FILTER_NSH);
+	}
+
+	write_sysreg(pmccfiltr_el0, PMU_FILTER_NSH);
+	write_sysreg(pmcr_el0, pmu_saved.pmcr | PMCR_E);
+	write_sysreg(pmcntenset_el0, mask);
+	__asm__ volatile("isb");
+
+	return count;
+}
+
+/**
+ * pmu_hw_read() - Read the cycle counter and @count event counters.
+ * @vals: Cycles first, then the events.
+ */
+void pmu_hw_read(uint64_t *vals, int count)
+{
+	int i;
+
+	__asm__ volatile("isb");
+	vals[0] = read_sysreg(pmccntr_el0);
+
+	for (i = 0; i < count; i++) {
+		write_sysreg(pmselr_el0, i);
+		__asm__ volatile("isb");
+		vals[i + 1] = read_sysreg(pmxevcntr_el0);
+	}
+}
+
+/**
+ * pmu_hw_restore() - Put the counters back as pmu_hw_init() found them.
+ */
+void pmu_hw_restore(void)
+{
+	uint64_t mask = PMCNTEN_C;
+	int i;
+
+	for (i = 0; i < pmu_saved.count; i++)
+		mask |= 1 << i;
+
+	write_sysreg(pmcntenclr_el0, mask);
+
+	for (i = 0; i < pmu_saved.count; i++) {
+		write_sysreg(pmselr_el0, i);
+		__asm__ volatile("isb");
+		write_sysreg(pmxevtyper_el0, pmu_saved.evtyper[i]);
+		write_sysreg(pmxevcntr_el0, pmu_saved.evcntr[i]);
+	}
+
+	write_sysreg(pmccfiltr_el0, pmu_saved.ccfiltr);
+	write_sysreg(pmccntr_el0, pmu_saved.ccntr);
+	write_sysreg(pmselr_el0, pmu_saved.selr);
+	write_sysreg(pmcr_el0, pmu_saved.pmcr);
+	write_sysreg(pmcntenset_el0, pmu_saved.cntenset & mask);
+	__asm__ volatile("isb");
+}
+
+#define MMFR1_HAFDBS(mmfr1)	((mmfr1) & 0xf)
+#define MMFR1_HAFDBS_DIRTY	2
+
+#define TCR_HA			(1ull << 39)
+#define TCR_HD			(1ull << 40)
+
+/**
+ * mmu_hw_dirty_enable() - Enable hardware Access Flag and dirty state updates.
+ *
+ * Only the stage 1 EL1&0 translation is affected. Note that the hyp
+ * may trap TCR_EL1 writes from EL1, this can't be detected.
+ *
+ * Return: 0 on success, -1 if the cpu doesn't have FEAT_HAFDBS.
+ */
+int mmu_hw_dirty_enable(void)
+{
+	if (MMFR1_HAFDBS(read_sysreg(id_aa64mmfr1_el1)) < MMFR1_HAFDBS_DIRTY)
+		return -1;
+
+	write_sysreg(tcr_el1, read_sysreg(tcr_el1) | TCR_HA | TCR_HD);
+	__asm__ volatile("isb");
+
+	return 0;
+}
+
+/**
+ * mmu_hw_tlb_flush() - Make the descriptor writes visible to the walker.
+ */
+void mmu_hw_tlb_flush(void)
+{
+	__asm__ volatile(
+		"dsb ishst\n\t"
+		"tlbi vmalle1\n\t"
+		"dsb ish\n\t"
+		"isb\n\t"
+		: : : "memory");
+}
+
+/**
+ * mmu_hw_set_ttbr0() - Switch the lower VA range to other tables.
+ *
+ * The old and the new tables may only differ in the block sizes, the
+ * addresses and attributes must stay the same. Until the TLB is
+ * invalidated, entries of both sizes may be looked up together, so the
+ * ranges accessed meanwhile, this code, the stack and the tables, must
+ * be mapped the same way by both.
+ */
+__attribute__((aligned(64)))
+void mmu_hw_set_ttbr0(uint64_t ttbr)
+{
+	__asm__ volatile(
+		"dsb ish\n\t"
+		"msr ttbr0_el1, %0\n\t"
+		"isb\n\t"
+		"tlbi vmalle1\n\t"
+		"dsb ish\n\t"
+		"isb\n\t"
+		: : "r" (ttbr) : "memory");
+}
+
+#define ISAR0_CRC32(isar0)	(((isar0) >> 16) & 0xf)
+
+int crc32_hw_supported(void)
+{
+	return ISAR0_CRC32(read_sysreg(id_aa64isar0_el1)) != 0;
+}
+
+/**
+ * crc32_hw() - CRC-32 (not CRC-32C) of a buffer with the ARMv8 instructions.
+ * @crc: Previous value, start with 0.
+ *
+ * Only use if crc32_hw_supported().
+ */
+uint32_t crc32_hw(uint32_t crc, uint64_t start, uint64_t size)
+{
+	const uint64_t *p = (const uint64_t *)start;
+	const uint8_t *b;
+	uint64_t i;
+
+	crc = ~crc;
+
+	for (i = 0; i < size / 8; i++)
+		__asm__(".arch_extension crc\n\tcrc32x %w0, %w0, %1" : "+r" (crc) : "r" (p[i]));
+
+	b = (const uint8_t *)&p[i];
+	for (i = 0; i < size % 8; i++)
+		__asm__(".arch_extension crc\n\tcrc32b %w0, %w0, %w1" : "+r" (crc) : "r" (b[i]));
+
+	return ~crc;
+}
+
 uint64_t _smc(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, uint64_t x5)
 {
 	register uint64_t r0 __asm__("r0") = x0;
@@ -40,14 +373,21 @@ uint64_t _smc(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, u
 	register uint64_t r3 __asm__("r3") = x3;
 	register uint64_t r4 __asm__("r4") = x4;
 	register uint64_t r5 __asm__("r5") = x5;
+	/*
+	 * All arguments must be asm operands, otherwise the compiler
+	 * is free to not have them in the registers at -O2.
+	 */
 	__asm__ volatile(
 		"smc	#0\n"
-		: "+r" (r0) : : "r1", "r2", "r3", "r4", "r5"
+		: "+r" (r0), "+r" (r1), "+r" (r2), "+r" (r3), "+r" (r4), "+r" (r5)
+		:
+		: "x6", "x7", "x8", "x9", "x10", "x11", "x12", "x13",
+		  "x14", "x15", "x16", "x17", "memory"
 	);
 	return r0;
 }
 
-uint64_t smc6(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, uint64_t x5)
+static uint64_t smc_real(const uint64_t args[6])
 {
 	uint64_t ret;
 	union daif daif_bak = read_daif();
@@ -63,13 +403,41 @@ uint64_t smc6(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, u
 	 */
 	read_modify_write_daif( .i=1 );
 
-	ret = _smc(x0, x1, x2, x3, x4, x5);
+	ret = _smc(args[0], args[1], args[2], args[3], args[4], args[5]);
 
 	unsafe_write_daif(daif_bak);
 
 	return ret;
 }
 
+static smc_backend_t smc_backend = smc_real;
+
+/**
+ * smc_set_backend() - Route all smc()/smc6() calls through a backend.
+ * @backend: New backend, NULL for the real smc.
+ *
+ * Returns the previous backend, so a backend that only observes the
+ * calls (see smclog.c) can pass them on.
+ */
+smc_backend_t smc_set_backend(smc_backend_t backend)
+{
+	smc_backend_t old = smc_backend;
+
+	if (backend)
+		smc_backend = backend;
+	else
+		smc_backend = smc_real;
+
+	return old;
+}
+
+uint64_t smc6(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, uint64_t x5)
+{
+	uint64_t args[6] = { x0, x1, x2, x3, x4, x5 };
+
+	return smc_backend(args);
+}
+
 uint64_t smc(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3)
 {
 	return smc6(x0, x1, x2, x3, 0, 0);
@@ -82,6 +450,7 @@ void psci_off(void)
 		"mov x0, #0xc4000000\n\t"
 		"add x0, x0, #8\n\t"
 		"smc #0\n\t"
+		: : : "x0", "memory"
 	);
 }
 
@@ -91,5 +460,126 @@ void psci_reboot(void)
 		"mov x0, #0xc4000000\n\t"
 		"add x0, x0, #9\n\t"
 		"smc #0\n\t"
+		: : : "x0", "memory"
 	);
 }
+
+/**
+ * el2_state_init() - Prepare tb_el2_state for tb_el2_setup().
+ * @e2h: Whether HCR_EL2.E2H will be set when the state is applied.
+ *
+ * The state is picked so nothing the loader or the kernel does early
+ * (FP/SIMD, SVE, counters, PMU) traps to the now non-existent hyp.
+ * Feature detection is done here since ID registers are readable from
+ * EL1, but PMCR_EL0.N is read by tb_el2_setup() itself as the old hyp
+ * may trap PMU accesses.
+ */
+void el2_state_init(int e2h)
+{
+	uint64_t pfr0 = read_sysreg(id_aa64pfr0_el1);
+	uint64_t dfr0 = read_sysreg(id_aa64dfr0_el1);
+	uint64_t pmuver = (dfr0 >> 8) & 0xf;
+	uint64_t *st = tb_el2_state;
+	int i;
+
+	for (i = 0; i < EL2_STATE_CNT; i++)
+		st[i] = 0;
+
+	if ((pfr0 >> 32) & 0xf)
+		st[EL2_FLAGS] |= EL2_F_SVE;
+	if (pmuver != 0 && pmuver != 0xf)
+		st[EL2_FLAGS] |= EL2_F_PMU;
+
+	if (e2h) {
+		st[EL2_CPTR] = CPTR_EL2_E2H_FPEN;
+		if (st[EL2_FLAGS] & EL2_F_SVE)
+			st[EL2_CPTR] |= CPTR_EL2_E2H_ZEN;
+
+		st[EL2_CNTHCTL] = CNTHCTL_EL2_EL0PCTEN | CNTHCTL_EL2_EL0VCTEN
+				| CNTHCTL_EL2_EL1PCTEN | CNTHCTL_EL2_EL1PCEN;
+	} else {
+		st[EL2_CPTR] = CPTR_EL2_NVHE_RES1;
+		if (!(st[EL2_FLAGS] & EL2_F_SVE))
+			st[EL2_CPTR] |= CPTR_EL2_NVHE_TZ;
+
+		/* Without E2H bits [1:0] are the EL1 controls. */
+		st[EL2_CNTHCTL] = CNTHCTL_EL2_EL0PCTEN | CNTHCTL_EL2_EL0VCTEN;
+	}
+
+	/* Max vector length, the cpu clamps it to what it has. */
+	if (st[EL2_FLAGS] & EL2_F_SVE)
+		st[EL2_ZCR] = 0xf;
+
+	/*
+	 * CNTVOFF, HSTR and VTTBR are left as zero, MDCR only gets HPMN
+	 * so debug and PMU accesses are not trapped.
+	 */
+
+	clear_dcache_range((uint64_t)tb_el2_state, sizeof(tb_el2_state));
+}
+
+#define EL2_READER(name, reg) \
+	static uint64_t el2_read_##name(void) { return read_sysreg(reg); }
+
+EL2_READER(cptr,	cptr_el2)
+EL2_READER(cnthctl,	cnthctl_el2)
+EL2_READER(cntvoff,	cntvoff_el2)
+EL2_READER(mdcr,	mdcr_el2)
+EL2_READER(hstr,	hstr_el2)
+EL2_READER(vttbr,	vttbr_el2)
+EL2_READER(zcr,		S3_4_C1_C2_0)
+
+static const struct {
+	const CHAR16 *name;
+	uint64_t (*read)(void);
+	enum el2_state_idx idx;
+	uint64_t needs;
+} el2_regs[] = {
+	{ L"cptr_el2",		el2_read_cptr,		EL2_CPTR,	0 },
+	{ L"cnthctl_el2",	el2_read_cnthctl,	EL2_CNTHCTL,	0 },
+	{ L"cntvoff_el2",	el2_read_cntvoff,	EL2_CNTVOFF,	0 },
+	{ L"mdcr_el2",		el2_read_mdcr,		EL2_MDCR,	0 },
+	{ L"hstr_el2",		el2_read_hstr,		EL2_HSTR,	0 },
+	{ L"vttbr_el2",		el2_read_vttbr,		EL2_VTTBR,	0 },
+	{ L"zcr_el2",		el2_read_zcr,		EL2_ZCR,	EL2_F_SVE },
+};
+
+/**
+ * el2_check_state() - Compare live EL2 registers with tb_el2_state.
+ * @out: Array to store the register values in, may be NULL.
+ * @max: Size of the array.
+ *
+ * Must be called in EL2, after tb_el2_setup(). Every checked register
+ * is stored into @out so the caller can dump all of them.
+ *
+ * Return: Number of registers that don't match.
+ */
+int el2_check_state(struct el2_check *out, int max)
+{
+	uint64_t flags = tb_el2_state[EL2_FLAGS];
+	uint64_t actual, expected;
+	int i, n = 0, bad = 0;
+
+	for (i = 0; i < sizeof(el2_regs) / sizeof(el2_regs[0]); i++) {
+		if ((el2_regs[i].needs & flags) != el2_regs[i].needs)
+			continue;
+
+		actual = el2_regs[i].read();
+		expected = tb_el2_state[el2_regs[i].idx];
+
+		if (el2_regs[i].idx == EL2_MDCR && (flags & EL2_F_PMU))
+			expected |= (read_sysreg(pmcr_el0) >> 11) & 0x1f;
+
+		if (actual != expected)
+			bad++;
+
+		if (out && n < max) {
+			out[n].name = el2_regs[i].name;
+			out[n].actual = actual;
+			out[n].expected = expected;
+			n++;
+		}
+	}
+
+	return bad;
+}
@@ -2,18 +2,147 @@
 #define ARCH_H
 
 #include <stdint.h>
+#include <efi.h>
 
+uint64_t dcache_line_size(void);
 void clear_dcache_range(uint64_t start, uint64_t size);
+void clean_dcache_range(uint64_t start, uint64_t size);
+void clear_dcache_all(void);
+uint64_t dcache_total_size(void);
+uint64_t dcache_zva_size(void);
+void zero_dcache_range(uint64_t start, uint64_t size);
 uint64_t smc(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3);
 uint64_t smc6(uint64_t x0, uint64_t x1, uint64_t x2, uint64_t x3, uint64_t x4, uint64_t x5);
 void psci_off(void);
 void psci_reboot(void);
 
+/* Handles an SMC with x0-x5 in args, returns x0. */
+typedef uint64_t (*smc_backend_t)(const uint64_t args[6]);
+
+smc_backend_t smc_set_backend(smc_backend_t backend);
+
+/* PMUv3 event counters used at most, the cycle counter is extra. */
+#define PMU_HW_MAX		8
+
+int pmu_hw_init(const uint16_t *events, int count);
+void pmu_hw_read(uint64_t *vals, int count);
+void pmu_hw_restore(void);
+
+int mmu_hw_dirty_enable(void);
+void mmu_hw_tlb_flush(void);
+void mmu_hw_set_ttbr0(uint64_t ttbr);
+
+int crc32_hw_supported(void);
+uint32_t crc32_hw(uint32_t crc, uint64_t start, uint64_t size);
+
+#ifdef SLBOUNCE_HOST
+/* Host builds get the timer from host/mock_arch.c */
+uint64_t host_read_sysreg(const char *reg);
+uint64_t arch_counter(void);
+uint64_t arch_fetch_add(uint64_t *ptr, uint64_t val);
+
+#define read_sysreg(reg)	host_read_sysreg(#reg)
+#else
+#define read_sysreg(reg) ({						\
+	uint64_t __val;							\
+	__asm__ volatile("mrs %0, " #reg : "=r" (__val));		\
+	__val;								\
+})
+
+#define write_sysreg(reg, val) \
+	__asm__ volatile("msr " #reg ", %0" : : "r" ((uint64_t)(val)) : "memory")
+
+/* Arch timer, counts at cntfrq_el0. */
+static inline uint64_t arch_counter(void)
+{
+	uint64_t val;
+
+	/* Don't let the read be done early. */
+	__asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r" (val) : : "memory");
+
+	return val;
+}
+
+/*
+ * Atomic *ptr += val, returns the old value. Exclusives only work on
+ * cacheable memory, so not with the MMU off. This is open-coded since
+ * the compiler would call into libgcc for it.
+ */
+static inline uint64_t arch_fetch_add(uint64_t *ptr, uint64_t val)
+{
+	uint64_t old, new;
+	uint32_t fail;
+
+	__asm__ volatile(
+		"1:	ldxr	%0, [%3]\n\t"
+		"add	%1, %0, %4\n\t"
+		"stxr	%w2, %1, [%3]\n\t"
+		"cbnz	%w2, 1b\n"
+		: "=&r" (old), "=&r" (new), "=&r" (fail)
+		: "r" (ptr), "r" (val)
+		: "memory");
+
+	return old;
+}
+#endif
+
+static inline uint64_t arch_ticks_to_ns(uint64_t ticks)
+{
+	uint64_t freq = read_sysreg(cntfrq_el0);
+
+	return (ticks / freq) * 1000000000 + (ticks % freq) * 1000000000 / freq;
+}
+
+/* Counter-timer Hypervisor Control Register, E2H=1 layout */
+#define CNTHCTL_EL2_EL0PCTEN	(1 << 0)
+#define CNTHCTL_EL2_EL0VCTEN	(1 << 1)
+#define CNTHCTL_EL2_EL1PCTEN	(1 << 10)
+#define CNTHCTL_EL2_EL1PCEN	(1 << 11)
+
+/* Architectural Feature Trap Register (EL2) */
+#define CPTR_EL2_E2H_ZEN	(3 << 16)
+#define CPTR_EL2_E2H_FPEN	(3 << 20)
+#define CPTR_EL2_NVHE_RES1	0x32ff	/* [13:12], [9:0] except TZ. */
+#define CPTR_EL2_NVHE_TZ	(1 << 8)
+
+#define HCR_EL2_E2H		(1ull << 34)
+
+/*
+ * EL2 state written by tb_el2_setup() after tcblaunch returns to us.
+ * Layout is shared with trans.s, keep in sync.
+ */
+enum el2_state_idx {
+	EL2_CPTR,
+	EL2_CNTHCTL,
+	EL2_CNTVOFF,
+	EL2_MDCR,
+	EL2_HSTR,
+	EL2_VTTBR,
+	EL2_ZCR,
+	EL2_FLAGS,
+	EL2_STATE_CNT,
+};
+
+#define EL2_F_SVE		(1 << 0)
+#define EL2_F_PMU		(1 << 1)
+
+struct el2_check {
+	const CHAR16 *name;
+	uint64_t actual;
+	uint64_t expected;
+};
+
+void el2_state_init(int e2h);
+int el2_check_state(struct el2_check *out, int max);
+
 /* In trans.s */
 void tb_entry(void);
 int tb_setjmp(uint64_t *jmp_buf) __attribute__((returns_twice));
 int tb_longjmp(uint64_t *jmp_buf, uint64_t retval) __attribute__((noreturn));
+void booti_enter(uint64_t entry, uint64_t dtb) __attribute__((noreturn));
+void tb_el2_setup(void);
 
 extern uint64_t tb_jmp_buf[21];
+extern uint64_t tb_el2_state[EL2_STATE_CNT];
 
 #endif
@@ -0,0 +1,640 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * slbench - Time the primitives slbounce depends on, on the target.
+ *
+ * Unlike host/bench.c the numbers here are real: cache maintenance,
+ * memory ops, the firmware FAT driver, libfdt and the SMC round trip
+ * are all timed with the arch timer on the device (or in QEMU). The
+ * results are printed and written to the ESP as CSV, with a header
+ * that identifies the cpu and the firmware so runs can be compared.
+ *
+ * Usage: slbench.efi [-n iters] [-t tcblaunch.exe] [-r file] [-d dtb]
+ *                    [-o dtbo] [-f out.csv]
+ */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+#include <efidebug.h>
+
+#include <string.h>
+
+#include <libfdt.h>
+
+#include <sysreg/currentel.h>
+
+#include "util.h"
+#include "arch.h"
+#include "sl.h"
+#include "dtq.h"
+
+#define SLBENCH_ITERS		16
+#define SLBENCH_BATCH		16	/* Runs per sample for cases without prepare(). */
+#define SLBENCH_MAX_RESULTS	64
+#define SLBENCH_BUF_SIZE	(16 * 1024 * 1024)
+#define SLBENCH_DTB_SLACK	(64 * 1024)
+#define SLBENCH_OUT_DEFAULT	L"slbench.csv"
+
+#define PSCI_VERSION		0x84000000
+
+struct slbench_result {
+	const CHAR16 *name;
+	const CHAR16 *variant;
+	UINT64 size;		/* Bytes processed per run, 0 if not applicable. */
+	UINTN iters;
+	UINT64 min, max, total;	/* ns */
+};
+
+struct slbench_case {
+	const CHAR16 *name;
+	const CHAR16 *variant;
+	void (*prepare)(UINT64 size);	/* Before every run, not timed. */
+	void (*run)(UINT64 size);
+};
+
+static struct slbench_result slbench_results[SLBENCH_MAX_RESULTS];
+static int slbench_result_cnt = 0;
+
+static UINTN slbench_iters = SLBENCH_ITERS;
+
+static UINT8 *slbench_buf;	/* Two buffers of SLBENCH_BUF_SIZE. */
+
+static EFI_FILE_HANDLE slbench_volume;
+static CHAR16 *slbench_read_name;
+static UINT8 *slbench_read_buf;
+static UINT64 slbench_read_chunk;
+
+static void *slbench_dtb;
+static UINT8 *slbench_dtb_work;
+static UINTN slbench_dtb_work_size;
+static UINT8 *slbench_dtbo;
+static UINT8 *slbench_dtbo_work;
+
+static struct sl_smc_params *slbench_smc_data;
+static uint64_t slbench_pe_data, slbench_pe_size, slbench_arg_data, slbench_arg_size;
+
+/* The same lookup as sl_is_allowed_by_fdt() in bounce_main.c */
+static struct dtq_query slbench_zap_query = {
+	.compatible = "qcom,adreno",
+	.name = "zap-shader",
+	.prop = "status",
+};
+
+/**
+ * slbench_run() - Time a case and store the result.
+ *
+ * Cases without prepare() are run SLBENCH_BATCH times per sample so
+ * short operations are still visible with a coarse arch timer.
+ */
+static void slbench_run(const struct slbench_case *c, UINT64 size)
+{
+	struct slbench_result *r;
+	UINTN batch = c->prepare ? 1 : SLBENCH_BATCH;
+	UINT64 t, ns;
+	UINTN i, j;
+
+	if (slbench_result_cnt == SLBENCH_MAX_RESULTS)
+		return;
+
+	r = &slbench_results[slbench_result_cnt++];
+	r->name = c->name;
+	r->variant = c->variant;
+	r->size = size;
+	r->iters = slbench_iters;
+	r->min = ~0ull;
+	r->max = 0;
+	r->total = 0;
+
+	/* Warm up, so the first sample doesn't pay for page faults. */
+	if (c->prepare)
+		c->prepare(size);
+	c->run(size);
+
+	for (i = 0; i < slbench_iters; i++) {
+		if (c->prepare)
+			c->prepare(size);
+
+		t = arch_counter();
+		for (j = 0; j < batch; j++)
+			c->run(size);
+		ns = arch_ticks_to_ns(arch_counter() - t) / batch;
+
+		if (ns < r->min)
+			r->min = ns;
+		if (ns > r->max)
+			r->max = ns;
+		r->total += ns;
+	}
+
+	Print(L"  %-16s %-12s %9lu  %9lu %9lu %9lu ns", r->name, r->variant, r->size,
+	      r->min, r->total / r->iters, r->max);
+	if (r->size && r->min)
+		Print(L"  %5lu MiB/s", (r->size * 1000000000 / r->min) >> 20);
+	Print(L"\n");
+}
+
+/*
+ * Cache maintenance and memory ops.
+ */
+
+static void slbench_dirty(UINT64 size)
+{
+	SetMem(slbench_buf, size, 0x5a);
+}
+
+static void slbench_clean(UINT64 size)
+{
+	SetMem(slbench_buf, size, 0x5a);
+	clear_dcache_range((uint64_t)slbench_buf, size);
+}
+
+static void slbench_civac(UINT64 size)
+{
+	clear_dcache_range((uint64_t)slbench_buf, size);
+}
+
+static void slbench_cvac(UINT64 size)
+{
+	clean_dcache_range((uint64_t)slbench_buf, size);
+}
+
+static void slbench_cisw(UINT64 size)
+{
+	clear_dcache_all();
+}
+
+static void slbench_copymem(UINT64 size)
+{
+	CopyMem(slbench_buf + SLBENCH_BUF_SIZE, slbench_buf, size);
+}
+
+static void slbench_setmem(UINT64 size)
+{
+	SetMem(slbench_buf, size, 0);
+}
+
+static void slbench_zva(UINT64 size)
+{
+	zero_dcache_range((uint64_t)slbench_buf, size);
+}
+
+static const struct slbench_case slbench_mem_cases[] = {
+	{ L"dc civac",	L"dirty",	slbench_dirty,	slbench_civac },
+	{ L"dc civac",	L"clean",	slbench_clean,	slbench_civac },
+	{ L"dc cvac",	L"dirty",	slbench_dirty,	slbench_cvac },
+	{ L"CopyMem",	L"",		NULL,		slbench_copymem },
+	{ L"SetMem",	L"",		NULL,		slbench_setmem },
+	{ L"dc zva",	L"",		NULL,		slbench_zva },
+};
+
+static const UINT64 slbench_sizes[] = {
+	4 * 1024,
+	64 * 1024,
+	1024 * 1024,
+	SLBENCH_BUF_SIZE,
+};
+
+static void slbench_mem(void)
+{
+	static const struct slbench_case cisw = { L"dc cisw", L"all", slbench_dirty, slbench_cisw };
+	UINT64 zva = dcache_zva_size();
+	int i, j;
+
+	Print(L"Memory (line %lu, zva %lu):\n", dcache_line_size(), zva);
+
+	for (i = 0; i < sizeof(slbench_mem_cases) / sizeof(slbench_mem_cases[0]); i++) {
+		if (slbench_mem_cases[i].run == slbench_zva && !zva)
+			continue;
+
+		for (j = 0; j < sizeof(slbench_sizes) / sizeof(slbench_sizes[0]); j++)
+			slbench_run(&slbench_mem_cases[i], slbench_sizes[j]);
+	}
+
+	/* The size is only what was dirtied, the whole cache is walked. */
+	slbench_run(&cisw, 1024 * 1024);
+}
+
+/*
+ * Reading from the ESP, through FileOpen() like slbounce does, so
+ * .lz4 files are decompressed as part of the read.
+ */
+
+/* Makes slbench_run() take one sample per read instead of a batch. */
+static void slbench_file_reopen(UINT64 size)
+{
+}
+
+static void slbench_file_read(UINT64 size)
+{
+	EFI_FILE_HANDLE file = FileOpen(slbench_volume, slbench_read_name);
+	UINT64 done = 0, len;
+
+	if (!file)
+		return;
+
+	while (done < size) {
+		len = size - done;
+		if (len > slbench_read_chunk)
+			len = slbench_read_chunk;
+
+		if (!FileRead(file, slbench_read_buf + done, len))
+			break;
+		done += len;
+	}
+
+	FileClose(file);
+}
+
+static void slbench_file(CHAR16 *name)
+{
+	static const struct {
+		const CHAR16 *variant;
+		UINT64 chunk;
+	} chunks[] = {
+		{ L"4k",	4 * 1024 },
+		{ L"64k",	64 * 1024 },
+		{ L"whole",	~0ull },
+	};
+	struct slbench_case c = { L"FileRead", NULL, slbench_file_reopen, slbench_file_read };
+	EFI_FILE_HANDLE file;
+	UINT64 size;
+	int i;
+
+	file = FileOpen(slbench_volume, name);
+	if (!file) {
+		Print(L"Can't open %s, skipping FileRead\n", name);
+		return;
+	}
+
+	size = FileSize(file);
+	FileClose(file);
+
+	if (size > SLBENCH_BUF_SIZE) {
+		Print(L"%s is too big, skipping FileRead\n", name);
+		return;
+	}
+
+	slbench_read_name = name;
+	slbench_read_buf = slbench_buf + SLBENCH_BUF_SIZE;
+
+	Print(L"FileRead (%s):\n", name);
+
+	for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+		c.variant = chunks[i].variant;
+		slbench_read_chunk = chunks[i].chunk;
+		slbench_run(&c, size);
+	}
+}
+
+/*
+ * DT lookups and overlays.
+ */
+
+static void slbench_dtq(UINT64 size)
+{
+	dtq_run(slbench_dtb, &slbench_zap_query, 1);
+}
+
+/* What sl_is_allowed_by_fdt() did before dtq. */
+static void slbench_libfdt(UINT64 size)
+{
+	int offset;
+
+	offset = fdt_node_offset_by_compatible(slbench_dtb, -1, "qcom,adreno");
+	if (offset < 0)
+		return;
+
+	offset = fdt_subnode_offset(slbench_dtb, offset, "zap-shader");
+	if (offset < 0)
+		return;
+
+	fdt_getprop(slbench_dtb, offset, "status", NULL);
+}
+
+static void slbench_overlay_prepare(UINT64 size)
+{
+	fdt_open_into(slbench_dtb, slbench_dtb_work, slbench_dtb_work_size);
+	CopyMem(slbench_dtbo_work, slbench_dtbo, fdt_totalsize(slbench_dtbo));
+}
+
+static void slbench_overlay(UINT64 size)
+{
+	fdt_overlay_apply(slbench_dtb_work, slbench_dtbo_work);
+}
+
+/*
+ * Without a dtbo from the ESP, apply a tiny overlay that works with
+ * any tree, so only the fixed cost of an overlay is measured.
+ */
+static UINT8 *slbench_make_dtbo(void)
+{
+	UINTN size = 4096;
+	UINT8 *dtbo = AllocatePool(size);
+	int frag, ovl, node;
+
+	if (!dtbo || fdt_create_empty_tree(dtbo, size))
+		return NULL;
+
+	frag = fdt_add_subnode(dtbo, 0, "fragment@0");
+	if (frag < 0 || fdt_setprop_string(dtbo, frag, "target-path", "/"))
+		return NULL;
+
+	ovl = fdt_add_subnode(dtbo, frag, "__overlay__");
+	if (ovl < 0)
+		return NULL;
+
+	node = fdt_add_subnode(dtbo, ovl, "slbench");
+	if (node < 0 || fdt_setprop_string(dtbo, node, "compatible", "slbounce,slbench"))
+		return NULL;
+
+	fdt_pack(dtbo);
+
+	return dtbo;
+}
+
+static UINT8 *slbench_load(CHAR16 *name, UINT64 *size)
+{
+	EFI_FILE_HANDLE file = FileOpen(slbench_volume, name);
+	UINT8 *data;
+
+	if (!file) {
+		Print(L"Can't open %s\n", name);
+		return NULL;
+	}
+
+	*size = FileSize(file);
+	data = AllocatePool(*size);
+	if (data && FileRead(file, data, *size) != *size) {
+		FreePool(data);
+		data = NULL;
+	}
+
+	FileClose(file);
+
+	return data;
+}
+
+static void slbench_fdt(CHAR16 *dtb_name, CHAR16 *dtbo_name)
+{
+	static const struct slbench_case cases[] = {
+		{ L"dtq",	L"zap-shader",	NULL,			slbench_dtq },
+		{ L"libfdt",	L"zap-shader",	NULL,			slbench_libfdt },
+		{ L"overlay",	L"apply",	slbench_overlay_prepare,	slbench_overlay },
+	};
+	EFI_GUID EfiDtbTableGuid = EFI_DTB_TABLE_GUID;
+	EFI_STATUS status;
+	UINT64 size;
+	int i;
+
+	if (dtb_name) {
+		slbench_dtb = slbench_load(dtb_name, &size);
+	} else {
+		status = LibGetSystemConfigurationTable(&EfiDtbTableGuid, &slbench_dtb);
+		if (EFI_ERROR(status))
+			slbench_dtb = NULL;
+	}
+
+	if (!slbench_dtb || fdt_check_header(slbench_dtb)) {
+		Print(L"No usable dtb, skipping DT\n");
+		slbench_dtb = NULL;
+		return;
+	}
+
+	if (dtbo_name)
+		slbench_dtbo = slbench_load(dtbo_name, &size);
+	else
+		slbench_dtbo = slbench_make_dtbo();
+
+	if (!slbench_dtbo || fdt_check_header(slbench_dtbo)) {
+		Print(L"No usable dtbo, skipping overlay\n");
+		slbench_dtbo = NULL;
+	}
+
+	slbench_dtb_work_size = fdt_totalsize(slbench_dtb) + SLBENCH_DTB_SLACK;
+	slbench_dtb_work = AllocatePool(slbench_dtb_work_size);
+	if (slbench_dtbo)
+		slbench_dtbo_work = AllocatePool(fdt_totalsize(slbench_dtbo));
+
+	dtq_prepare(&slbench_zap_query, 1);
+
+	Print(L"DT (%lu bytes):\n", (UINT64)fdt_totalsize(slbench_dtb));
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		if (cases[i].run == slbench_overlay && (!slbench_dtbo_work || !slbench_dtb_work))
+			continue;
+
+		slbench_run(&cases[i], fdt_totalsize(slbench_dtb));
+	}
+}
+
+/*
+ * SMC round trips. There is no "nop" SMC, PSCI_VERSION is the
+ * cheapest call every firmware has.
+ */
+
+static void slbench_psci_version(UINT64 size)
+{
+	smc(PSCI_VERSION, 0, 0, 0);
+}
+
+static void slbench_sl_available(UINT64 size)
+{
+	sl_smc(slbench_smc_data, SL_CMD_IS_AVAILABLE, slbench_pe_data, slbench_pe_size,
+	       slbench_arg_data, slbench_arg_size);
+}
+
+/* QEMU without EL3 has no SMC at all, the dtb tells which conduit works. */
+static BOOLEAN slbench_has_smc(void)
+{
+	const char *method;
+	int offset, len;
+
+	if (!slbench_dtb)
+		return TRUE;
+
+	offset = fdt_path_offset(slbench_dtb, "/psci");
+	if (offset < 0)
+		return TRUE;
+
+	method = fdt_getprop(slbench_dtb, offset, "method", &len);
+	if (!method)
+		return TRUE;
+
+	return len == sizeof("smc") && !strncmp(method, "smc", len);
+}
+
+static void slbench_smc(CHAR16 *tcb_name)
+{
+	static const struct slbench_case psci = { L"smc", L"psci-version", NULL, slbench_psci_version };
+	static const struct slbench_case avail = { L"smc", L"sl-available", NULL, slbench_sl_available };
+	EFI_FILE_HANDLE file;
+	EFI_STATUS status;
+	uint64_t ret;
+
+	if (read_currentel().el != 1 || !slbench_has_smc()) {
+		Print(L"SMC is not handled by the firmware, skipping SMC\n");
+		return;
+	}
+
+	Print(L"SMC:\n");
+	slbench_run(&psci, 0);
+
+	if (!tcb_name)
+		return;
+
+	file = FileOpen(slbench_volume, tcb_name);
+	if (!file) {
+		Print(L"Can't open %s, skipping SL\n", tcb_name);
+		return;
+	}
+
+	status = sl_create_data(file, &slbench_smc_data, &slbench_pe_data, &slbench_pe_size,
+				&slbench_arg_data, &slbench_arg_size);
+	FileClose(file);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to prepare data for Secure-Launch: %d\n", status);
+		return;
+	}
+
+	/* Only IS_AVAILABLE is safe to repeat, AUTH can't be undone. */
+	ret = sl_smc(slbench_smc_data, SL_CMD_IS_AVAILABLE, slbench_pe_data, slbench_pe_size,
+		     slbench_arg_data, slbench_arg_size);
+	if (ret) {
+		Print(L"IS_AVAILABLE returned 0x%lx, skipping SL\n", ret);
+		return;
+	}
+
+	slbench_run(&avail, 0);
+}
+
+/*
+ * Results
+ */
+
+static void slbench_puts(EFI_FILE_HANDLE file, CHAR16 *line)
+{
+	UINT8 buf[256];
+	UINTN i;
+
+	for (i = 0; line[i] && i < sizeof(buf); i++)
+		buf[i] = line[i];
+
+	FileWrite(file, buf, i);
+}
+
+static EFI_STATUS slbench_save(CHAR16 *name)
+{
+	CHAR16 line[256];
+	struct slbench_result *r;
+	EFI_FILE_HANDLE file;
+	int i;
+
+	file = FileCreate(slbench_volume, name);
+	if (!file)
+		return EFI_ACCESS_DENIED;
+
+	SPrint(line, sizeof(line), L"# firmware,%s,0x%x\n", ST->FirmwareVendor, ST->FirmwareRevision);
+	slbench_puts(file, line);
+	SPrint(line, sizeof(line), L"# midr,0x%lx\n# ctr,0x%lx\n# clidr,0x%lx\n# dczid,0x%lx\n",
+	       read_sysreg(midr_el1), read_sysreg(ctr_el0), read_sysreg(clidr_el1), read_sysreg(dczid_el0));
+	slbench_puts(file, line);
+	SPrint(line, sizeof(line), L"# cntfrq,%lu\n# el,%d\n", read_sysreg(cntfrq_el0), read_currentel().el);
+	slbench_puts(file, line);
+	slbench_puts(file, L"bench,variant,size,iters,min_ns,avg_ns,max_ns\n");
+
+	for (i = 0; i < slbench_result_cnt; i++) {
+		r = &slbench_results[i];
+		SPrint(line, sizeof(line), L"%s,%s,%lu,%lu,%lu,%lu,%lu\n", r->name, r->variant,
+		       r->size, (UINT64)r->iters, r->min, r->total / r->iters, r->max);
+		slbench_puts(file, line);
+	}
+
+	FileClose(file);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
+{
+	CHAR16 *tcb_name = NULL, *read_name = NULL, *dtb_name = NULL, *dtbo_name = NULL;
+	CHAR16 *out_name = SLBENCH_OUT_DEFAULT;
+	EFI_PHYSICAL_ADDRESS buf;
+	EFI_STATUS status;
+	CHAR16 **argv;
+	INTN argc, i;
+
+	InitializeLib(ImageHandle, SystemTable);
+	argc = GetShellArgcArgv(ImageHandle, &argv);
+
+	Print(L"SL-Bench\n");
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 == argc)
+			goto usage;
+
+		if (!StrCmp(argv[i], L"-n"))
+			slbench_iters = Atoi(argv[++i]);
+		else if (!StrCmp(argv[i], L"-t"))
+			tcb_name = argv[++i];
+		else if (!StrCmp(argv[i], L"-r"))
+			read_name = argv[++i];
+		else if (!StrCmp(argv[i], L"-d"))
+			dtb_name = argv[++i];
+		else if (!StrCmp(argv[i], L"-o"))
+			dtbo_name = argv[++i];
+		else if (!StrCmp(argv[i], L"-f"))
+			out_name = argv[++i];
+		else
+			goto usage;
+	}
+
+	if (!slbench_iters)
+		goto usage;
+
+	/* tcblaunch.exe is the file slbounce reads at boot. */
+	if (!read_name)
+		read_name = tcb_name;
+
+	slbench_volume = GetVolume(ImageHandle);
+	if (!slbench_volume) {
+		Print(L"Getting volume failed.\n");
+		return EFI_INVALID_PARAMETER;
+	}
+
+	status = AllocateZeroPages(2 * SLBENCH_BUF_SIZE / 4096, &buf);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to allocate memory: %d\n", status);
+		return status;
+	}
+	slbench_buf = (UINT8 *)buf;
+
+	Print(L"Running in EL=%d, %lu iterations, cntfrq %lu\n\n", read_currentel().el,
+	      (UINT64)slbench_iters, read_sysreg(cntfrq_el0));
+	Print(L"  %-16s %-12s %9s  %9s %9s %9s\n", L"bench", L"variant", L"size", L"min", L"avg", L"max");
+
+	slbench_mem();
+
+	if (read_name)
+		slbench_file(read_name);
+
+	slbench_fdt(dtb_name, dtbo_name);
+	slbench_smc(tcb_name);
+
+	status = slbench_save(out_name);
+	if (EFI_ERROR(status))
+		Print(L"\nFailed to write %s: %d\n", out_name, status);
+	else
+		Print(L"\nResults written to %s\n", out_name);
+
+	FreePages(buf, 2 * SLBENCH_BUF_SIZE / 4096);
+
+	return EFI_SUCCESS;
+
+usage:
+	Print(L"Usage: slbench.efi [-n iters] [-t tcblaunch.exe] [-r file] [-d dtb]\n"
+	      L"                   [-o dtbo] [-f out.csv]\n\n");
+	return EFI_INVALID_PARAMETER;
+}
@@ -0,0 +1,614 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+#include <efidebug.h>
+
+#include <libfdt.h>
+
+#include <sysreg/currentel.h>
+
+#include "util.h"
+#include "arch.h"
+#include "sl.h"
+#include "dtfixup.h"
+#include "booti.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "pmu.h"
+#include "smclog.h"
+
+#define SZ_2M			(2 * 1024 * 1024)
+
+/*
+ * arm64 Image header.
+ * See Documentation/arch/arm64/booting.rst in Linux.
+ */
+struct booti_header {
+	uint32_t code0;
+	uint32_t code1;
+	uint64_t text_offset;
+	uint64_t image_size;
+	uint64_t flags;
+	uint64_t res2;
+	uint64_t res3;
+	uint64_t res4;
+	uint32_t magic;
+	uint32_t res5;
+} __PACKED;
+
+#define BOOTI_MAGIC		0x644d5241	// 'ARM\x64'
+
+/* Linux wants the dtb within one 2M block */
+#define BOOTI_DTB_MAX		SZ_2M
+
+struct booti_range {
+	uint64_t start;
+	uint64_t size;
+};
+
+/*
+ * Everything we need after the Secure-Launch has to be written
+ * to ram before it, so keep it out of the stack.
+ */
+static struct {
+	uint64_t entry;
+	uint64_t dtb;
+} booti_jump;
+
+/* The kernel, initrd and dtb, as allocated, to give back if we fail. */
+#define BOOTI_ALLOCS		3
+
+static struct {
+	EFI_PHYSICAL_ADDRESS phys;
+	UINT64 pages;
+} booti_allocs[BOOTI_ALLOCS];
+
+static int booti_alloc_cnt;
+
+/**
+ * booti_alloc() - Allocate 2M aligned memory.
+ *
+ * The slack before and after the aligned block is left allocated,
+ * it's going to be usable by the kernel anyway.
+ */
+static EFI_STATUS booti_alloc(UINT64 size, EFI_PHYSICAL_ADDRESS *addr)
+{
+	EFI_PHYSICAL_ADDRESS phys = 0;
+	UINT64 pages = (size + SZ_2M) / 4096 + 1;
+	EFI_STATUS status;
+
+	if (booti_alloc_cnt == BOOTI_ALLOCS)
+		return EFI_OUT_OF_RESOURCES;
+
+	status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiLoaderData, pages, &phys);
+	if (EFI_ERROR(status))
+		return status;
+
+	booti_allocs[booti_alloc_cnt].phys = phys;
+	booti_allocs[booti_alloc_cnt].pages = pages;
+	booti_alloc_cnt++;
+
+	*addr = (phys + SZ_2M - 1) & ~((UINT64)SZ_2M - 1);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * booti_free() - Give back everything booti_alloc() got.
+ */
+static void booti_free(void)
+{
+	while (booti_alloc_cnt) {
+		booti_alloc_cnt--;
+		uefi_call_wrapper(BS->FreePages, 2, booti_allocs[booti_alloc_cnt].phys,
+				  booti_allocs[booti_alloc_cnt].pages);
+	}
+}
+
+static EFI_STATUS booti_load_kernel(EFI_FILE_HANDLE volume, CHAR16 *name, struct booti_range *kernel, uint64_t *entry)
+{
+	struct booti_header hdr;
+	EFI_PHYSICAL_ADDRESS base;
+	EFI_FILE_HANDLE file;
+	EFI_STATUS status;
+	UINT64 size;
+
+	file = FileOpen(volume, name);
+	if (!file) {
+		Print(L"Opening file \"%s\" failed.\n", name);
+		return EFI_NOT_FOUND;
+	}
+
+	size = FileSize(file);
+	if (size < sizeof(hdr) || FileRead(file, (UINT8 *)&hdr, sizeof(hdr)) != sizeof(hdr)) {
+		status = EFI_LOAD_ERROR;
+		goto exit;
+	}
+
+	if (hdr.magic != BOOTI_MAGIC) {
+		Print(L"\"%s\" is not an arm64 Image.\n", name);
+		status = EFI_LOAD_ERROR;
+		goto exit;
+	}
+
+	/* Kernels older than 3.17 don't tell us how much memory they need. */
+	if (!hdr.image_size) {
+		Print(L"Image size is not set in the header.\n");
+		status = EFI_LOAD_ERROR;
+		goto exit;
+	}
+
+	if (hdr.image_size < size) {
+		Print(L"Image is bigger than its header claims.\n");
+		status = EFI_LOAD_ERROR;
+		goto exit;
+	}
+
+	status = booti_alloc(hdr.text_offset + hdr.image_size, &base);
+	if (EFI_ERROR(status))
+		goto exit;
+
+	UINT8 *dst = (UINT8 *)(base + hdr.text_offset);
+
+	CopyMem(dst, &hdr, sizeof(hdr));
+	if (FileRead(file, dst + sizeof(hdr), size - sizeof(hdr)) != size - sizeof(hdr)) {
+		status = EFI_LOAD_ERROR;
+		goto exit;
+	}
+
+	/* The bss and whatever comes after has to be clean too. */
+	SetMem(dst + size, hdr.image_size - size, 0);
+
+	Trace(TRACE_BOOTI_KERNEL, base, hdr.text_offset, hdr.image_size, 0);
+
+	kernel->start = (uint64_t)dst;
+	kernel->size = hdr.image_size;
+	*entry = (uint64_t)dst;
+
+exit:
+	FileClose(file);
+	return status;
+}
+
+static EFI_STATUS booti_load_initrd(EFI_FILE_HANDLE volume, CHAR16 *name, struct booti_range *initrd)
+{
+	EFI_PHYSICAL_ADDRESS base;
+	EFI_FILE_HANDLE file;
+	EFI_STATUS status;
+	UINT64 size;
+
+	file = FileOpen(volume, name);
+	if (!file) {
+		Print(L"Opening file \"%s\" failed.\n", name);
+		return EFI_NOT_FOUND;
+	}
+
+	size = FileSize(file);
+
+	status = booti_alloc(size, &base);
+	if (EFI_ERROR(status))
+		goto exit;
+
+	if (FileRead(file, (UINT8 *)base, size) != size) {
+		status = EFI_LOAD_ERROR;
+		goto exit;
+	}
+
+	Trace(TRACE_BOOTI_INITRD, base, size, 0, 0);
+
+	initrd->start = base;
+	initrd->size = size;
+
+exit:
+	FileClose(file);
+	return status;
+}
+
+static EFI_STATUS booti_load_dtb(EFI_FILE_HANDLE volume, CHAR16 *name, struct booti_range *dtb)
+{
+	EFI_GUID EfiDtbTableGuid = EFI_DTB_TABLE_GUID;
+	EFI_PHYSICAL_ADDRESS base;
+	EFI_FILE_HANDLE file;
+	EFI_STATUS status;
+	VOID *table;
+	UINT64 size;
+	int ret;
+
+	status = booti_alloc(BOOTI_DTB_MAX, &base);
+	if (EFI_ERROR(status))
+		return status;
+
+	if (name) {
+		file = FileOpen(volume, name);
+		if (!file) {
+			Print(L"Opening file \"%s\" failed.\n", name);
+			return EFI_NOT_FOUND;
+		}
+
+		size = FileSize(file);
+		if (size > BOOTI_DTB_MAX || FileRead(file, (UINT8 *)base, size) != size) {
+			FileClose(file);
+			return EFI_LOAD_ERROR;
+		}
+		FileClose(file);
+	} else {
+		/* Use whatever the firmware (or dtbhack) installed. */
+		status = LibGetSystemConfigurationTable(&EfiDtbTableGuid, &table);
+		if (EFI_ERROR(status)) {
+			Print(L"No dtb was given and none is installed.\n");
+			return EFI_NOT_FOUND;
+		}
+
+		size = fdt_totalsize(table);
+		if (size > BOOTI_DTB_MAX)
+			return EFI_LOAD_ERROR;
+
+		CopyMem((VOID *)base, table, size);
+	}
+
+	ret = fdt_check_header((VOID *)base);
+	if (ret) {
+		Print(L"fdt header check failed: %d\n", ret);
+		return EFI_LOAD_ERROR;
+	}
+
+#ifndef SLBOUNCE_NO_DT_FIXUP
+	size = BOOTI_DTB_MAX;
+	status = dtfixup_apply((VOID *)base, &size, EFI_DT_APPLY_FIXUPS | EFI_DT_RESERVE_MEMORY);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to apply EL2 fixups: %d\n", status);
+		return status;
+	}
+#endif
+
+	ret = fdt_open_into((VOID *)base, (VOID *)base, BOOTI_DTB_MAX);
+	if (ret) {
+		Print(L"fdt open failed: %d\n", ret);
+		return EFI_LOAD_ERROR;
+	}
+
+	dtb->start = base;
+	dtb->size = BOOTI_DTB_MAX;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS booti_set_chosen(VOID *fdt, struct booti_range *initrd, char *bootargs)
+{
+	int offset, ret;
+
+	offset = fdt_path_offset(fdt, "/chosen");
+	if (offset < 0)
+		offset = fdt_add_subnode(fdt, 0, "chosen");
+	if (offset < 0)
+		return EFI_LOAD_ERROR;
+
+	ret = fdt_setprop_string(fdt, offset, "bootargs", bootargs);
+	if (ret)
+		return EFI_LOAD_ERROR;
+
+	fdt_delprop(fdt, offset, "linux,initrd-start");
+	fdt_delprop(fdt, offset, "linux,initrd-end");
+
+	if (initrd->size) {
+		ret = fdt_setprop_u64(fdt, offset, "linux,initrd-start", initrd->start);
+		if (ret)
+			return EFI_LOAD_ERROR;
+
+		ret = fdt_setprop_u64(fdt, offset, "linux,initrd-end", initrd->start + initrd->size);
+		if (ret)
+			return EFI_LOAD_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * booti_set_memory() - Describe the usable ram in the dtb.
+ *
+ * Without the EFI stub nobody would tell Linux about the memory map,
+ * so convert it into a memory node. Anything that is not listed there
+ * is left alone by the kernel, so there is no need to reserve it.
+ */
+static EFI_STATUS booti_set_memory(VOID *fdt, EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	EFI_MEMORY_DESCRIPTOR *desc;
+	uint64_t start = 0, end = 0;
+	int offset, ret, i;
+
+	while ((offset = fdt_node_offset_by_prop_value(fdt, -1, "device_type", "memory", sizeof("memory"))) >= 0)
+		fdt_del_node(fdt, offset);
+
+	offset = fdt_add_subnode(fdt, 0, "memory");
+	if (offset < 0)
+		return EFI_LOAD_ERROR;
+
+	ret = fdt_setprop_string(fdt, offset, "device_type", "memory");
+	if (ret)
+		return EFI_LOAD_ERROR;
+
+	for (i = 0; i <= map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+
+		if (i < map_size / desc_size) {
+			switch (desc->Type) {
+			case EfiLoaderCode:
+			case EfiLoaderData:
+			case EfiBootServicesCode:
+			case EfiBootServicesData:
+			case EfiConventionalMemory:
+				break;
+			default:
+				continue;
+			}
+
+			/* Merge adjacent ranges to keep the node small. */
+			if (desc->PhysicalStart == end) {
+				end += desc->NumberOfPages * 4096;
+				continue;
+			}
+		}
+
+		if (end != start) {
+			ret = fdt_appendprop_addrrange(fdt, 0, offset, "reg", start, end - start);
+			if (ret)
+				return EFI_LOAD_ERROR;
+		}
+
+		if (i < map_size / desc_size) {
+			start = desc->PhysicalStart;
+			end = start + desc->NumberOfPages * 4096;
+		}
+	}
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * Only the memory we wrote to needs to survive the Secure-Launch,
+ * unlike the EBS hook we know exactly what it is.
+ */
+static void booti_flush(struct booti_range *ranges, int count)
+{
+	int i;
+
+	pmu_begin(PMU_FLUSH);
+
+	for (i = 0; i < count; ++i)
+		if (ranges[i].size)
+			clear_dcache_range(ranges[i].start, ranges[i].size);
+
+	pmu_end(PMU_FLUSH);
+}
+
+static void booti_find_range(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size,
+			     uint64_t addr, struct booti_range *range)
+{
+	EFI_MEMORY_DESCRIPTOR *desc;
+	int i;
+
+	range->start = addr;
+	range->size = 0;
+
+	for (i = 0; i < map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+
+		if (addr >= desc->PhysicalStart && addr < desc->PhysicalStart + desc->NumberOfPages * 4096) {
+			range->start = desc->PhysicalStart;
+			range->size = desc->NumberOfPages * 4096;
+			return;
+		}
+	}
+}
+
+/**
+ * booti_boot() - Load and boot a raw arm64 Image in EL2.
+ *
+ * Usage: slbounce.efi Image [initrd=FILE] [dtb=FILE] [ARGS...]
+ *
+ * Unlike the EBS hook, we do all the loader's work here: the kernel,
+ * initrd and dtb are placed at 2M aligned addresses, the memory map
+ * is converted to the dtb and only the ranges we wrote are flushed
+ * before the Secure-Launch. The kernel is entered with MMU off and
+ * x0 pointing to the dtb, as per the arm64 boot protocol.
+ */
+EFI_STATUS booti_boot(EFI_HANDLE ImageHandle, EFI_FILE_HANDLE volume, EFI_FILE_HANDLE tcblaunch, INTN argc, CHAR16 **argv)
+{
+	EFI_GUID lipGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+	struct booti_range ranges[6] = { 0 };
+	struct booti_range *kernel = &ranges[0], *initrd = &ranges[1], *dtb = &ranges[2];
+	struct booti_range *self = &ranges[3], *stack = &ranges[4], *jump = &ranges[5];
+	CHAR16 *initrd_name = NULL, *dtb_name = NULL;
+	struct sl_smc_params *smc_data;
+	uint64_t pe_data, pe_size, arg_data, arg_size;
+	EFI_LOADED_IMAGE *loaded_image;
+	EFI_MEMORY_DESCRIPTOR *map = NULL;
+	UINTN map_size, map_alloc, map_key, desc_size;
+	UINT32 desc_version;
+	uint64_t smcret;
+	EFI_STATUS status;
+	char *bootargs;
+	UINTN len = 0;
+	int i, j;
+
+	if (argc < 1)
+		return EFI_INVALID_PARAMETER;
+
+	/* Everything we don't understand goes to the kernel. */
+	for (i = 1; i < argc; ++i)
+		len += StrLen(argv[i]) + 1;
+
+	bootargs = AllocateZeroPool(len + 1);
+	if (!bootargs)
+		return EFI_OUT_OF_RESOURCES;
+
+	for (i = 1, len = 0; i < argc; ++i) {
+		if (!StrnCmp(argv[i], L"initrd=", 7)) {
+			initrd_name = argv[i] + 7;
+			continue;
+		}
+
+		if (!StrnCmp(argv[i], L"dtb=", 4)) {
+			dtb_name = argv[i] + 4;
+			continue;
+		}
+
+		if (len)
+			bootargs[len++] = ' ';
+		for (j = 0; argv[i][j]; ++j)
+			bootargs[len++] = argv[i][j];
+	}
+
+	telemetry_begin(TELEMETRY_CREATE);
+	status = sl_create_data(tcblaunch, &smc_data, &pe_data, &pe_size, &arg_data, &arg_size);
+	telemetry_end(TELEMETRY_CREATE, status);
+	telemetry_import_report(&sl_report);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to prepare data for Secure-Launch: %d\n", status);
+		goto error;
+	}
+
+	telemetry_begin(TELEMETRY_AVAILABLE);
+	smcret = sl_smc(smc_data, SL_CMD_IS_AVAILABLE, pe_data, pe_size, arg_data, arg_size);
+	telemetry_end(TELEMETRY_AVAILABLE, smcret);
+	if (smcret) {
+		Print(L"This device does not support Secure-Launch.\n");
+		status = EFI_UNSUPPORTED;
+		goto error;
+	}
+
+	telemetry_begin(TELEMETRY_BOOTI);
+
+	status = booti_load_kernel(volume, argv[0], kernel, &booti_jump.entry);
+	if (EFI_ERROR(status))
+		goto error;
+
+	if (initrd_name) {
+		status = booti_load_initrd(volume, initrd_name, initrd);
+		if (EFI_ERROR(status))
+			goto error;
+	}
+
+	status = booti_load_dtb(volume, dtb_name, dtb);
+	if (EFI_ERROR(status))
+		goto error;
+
+	booti_jump.dtb = dtb->start;
+
+	status = booti_set_chosen((VOID *)dtb->start, initrd, bootargs);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to update /chosen\n");
+		goto error;
+	}
+
+	/* Our own code and data are used after the Secure-Launch too. */
+	status = uefi_call_wrapper(BS->HandleProtocol, 3, ImageHandle, &lipGuid, (void **)&loaded_image);
+	if (EFI_ERROR(status))
+		goto error;
+
+	self->start = (uint64_t)loaded_image->ImageBase;
+	self->size = loaded_image->ImageSize;
+
+	jump->start = (uint64_t)&booti_jump;
+	jump->size = sizeof(booti_jump);
+
+	map_size = 0;
+	status = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, NULL, &map_key, &desc_size, &desc_version);
+	if (status != EFI_BUFFER_TOO_SMALL)
+		goto error;
+
+	/* Leave some room for the changes our allocation causes. */
+	map_alloc = map_size + 8 * desc_size;
+	map = AllocatePool(map_alloc);
+	if (!map) {
+		status = EFI_OUT_OF_RESOURCES;
+		goto error;
+	}
+
+	telemetry_end(TELEMETRY_BOOTI, 0);
+
+#ifdef EFI_DEBUG
+	trace_dump();
+#endif
+
+#ifdef SLBOUNCE_SMC_REPLAY
+	smclog_replay_report();
+#endif
+
+	Print(L"Booting the kernel in EL2...\n");
+
+	/*
+	 * Nothing can allocate memory between GetMemoryMap() and EBS,
+	 * so if EBS fails, we have to redo the whole thing.
+	 */
+	for (i = 0; i < 2; ++i) {
+		map_size = map_alloc;
+		status = uefi_call_wrapper(BS->GetMemoryMap, 5, &map_size, map, &map_key, &desc_size, &desc_version);
+		if (EFI_ERROR(status))
+			goto error;
+
+		status = booti_set_memory((VOID *)dtb->start, map, map_size, desc_size);
+		if (EFI_ERROR(status))
+			goto error;
+
+		booti_find_range(map, map_size, desc_size, (uint64_t)&status, stack);
+
+		telemetry_begin(TELEMETRY_FLUSH);
+		booti_flush(ranges, sizeof(ranges) / sizeof(ranges[0]));
+		telemetry_end(TELEMETRY_FLUSH, 0);
+
+		telemetry_begin(TELEMETRY_EBS);
+		pmu_begin(PMU_EBS);
+		status = uefi_call_wrapper(BS->ExitBootServices, 2, ImageHandle, map_key);
+		pmu_end(PMU_EBS);
+		telemetry_end(TELEMETRY_EBS, status);
+		Trace(TRACE_EBS, status, 0, 0, 0);
+		if (!EFI_ERROR(status))
+			break;
+	}
+
+	if (EFI_ERROR(status))
+		goto error;
+
+	telemetry_begin(TELEMETRY_AUTH);
+	smcret = sl_smc(smc_data, SL_CMD_AUTH, pe_data, pe_size, arg_data, arg_size);
+	telemetry_end(TELEMETRY_AUTH, smcret);
+	if (smcret) {
+		telemetry_sync(); /* For the boot history. */
+		psci_reboot();
+	}
+
+	/* We set a special longjmp point here in hopes SL gets us back. */
+	if (tb_setjmp(tb_jmp_buf) == 0) {
+		clear_dcache_range((uint64_t)tb_jmp_buf, 8*21);
+		telemetry_begin(TELEMETRY_LAUNCH);
+		telemetry_sync();
+		trace_sync();
+		smcret = sl_smc(smc_data, SL_CMD_LAUNCH, pe_data, pe_size, arg_data, arg_size);
+		if (smcret) {
+			telemetry_end(TELEMETRY_LAUNCH, smcret);
+			telemetry_sync();
+			psci_reboot(); /* Indicate a fatal error with a reboot. */
+		}
+	}
+
+	telemetry_end(TELEMETRY_LAUNCH, read_currentel().el);
+	pmu_stop(); /* Don't leave our counters to the kernel. */
+	telemetry_sync();
+	Trace(TRACE_EL2, read_currentel().el, 0, 0, 0);
+	trace_sync();
+
+	booti_enter(booti_jump.entry, booti_jump.dtb);
+
+error:
+	if (map)
+		FreePool(map);
+	booti_free();
+	FreePool(bootargs);
+
+	return status;
+}
@@ -0,0 +1,8 @@
+#ifndef BOOTI_H
+#define BOOTI_H
+
+#include <efi.h>
+
+EFI_STATUS booti_boot(EFI_HANDLE ImageHandle, EFI_FILE_HANDLE volume, EFI_FILE_HANDLE tcblaunch, INTN argc, CHAR16 **argv);
+
+#endif
@@ -7,7 +7,6 @@
 #include <efilib.h>
 #include <efidebug.h>
 
-#include <libfdt.h>
 #include <string.h>
 
 #include <sysreg/currentel.h>
@@ -15,13 +14,41 @@
 #include "util.h"
 #include "arch.h"
 #include "sl.h"
+#include "dtfixup.h"
+#include "booti.h"
+#include "flush.h"
+#include "dirty.h"
+#include "idmap.h"
+#include "verify.h"
+#include "tune.h"
+#include "dtq.h"
+#include "capture.h"
+#include "resmem.h"
+#include "smclog.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "history.h"
+#include "pmu.h"
+#include "initrd.h"
+
+/* Prepared in sl_install() so EBS only has to walk the dtb. */
+static struct dtq_query sl_el2_queries[] = {
+	/* Set by our overlays, by dtbhack.efi or our EFI_DT_FIXUP_PROTOCOL. */
+	{ .path = "/chosen", .prop = "dtbhack-el2-overlay" },
+	{ .compatible = "qcom,adreno", .name = "zap-shader", .prop = "status" },
+};
+
+#define SL_EL2_QUERIES		(sizeof(sl_el2_queries) / sizeof(sl_el2_queries[0]))
 
 /**
  * sl_is_allowed_by_fdt() - Check if dtb is configured for el2.
  *
  * Check if the currently loaded dtb has zap shader explicitly
  * disabled, which is a common enough heuristic for WoA devices
- * as the zap register is otherwise protected.
+ * as the zap register is otherwise protected. A dtb with our EL2
+ * overlay applied is always usable.
+ *
+ * This runs in EBS, so the lookup is done with dtq instead of libfdt.
  *
  * Returns:
  *  - EFI_SUCCESS     if the dtb is usable in EL2.
@@ -30,9 +57,8 @@
 EFI_STATUS sl_is_allowed_by_fdt(void)
 {
 	EFI_GUID EfiDtbTableGuid = EFI_DTB_TABLE_GUID;
-	const char *prop_status;
+	struct dtq_query *el2 = &sl_el2_queries[0], *zap = &sl_el2_queries[1];
 	EFI_STATUS status;
-	int ret, offset;
 	void *dtb;
 
 #ifdef SLBOUNCE_ALWAYS_SWITCH
@@ -43,29 +69,26 @@ EFI_STATUS sl_is_allowed_by_fdt(void)
 	if (EFI_ERROR(status))
 		return EFI_UNSUPPORTED;
 
-	ret = fdt_check_header(dtb);
-	if (ret)
-		return EFI_UNSUPPORTED;
-
-	offset = fdt_node_offset_by_compatible(dtb, 0, "qcom,adreno");
-	if (offset <= 0)
+	if (dtq_run(dtb, sl_el2_queries, SL_EL2_QUERIES))
 		return EFI_UNSUPPORTED;
 
-	offset = fdt_subnode_offset(dtb, offset, "zap-shader");
-	if (offset <= 0)
-		return EFI_UNSUPPORTED;
+	/* The EL2 fixups were done already, no need to guess. */
+	if (el2->value)
+		return EFI_SUCCESS;
 
-	prop_status = fdt_getprop(dtb, offset, "status", &ret);
-	if (!prop_status || ret <= 0)
+	if (!zap->value || zap->len <= 0)
 		return EFI_UNSUPPORTED;
 
-	if (!strncmp(prop_status, "disabled", ret))
+	if (!strncmp(zap->value, "disabled", zap->len))
 		return EFI_SUCCESS;
 
 	return EFI_UNSUPPORTED;
 
 }
 
+/* Stack around the EBS hook frame that is not verified. */
+#define SL_VERIFY_STACK		(64 * 1024)
+
 static struct sl_smc_params *smc_data;
 static uint64_t pe_data, pe_size, arg_data, arg_size;
 
@@ -94,9 +117,26 @@ EFI_STATUS sl_GetMemoryMap(UINTN *MemoryMapSize, EFI_MEMORY_DESCRIPTOR *MemoryMa
 EFI_STATUS sl_ExitBootServices(EFI_HANDLE ImageHandle, UINTN MapKey)
 {
 	uint64_t smcret = 0;
+	EFI_STATUS status;
 
-	if (sl_is_allowed_by_fdt() != EFI_SUCCESS)
-		return uefi_call_wrapper(real_ExitBootServices, 2, ImageHandle, MapKey);
+	telemetry_begin(TELEMETRY_EBS_HOOK);
+	Trace(TRACE_EBS_HOOK, MapKey, 0, 0, 0);
+
+	telemetry_begin(TELEMETRY_POLICY);
+	status = sl_is_allowed_by_fdt();
+	telemetry_end(TELEMETRY_POLICY, status);
+
+	if (status != EFI_SUCCESS) {
+		telemetry_begin(TELEMETRY_EBS);
+		pmu_begin(PMU_EBS);
+		status = uefi_call_wrapper(real_ExitBootServices, 2, ImageHandle, MapKey);
+		pmu_end(PMU_EBS);
+		telemetry_end(TELEMETRY_EBS, status);
+		telemetry_end(TELEMETRY_EBS_HOOK, status);
+		if (!EFI_ERROR(status))
+			pmu_stop();
+		return status;
+	}
 
 	/*
 	 * Unfortunately switching to EL2 will corrupt the caches and
@@ -106,68 +146,180 @@ EFI_STATUS sl_ExitBootServices(EFI_HANDLE ImageHandle, UINTN MapKey)
 	 * doesn't break.
 	 *
 	 * We can't possibly know which memory was touched by the loader
-	 * so we just flush everything that was allocated here. This
+	 * so we just flush everything that was allocated here, except
+	 * for the ranges we've written and cleaned ourselves. This
 	 * is suboptimal but would hopefully make sure we don't crash.
+	 * With SLBOUNCE_DIRTY the hardware narrows it down to the
+	 * pages written since sl_install().
 	 *
 	 * Note that if we try to flush caches on hyp-owned memory, we
 	 * will also crash. Thus we perform AUTH command after we flushed
 	 * all the cache.
 	 */
 
-	EFI_MEMORY_DESCRIPTOR *MemoryEntry;
-	for (int i = 0; i < LastMemoryMapSize / LastDescriptorSize; ++i) {
-		MemoryEntry = (EFI_MEMORY_DESCRIPTOR*)((UINT8*)LastMemoryMap + LastDescriptorSize * i);
-		uint64_t start = MemoryEntry->PhysicalStart;
-		uint64_t size  = MemoryEntry->NumberOfPages * 4096;
-
-		switch (MemoryEntry->Type) {
-		case EfiLoaderCode:
-		case EfiLoaderData:
-		case EfiBootServicesCode:
-		case EfiBootServicesData:
-		case EfiRuntimeServicesCode:
-		case EfiRuntimeServicesData:
-		case EfiACPIReclaimMemory:
-			clear_dcache_range(start, size);
-			break;
-		}
-	}
+#ifdef SLBOUNCE_CAPTURE
+	capture_memory_map(LastMemoryMap, LastMemoryMapSize, LastDescriptorSize);
+#endif
 
-	EFI_STATUS status = uefi_call_wrapper(real_ExitBootServices, 2, ImageHandle, MapKey);
-	if (EFI_ERROR(status))
+#ifdef SLBOUNCE_TUNE
+	tune_report(LastMemoryMap, LastMemoryMapSize, LastDescriptorSize);
+#endif
+
+	telemetry_begin(TELEMETRY_FLUSH);
+	flush_memory_map(LastMemoryMap, LastMemoryMapSize, LastDescriptorSize);
+	telemetry_end(TELEMETRY_FLUSH, 0);
+
+#ifdef SLBOUNCE_CAPTURE
+	capture_finish();
+#endif
+
+#ifdef SLBOUNCE_SMC_REPLAY
+	smclog_replay_report(); /* The last chance to print. */
+#endif
+
+	telemetry_begin(TELEMETRY_EBS);
+	pmu_begin(PMU_EBS);
+	status = uefi_call_wrapper(real_ExitBootServices, 2, ImageHandle, MapKey);
+	pmu_end(PMU_EBS);
+	telemetry_end(TELEMETRY_EBS, status);
+	Trace(TRACE_EBS, status, 0, 0, 0);
+	if (EFI_ERROR(status)) {
+		telemetry_end(TELEMETRY_EBS_HOOK, status);
 		return status;
+	}
+
+#ifdef SLBOUNCE_VERIFY
+	/*
+	 * After the real EBS, so the sums include what its handlers wrote
+	 * after our flush: if that is lost in the switch, the chunk won't
+	 * match. Before AUTH hands the SL buffers to the hypervisor. Our
+	 * stack and those buffers are written during the switch, don't
+	 * count them. No boot services are needed for this.
+	 */
+	verify_exclude((uint64_t)__builtin_frame_address(0) - SL_VERIFY_STACK, 2 * SL_VERIFY_STACK);
+	verify_exclude((uint64_t)smc_data, sizeof(*smc_data));
+	verify_exclude(pe_data, pe_size);
+	verify_exclude(arg_data, arg_size);
+	verify_sum(LastMemoryMap, LastMemoryMapSize, LastDescriptorSize);
+#endif
 
+	telemetry_begin(TELEMETRY_AUTH);
 	smcret = sl_smc(smc_data, SL_CMD_AUTH, pe_data, pe_size, arg_data, arg_size);
-	if (smcret)
+	telemetry_end(TELEMETRY_AUTH, smcret);
+	if (smcret) {
+		telemetry_sync(); /* For the boot history. */
 		psci_reboot();
+	}
 
 	/* We set a special longjmp point here in hopes SL gets us back. */
 	if (tb_setjmp(tb_jmp_buf) == 0) {
 		clear_dcache_range((uint64_t)tb_jmp_buf, 8*21);
+		telemetry_begin(TELEMETRY_LAUNCH);
+		telemetry_sync();
+		trace_sync();
 		smcret = sl_smc(smc_data, SL_CMD_LAUNCH, pe_data, pe_size, arg_data, arg_size);
-		if (smcret)
+		if (smcret) {
+			telemetry_end(TELEMETRY_LAUNCH, smcret);
+			telemetry_sync();
 			psci_reboot(); /* Indicate a fatal error with a reboot. */
+		}
 	}
 
+	telemetry_end(TELEMETRY_LAUNCH, read_currentel().el);
+	telemetry_end(TELEMETRY_EBS_HOOK, status);
+#ifdef SLBOUNCE_VERIFY
+	verify_check();
+#endif
+	pmu_stop(); /* Don't leave our counters to the OS. */
+	telemetry_sync();
+	Trace(TRACE_EL2, read_currentel().el, 0, 0, 0);
+	trace_sync();
+
 	return status;
 }
 
+#ifdef SLBOUNCE_TUNE
+/**
+ * sl_tune() - Pick the cheapest safe flush strategy for this device.
+ *
+ * The prediction is for the current memory map, the loader will
+ * change it, so it's done again for the final one in the EBS hook.
+ */
+static EFI_STATUS sl_tune(void)
+{
+	EFI_MEMORY_DESCRIPTOR *map;
+	UINTN count, key, desc_size;
+	UINT32 desc_ver;
+	EFI_STATUS status;
+
+	status = tune_init();
+	if (EFI_ERROR(status))
+		return status;
+
+	map = LibMemoryMap(&count, &key, &desc_size, &desc_ver);
+	if (!map)
+		return EFI_OUT_OF_RESOURCES;
+
+	flush_set_strategy(tune_pick(map, count * desc_size, desc_size));
+
+	FreePool(map);
+
+	return EFI_SUCCESS;
+}
+#endif
+
+#ifdef SLBOUNCE_DIRTY
+/**
+ * sl_dirty_start() - Have the EBS flush skip memory that wasn't written.
+ *
+ * The memory the EBS flush would cover is cleaned once here, after
+ * the tracking was started, so the writes before it are not lost.
+ * The map is taken before, so that cleaning it is tracked too.
+ */
+static EFI_STATUS sl_dirty_start(void)
+{
+	EFI_MEMORY_DESCRIPTOR *map;
+	UINTN count, key, desc_size;
+	UINT32 desc_ver;
+	EFI_STATUS status;
+
+	map = LibMemoryMap(&count, &key, &desc_size, &desc_ver);
+	if (!map)
+		return EFI_OUT_OF_RESOURCES;
+
+	status = dirty_start();
+	if (!EFI_ERROR(status))
+		flush_clean_memory_map(map, count * desc_size, desc_size);
+
+	FreePool(map);
+
+	return status;
+}
+#endif
+
 EFI_STATUS sl_install(EFI_FILE_HANDLE tcblaunch)
 {
 	EFI_STATUS ret = EFI_SUCCESS;
 	uint64_t smcret = 0;
 
+#ifdef SLBOUNCE_SMCLOG
+	ret = smclog_record_init();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to set up the SMC log: %d\n", ret);
+#endif
+
+	telemetry_begin(TELEMETRY_CREATE);
 	ret = sl_create_data(tcblaunch, &smc_data, &pe_data, &pe_size, &arg_data, &arg_size);
+	telemetry_end(TELEMETRY_CREATE, ret);
+	telemetry_import_report(&sl_report);
 	if (EFI_ERROR(ret)) {
 		Print(L"Failed to prepare data for Secure-Launch: %d\n", ret);
 		return ret;
 	}
 
-	Dbg(L"Data creation is done. Trying to prepare Secure-Launch...\n");
-
-	Dbg(L" == Available: ");
+	telemetry_begin(TELEMETRY_AVAILABLE);
 	smcret = sl_smc(smc_data, SL_CMD_IS_AVAILABLE, pe_data, pe_size, arg_data, arg_size);
-	Dbg(L"0x%x\n", smcret);
+	telemetry_end(TELEMETRY_AVAILABLE, smcret);
 	if (smcret) {
 		Print(L"This device does not support Secure-Launch.\n");
 		return EFI_UNSUPPORTED;
@@ -188,9 +340,156 @@ EFI_STATUS sl_install(EFI_FILE_HANDLE tcblaunch)
 	real_GetMemoryMap = BS->GetMemoryMap;
 	BS->GetMemoryMap = sl_GetMemoryMap;
 
+	dtq_prepare(sl_el2_queries, SL_EL2_QUERIES);
+
+#ifdef EFI_DEBUG
+	trace_dump();
+#endif
+
+#ifdef SLBOUNCE_CAPTURE
+	ret = capture_init();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to set up the memory map capture: %d\n", ret);
+#endif
+
+#ifndef SLBOUNCE_NO_DT_FIXUP
+	/*
+	 * Loaders that finalize the dtb via EFI_DT_FIXUP_PROTOCOL
+	 * get the EL2 overlay and fixups applied in memory.
+	 */
+	ret = dtfixup_install();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to install DT fixup protocol: %d\n", ret);
+#endif
+
+#ifdef SLBOUNCE_TUNE
+	ret = sl_tune();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to tune the flush, using the default: %d\n", ret);
+#endif
+
+#ifdef SLBOUNCE_DIRTY
+	/* Last, so that our own setup doesn't count as dirty. */
+	ret = sl_dirty_start();
+	if (EFI_ERROR(ret))
+		Print(L"Dirty tracking is not available, will flush everything: %d\n", ret);
+#endif
+
 	return EFI_SUCCESS;
 }
 
+#ifdef SLBOUNCE_TRACE
+/**
+ * sl_trace_init() - Record the trace into a reserved-memory region.
+ *
+ * Same as the other regions, the OS finds it in /reserved-memory or
+ * as TRACE_GUID config table.
+ */
+static EFI_STATUS sl_trace_init(void)
+{
+	EFI_GUID TraceGuid = TRACE_GUID;
+	EFI_STATUS status;
+	VOID *data;
+
+	status = resmem_alloc("slbounce-trace", TRACE_COMPATIBLE, TRACE_SIZE, &TraceGuid, &data);
+	if (EFI_ERROR(status))
+		return status;
+
+	return trace_start(data, TRACE_SIZE);
+}
+#endif
+
+#ifdef SLBOUNCE_VERIFY
+/**
+ * sl_verify_init() - Set up checking the EBS flush for misses.
+ *
+ * Our own image is written during the switch (the jump buffer, the
+ * counters), so it is not checked.
+ */
+static EFI_STATUS sl_verify_init(EFI_HANDLE ImageHandle)
+{
+	EFI_GUID lipGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+	EFI_LOADED_IMAGE *loaded_image;
+	EFI_STATUS status;
+
+	status = verify_init();
+	if (EFI_ERROR(status))
+		return status;
+
+	status = uefi_call_wrapper(BS->HandleProtocol, 3, ImageHandle, &lipGuid, (void **)&loaded_image);
+	if (EFI_ERROR(status))
+		return status;
+
+	verify_exclude((uint64_t)loaded_image->ImageBase, loaded_image->ImageSize);
+
+	return EFI_SUCCESS;
+}
+#endif
+
+#ifdef SLBOUNCE_IDMAP
+/**
+ * sl_idmap_init() - Prepare the block-mapped identity map for the flush.
+ *
+ * Our image runs while the tables are switched, so the firmware's
+ * mapping of it is kept.
+ */
+static EFI_STATUS sl_idmap_init(EFI_HANDLE ImageHandle)
+{
+	EFI_GUID lipGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+	EFI_LOADED_IMAGE *loaded_image;
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(BS->HandleProtocol, 3, ImageHandle, &lipGuid, (void **)&loaded_image);
+	if (EFI_ERROR(status))
+		return status;
+
+	status = idmap_init();
+	if (EFI_ERROR(status))
+		return status;
+
+	idmap_exclude((uint64_t)loaded_image->ImageBase, loaded_image->ImageSize);
+
+	return EFI_SUCCESS;
+}
+#endif
+
+#ifdef SLBOUNCE_SMC_REPLAY
+/**
+ * sl_replay_load() - Answer SMCs from smclog.bin instead of the firmware.
+ *
+ * For running under an emulator with a log recorded on a device,
+ * the calls take as long as they did there.
+ */
+static EFI_STATUS sl_replay_load(EFI_FILE_HANDLE volume)
+{
+	EFI_FILE_HANDLE file;
+	EFI_STATUS ret;
+	UINT64 size;
+	UINT8 *log;
+
+	file = FileOpen(volume, L"smclog.bin");
+	if (!file)
+		return EFI_NOT_FOUND;
+
+	size = FileSize(file);
+	log = AllocatePool(size);
+	if (!log) {
+		FileClose(file);
+		return EFI_OUT_OF_RESOURCES;
+	}
+
+	if (FileRead(file, log, size) != size)
+		ret = EFI_LOAD_ERROR;
+	else
+		ret = smclog_replay_init(log, size, TRUE);
+
+	FileClose(file);
+	if (EFI_ERROR(ret))
+		FreePool(log);
+
+	return ret;
+}
+#endif
 
 EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
@@ -210,29 +509,97 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 		return EFI_UNSUPPORTED;
 	}
 
+	ret = history_load();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to read the boot history: %d\n", ret);
+
+	ret = telemetry_init();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to set up the telemetry: %d\n", ret);
+
+	telemetry_begin(TELEMETRY_LOAD);
+	pmu_start();
+
+	ret = history_save(telemetry_get());
+	if (EFI_ERROR(ret))
+		Print(L"Failed to write the boot history: %d\n", ret);
+
+#ifdef SLBOUNCE_TRACE
+	ret = sl_trace_init();
+	if (EFI_ERROR(ret))
+		Print(L"Failed to set up the trace: %d\n", ret);
+#endif
+
+#ifdef SLBOUNCE_VERIFY
+	ret = sl_verify_init(ImageHandle);
+	if (EFI_ERROR(ret))
+		Print(L"Failed to set up the flush verification: %d\n", ret);
+#endif
+
+#ifdef SLBOUNCE_IDMAP
+	ret = sl_idmap_init(ImageHandle);
+	if (EFI_ERROR(ret))
+		Print(L"Can't block-map the flush, using the firmware's tables: %d\n", ret);
+#endif
+
 	volume = GetVolume(ImageHandle);
 	if (!volume) {
 		Print(L"Getting volume failed.\n");
+		pmu_stop();
 		return EFI_INVALID_PARAMETER;
 	}
 
 	file = FileOpen(volume, L"tcblaunch.exe");
 	if (!file) {
 		Print(L"Opening file \"tcblaunch.exe\" failed.\n");
+		pmu_stop();
 		return EFI_INVALID_PARAMETER;
 	}
 
+#ifdef SLBOUNCE_SMC_REPLAY
+	ret = sl_replay_load(volume);
+	if (EFI_ERROR(ret)) {
+		Print(L"Loading \"smclog.bin\" failed with %d\n", ret);
+		pmu_stop();
+		return ret;
+	}
+#endif
+
+	/* With a kernel in arguments we are asked to boot it ourselves. */
+	if (argc > 1 && StrnCmp(argv[1], L"initrd=", 7)) {
+		/* Only returns if it failed. */
+		ret = booti_boot(ImageHandle, volume, file, argc - 1, argv + 1);
+		pmu_stop();
+		return ret;
+	}
+
 	ret = sl_install(file);
 	if (EFI_ERROR(ret)) {
 		Print(L"Installing SL hook failed with %d\n", ret);
+		pmu_stop();
 		return ret;
 	}
 
+	if (argc > 1) {
+		/* The hooks are in place, so we must stay loaded anyway. */
+		ret = initrd_install(volume, argv[1] + 7);
+		if (EFI_ERROR(ret)) {
+			Print(L"Installing initrd provider failed with %d\n", ret);
+			ret = EFI_SUCCESS;
+		}
+	}
+
+#ifdef SLBOUNCE_SMC_REPLAY
+	smclog_replay_report();
+#endif
+
 	Print(L"===[ slbounce ]==================================\n");
 	Print(L" BS->ExitBootServices() was replaced with a hook\n");
 	Print(L"  that would perform Secure-Launch right after\n");
 	Print(L"exiting UEFI. Your system will crash if SL fails.\n");
 	Print(L"=================================================\n");
 
+	telemetry_end(TELEMETRY_LOAD, ret);
+
 	return ret;
 }
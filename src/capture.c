@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "arch.h"
+#include "dtq.h"
+#include "resmem.h"
+#include "capture.h"
+
+static struct capture_header *capture = NULL;
+
+static struct dtq_query capture_model_query = {
+	.path = "/",
+	.prop = "model",
+};
+
+static inline VOID *capture_ptr(uint32_t offset)
+{
+	return (UINT8 *)capture + offset;
+}
+
+/**
+ * capture_init() - Allocate the capture region.
+ *
+ * The region is described in /reserved-memory of the dtbs that go
+ * through our EFI_DT_FIXUP_PROTOCOL and installed as CAPTURE_GUID
+ * config table, so it can be found after boot.
+ */
+EFI_STATUS capture_init(void)
+{
+	EFI_GUID CaptureGuid = CAPTURE_GUID;
+	EFI_STATUS status;
+	VOID *data;
+
+	status = resmem_alloc("slbounce-capture", CAPTURE_COMPATIBLE, CAPTURE_SIZE, &CaptureGuid, &data);
+	if (EFI_ERROR(status))
+		return status;
+
+	capture = data;
+	capture->magic = CAPTURE_MAGIC;
+	capture->version = CAPTURE_VERSION;
+	capture->size = sizeof(*capture);
+	capture->freq = read_sysreg(cntfrq_el0);
+	capture->line_size = dcache_line_size();
+
+	dtq_prepare(&capture_model_query, 1);
+
+	Dbg(L"Capturing the EBS memory map to 0x%lx\n", (uint64_t)capture);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * capture_memory_map() - Record the final memory map, start of the flush.
+ *
+ * Ranges are recorded after the map, so this resets them as well in
+ * case EBS is retried.
+ */
+void capture_memory_map(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	EFI_GUID EfiDtbTableGuid = EFI_DTB_TABLE_GUID;
+	UINTN count = map_size / desc_size;
+	UINTN room;
+	VOID *dtb;
+	int i;
+
+	if (!capture)
+		return;
+
+	room = (CAPTURE_SIZE - sizeof(*capture)) / 2 / desc_size;
+	if (count > room) {
+		capture->map_dropped = count - room;
+		count = room;
+	} else {
+		capture->map_dropped = 0;
+	}
+
+	capture->desc_size = desc_size;
+	capture->map_offset = sizeof(*capture);
+	capture->map_count = count;
+	CopyMem(capture_ptr(capture->map_offset), map, count * desc_size);
+
+	capture->range_offset = (capture->map_offset + count * desc_size + 7) & ~7;
+	capture->range_count = 0;
+	capture->range_dropped = 0;
+	capture->size = capture->range_offset;
+
+	capture->model[0] = '\0';
+	if (!EFI_ERROR(LibGetSystemConfigurationTable(&EfiDtbTableGuid, &dtb)) &&
+	    !dtq_run(dtb, &capture_model_query, 1) && capture_model_query.value) {
+		const char *model = capture_model_query.value;
+
+		for (i = 0; i < sizeof(capture->model) - 1 && i < capture_model_query.len && model[i]; i++)
+			capture->model[i] = model[i];
+		capture->model[i] = '\0';
+	}
+
+	capture->flush_start = arch_counter();
+}
+
+/**
+ * capture_add_range() - Record one flushed range and how long it took.
+ */
+void capture_add_range(uint64_t start, uint64_t size, uint64_t ticks, uint32_t type)
+{
+	struct capture_range *r;
+
+	if (!capture || !capture->range_offset)
+		return;
+
+	if (capture->size + sizeof(*r) > CAPTURE_SIZE) {
+		capture->range_dropped++;
+		return;
+	}
+
+	r = capture_ptr(capture->size);
+	r->start = start;
+	r->size = size;
+	r->ticks = ticks;
+	r->type = type;
+	r->pad = 0;
+
+	capture->range_count++;
+	capture->size += sizeof(*r);
+}
+
+/**
+ * capture_finish() - End of the flush, push the capture to memory.
+ *
+ * The region is not part of the memory map flush, so it has to be
+ * cleaned here, after the last write.
+ */
+void capture_finish(void)
+{
+	if (!capture)
+		return;
+
+	capture->flush_end = arch_counter();
+	clear_dcache_range((uint64_t)capture, capture->size);
+}
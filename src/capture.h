@@ -0,0 +1,56 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+
+/*
+ * EBS-time memory map and flush plan, left in a reserved-memory
+ * region for the OS. The layout is shared with tools/flushmodel.c,
+ * which builds with CAPTURE_FORMAT_ONLY.
+ */
+
+#define CAPTURE_MAGIC		0x50414d4d42534c53ull	// 'SLBMMAP'
+#define CAPTURE_VERSION		1
+#define CAPTURE_SIZE		(128 * 1024)
+#define CAPTURE_COMPATIBLE	"slbounce,capture"
+
+#define CAPTURE_GUID \
+    { 0x8a1f3d52, 0x6b0e, 0x4c57, {0x9d, 0x2a, 0x41, 0x7e, 0xc3, 0x05, 0x9b, 0x66} }
+
+struct capture_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t size;			/* Bytes used, including the header. */
+	uint64_t freq;			/* cntfrq_el0 */
+	uint32_t line_size;		/* D-cache line size used for the flush. */
+	uint32_t desc_size;		/* EFI_MEMORY_DESCRIPTOR size. */
+	uint32_t map_offset;		/* From the header, descriptors as given by the firmware. */
+	uint32_t map_count;
+	uint32_t map_dropped;		/* Descriptors that didn't fit. */
+	uint32_t range_offset;		/* From the header, struct capture_range[]. */
+	uint32_t range_count;
+	uint32_t range_dropped;		/* Ranges that didn't fit. */
+	uint64_t flush_start;		/* cntvct_el0 */
+	uint64_t flush_end;
+	char model[64];			/* Root "model" of the dtb, if any. */
+};
+
+/* One clear_dcache_range() call of the EBS flush. */
+struct capture_range {
+	uint64_t start;
+	uint64_t size;
+	uint64_t ticks;
+	uint32_t type;			/* EFI memory type the range came from. */
+	uint32_t pad;
+};
+
+#ifndef CAPTURE_FORMAT_ONLY
+#include <efi.h>
+
+EFI_STATUS capture_init(void);
+void capture_memory_map(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+void capture_add_range(uint64_t start, uint64_t size, uint64_t ticks, uint32_t type);
+void capture_finish(void);
+#endif
+
+#endif
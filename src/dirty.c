@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "arch.h"
+#include "trace.h"
+#include "dirty.h"
+
+#ifdef SLBOUNCE_DIRTY
+
+/* Stage 1 descriptors, 4K granule. */
+#define PTE_VALID		(1ull << 0)
+#define PTE_TABLE		(1ull << 1)	/* A page at level 3. */
+#define PTE_ATTRINDX(pte)	(((pte) >> 2) & 0x7)
+#define PTE_RDONLY		(1ull << 7)	/* AP[2] */
+#define PTE_AF			(1ull << 10)
+#define PTE_DBM			(1ull << 51)
+#define PTE_ADDR_MASK		0x0000fffffffff000ull
+
+#define TCR_T0SZ(tcr)		((tcr) & 0x3f)
+#define TCR_EPD0		(1ull << 7)
+#define TCR_TG0(tcr)		(((tcr) >> 14) & 0x3)
+#define TCR_TG0_4K		0
+
+#define TTBR_BADDR_MASK		0x0000fffffffffffeull
+
+#define DIRTY_LEVEL_SHIFT(l)	(12 + 9 * (3 - (l)))
+
+typedef void (*dirty_leaf_fn)(uint64_t *pte, uint64_t va, uint64_t size);
+
+static BOOLEAN dirty_on = FALSE;
+static uint64_t *dirty_root;
+static int dirty_root_level;
+static uint64_t dirty_va_end;
+static uint64_t dirty_mair;
+
+/**
+ * dirty_visit() - Call @fn for every leaf entry mapping [start, end).
+ * @table: Translation table at @level, covering VAs from @base.
+ *
+ * The tables are identity mapped, so they are accessed directly.
+ */
+static void dirty_visit(uint64_t *table, int level, uint64_t base,
+			uint64_t start, uint64_t end, dirty_leaf_fn fn)
+{
+	uint64_t shift = DIRTY_LEVEL_SHIFT(level);
+	uint64_t size = 1ull << shift;
+	uint64_t idx = (start - base) >> shift;
+	uint64_t va, pte;
+
+	for (va = base + (idx << shift); va < end; va += size, idx++) {
+		pte = table[idx];
+		if (!(pte & PTE_VALID))
+			continue;
+
+		if (level < 3 && (pte & PTE_TABLE))
+			dirty_visit((uint64_t *)(pte & PTE_ADDR_MASK), level + 1, va,
+				    va > start ? va : start, va + size < end ? va + size : end, fn);
+		else if (level > 0 && (level < 3 || (pte & PTE_TABLE)))
+			fn(&table[idx], va, size);
+	}
+}
+
+static BOOLEAN dirty_is_normal(uint64_t pte)
+{
+	/* Device memory types have the upper half zero. */
+	return (dirty_mair >> (PTE_ATTRINDX(pte) * 8)) & 0xf0;
+}
+
+static uint64_t dirty_armed = 0;
+static uint64_t dirty_blocks = 0;
+
+/*
+ * Writable-clean: read-only with DBM, the first write makes the hardware
+ * clear AP[2]. AF is cleared as well so we know which pages were not
+ * touched at all, see dirty_written().
+ */
+static void dirty_arm_leaf(uint64_t *pte, uint64_t va, uint64_t size)
+{
+	uint64_t val = *pte;
+
+	if ((val & PTE_RDONLY) || !dirty_is_normal(val))
+		return;
+
+	*pte = (val | PTE_DBM | PTE_RDONLY) & ~PTE_AF;
+
+	dirty_armed++;
+	if (size > (1ull << DIRTY_LEVEL_SHIFT(3)))
+		dirty_blocks++;
+}
+
+/**
+ * dirty_start() - Start tracking writes through the identity map.
+ *
+ * All writable normal memory leaf entries of TTBR0_EL1 are made
+ * writable-clean. Only the 4K granule is supported. The caller must
+ * clean whatever was written before this returned.
+ *
+ * Return: EFI_UNSUPPORTED if the cpu or the tables can't do it.
+ */
+EFI_STATUS dirty_start(void)
+{
+	uint64_t tcr = read_sysreg(tcr_el1);
+	uint64_t va_bits = 64 - TCR_T0SZ(tcr);
+
+	if (dirty_on)
+		return EFI_SUCCESS;
+
+	if (TCR_TG0(tcr) != TCR_TG0_4K || (tcr & TCR_EPD0) || va_bits > 48)
+		return EFI_UNSUPPORTED;
+
+	if (va_bits > 39)
+		dirty_root_level = 0;
+	else if (va_bits > 30)
+		dirty_root_level = 1;
+	else
+		dirty_root_level = 2;
+
+	dirty_root = (uint64_t *)(read_sysreg(ttbr0_el1) & TTBR_BADDR_MASK);
+	dirty_va_end = 1ull << va_bits;
+	dirty_mair = read_sysreg(mair_el1);
+
+	/* Must be on before AF is cleared, or the next access faults. */
+	if (mmu_hw_dirty_enable())
+		return EFI_UNSUPPORTED;
+
+	dirty_visit(dirty_root, dirty_root_level, 0, 0, dirty_va_end, dirty_arm_leaf);
+	mmu_hw_tlb_flush();
+
+	dirty_on = TRUE;
+	Trace(TRACE_DIRTY, dirty_armed, dirty_blocks, read_sysreg(tcr_el1), 0);
+
+	return EFI_SUCCESS;
+}
+
+BOOLEAN dirty_active(void)
+{
+	return dirty_on;
+}
+
+/**
+ * dirty_written() - Check if a page may have been written since dirty_start().
+ *
+ * Only entries still exactly as dirty_arm_leaf() left them, read-only
+ * with DBM and never accessed, are skipped. Writable entries are either
+ * dirty or were never armed because the firmware mapped them later, and
+ * the firmware may have rewritten a dirty entry as read-only, e.g. when
+ * changing the memory attributes, which also drops DBM.
+ */
+static BOOLEAN dirty_written(uint64_t pte)
+{
+	return !((pte & PTE_RDONLY) && (pte & PTE_DBM) && !(pte & PTE_AF));
+}
+
+static dirty_range_fn dirty_fn;
+static uint64_t dirty_lo, dirty_hi;
+static uint64_t dirty_run_start, dirty_run_end;
+
+static void dirty_walk_leaf(uint64_t *pte, uint64_t va, uint64_t size)
+{
+	uint64_t start = va > dirty_lo ? va : dirty_lo;
+	uint64_t end = va + size < dirty_hi ? va + size : dirty_hi;
+
+	if (!dirty_written(*pte))
+		return;
+
+	if (start == dirty_run_end) {
+		dirty_run_end = end;
+		return;
+	}
+
+	if (dirty_run_end > dirty_run_start)
+		dirty_fn(dirty_run_start, dirty_run_end);
+
+	dirty_run_start = start;
+	dirty_run_end = end;
+}
+
+/**
+ * dirty_walk() - Call @fn for the parts of [start, end) that may be dirty.
+ *
+ * Adjacent pages are merged into one range. Without tracking, @fn
+ * gets the whole range. Unmapped pages are skipped, they can't be
+ * flushed anyway.
+ */
+void dirty_walk(uint64_t start, uint64_t end, dirty_range_fn fn)
+{
+	if (!dirty_on) {
+		fn(start, end);
+		return;
+	}
+
+	if (end > dirty_va_end)
+		end = dirty_va_end;
+	if (start >= end)
+		return;
+
+	dirty_fn = fn;
+	dirty_lo = start;
+	dirty_hi = end;
+	dirty_run_start = dirty_run_end = 0;
+
+	dirty_visit(dirty_root, dirty_root_level, 0, start, end, dirty_walk_leaf);
+
+	if (dirty_run_end > dirty_run_start)
+		fn(dirty_run_start, dirty_run_end);
+}
+
+#endif
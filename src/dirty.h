@@ -0,0 +1,25 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include <stdint.h>
+#include <efi.h>
+
+/*
+ * Hardware dirty state tracking on the firmware's identity map, built
+ * with SLBOUNCE_DIRTY. Once started, only the pages that may have been
+ * written since then need to be flushed before the switch.
+ */
+
+typedef void (*dirty_range_fn)(uint64_t start, uint64_t end);
+
+#ifdef SLBOUNCE_DIRTY
+EFI_STATUS dirty_start(void);
+BOOLEAN dirty_active(void);
+void dirty_walk(uint64_t start, uint64_t end, dirty_range_fn fn);
+#else
+static inline EFI_STATUS dirty_start(void) { return EFI_UNSUPPORTED; }
+static inline BOOLEAN dirty_active(void) { return FALSE; }
+static inline void dirty_walk(uint64_t start, uint64_t end, dirty_range_fn fn) { fn(start, end); }
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+#include <efidebug.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+#include "arch.h"
+#include "dtbhack.h"
+
+static EFI_STATUS dtbhack_cmd_db_relocation(UINT8 *dtb)
+{
+	EFI_STATUS status;
+	uint32_t offset;
+	int ret;
+
+	offset = fdt_node_offset_by_compatible(dtb, 0, "qcom,cmd-db");
+	if (offset <= 0) {
+		Print(L"Failed to find cmd-db node: %d\n", offset);
+		return EFI_UNSUPPORTED;
+	}
+
+	const fdt32_t *cmd_db_reg = fdt_getprop(dtb, offset, "reg", &ret);
+	ASSERT(ret == 4 * 4);
+
+	uint64_t cmd_db_base = ((uint64_t)fdt32_to_cpu(cmd_db_reg[0]) << 32) | fdt32_to_cpu(cmd_db_reg[1]);
+	uint64_t cmd_db_size = ((uint64_t)fdt32_to_cpu(cmd_db_reg[2]) << 32) | fdt32_to_cpu(cmd_db_reg[3]);
+	ASSERT(cmd_db_base);
+	ASSERT(cmd_db_size);
+
+	ret = fdt_nop_property(dtb, offset, "compatible");
+	ASSERT(ret >= 0);
+
+	EFI_PHYSICAL_ADDRESS cmddb_phys = 0;
+	UINT64 cmddb_pages = cmd_db_size / 4096 + 1;
+
+	status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiReservedMemoryType, cmddb_pages, &cmddb_phys);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to allocate memory: %d\n", status);
+		return status;
+	}
+	Print(L"Relocating cmd-db: reg=0x%llx size=0x%llx new_addr=0x%llx\n", cmd_db_base, cmd_db_size, cmddb_phys);
+
+	CopyMem((UINT8*)cmddb_phys, (UINT8*)cmd_db_base, cmd_db_size);
+
+	int resmem_offset = fdt_path_offset(dtb, "/reserved-memory");
+	if (resmem_offset <= 0)
+		goto error_allocated;
+
+	offset = fdt_add_subnode(dtb, resmem_offset, "cmd-db-copy");
+	if (offset <= 0)
+		goto error_allocated;
+
+	ret = fdt_setprop_string(dtb, offset, "compatible", "qcom,cmd-db");
+	if (ret)
+		goto error_allocated;
+
+	ret = fdt_appendprop_addrrange(dtb, resmem_offset, offset, "reg", cmddb_phys, cmd_db_size);
+	if (ret)
+		goto error_allocated;
+
+	ret = fdt_setprop_empty(dtb, offset, "no-map");
+	if (ret)
+		goto error_allocated;
+
+	return EFI_SUCCESS;
+
+error_allocated:
+	uefi_call_wrapper(BS->FreePages, 2, cmddb_phys, cmddb_pages);
+	return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS dtbhack_assign_rmtfs(UINT8 *dtb)
+{
+	uint32_t offset, cid, vmid;
+	uint64_t base, size;
+	const fdt32_t *prop;
+	EFI_STATUS status;
+	int ret;
+
+	offset = fdt_node_offset_by_compatible(dtb, 0, "qcom,rmtfs-mem");
+	if (offset <= 0) {
+		Print(L"Failed to find rmtfs node: %d\n", offset);
+		return EFI_UNSUPPORTED;
+	}
+
+	prop = fdt_getprop(dtb, offset, "reg", &ret);
+	if (ret != 4 * 4) {
+		Print(L"Failed to read reg: %d\n", ret);
+		return EFI_UNSUPPORTED;
+	}
+	base = ((uint64_t)fdt32_to_cpu(prop[0]) << 32) | fdt32_to_cpu(prop[1]);
+	size = ((uint64_t)fdt32_to_cpu(prop[2]) << 32) | fdt32_to_cpu(prop[3]);
+
+	prop = fdt_getprop(dtb, offset, "qcom,client-id", &ret);
+	if (ret <= 0) {
+		Print(L"Failed to read client-id: %d\n", ret);
+		return EFI_UNSUPPORTED;
+	}
+	cid = fdt32_to_cpu(*prop);
+
+	prop = fdt_getprop(dtb, offset, "qcom,vmid", &ret);
+	if (ret <= 0) {
+		Print(L"Failed to read vmid: %d\n", ret);
+		return EFI_UNSUPPORTED;
+	}
+	vmid = fdt32_to_cpu(*prop);
+
+	Print(L"Assigning rmtfs mem: reg=0x%llx size=0x%llx cid=%d vmid=%d -> ", base, size, cid, vmid);
+
+	EFI_PHYSICAL_ADDRESS msg_phys = 0x99900000;
+	UINT64 msg_pages = 4;
+
+	status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateMaxAddress, EfiReservedMemoryType, msg_pages, &msg_phys);
+	if (EFI_ERROR(status)) {
+		Print(L"Failed to allocate memory: %d\n", status);
+		return status;
+	}
+
+	uint64_t *map =  (uint64_t*)(msg_phys + 64);
+	uint32_t map_sz = 16;
+	map[0] = base;
+	map[1] = size;
+
+	uint32_t *src = (uint32_t*)(msg_phys);
+	uint64_t src_sz = 4;
+	src[0] = 3;
+
+	uint32_t *dst = (uint32_t*)(msg_phys + 64 + 64);
+	uint64_t dst_sz = 24 * 2;
+
+	dst[0] = 3;  dst[1] = 6;
+	dst[2] = 0;  dst[3] = 0;
+	dst[4] = 0;  dst[5] = 0;
+
+	dst[6] = vmid; dst[7] = 6;
+	dst[8] = 0;    dst[9] = 0;
+	dst[10] = 0;   dst[11]= 0;
+
+	uint64_t *args = (uint64_t*)(msg_phys + 4096*3);
+	args[0] = src_sz;
+	args[1] = (uint64_t)dst;
+	args[2] = dst_sz;
+	args[3] = 0;
+
+	do {
+		ret = smc6(0x42000c16, 0x1117, (uint64_t)map, map_sz, (uint64_t)src, (uint64_t)args);
+	} while (ret == 1);
+
+	Print(L"ret=%d\n", ret);
+	if (ret)
+		return EFI_UNSUPPORTED;
+
+	ret = fdt_nop_property(dtb, offset, "qcom,vmid");
+	if (ret) {
+		Print(L"Failed to nop vmid prop: %d\n", ret);
+		return EFI_UNSUPPORTED;
+	}
+
+	uefi_call_wrapper(BS->FreePages, 2, msg_phys, msg_pages);
+
+	return EFI_SUCCESS;
+}
+
+EFI_STATUS dtbhack_zap_zap_shader(UINT8 *dtb)
+{
+	uint32_t offset;
+	int ret;
+
+	offset = fdt_node_offset_by_compatible(dtb, 0, "qcom,adreno");
+	if (offset <= 0) {
+		Print(L"Failed to find adreno node: %d\n", offset);
+		return EFI_UNSUPPORTED;
+	}
+
+	offset = fdt_subnode_offset(dtb, offset, "zap-shader");
+	if (offset <= 0) {
+		Print(L"Failed to find gpu/zap-shader node: %d\n", offset);
+		return EFI_UNSUPPORTED;
+	}
+
+	ret = fdt_nop_node(dtb, offset);
+	if (ret) {
+		Print(L"Failed to nop gpu/zap-shader node: %d\n", ret);
+		return EFI_UNSUPPORTED;
+	}
+
+	return EFI_SUCCESS;
+}
+
+#ifndef SOC_QUIRKS
+/**
+ * dtbhack_soc_quirks() - Get the SOC_QUIRK_* mask the dtb needs.
+ *
+ * Per-SoC builds have it fixed, see dtbhack.h.
+ */
+UINT32 dtbhack_soc_quirks(UINT8 *dtb)
+{
+	if (!fdt_node_check_compatible(dtb, 0, "qcom,sc7180"))
+		return SOC_QUIRK_CMD_DB | SOC_QUIRK_RMTFS | SOC_QUIRK_ZAP_SHADER;
+	else if (!fdt_node_check_compatible(dtb, 0, "qcom,sc8280xp"))
+		return SOC_QUIRK_ZAP_SHADER;
+	else if (!fdt_node_check_compatible(dtb, 0, "qcom,x1e80100"))
+		return SOC_QUIRK_ZAP_SHADER;
+
+	return 0;
+}
+#endif
+
+/**
+ * dtbhack_soc_fixups() - Apply soc-specific updates to the dtb.
+ * @flags: DTBHACK_* mask of the update kinds to perform.
+ */
+EFI_STATUS dtbhack_soc_fixups(UINT8 *dtb, UINT32 flags)
+{
+	UINT32 quirks = dtbhack_soc_quirks(dtb);
+	EFI_STATUS status = EFI_SUCCESS;
+
+	if (!quirks) {
+		Print(L"NOTE: No soc-specific updates done.\n");
+		return EFI_SUCCESS;
+	}
+
+	/*
+	 * cmd-db memory is for some reason "broken" after switching to el2.
+	 * Let's make a copy in another place for fun and give linux that.
+	 */
+	if ((quirks & SOC_QUIRK_CMD_DB) && (flags & DTBHACK_RESERVE_MEMORY)) {
+		status = dtbhack_cmd_db_relocation(dtb);
+		if (EFI_ERROR(status)) {
+			Print(L"Failed to relocate cmd-db: %d\n", status);
+			return status;
+		}
+	}
+
+	/*
+	 * We need to assign rmtfs memory to the modem and it's
+	 * easier to do while we have the hyp around so just do it here.
+	 */
+	if ((quirks & SOC_QUIRK_RMTFS) && (flags & DTBHACK_FIXUPS)) {
+		status = dtbhack_assign_rmtfs(dtb);
+		if (EFI_ERROR(status)) {
+			Print(L"Failed to assign rmtfs mem: %d\n", status);
+			return status;
+		}
+	}
+
+	return status;
+}
@@ -0,0 +1,23 @@
+#ifndef DTBHACK_H
+#define DTBHACK_H
+
+#include <efi.h>
+
+#include "soc.h"
+
+/* Kinds of updates, same values as in EFI_DT_FIXUP_PROTOCOL. */
+#define DTBHACK_FIXUPS		(1 << 0)	/* Update the tree itself. */
+#define DTBHACK_RESERVE_MEMORY	(1 << 1)	/* Allocate and reserve memory. */
+
+EFI_STATUS dtbhack_zap_zap_shader(UINT8 *dtb);
+
+/* Per-SoC builds know the quirks at compile time, unused updates are dropped. */
+#ifdef SOC_QUIRKS
+#define dtbhack_soc_quirks(dtb)	((void)(dtb), (UINT32)(SOC_QUIRKS))
+#else
+UINT32 dtbhack_soc_quirks(UINT8 *dtb);
+#endif
+
+EFI_STATUS dtbhack_soc_fixups(UINT8 *dtb, UINT32 flags);
+
+#endif
@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * Overlay blobs built by "make dtbs", embedded so slbounce
+ * can apply them without reading anything from the disk.
+ */
+
+.macro dtbo name, file
+	.balign	8
+	.global	\name
+\name:
+	.incbin	"\file"
+.endm
+
+.section .rodata
+
+/* The Makefile defines DTBO_<soc> for every soc the build supports. */
+
+.ifdef DTBO_sc7180
+dtbo	dtbo_sc7180_symbols,	"dtbo/sc7180-symbols.dtbo"
+dtbo	dtbo_sc7180_el2,	"dtbo/sc7180-el2.dtbo"
+.endif
+
+.ifdef DTBO_sc8280xp
+dtbo	dtbo_sc8280xp_symbols,	"dtbo/sc8280xp-symbols.dtbo"
+dtbo	dtbo_sc8280xp_el2,	"dtbo/sc8280xp-el2.dtbo"
+.endif
+
+.ifdef DTBO_x1e
+dtbo	dtbo_x1e_el2,		"dtbo/x1e-el2.dtbo"
+.endif
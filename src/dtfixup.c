@@ -0,0 +1,275 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+#include "dtbhack.h"
+#include "dtfixup.h"
+#include "resmem.h"
+#include "telemetry.h"
+#include "trace.h"
+
+/* Room for the nodes added by the soc-specific updates. */
+#define DTFIXUP_SLACK		(4 * 4096)
+
+/* In dtbo.s */
+extern const UINT8 dtbo_sc7180_symbols[];
+extern const UINT8 dtbo_sc7180_el2[];
+extern const UINT8 dtbo_sc8280xp_symbols[];
+extern const UINT8 dtbo_sc8280xp_el2[];
+extern const UINT8 dtbo_x1e_el2[];
+
+static const struct dtfixup_soc {
+	const char *compatible;
+	const UINT8 *symbols;	/* Only used if the dtb was built without symbols. */
+	const UINT8 *el2;
+} dtfixup_socs[] = {
+#ifdef SOC_COMPATIBLE
+	/* Still checked so a foreign dtb is left alone. */
+	{ SOC_COMPATIBLE,	SOC_DTBO_SYMBOLS,	SOC_DTBO_EL2 },
+#else
+	{ "qcom,sc7180",	dtbo_sc7180_symbols,	dtbo_sc7180_el2 },
+	{ "qcom,sc8280xp",	dtbo_sc8280xp_symbols,	dtbo_sc8280xp_el2 },
+	{ "qcom,x1e80100",	NULL,			dtbo_x1e_el2 },
+#endif
+};
+
+/* The firmware's instance we hooked, its Fixup() may need its own This. */
+static EFI_DT_FIXUP_PROTOCOL *real_proto = NULL;
+static EFI_DT_FIXUP real_Fixup = NULL;
+
+static const struct dtfixup_soc *dtfixup_find_soc(VOID *fdt)
+{
+	int i;
+
+	for (i = 0; i < sizeof(dtfixup_socs) / sizeof(dtfixup_socs[0]); ++i)
+		if (!fdt_node_check_compatible(fdt, 0, dtfixup_socs[i].compatible))
+			return &dtfixup_socs[i];
+
+	return NULL;
+}
+
+/*
+ * Our overlays mark /chosen so we can tell if the loader
+ * already uses an -el2 dtb.
+ */
+static BOOLEAN dtfixup_has_el2_overlay(VOID *fdt)
+{
+	int offset = fdt_path_offset(fdt, "/chosen");
+
+	if (offset < 0)
+		return FALSE;
+
+	return fdt_getprop(fdt, offset, "dtbhack-el2-overlay", NULL) != NULL;
+}
+
+static EFI_STATUS dtfixup_apply_overlay(VOID *fdt, const UINT8 *blob)
+{
+	UINTN size = fdt_totalsize(blob);
+	VOID *dtbo;
+	int ret;
+
+	/* fdt_overlay_apply() trashes the overlay, so work on a copy. */
+	dtbo = AllocatePool(size);
+	if (!dtbo)
+		return EFI_OUT_OF_RESOURCES;
+
+	CopyMem(dtbo, (VOID *)blob, size);
+
+	ret = fdt_overlay_apply(fdt, dtbo);
+	FreePool(dtbo);
+
+	if (ret) {
+		Print(L"Failed to apply the overlay: %d\n", ret);
+		return EFI_LOAD_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * A failed fdt_overlay_apply() leaves the tree broken, so the overlays
+ * go to a copy and the loader's dtb is only replaced if all applied.
+ */
+static EFI_STATUS dtfixup_apply_overlays(VOID *fdt, UINTN size, const struct dtfixup_soc *soc)
+{
+	EFI_STATUS status = EFI_SUCCESS;
+	VOID *tmp;
+
+	tmp = AllocatePool(size);
+	if (!tmp)
+		return EFI_OUT_OF_RESOURCES;
+
+	CopyMem(tmp, fdt, size);
+
+	if (soc->symbols && fdt_path_offset(tmp, "/__symbols__") < 0)
+		status = dtfixup_apply_overlay(tmp, soc->symbols);
+
+	if (!EFI_ERROR(status))
+		status = dtfixup_apply_overlay(tmp, soc->el2);
+
+	if (!EFI_ERROR(status))
+		CopyMem(fdt, tmp, size);
+
+	FreePool(tmp);
+
+	return status;
+}
+
+static EFI_STATUS dtfixup_do_fixup(VOID *Fdt, UINTN *BufferSize, UINT32 Flags)
+{
+	EFI_GUID EfiDtbTableGuid = EFI_DTB_TABLE_GUID;
+	const struct dtfixup_soc *soc;
+	BOOLEAN need_overlay;
+	UINT32 flags = 0;
+	EFI_STATUS status;
+	UINTN size;
+	int ret;
+
+	if (!Fdt || !BufferSize)
+		return EFI_INVALID_PARAMETER;
+
+	if (fdt_check_header(Fdt))
+		return EFI_INVALID_PARAMETER;
+
+	soc = dtfixup_find_soc(Fdt);
+	need_overlay = (Flags & EFI_DT_APPLY_FIXUPS) && soc && !dtfixup_has_el2_overlay(Fdt);
+
+	size = fdt_totalsize(Fdt) + DTFIXUP_SLACK;
+	if (need_overlay) {
+		size += fdt_totalsize(soc->el2);
+		if (soc->symbols)
+			size += fdt_totalsize(soc->symbols);
+	}
+
+	if (*BufferSize < size) {
+		*BufferSize = size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	/*
+	 * If the firmware has its own fixups, let it do them first. Only
+	 * once we know the buffer fits ours, or a retry with a bigger one
+	 * would apply them twice. Our slack covers what they add.
+	 */
+	if (real_Fixup) {
+		status = uefi_call_wrapper(real_Fixup, 4, real_proto, Fdt, BufferSize, Flags & ~EFI_DT_INSTALL_TABLE);
+		if (status == EFI_BUFFER_TOO_SMALL)
+			*BufferSize += size - fdt_totalsize(Fdt);
+		if (EFI_ERROR(status))
+			return status;
+	}
+
+	ret = fdt_open_into(Fdt, Fdt, *BufferSize);
+	if (ret) {
+		Print(L"fdt open failed: %d\n", ret);
+		return EFI_INVALID_PARAMETER;
+	}
+
+	if (need_overlay) {
+		status = dtfixup_apply_overlays(Fdt, *BufferSize, soc);
+		if (EFI_ERROR(status))
+			return status;
+	}
+
+	if (Flags & EFI_DT_APPLY_FIXUPS)
+		flags |= DTBHACK_FIXUPS;
+	if (Flags & EFI_DT_RESERVE_MEMORY)
+		flags |= DTBHACK_RESERVE_MEMORY;
+
+	/* Regions we leave data in for the OS. */
+	if (Flags & EFI_DT_RESERVE_MEMORY) {
+		status = resmem_fdt_add(Fdt);
+		if (EFI_ERROR(status))
+			return status;
+
+		status = telemetry_fdt_add(Fdt);
+		if (EFI_ERROR(status))
+			return status;
+	}
+
+	if (soc && flags) {
+		status = dtbhack_soc_fixups(Fdt, flags);
+		if (EFI_ERROR(status))
+			return status;
+	}
+
+	if (soc && (Flags & EFI_DT_APPLY_FIXUPS)) {
+		/*
+		 * The overlay already disabled the zap shader, dropping the
+		 * node is just for older kernels so it's fine if it's gone.
+		 */
+		if (dtbhack_soc_quirks(Fdt) & SOC_QUIRK_ZAP_SHADER)
+			dtbhack_zap_zap_shader(Fdt);
+	}
+
+	ret = fdt_pack(Fdt);
+	if (ret) {
+		Print(L"fdt pack failed: %d\n", ret);
+		return EFI_LOAD_ERROR;
+	}
+
+	if (Flags & EFI_DT_INSTALL_TABLE) {
+		status = uefi_call_wrapper(BS->InstallConfigurationTable, 2, &EfiDtbTableGuid, Fdt);
+		if (EFI_ERROR(status))
+			return status;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI dtfixup_fixup(EFI_DT_FIXUP_PROTOCOL *This, VOID *Fdt, UINTN *BufferSize, UINT32 Flags)
+{
+	EFI_STATUS status;
+
+	telemetry_begin(TELEMETRY_DT_FIXUP);
+	status = dtfixup_do_fixup(Fdt, BufferSize, Flags);
+	telemetry_end(TELEMETRY_DT_FIXUP, status);
+	Trace(TRACE_DT_FIXUP, status, 0, 0, 0);
+
+	return status;
+}
+
+static EFI_DT_FIXUP_PROTOCOL dtfixup_protocol = {
+	.Revision = EFI_DT_FIXUP_PROTOCOL_REVISION,
+	.Fixup = dtfixup_fixup,
+};
+
+/**
+ * dtfixup_apply() - Same as calling our EFI_DT_FIXUP_PROTOCOL.
+ */
+EFI_STATUS dtfixup_apply(VOID *Fdt, UINTN *BufferSize, UINT32 Flags)
+{
+	return dtfixup_fixup(&dtfixup_protocol, Fdt, BufferSize, Flags);
+}
+
+/**
+ * dtfixup_install() - Provide EFI_DT_FIXUP_PROTOCOL to the loaders.
+ *
+ * If the firmware already provides the protocol, we hook into it
+ * instead, so there is only one instance for the loader to find.
+ */
+EFI_STATUS dtfixup_install(void)
+{
+	EFI_GUID DtFixupGuid = EFI_DT_FIXUP_PROTOCOL_GUID;
+	EFI_DT_FIXUP_PROTOCOL *proto;
+	EFI_HANDLE handle = NULL;
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(BS->LocateProtocol, 3, &DtFixupGuid, NULL, (void **)&proto);
+	if (!EFI_ERROR(status)) {
+		real_proto = proto;
+		real_Fixup = proto->Fixup;
+		proto->Fixup = dtfixup_fixup;
+		return EFI_SUCCESS;
+	}
+
+	return uefi_call_wrapper(BS->InstallProtocolInterface, 4, &handle, &DtFixupGuid,
+				 EFI_NATIVE_INTERFACE, &dtfixup_protocol);
+}
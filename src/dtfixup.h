@@ -0,0 +1,33 @@
+#ifndef DTFIXUP_H
+#define DTFIXUP_H
+
+#include <efi.h>
+
+/*
+ * EFI_DT_FIXUP_PROTOCOL as implemented by u-boot and used by
+ * systemd-boot and others to finalize the loaded dtb.
+ */
+#ifndef EFI_DT_FIXUP_PROTOCOL_GUID
+#define EFI_DT_FIXUP_PROTOCOL_GUID \
+    { 0xe617d64c, 0xfe08, 0x46da, {0xf4, 0xdc, 0xbb, 0xd5, 0x87, 0x0c, 0x73, 0x00} }
+
+#define EFI_DT_FIXUP_PROTOCOL_REVISION	0x00010000
+
+#define EFI_DT_APPLY_FIXUPS		0x00000001
+#define EFI_DT_RESERVE_MEMORY		0x00000002
+#define EFI_DT_INSTALL_TABLE		0x00000004
+
+typedef struct _EFI_DT_FIXUP_PROTOCOL EFI_DT_FIXUP_PROTOCOL;
+
+typedef EFI_STATUS (EFIAPI *EFI_DT_FIXUP)(EFI_DT_FIXUP_PROTOCOL *This, VOID *Fdt, UINTN *BufferSize, UINT32 Flags);
+
+struct _EFI_DT_FIXUP_PROTOCOL {
+	UINT64		Revision;
+	EFI_DT_FIXUP	Fixup;
+};
+#endif
+
+EFI_STATUS dtfixup_install(void);
+EFI_STATUS dtfixup_apply(VOID *Fdt, UINTN *BufferSize, UINT32 Flags);
+
+#endif
@@ -0,0 +1,393 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * dtq - Minimal read-only DeviceTree queries.
+ *
+ * slbounce only needs to look at a few nodes of the dtb at EBS time,
+ * so instead of libfdt, all lookups are resolved at once in a single
+ * pass over the structure block. Names we look for are hashed ahead of
+ * time, and node names and compatible strings are hashed while they
+ * are skipped over anyway, so only hash hits are compared byte by byte.
+ * Property names are resolved to strings block offsets before the walk.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dtq.h"
+
+#define DTQ_FDT_MAGIC		0xd00dfeed
+#define DTQ_FDT_BEGIN_NODE	0x1
+#define DTQ_FDT_END_NODE	0x2
+#define DTQ_FDT_PROP		0x3
+#define DTQ_FDT_NOP		0x4
+#define DTQ_FDT_END		0x9
+
+#define DTQ_FNV_OFFSET		0x811c9dc5
+#define DTQ_FNV_PRIME		0x01000193
+
+struct dtq_fdt_header {
+	uint32_t magic;
+	uint32_t totalsize;
+	uint32_t off_dt_struct;
+	uint32_t off_dt_strings;
+	uint32_t off_mem_rsvmap;
+	uint32_t version;
+	uint32_t last_comp_version;
+	uint32_t boot_cpuid_phys;
+	uint32_t size_dt_strings;
+	uint32_t size_dt_struct;
+};
+
+/* Where a property name can be found in the strings block. */
+struct dtq_name {
+	const char *name;
+	int len;
+	uint32_t offs[DTQ_MAX_OFFS];
+	int cnt;
+};
+
+static inline uint32_t dtq_be32(const void *p)
+{
+	return __builtin_bswap32(*(const uint32_t *)p);
+}
+
+static uint32_t dtq_hash(const char *s, int len)
+{
+	uint32_t h = DTQ_FNV_OFFSET;
+	int i;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ (uint8_t)s[i]) * DTQ_FNV_PRIME;
+
+	return h;
+}
+
+static int dtq_strlen(const char *s)
+{
+	int i = 0;
+
+	while (s[i])
+		i++;
+
+	return i;
+}
+
+static int dtq_eq(const char *a, const char *b, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (a[i] != b[i])
+			return 0;
+
+	return 1;
+}
+
+/* Get the idx-th component of an absolute path. */
+static const char *dtq_path_component(const char *path, int idx, int *len)
+{
+	const char *c = path + 1;
+	int i;
+
+	for (i = 0; i < idx; i++) {
+		while (*c && *c != '/')
+			c++;
+		if (*c)
+			c++;
+	}
+
+	for (*len = 0; c[*len] && c[*len] != '/'; (*len)++)
+		;
+
+	return c;
+}
+
+/**
+ * dtq_prepare() - Hash the names the queries look for.
+ * @q:     Array of queries.
+ * @count: Number of queries.
+ *
+ * Only needs to be done once, the same queries can be reused with
+ * dtq_run() on any number of dtbs.
+ */
+void dtq_prepare(struct dtq_query *q, int count)
+{
+	const char *c;
+	int i, d, len;
+
+	for (i = 0; i < count; i++) {
+		q[i].name_hash = q[i].name ? dtq_hash(q[i].name, dtq_strlen(q[i].name)) : 0;
+		q[i].compat_hash = q[i].compatible ? dtq_hash(q[i].compatible, dtq_strlen(q[i].compatible)) : 0;
+		q[i].prop_hash = q[i].prop ? dtq_hash(q[i].prop, dtq_strlen(q[i].prop)) : 0;
+
+		q[i].path_depth = 0;
+		if (!q[i].path || q[i].path[0] != '/' || q[i].path[1] == '\0')
+			continue;
+
+		for (d = 0; d < DTQ_MAX_DEPTH; d++) {
+			c = dtq_path_component(q[i].path, d, &len);
+			if (!len)
+				break;
+			q[i].path_hash[d] = dtq_hash(c, len);
+			q[i].path_depth = d + 1;
+		}
+	}
+}
+
+/*
+ * Find all offsets in the strings block that hold the name.
+ * dtc may share string tails, so look at every NUL rather than only
+ * at the string starts.
+ */
+static void dtq_find_names(const char *strs, uint32_t size, struct dtq_name *names, int cnt)
+{
+	uint32_t e;
+	int n;
+
+	for (e = 0; e < size; e++) {
+		if (strs[e])
+			continue;
+
+		for (n = 0; n < cnt; n++) {
+			struct dtq_name *nm = &names[n];
+
+			if (!nm->name || e < (uint32_t)nm->len || nm->cnt == DTQ_MAX_OFFS)
+				continue;
+
+			if (dtq_eq(&strs[e - nm->len], nm->name, nm->len))
+				nm->offs[nm->cnt++] = e - nm->len;
+		}
+	}
+}
+
+static int dtq_name_at(const struct dtq_name *nm, uint32_t off)
+{
+	int i;
+
+	for (i = 0; i < nm->cnt; i++)
+		if (nm->offs[i] == off)
+			return 1;
+
+	return 0;
+}
+
+/**
+ * dtq_run() - Resolve the queries in a single pass over the dtb.
+ * @fdt:   Flattened DeviceTree.
+ * @q:     Array of queries, prepared with dtq_prepare().
+ * @count: Number of queries, at most DTQ_MAX_QUERIES.
+ *
+ * Return: 0 on success (even if nothing was found), -1 if the dtb is
+ * malformed. On error the results are not valid.
+ */
+int dtq_run(const void *fdt, struct dtq_query *q, int count)
+{
+	const struct dtq_fdt_header *hdr = fdt;
+	const uint8_t *base = fdt;
+	const uint8_t *st, *p, *end;
+	const char *strs;
+	uint32_t totalsize, st_size, strs_size;
+	uint32_t compat_bits[DTQ_MAX_DEPTH];
+	uint32_t path_bits[DTQ_MAX_DEPTH];
+	uint32_t all, done = 0, sel = 0, candidates = 0, compat_q = 0;
+	struct dtq_name names[DTQ_MAX_QUERIES + 1];
+	int depth = -1, skip = 0, props_open = 0;
+	int cur_node = -1;
+	int i;
+
+	if (count > DTQ_MAX_QUERIES)
+		return -1;
+
+	if (dtq_be32(&hdr->magic) != DTQ_FDT_MAGIC)
+		return -1;
+	if (dtq_be32(&hdr->version) < 17 || dtq_be32(&hdr->last_comp_version) > 17)
+		return -1;
+
+	totalsize = dtq_be32(&hdr->totalsize);
+	st_size = dtq_be32(&hdr->size_dt_struct);
+	strs_size = dtq_be32(&hdr->size_dt_strings);
+	st = base + dtq_be32(&hdr->off_dt_struct);
+	strs = (const char *)base + dtq_be32(&hdr->off_dt_strings);
+
+	if (dtq_be32(&hdr->off_dt_struct) + (uint64_t)st_size > totalsize ||
+	    dtq_be32(&hdr->off_dt_strings) + (uint64_t)strs_size > totalsize ||
+	    (dtq_be32(&hdr->off_dt_struct) & 3))
+		return -1;
+
+	all = (count == 32) ? 0xffffffff : ((1u << count) - 1);
+
+	/* names[0] is "compatible", names[1 + i] is the property of q[i]. */
+	names[0].name = "compatible";
+	names[0].len = 10;
+	names[0].cnt = 0;
+	for (i = 0; i < count; i++) {
+		names[1 + i].name = q[i].prop;
+		names[1 + i].len = q[i].prop ? dtq_strlen(q[i].prop) : 0;
+		names[1 + i].cnt = 0;
+
+		q[i].node = -1;
+		q[i].value = NULL;
+		q[i].len = 0;
+
+		if (q[i].compatible && !q[i].path)
+			compat_q |= 1u << i;
+	}
+	dtq_find_names(strs, strs_size, names, count + 1);
+
+	p = st;
+	end = st + st_size;
+
+	while (p + 4 <= end && done != all) {
+		uint32_t token = dtq_be32(p);
+		int offset = p - st;
+
+		p += 4;
+
+		/* Properties of the current node end with the first subnode. */
+		if (props_open && token != DTQ_FDT_PROP && token != DTQ_FDT_NOP) {
+			for (i = 0; i < count; i++) {
+				uint32_t bit = 1u << i;
+
+				if (candidates & bit && compat_bits[depth] & bit) {
+					q[i].node = cur_node;
+					sel |= bit;
+				}
+				if (!(sel & bit) && !(done & bit)) {
+					q[i].value = NULL;
+					q[i].len = 0;
+				}
+			}
+			done |= sel;
+			sel = 0;
+			candidates = 0;
+			props_open = 0;
+		}
+
+		switch (token) {
+		case DTQ_FDT_BEGIN_NODE: {
+			const char *name = (const char *)p;
+			uint32_t h = DTQ_FNV_OFFSET;
+			int len = 0;
+
+			/* Hash the name while looking for its end. */
+			while (p + len < end && name[len]) {
+				h = (h ^ (uint8_t)name[len]) * DTQ_FNV_PRIME;
+				len++;
+			}
+			if (p + len >= end)
+				return -1;
+			p += (len + 1 + 3) & ~3;
+
+			if (skip || depth + 1 >= DTQ_MAX_DEPTH) {
+				skip++;
+				break;
+			}
+
+			depth++;
+			cur_node = offset;
+			compat_bits[depth] = 0;
+			path_bits[depth] = 0;
+			props_open = 1;
+
+			for (i = 0; i < count; i++) {
+				uint32_t bit = 1u << i;
+				const char *c;
+				int clen;
+
+				if (done & bit)
+					continue;
+
+				if (q[i].path) {
+					if (depth == 0) {
+						path_bits[0] |= bit;
+					} else if ((path_bits[depth - 1] & bit) && depth <= q[i].path_depth &&
+						   h == q[i].path_hash[depth - 1]) {
+						c = dtq_path_component(q[i].path, depth - 1, &clen);
+						if (clen == len && dtq_eq(c, name, len))
+							path_bits[depth] |= bit;
+					}
+
+					if ((path_bits[depth] & bit) && depth == q[i].path_depth)
+						sel |= bit;
+				} else if (q[i].name) {
+					if (h != q[i].name_hash || !dtq_eq(q[i].name, name, len + 1))
+						continue;
+					if (q[i].compatible && (depth == 0 || !(compat_bits[depth - 1] & bit)))
+						continue;
+					sel |= bit;
+				} else if (q[i].compatible) {
+					candidates |= bit;
+				}
+
+				if (sel & bit)
+					q[i].node = offset;
+			}
+			break;
+		}
+		case DTQ_FDT_END_NODE:
+			if (skip)
+				skip--;
+			else if (depth-- < 0)
+				return -1;
+			break;
+		case DTQ_FDT_PROP: {
+			uint32_t len, nameoff;
+			const char *val;
+
+			if (p + 8 > end)
+				return -1;
+			len = dtq_be32(p);
+			nameoff = dtq_be32(p + 4);
+			val = (const char *)p + 8;
+			if (len > end - p - 8)
+				return -1;
+			p += 8 + ((len + 3) & ~3);
+
+			if (skip || !props_open)
+				break;
+
+			if ((compat_q & ~done) && dtq_name_at(&names[0], nameoff)) {
+				uint32_t s = 0, e;
+
+				/* Hash every string of the list. */
+				while (s < len) {
+					uint32_t h = DTQ_FNV_OFFSET;
+
+					for (e = s; e < len && val[e]; e++)
+						h = (h ^ (uint8_t)val[e]) * DTQ_FNV_PRIME;
+					if (e == len)
+						break;
+
+					for (i = 0; i < count; i++) {
+						if (!(compat_q & ~done & (1u << i)) || h != q[i].compat_hash)
+							continue;
+						if (dtq_eq(q[i].compatible, &val[s], e - s + 1))
+							compat_bits[depth] |= 1u << i;
+					}
+					s = e + 1;
+				}
+			}
+
+			for (i = 0; i < count; i++) {
+				if (!((sel | candidates) & (1u << i)) || !q[i].prop)
+					continue;
+				if (dtq_name_at(&names[1 + i], nameoff)) {
+					q[i].value = val;
+					q[i].len = len;
+				}
+			}
+			break;
+		}
+		case DTQ_FDT_NOP:
+			break;
+		case DTQ_FDT_END:
+			return depth == -1 ? 0 : -1;
+		default:
+			return -1;
+		}
+	}
+
+	return 0;
+}
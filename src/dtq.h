@@ -0,0 +1,43 @@
+#ifndef DTQ_H
+#define DTQ_H
+
+#include <stdint.h>
+
+#define DTQ_MAX_QUERIES		32	/* Queries per dtq_run() call. */
+#define DTQ_MAX_DEPTH		16	/* Deeper nodes are skipped. */
+#define DTQ_MAX_OFFS		4	/* Copies of a property name in the strings block. */
+
+/*
+ * A single lookup in the dtb, resolved by dtq_run().
+ *
+ * The node is selected by one of:
+ *  - path:            Absolute path, i.e. "/chosen".
+ *  - compatible:      First node compatible with the string.
+ *  - compatible+name: First node called name whose parent is compatible.
+ *  - name:            First node called name.
+ * Names include the unit address. If prop is set, the property is
+ * looked up in the selected node.
+ */
+struct dtq_query {
+	const char *path;
+	const char *compatible;
+	const char *name;
+	const char *prop;
+
+	/* Results, valid after dtq_run(). */
+	int node;		/* Structure block offset, -1 if not found. */
+	const void *value;	/* NULL if the node or property is not found. */
+	int len;
+
+	/* Private, set by dtq_prepare(). */
+	uint32_t name_hash;
+	uint32_t compat_hash;
+	uint32_t path_hash[DTQ_MAX_DEPTH];
+	int path_depth;
+	uint32_t prop_hash;
+};
+
+void dtq_prepare(struct dtq_query *q, int count);
+int dtq_run(const void *fdt, struct dtq_query *q, int count);
+
+#endif
@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * dtslim - Rebuild the dtb with only what the OS needs.
+ *
+ * The tree is copied with the sequential write functions of libfdt,
+ * which don't emit NOPs and add every property name to the strings
+ * block only once. On the way, the overlay metadata at the root is
+ * left out, as are disabled subtrees whose phandles nothing outside
+ * of them refers to.
+ *
+ * There is no telling which properties hold phandles without the
+ * bindings, so every aligned cell of every property that can hold one
+ * is counted as a reference to the phandle of that value. This keeps
+ * some nodes that could go, but never drops a referenced one.
+ */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <string.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+#include "dtslim.h"
+
+/* Above that, the tree is odd enough to keep all nodes with a phandle. */
+#define DTSLIM_MAX_PHANDLE	(1 << 20)
+
+struct dtslim_ctx {
+	const void *fdt;
+	uint32_t *refs;		/* References to each phandle, by value. */
+	uint32_t max_phandle;
+	int cpus;
+	BOOLEAN in_cpus;	/* The copy is inside of /cpus. */
+};
+
+/* Root nodes only needed to apply more overlays. */
+static const char *const dtslim_meta[] = {
+	"__symbols__",
+	"__fixups__",
+	"__local_fixups__",
+};
+
+/* Properties that never hold a phandle, names starting with '#' neither. */
+static const char *const dtslim_no_refs[] = {
+	"phandle",
+	"linux,phandle",
+	"compatible",
+	"status",
+	"reg",
+	"ranges",
+	"dma-ranges",
+	"interrupts",
+};
+
+static BOOLEAN dtslim_name_in_list(const char *name, const char *const *list, int count)
+{
+	int i;
+
+	for (i = 0; i < count; ++i)
+		if (!strncmp(name, list[i], strlen(list[i]) + 1))
+			return TRUE;
+
+	return FALSE;
+}
+
+#define dtslim_name_in(name, list) \
+	dtslim_name_in_list(name, list, sizeof(list) / sizeof(list[0]))
+
+static BOOLEAN dtslim_is_meta(const void *fdt, int node)
+{
+	const char *name = fdt_get_name(fdt, node, NULL);
+
+	return name && dtslim_name_in(name, dtslim_meta);
+}
+
+/**
+ * dtslim_skip() - Find the end of the subtree at @node.
+ * @nodes: Incremented for each node in the subtree, if not NULL.
+ *
+ * Return: Offset of the tag after the END_NODE of @node, or a negative
+ * libfdt error.
+ */
+static int dtslim_skip(const void *fdt, int node, uint32_t *nodes)
+{
+	int off = node, next, depth = 0;
+	uint32_t tag;
+
+	do {
+		tag = fdt_next_tag(fdt, off, &next);
+		if (next < 0)
+			return next;
+
+		if (tag == FDT_BEGIN_NODE) {
+			depth++;
+			if (nodes)
+				(*nodes)++;
+		} else if (tag == FDT_END_NODE) {
+			depth--;
+		} else if (tag == FDT_END) {
+			return -FDT_ERR_TRUNCATED;
+		}
+
+		off = next;
+	} while (depth);
+
+	return off;
+}
+
+/**
+ * dtslim_count() - Add @delta to the references made from the subtree at @node.
+ *
+ * For the root, the overlay metadata is not counted, it goes anyway.
+ */
+static int dtslim_count(struct dtslim_ctx *s, int node, int delta)
+{
+	const struct fdt_property *prop;
+	int off = node, next, depth = 0, len, i;
+	const fdt32_t *cell;
+	const char *name;
+	uint32_t tag, val;
+
+	if (!s->refs)
+		return 0;
+
+	do {
+		tag = fdt_next_tag(s->fdt, off, &next);
+		if (next < 0)
+			return next;
+
+		switch (tag) {
+		case FDT_BEGIN_NODE:
+			if (node == 0 && depth == 1 && dtslim_is_meta(s->fdt, off)) {
+				next = dtslim_skip(s->fdt, off, NULL);
+				if (next < 0)
+					return next;
+				break;
+			}
+			depth++;
+			break;
+		case FDT_END_NODE:
+			depth--;
+			break;
+		case FDT_PROP:
+			prop = fdt_get_property_by_offset(s->fdt, off, &len);
+			if (!prop)
+				return len;
+
+			name = fdt_string(s->fdt, fdt32_to_cpu(prop->nameoff));
+			if (!name || name[0] == '#' ||
+			    dtslim_name_in(name, dtslim_no_refs))
+				break;
+
+			cell = (const fdt32_t *)prop->data;
+			for (i = 0; i < len / sizeof(*cell); ++i) {
+				val = fdt32_to_cpu(cell[i]);
+				if (val && val <= s->max_phandle)
+					s->refs[val] += delta;
+			}
+			break;
+		case FDT_END:
+			return -FDT_ERR_TRUNCATED;
+		}
+
+		off = next;
+	} while (depth);
+
+	return 0;
+}
+
+/**
+ * dtslim_referenced() - Check if a phandle of the subtree at @node is used.
+ *
+ * The references from inside of the subtree must already be subtracted.
+ */
+static BOOLEAN dtslim_referenced(struct dtslim_ctx *s, int node)
+{
+	int off = node, depth;
+	uint32_t phandle;
+
+	for (depth = 0; off >= 0 && depth >= 0; off = fdt_next_node(s->fdt, off, &depth)) {
+		phandle = fdt_get_phandle(s->fdt, off);
+		if (!phandle)
+			continue;
+
+		if (!s->refs || phandle > s->max_phandle || s->refs[phandle])
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static BOOLEAN dtslim_disabled(const void *fdt, int node)
+{
+	const char *status;
+	int len;
+
+	status = fdt_getprop(fdt, node, "status", &len);
+
+	return status && len == sizeof("disabled") && !memcmp(status, "disabled", len);
+}
+
+/**
+ * dtslim_drop() - Decide if the subtree at @node is left out.
+ * @depth: Depth of @node, the root is 0.
+ *
+ * Linux still walks disabled cpus, so nothing under /cpus is dropped.
+ * The references a dropped subtree makes are forgotten, which may let
+ * later subtrees go as well.
+ */
+static BOOLEAN dtslim_drop(struct dtslim_ctx *s, int node, int depth, struct dtslim_stats *stats)
+{
+	if (depth == 1 && dtslim_is_meta(s->fdt, node))
+		return TRUE;
+
+	if (depth == 0 || node == s->cpus || s->in_cpus || !dtslim_disabled(s->fdt, node))
+		return FALSE;
+
+	if (dtslim_count(s, node, -1))
+		return FALSE;
+
+	if (dtslim_referenced(s, node)) {
+		dtslim_count(s, node, 1);
+		stats->kept_disabled++;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static EFI_STATUS dtslim_prepare(struct dtslim_ctx *s, const void *fdt)
+{
+	uint32_t phandle;
+	int node, ret;
+
+	s->fdt = fdt;
+	s->refs = NULL;
+	s->max_phandle = 0;
+	s->cpus = fdt_path_offset(fdt, "/cpus");
+	s->in_cpus = FALSE;
+
+	for (node = 0; node >= 0; node = fdt_next_node(fdt, node, NULL)) {
+		phandle = fdt_get_phandle(fdt, node);
+		if (phandle > s->max_phandle && phandle != (uint32_t)-1)
+			s->max_phandle = phandle;
+	}
+
+	if (s->max_phandle > DTSLIM_MAX_PHANDLE) {
+		s->max_phandle = 0;
+		return EFI_SUCCESS;
+	}
+
+	s->refs = AllocateZeroPool((s->max_phandle + 1) * sizeof(*s->refs));
+	if (!s->refs)
+		return EFI_OUT_OF_RESOURCES;
+
+	ret = dtslim_count(s, 0, 1);
+	if (ret) {
+		FreePool(s->refs);
+		s->refs = NULL;
+		return EFI_LOAD_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * dtslim() - Copy @fdt into @buf, leaving out what the OS doesn't need.
+ * @size: Size of @buf, the result is packed.
+ *
+ * The memory reservations and the boot cpu are kept as is. Since the
+ * overlay metadata is gone, no more overlays can be applied to the
+ * result.
+ *
+ * Return: EFI_BUFFER_TOO_SMALL if the result doesn't fit into @buf.
+ */
+EFI_STATUS dtslim(const void *fdt, void *buf, int size, struct dtslim_stats *stats)
+{
+	const struct fdt_property *prop;
+	int off = 0, next, depth = 0, ret, len, i;
+	struct dtslim_ctx s;
+	uint64_t addr, sz;
+	EFI_STATUS status;
+	uint32_t tag;
+
+	SetMem(stats, sizeof(*stats), 0);
+	stats->size_before = fdt_totalsize(fdt);
+
+	status = dtslim_prepare(&s, fdt);
+	if (EFI_ERROR(status))
+		return status;
+
+	ret = fdt_create(buf, size);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < fdt_num_mem_rsv(fdt); ++i) {
+		ret = fdt_get_mem_rsv(fdt, i, &addr, &sz);
+		if (ret)
+			goto out;
+
+		ret = fdt_add_reservemap_entry(buf, addr, sz);
+		if (ret)
+			goto out;
+	}
+
+	ret = fdt_finish_reservemap(buf);
+	if (ret)
+		goto out;
+
+	do {
+		tag = fdt_next_tag(fdt, off, &next);
+		if (next < 0) {
+			ret = next;
+			goto out;
+		}
+
+		switch (tag) {
+		case FDT_BEGIN_NODE:
+			if (dtslim_drop(&s, off, depth, stats)) {
+				next = dtslim_skip(fdt, off, &stats->dropped);
+				if (next < 0) {
+					ret = next;
+					goto out;
+				}
+				break;
+			}
+
+			ret = fdt_begin_node(buf, fdt_get_name(fdt, off, NULL));
+			stats->nodes++;
+			depth++;
+			if (off == s.cpus)
+				s.in_cpus = TRUE;
+			break;
+		case FDT_END_NODE:
+			ret = fdt_end_node(buf);
+			depth--;
+			/* /cpus is at the root, back there it's done. */
+			if (depth == 1)
+				s.in_cpus = FALSE;
+			break;
+		case FDT_PROP:
+			prop = fdt_get_property_by_offset(fdt, off, &len);
+			if (!prop) {
+				ret = len;
+				goto out;
+			}
+
+			ret = fdt_property(buf, fdt_string(fdt, fdt32_to_cpu(prop->nameoff)),
+					   prop->data, len);
+			break;
+		}
+
+		if (ret)
+			goto out;
+
+		off = next;
+	} while (tag != FDT_END);
+
+	ret = fdt_finish(buf);
+	if (ret)
+		goto out;
+
+	fdt_set_boot_cpuid_phys(buf, fdt_boot_cpuid_phys(fdt));
+	stats->size_after = fdt_totalsize(buf);
+
+out:
+	if (s.refs)
+		FreePool(s.refs);
+
+	if (ret == -FDT_ERR_NOSPACE)
+		return EFI_BUFFER_TOO_SMALL;
+	if (ret) {
+		Dbg(L"dtslim failed: %a\n", fdt_strerror(ret));
+		return EFI_LOAD_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
@@ -0,0 +1,22 @@
+#ifndef DTSLIM_H
+#define DTSLIM_H
+
+#include <stdint.h>
+#include <efi.h>
+
+/*
+ * Rebuild a dtb without what the OS has no use for: overlay metadata,
+ * disabled subtrees nothing points at, NOPs and duplicate strings.
+ */
+
+struct dtslim_stats {
+	uint32_t nodes;		/* Nodes kept. */
+	uint32_t dropped;	/* Nodes dropped, including subnodes. */
+	uint32_t kept_disabled;	/* Disabled nodes kept for their phandles. */
+	uint32_t size_before;
+	uint32_t size_after;
+};
+
+EFI_STATUS dtslim(const void *fdt, void *buf, int size, struct dtslim_stats *stats);
+
+#endif
@@ -0,0 +1,346 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+
+#include "arch.h"
+#include "sl.h"
+#include "fbcon.h"
+
+#define FONT_W		5
+#define FONT_H		7
+#define FONT_FIRST	' '
+#define FONT_LAST	'Z'
+
+/* 5x7 glyphs, one byte per row, MSB on the left. */
+static const uint8_t fbcon_font[FONT_LAST - FONT_FIRST + 1][FONT_H] = {
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* ' ' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '!' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '"' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '#' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '$' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '%' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '&' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* ''' */
+	{ 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 },	/* '(' */
+	{ 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 },	/* ')' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '*' */
+	{ 0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00 },	/* '+' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08 },	/* ',' */
+	{ 0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00 },	/* '-' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c },	/* '.' */
+	{ 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 },	/* '/' */
+	{ 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },	/* '0' */
+	{ 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },	/* '1' */
+	{ 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },	/* '2' */
+	{ 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },	/* '3' */
+	{ 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },	/* '4' */
+	{ 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },	/* '5' */
+	{ 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },	/* '6' */
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },	/* '7' */
+	{ 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },	/* '8' */
+	{ 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },	/* '9' */
+	{ 0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00 },	/* ':' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* ';' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '<' */
+	{ 0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00 },	/* '=' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '>' */
+	{ 0x0e, 0x11, 0x01, 0x02, 0x04, 0x00, 0x04 },	/* '?' */
+	{ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },	/* '@' */
+	{ 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },	/* 'A' */
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e },	/* 'B' */
+	{ 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e },	/* 'C' */
+	{ 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c },	/* 'D' */
+	{ 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f },	/* 'E' */
+	{ 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 },	/* 'F' */
+	{ 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f },	/* 'G' */
+	{ 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },	/* 'H' */
+	{ 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e },	/* 'I' */
+	{ 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c },	/* 'J' */
+	{ 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },	/* 'K' */
+	{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f },	/* 'L' */
+	{ 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 },	/* 'M' */
+	{ 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },	/* 'N' */
+	{ 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },	/* 'O' */
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 },	/* 'P' */
+	{ 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d },	/* 'Q' */
+	{ 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 },	/* 'R' */
+	{ 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e },	/* 'S' */
+	{ 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },	/* 'T' */
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },	/* 'U' */
+	{ 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 },	/* 'V' */
+	{ 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a },	/* 'W' */
+	{ 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 },	/* 'X' */
+	{ 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 },	/* 'Y' */
+	{ 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f },	/* 'Z' */
+};
+
+/**
+ * fbcon_fill() - Fill pixels with a color.
+ * @dst:   First pixel.
+ * @color: Color to fill with.
+ * @count: Number of pixels.
+ *
+ * With MMU off the framebuffer is Device memory and every store is a
+ * separate bus transaction, so fill in 64 byte bursts of stp.
+ */
+void fbcon_fill(uint32_t *dst, uint32_t color, uint64_t count)
+{
+	uint64_t c2 = ((uint64_t)color << 32) | color;
+
+	if (((uint64_t)dst & 7) && count) {
+		*dst++ = color;
+		count--;
+	}
+
+	for (; count >= 16; count -= 16, dst += 16) {
+		__asm__ volatile(
+			"stp	%1, %1, [%0, #0]\n\t"
+			"stp	%1, %1, [%0, #16]\n\t"
+			"stp	%1, %1, [%0, #32]\n\t"
+			"stp	%1, %1, [%0, #48]\n\t"
+			: : "r" (dst), "r" (c2) : "memory"
+		);
+	}
+
+	while (count--)
+		*dst++ = color;
+}
+
+/**
+ * fbcon_copy() - Copy pixels, i.e. from one line to another.
+ * @dst:   First destination pixel.
+ * @src:   First source pixel.
+ * @count: Number of pixels.
+ *
+ * Same as fbcon_fill(), uses 64 byte ldp/stp bursts if both pointers
+ * can be 8 byte aligned at the same time.
+ */
+void fbcon_copy(uint32_t *dst, const uint32_t *src, uint64_t count)
+{
+	uint64_t a, b, c, d;
+
+	if (((uint64_t)dst ^ (uint64_t)src) & 7)
+		goto tail;
+
+	if (((uint64_t)dst & 7) && count) {
+		*dst++ = *src++;
+		count--;
+	}
+
+	for (; count >= 16; count -= 16, dst += 16, src += 16) {
+		__asm__ volatile(
+			"ldp	%0, %1, [%5, #0]\n\t"
+			"ldp	%2, %3, [%5, #16]\n\t"
+			"stp	%0, %1, [%4, #0]\n\t"
+			"stp	%2, %3, [%4, #16]\n\t"
+			"ldp	%0, %1, [%5, #32]\n\t"
+			"ldp	%2, %3, [%5, #48]\n\t"
+			"stp	%0, %1, [%4, #32]\n\t"
+			"stp	%2, %3, [%4, #48]\n\t"
+			: "=&r" (a), "=&r" (b), "=&r" (c), "=&r" (d)
+			: "r" (dst), "r" (src) : "memory"
+		);
+	}
+
+tail:
+	while (count--)
+		*dst++ = *src++;
+}
+
+/**
+ * fbcon_init() - Set up the console.
+ * @fb:     Console to initialize.
+ * @base:   Framebuffer base address.
+ * @stride: Framebuffer stride in pixels.
+ * @y:      First line to draw on, in pixels.
+ *
+ * The glyphs are scaled so a line fits about 64 characters.
+ */
+void fbcon_init(struct fbcon *fb, uint64_t base, uint64_t stride, uint64_t y)
+{
+	fb->base = (uint32_t *)base;
+	fb->stride = stride;
+	fb->x = 0;
+	fb->y = y;
+	fb->fg = FBCON_WHITE;
+	fb->bg = FBCON_BLACK;
+	fb->scale = stride / (64 * (FONT_W + 1));
+	if (fb->scale == 0)
+		fb->scale = 1;
+}
+
+static void fbcon_newline(struct fbcon *fb)
+{
+	fb->x = 0;
+	fb->y += (FONT_H + 1) * fb->scale;
+}
+
+/**
+ * fbcon_putc() - Draw one character at the cursor and advance it.
+ * @fb: Console to draw on.
+ * @c:  Character, lowercase is drawn as uppercase.
+ *
+ * Only the first line of every glyph row is drawn pixel by pixel,
+ * the rest of the scaled row is copied from it.
+ */
+void fbcon_putc(struct fbcon *fb, char c)
+{
+	uint64_t cell_w = (FONT_W + 1) * fb->scale;
+	uint32_t *line;
+	uint64_t run;
+	int row, col, set;
+
+	if (c == '\n') {
+		fbcon_newline(fb);
+		return;
+	}
+
+	if (fb->x + cell_w > fb->stride)
+		fbcon_newline(fb);
+
+	if (c >= 'a' && c <= 'z')
+		c -= 'a' - 'A';
+	if (c < FONT_FIRST || c > FONT_LAST)
+		c = ' ';
+
+	line = fb->base + fb->y * fb->stride + fb->x;
+
+	for (row = 0; row < FONT_H; row++) {
+		uint8_t bits = fbcon_font[c - FONT_FIRST][row];
+		uint32_t *px = line;
+
+		/* Draw runs of the same color at once. */
+		for (col = 0; col < FONT_W; col += run) {
+			set = bits & (1 << (FONT_W - 1 - col));
+			for (run = 1; col + run < FONT_W; run++)
+				if (!!(bits & (1 << (FONT_W - 1 - col - run))) != !!set)
+					break;
+
+			fbcon_fill(px, set ? fb->fg : fb->bg, run * fb->scale);
+			px += run * fb->scale;
+		}
+		fbcon_fill(px, fb->bg, fb->scale);
+
+		for (col = 1; col < fb->scale; col++)
+			fbcon_copy(line + col * fb->stride, line, cell_w);
+
+		line += fb->scale * fb->stride;
+	}
+
+	for (row = 0; row < fb->scale; row++, line += fb->stride)
+		fbcon_fill(line, fb->bg, cell_w);
+
+	fb->x += cell_w;
+}
+
+void fbcon_puts(struct fbcon *fb, const char *s)
+{
+	while (*s)
+		fbcon_putc(fb, *s++);
+}
+
+void fbcon_puthex(struct fbcon *fb, uint64_t val)
+{
+	int i;
+
+	fbcon_puts(fb, "0x");
+	for (i = 60; i > 0 && !(val >> i); i -= 4)
+		;
+
+	for (; i >= 0; i -= 4)
+		fbcon_putc(fb, "0123456789ABCDEF"[(val >> i) & 0xf]);
+}
+
+void fbcon_putdec(struct fbcon *fb, uint64_t val)
+{
+	char buf[21];
+	int i = sizeof(buf) - 1;
+
+	buf[i] = '\0';
+	do {
+		buf[--i] = '0' + val % 10;
+		val /= 10;
+	} while (val);
+
+	fbcon_puts(fb, &buf[i]);
+}
+
+/**
+ * tb_report() - Show the bounce report on the screen.
+ * @tb_data: tb_data passed to tb_entry, holds the framebuffer.
+ *
+ * Called from tb_entry in EL2 on a private stack, shows the current EL,
+ * the phases recorded with sl_report_add() with how long each of them
+ * took and the time it took to get from each of them to here, and the
+ * latency histogram if sltest ran with --timing.
+ */
+void tb_report(struct sl_tb_data *tb_data)
+{
+	uint64_t now = read_sysreg(cntvct_el0);
+	struct sl_report *rep = &sl_report;
+	struct sl_report_hist *hist = &rep->hist;
+	uint64_t band = 16 * tb_data->tcr;
+	struct fbcon fb;
+	int i;
+
+	/* The green band is what users look for, keep it. */
+	fbcon_fill((uint32_t *)tb_data->sp, FBCON_GREEN, band);
+	fbcon_init(&fb, tb_data->sp, tb_data->tcr, 32);
+
+	fbcon_puts(&fb, "SLBOUNCE: RUNNING IN EL");
+	fbcon_putdec(&fb, (read_sysreg(CurrentEL) >> 2) & 3);
+	fbcon_putc(&fb, '\n');
+
+	if (rep->magic != SL_REPORT_MAGIC || !rep->freq) {
+		fbcon_puts(&fb, "NO REPORT\n");
+		return;
+	}
+
+	fbcon_puts(&fb, "CNTFRQ ");
+	fbcon_putdec(&fb, rep->freq);
+	fbcon_puts(&fb, "\n\n");
+
+	for (i = 0; i < rep->count && i < SL_REPORT_MAX; i++) {
+		struct sl_report_entry *ent = &rep->entries[i];
+
+		fb.fg = ent->value ? FBCON_RED : FBCON_WHITE;
+		fbcon_puts(&fb, ent->name);
+		fbcon_puts(&fb, " = ");
+		fbcon_puthex(&fb, ent->value);
+		fbcon_puts(&fb, " +");
+		fbcon_putdec(&fb, (ent->time - ent->start) * 1000000 / rep->freq);
+		fbcon_puts(&fb, " US T-");
+		fbcon_putdec(&fb, (now - ent->time) * 1000000 / rep->freq);
+		fbcon_puts(&fb, " US\n");
+	}
+
+	if (!hist->count)
+		return;
+
+	fb.fg = FBCON_WHITE;
+	fbcon_putc(&fb, '\n');
+	fbcon_puts(&fb, hist->name);
+	fbcon_puts(&fb, " X");
+	fbcon_putdec(&fb, hist->count);
+	fbcon_puts(&fb, ": MIN ");
+	fbcon_putdec(&fb, hist->min * 1000000 / rep->freq);
+	fbcon_puts(&fb, " AVG ");
+	fbcon_putdec(&fb, hist->total / hist->count * 1000000 / rep->freq);
+	fbcon_puts(&fb, " MAX ");
+	fbcon_putdec(&fb, hist->max * 1000000 / rep->freq);
+	fbcon_puts(&fb, " US\n");
+
+	/* Lower bound of every bucket in us, the last one is open. */
+	for (i = 0; i < SL_REPORT_HIST; i++) {
+		if (!hist->buckets[i])
+			continue;
+
+		fbcon_putdec(&fb, i ? 1ull << i : 0);
+		fbcon_puts(&fb, i == SL_REPORT_HIST - 1 ? "+ US: " : " US: ");
+		fbcon_putdec(&fb, hist->buckets[i]);
+		fbcon_putc(&fb, '\n');
+	}
+}
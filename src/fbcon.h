@@ -0,0 +1,39 @@
+#ifndef FBCON_H
+#define FBCON_H
+
+#include <stdint.h>
+
+#include "sl.h"
+
+#define FBCON_BLACK	0x00000000
+#define FBCON_WHITE	0x00ffffff
+#define FBCON_GREEN	0x0000ff00
+#define FBCON_RED	0x00ff0000
+
+/*
+ * Minimal text console on a linear 32bpp framebuffer.
+ *
+ * This code runs in EL2 right after tcblaunch returns to us, with MMU
+ * off and without boot services, so it can't use FP/SIMD registers
+ * and all framebuffer accesses must be naturally aligned.
+ */
+struct fbcon {
+	uint32_t *base;
+	uint64_t stride;	/* In pixels. */
+	uint64_t x, y;		/* Cursor position, in pixels. */
+	uint32_t fg, bg;
+	uint32_t scale;
+};
+
+void fbcon_fill(uint32_t *dst, uint32_t color, uint64_t count);
+void fbcon_copy(uint32_t *dst, const uint32_t *src, uint64_t count);
+
+void fbcon_init(struct fbcon *fb, uint64_t base, uint64_t stride, uint64_t y);
+void fbcon_putc(struct fbcon *fb, char c);
+void fbcon_puts(struct fbcon *fb, const char *s);
+void fbcon_puthex(struct fbcon *fb, uint64_t val);
+void fbcon_putdec(struct fbcon *fb, uint64_t val);
+
+void tb_report(struct sl_tb_data *tb_data);
+
+#endif
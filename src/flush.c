@@ -0,0 +1,210 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "arch.h"
+#include "capture.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "pmu.h"
+#include "dirty.h"
+#include "idmap.h"
+#include "flush.h"
+
+struct flush_range {
+	uint64_t start;
+	uint64_t size;
+};
+
+/*
+ * Loader buffers that were cleaned to PoC as they were written and
+ * are not going to be touched before EBS, so we can skip them later.
+ */
+static struct flush_range flush_clean[FLUSH_CLEAN_CNT];
+
+/* EFI memory type of the range being flushed, for the accounting. */
+static uint32_t flush_cur_type;
+
+static enum flush_strategy flush_strategy = FLUSH_PER_VA;
+
+/**
+ * flush_mark_clean() - Exclude an already clean loader buffer from the EBS flush.
+ * @id: Which buffer it is, the range marked for it before is forgotten.
+ *
+ * The caller must make sure nothing writes to the range after it
+ * was cleaned, or that data will be lost. The range is only skipped
+ * if it is still LoaderData in the final memory map.
+ */
+void flush_mark_clean(enum flush_clean_id id, uint64_t start, uint64_t size)
+{
+	flush_clean[id].start = start;
+	flush_clean[id].size = size;
+}
+
+/* Forget the clean buffers the loader has freed, the memory may be reused. */
+static void flush_check_clean(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	EFI_MEMORY_DESCRIPTOR *desc;
+	uint64_t start, end;
+	BOOLEAN allocated;
+	int id, i;
+
+	for (id = 0; id < FLUSH_CLEAN_CNT; ++id) {
+		if (!flush_clean[id].size)
+			continue;
+
+		start = flush_clean[id].start;
+		end = start + flush_clean[id].size;
+		allocated = FALSE;
+
+		for (i = 0; i < map_size / desc_size && !allocated; ++i) {
+			desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+			allocated = desc->Type == EfiLoaderData && desc->PhysicalStart <= start &&
+				    desc->PhysicalStart + desc->NumberOfPages * 4096 >= end;
+		}
+
+		if (!allocated)
+			flush_clean[id].size = 0;
+	}
+}
+
+static void flush_range(uint64_t start, uint64_t end)
+{
+	uint64_t cstart, cend;
+	int i;
+
+	for (i = 0; i < FLUSH_CLEAN_CNT; ++i) {
+		if (!flush_clean[i].size)
+			continue;
+
+		cstart = flush_clean[i].start;
+		cend = cstart + flush_clean[i].size;
+
+		if (cend <= start || cstart >= end)
+			continue;
+
+		/* Flush around the clean range, the rest is checked again. */
+		if (cstart > start)
+			flush_range(start, cstart);
+		if (cend < end)
+			flush_range(cend, end);
+		return;
+	}
+
+	uint64_t t = arch_counter();
+
+	if (flush_strategy == FLUSH_CLEAN)
+		clean_dcache_range(start, end - start);
+	else
+		clear_dcache_range(start, end - start);
+	t = arch_counter() - t;
+
+	telemetry_add_flush(flush_cur_type, end - start, t);
+	Trace(TRACE_FLUSH, start, end - start, t, flush_cur_type);
+#ifdef SLBOUNCE_CAPTURE
+	capture_add_range(start, end - start, t, flush_cur_type);
+#endif
+}
+
+/**
+ * flush_type_needed() - Check if the EBS flush covers a memory type.
+ *
+ * These are the types the loader or the firmware might have written.
+ */
+BOOLEAN flush_type_needed(UINT32 type)
+{
+	switch (type) {
+	case EfiLoaderCode:
+	case EfiLoaderData:
+	case EfiBootServicesCode:
+	case EfiBootServicesData:
+	case EfiRuntimeServicesCode:
+	case EfiRuntimeServicesData:
+	case EfiACPIReclaimMemory:
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+/**
+ * flush_set_strategy() - Choose how flush_memory_map() cleans the caches.
+ *
+ * FLUSH_SET_WAY is not safe on its own and is treated as FLUSH_PER_VA.
+ */
+void flush_set_strategy(enum flush_strategy strategy)
+{
+	if (strategy >= FLUSH_SET_WAY)
+		strategy = FLUSH_PER_VA;
+
+	flush_strategy = strategy;
+}
+
+/**
+ * flush_memory_map() - Flush all memory the loader might have written.
+ *
+ * With dirty tracking, only the pages written since it was started.
+ * Unless flushing per entry, adjacent entries are flushed as one
+ * range, accounted to the type of the first one. With the block-mapped
+ * identity map, it is only used for the flush itself.
+ */
+void flush_memory_map(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	EFI_MEMORY_DESCRIPTOR *desc;
+	uint64_t start, size, run_start = 0, run_end = 0;
+	int i;
+
+	pmu_begin(PMU_FLUSH);
+	flush_check_clean(map, map_size, desc_size);
+	idmap_enter(map, map_size, desc_size);
+
+	for (i = 0; i < map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+		start = desc->PhysicalStart;
+		size  = desc->NumberOfPages * 4096;
+
+		if (!flush_type_needed(desc->Type))
+			continue;
+
+		if (flush_strategy != FLUSH_PER_VA && run_end && start == run_end) {
+			run_end += size;
+			continue;
+		}
+
+		if (run_end)
+			dirty_walk(run_start, run_end, flush_range);
+
+		flush_cur_type = desc->Type;
+		run_start = start;
+		run_end = start + size;
+	}
+
+	if (run_end)
+		dirty_walk(run_start, run_end, flush_range);
+
+	idmap_exit();
+	pmu_end(PMU_FLUSH);
+}
+
+/**
+ * flush_clean_memory_map() - Clean what flush_memory_map() would flush.
+ *
+ * Used as the baseline for dirty tracking, the lines stay valid. This
+ * doesn't count towards the flush telemetry.
+ */
+void flush_clean_memory_map(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	EFI_MEMORY_DESCRIPTOR *desc;
+	int i;
+
+	for (i = 0; i < map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+
+		if (flush_type_needed(desc->Type))
+			clean_dcache_range(desc->PhysicalStart, desc->NumberOfPages * 4096);
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef FLUSH_H
+#define FLUSH_H
+
+#include <stdint.h>
+#include <efi.h>
+
+/* Buffers cleaned as they were written, a new range replaces the old one. */
+enum flush_clean_id {
+	FLUSH_CLEAN_INITRD,
+	FLUSH_CLEAN_CNT,
+};
+
+/* Never renumber, the telemetry records the number. */
+enum flush_strategy {
+	FLUSH_PER_VA		= 0,	/* dc civac over each memory map entry. */
+	FLUSH_COALESCED		= 1,	/* Same, adjacent entries merged. */
+	FLUSH_CLEAN		= 2,	/* Coalesced with dc cvac, lines stay valid. */
+	FLUSH_SET_WAY		= 3,	/* Only estimated, misses system caches. */
+	FLUSH_STRATEGIES,
+};
+
+BOOLEAN flush_type_needed(UINT32 type);
+void flush_set_strategy(enum flush_strategy strategy);
+void flush_mark_clean(enum flush_clean_id id, uint64_t start, uint64_t size);
+void flush_memory_map(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+void flush_clean_memory_map(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+
+#endif
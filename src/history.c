@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "telemetry.h"
+#include "history.h"
+
+#define HISTORY_VAR_ATTRS \
+	(EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+/* Telemetry phases the history keeps durations of. */
+static const enum telemetry_event history_phase_events[HISTORY_PHASES] = {
+	[HISTORY_CREATE]	= TELEMETRY_CREATE,
+	[HISTORY_DT_FIXUP]	= TELEMETRY_DT_FIXUP,
+	[HISTORY_POLICY]	= TELEMETRY_POLICY,
+	[HISTORY_FLUSH]		= TELEMETRY_FLUSH,
+	[HISTORY_EBS]		= TELEMETRY_EBS,
+	[HISTORY_AUTH]		= TELEMETRY_AUTH,
+	[HISTORY_LAUNCH]	= TELEMETRY_LAUNCH,
+};
+
+/**
+ * history_is_ram() - Check that a range is in cacheable RAM.
+ *
+ * The address comes from the previous boot, so it may not even be
+ * memory on this one if the memory map changed.
+ */
+static BOOLEAN history_is_ram(uint64_t addr, uint64_t size)
+{
+	EFI_MEMORY_DESCRIPTOR *map, *desc;
+	UINTN count, key, desc_size, i;
+	UINT32 desc_ver;
+	BOOLEAN ret = FALSE;
+
+	map = LibMemoryMap(&count, &key, &desc_size, &desc_ver);
+	if (!map)
+		return FALSE;
+
+	for (i = 0; i < count; i++) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+
+		if (addr < desc->PhysicalStart ||
+		    addr + size > desc->PhysicalStart + desc->NumberOfPages * 4096)
+			continue;
+
+		ret = (desc->Attribute & EFI_MEMORY_WB) && desc->Type != EfiMemoryMappedIO;
+		break;
+	}
+
+	FreePool(map);
+
+	return ret;
+}
+
+static uint32_t history_us(const struct telemetry_record *rec, enum telemetry_event ev)
+{
+	const struct telemetry_event_rec *e = &rec->events[ev];
+	uint64_t us;
+
+	if (!e->count)
+		return 0;
+
+	if (!e->end || e->end < e->start)
+		return HISTORY_UNFINISHED;
+
+	us = (e->end - e->start) * 1000000 / rec->freq;
+
+	return us < HISTORY_UNFINISHED ? us : HISTORY_UNFINISHED - 1;
+}
+
+/**
+ * history_fill() - Summarize the telemetry of an attempt.
+ * @r:   Record to fill, stamp and flags must be set already.
+ * @rec: Telemetry of the attempt, if it survived.
+ */
+static void history_fill(struct history_rec *r, const struct telemetry_record *rec)
+{
+	const struct telemetry_event_rec *launch;
+	int i;
+
+	if (!rec)
+		return;
+
+	r->flags |= HISTORY_F_FOUND;
+
+	launch = &rec->events[TELEMETRY_LAUNCH];
+	if (launch->count)
+		r->flags |= HISTORY_F_LAUNCH;
+	if (launch->end && launch->value == 2)
+		r->flags |= HISTORY_F_EL2;
+	if (rec->events[TELEMETRY_BOOTI].count)
+		r->flags |= HISTORY_F_BOOTI;
+
+	r->available = rec->events[TELEMETRY_AVAILABLE].value;
+	r->auth = rec->events[TELEMETRY_AUTH].value;
+	r->ebs = rec->events[TELEMETRY_EBS].value;
+
+	for (i = 0; i < HISTORY_PHASES; i++)
+		r->us[i] = history_us(rec, history_phase_events[i]);
+
+	for (i = 0; i < TELEMETRY_MEM_TYPES; i++) {
+		r->flush_bytes += rec->flush[i].bytes;
+		r->flush_ranges += rec->flush[i].ranges;
+	}
+}
+
+static struct history_var *history = NULL;
+static BOOLEAN history_dirty = FALSE;
+
+/*
+ * dtbhack and slbounce share one telemetry record per boot, so the
+ * attempt is named by whichever of them started first. The one that
+ * runs second doesn't change the name, so it has nothing to write.
+ */
+static uint64_t history_stamp(const struct telemetry_record *rec)
+{
+	const struct telemetry_event_rec *dtbhack = &rec->events[TELEMETRY_DTBHACK];
+	const struct telemetry_event_rec *load = &rec->events[TELEMETRY_LOAD];
+
+	if (!dtbhack->count)
+		return load->start;
+	if (!load->count)
+		return dtbhack->start;
+
+	return dtbhack->start < load->start ? dtbhack->start : load->start;
+}
+
+/**
+ * history_load() - Read the history and record the previous attempt.
+ *
+ * Must be called before telemetry_init(), which may reuse the memory
+ * the previous record was in. The telemetry of the previous attempt
+ * is looked up at the address remembered by history_save(), so the
+ * result is only known if the memory was not cleared by the reboot.
+ * An attempt that left nothing behind is still recorded, so reboot
+ * loops show up as a run of records without HISTORY_F_EL2.
+ */
+EFI_STATUS history_load(void)
+{
+	EFI_GUID HistoryGuid = HISTORY_VAR_GUID;
+	EFI_GUID TelemetryGuid = TELEMETRY_GUID;
+	const struct telemetry_record *prev = NULL;
+	struct history_header *hdr;
+	struct history_rec *r;
+	UINTN size = sizeof(*history);
+	UINT32 attrs;
+	EFI_STATUS status;
+	VOID *table;
+
+	if (history)
+		return EFI_SUCCESS;
+
+	history = AllocateZeroPool(sizeof(*history));
+	if (!history)
+		return EFI_OUT_OF_RESOURCES;
+
+	hdr = &history->hdr;
+
+	status = uefi_call_wrapper(RT->GetVariable, 5, HISTORY_VAR_NAME, &HistoryGuid, &attrs, &size, history);
+	if (EFI_ERROR(status) || size != sizeof(*history) || hdr->magic != HISTORY_MAGIC ||
+	    hdr->version != HISTORY_VERSION || hdr->records != HISTORY_RECORDS ||
+	    hdr->next >= HISTORY_RECORDS) {
+		SetMem(history, sizeof(*history), 0);
+		hdr->magic = HISTORY_MAGIC;
+		hdr->version = HISTORY_VERSION;
+		hdr->records = HISTORY_RECORDS;
+	}
+
+	if (!hdr->pending_stamp)
+		return EFI_SUCCESS;
+
+	/* The other of dtbhack and slbounce ran on this boot and did it already. */
+	status = LibGetSystemConfigurationTable(&TelemetryGuid, &table);
+	if (!EFI_ERROR(status) && (uint64_t)table == hdr->pending_addr)
+		return EFI_SUCCESS;
+
+	if (hdr->pending_addr && history_is_ram(hdr->pending_addr, sizeof(*prev))) {
+		prev = (const struct telemetry_record *)hdr->pending_addr;
+
+		if (prev->magic != TELEMETRY_MAGIC || prev->version != TELEMETRY_VERSION ||
+		    prev->size != sizeof(*prev) || !prev->freq ||
+		    history_stamp(prev) != hdr->pending_stamp)
+			prev = NULL;
+	}
+
+	r = &history->recs[hdr->next];
+	SetMem(r, sizeof(*r), 0);
+	r->stamp = hdr->pending_stamp;
+	history_fill(r, prev);
+
+	hdr->next = (hdr->next + 1) % HISTORY_RECORDS;
+	hdr->boots++;
+	hdr->pending_addr = 0;
+	hdr->pending_stamp = 0;
+	history_dirty = TRUE;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * history_save() - Remember this attempt and write the history.
+ * @cur: Telemetry of this attempt, may be NULL.
+ *
+ * The variable is only written if something changed, which is once
+ * per boot even if both dtbhack and slbounce run: the second one finds
+ * the previous attempt recorded and this one pending already.
+ */
+EFI_STATUS history_save(const struct telemetry_record *cur)
+{
+	EFI_GUID HistoryGuid = HISTORY_VAR_GUID;
+	struct history_header *hdr;
+	EFI_STATUS status;
+
+	if (!history)
+		return EFI_NOT_READY;
+
+	hdr = &history->hdr;
+
+	if (cur && (hdr->pending_addr != (uint64_t)cur || hdr->pending_stamp != history_stamp(cur))) {
+		hdr->pending_addr = (uint64_t)cur;
+		hdr->pending_stamp = history_stamp(cur);
+		history_dirty = TRUE;
+	}
+
+	if (!history_dirty)
+		return EFI_SUCCESS;
+
+	status = uefi_call_wrapper(RT->SetVariable, 5, HISTORY_VAR_NAME, &HistoryGuid,
+				   HISTORY_VAR_ATTRS, sizeof(*history), history);
+	if (!EFI_ERROR(status))
+		history_dirty = FALSE;
+
+	return status;
+}
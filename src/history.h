@@ -0,0 +1,77 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+
+/*
+ * Outcomes of the last few boot attempts, kept in an NV variable so
+ * regressions and reboot loops can be seen from the OS. The variable
+ * is written once per boot, at load, with the result of the previous
+ * attempt taken from its telemetry record if the memory survived the
+ * reboot. The layout is shared with tools/slhistory.c, which builds
+ * with HISTORY_FORMAT_ONLY.
+ */
+
+#define HISTORY_MAGIC		0x54534853	// 'SHST'
+#define HISTORY_VERSION		1
+#define HISTORY_RECORDS		16
+#define HISTORY_VAR_NAME	L"SlbounceHistory"
+
+#define HISTORY_VAR_GUID \
+    { 0x1f6d8a3c, 0x95b2, 0x4c70, {0xb4, 0x1e, 0x7a, 0x28, 0xd3, 0x60, 0xc5, 0x9f} }
+
+#define HISTORY_F_FOUND		(1 << 0)	/* The telemetry record survived. */
+#define HISTORY_F_LAUNCH	(1 << 1)	/* SL_CMD_LAUNCH was attempted. */
+#define HISTORY_F_EL2		(1 << 2)	/* Came back in EL2. */
+#define HISTORY_F_BOOTI		(1 << 3)	/* Booted the kernel directly. */
+
+#define HISTORY_UNFINISHED	0xffffffff	/* Phase started but didn't end. */
+
+/* Phases with a duration in the record, a subset of the telemetry. */
+enum history_phase {
+	HISTORY_CREATE,
+	HISTORY_DT_FIXUP,
+	HISTORY_POLICY,
+	HISTORY_FLUSH,
+	HISTORY_EBS,
+	HISTORY_AUTH,
+	HISTORY_LAUNCH,
+	HISTORY_PHASES,
+};
+
+struct history_rec {
+	uint64_t stamp;			/* cntvct_el0 at the start, 0 if empty. */
+	uint32_t flags;
+	uint32_t available;		/* SL_CMD_IS_AVAILABLE result */
+	uint32_t auth;			/* SL_CMD_AUTH result */
+	uint32_t ebs;			/* ExitBootServices() status, low bits. */
+	uint32_t us[HISTORY_PHASES];	/* 0 if the phase didn't happen. */
+	uint32_t flush_ranges;
+	uint64_t flush_bytes;
+};
+
+struct history_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t records;		/* HISTORY_RECORDS */
+	uint32_t next;			/* Slot the next record goes to. */
+	uint32_t boots;			/* Attempts recorded so far. */
+	uint64_t pending_addr;		/* Telemetry of the attempt in progress. */
+	uint64_t pending_stamp;		/* Its start timestamp, to tell it's the same one. */
+};
+
+struct history_var {
+	struct history_header hdr;
+	struct history_rec recs[HISTORY_RECORDS];
+};
+
+#ifndef HISTORY_FORMAT_ONLY
+#include <efi.h>
+
+#include "telemetry.h"
+
+EFI_STATUS history_load(void);
+EFI_STATUS history_save(const struct telemetry_record *cur);
+#endif
+
+#endif
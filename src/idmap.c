@@ -0,0 +1,359 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <sysreg/currentel.h>
+
+#include "util.h"
+#include "arch.h"
+#include "trace.h"
+#include "idmap.h"
+
+#ifdef SLBOUNCE_IDMAP
+
+/* Stage 1 descriptors, 4K granule. */
+#define PTE_VALID		(1ull << 0)
+#define PTE_TABLE		(1ull << 1)	/* A page at level 3. */
+#define PTE_AF			(1ull << 10)
+#define PTE_CONT		(1ull << 52)
+#define PTE_ADDR_MASK		0x0000fffffffff000ull
+
+/* What must match for entries to be merged into a block. */
+#define PTE_ATTRS_MASK		(~(PTE_ADDR_MASK | PTE_AF | PTE_CONT | PTE_TABLE | PTE_VALID))
+
+#define TCR_T0SZ(tcr)		((tcr) & 0x3f)
+#define TCR_EPD0		(1ull << 7)
+#define TCR_TG0(tcr)		(((tcr) >> 14) & 0x3)
+#define TCR_TG0_4K		0
+
+#define TTBR_BADDR_MASK		0x0000fffffffffffeull
+
+#define IDMAP_LEVEL_SHIFT(l)	(12 + 9 * (3 - (l)))
+#define IDMAP_ENTRIES		512
+#define IDMAP_STACK		(64 * 1024)	/* Around the frame of idmap_enter(). */
+#define IDMAP_MAX_EXCLUDE	4
+
+static uint64_t *idmap_tables = NULL;	/* IDMAP_PAGES of them. */
+static int idmap_used;
+static uint64_t idmap_fw_ttbr;
+static BOOLEAN idmap_on = FALSE;
+static uint64_t idmap_blocks[2];	/* 1G and 2M ones. */
+
+/* Ranges used while switching the tables, i.e. our image and tables. */
+static struct {
+	uint64_t start;
+	uint64_t end;
+} idmap_excluded[IDMAP_MAX_EXCLUDE];
+static int idmap_excluded_cnt = 0;
+static uint64_t idmap_stack;
+
+static BOOLEAN idmap_tcr_usable(uint64_t tcr)
+{
+	return TCR_TG0(tcr) == TCR_TG0_4K && !(tcr & TCR_EPD0) && 64 - TCR_T0SZ(tcr) <= 48;
+}
+
+static int idmap_root_level(uint64_t va_bits)
+{
+	if (va_bits > 39)
+		return 0;
+	if (va_bits > 30)
+		return 1;
+	return 2;
+}
+
+/**
+ * idmap_init() - Reserve the pages for the block-mapped tables.
+ *
+ * The tables are only built in the EBS hook, when the memory map is
+ * final and nothing can be allocated anymore.
+ *
+ * Return: EFI_UNSUPPORTED if the firmware's translation can't be copied.
+ */
+EFI_STATUS idmap_init(void)
+{
+	EFI_PHYSICAL_ADDRESS tables;
+	EFI_STATUS status;
+
+	if (read_currentel().el != 1 || !idmap_tcr_usable(read_sysreg(tcr_el1)))
+		return EFI_UNSUPPORTED;
+
+	status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiBootServicesData,
+				   IDMAP_PAGES, &tables);
+	if (EFI_ERROR(status))
+		return status;
+
+	idmap_tables = (uint64_t *)tables;
+	idmap_exclude(tables, IDMAP_PAGES * EFI_PAGE_SIZE);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * idmap_exclude() - Keep the firmware's pages for a range used during the switch.
+ *
+ * Between switching TTBR0_EL1 and invalidating the TLB, accesses to a
+ * range mapped by a block in one of the tables and by pages in the
+ * other could hit both, which is a TLB conflict. Only some cores
+ * (FEAT_BBM level 2) promise not to fault on that, so the blocks
+ * holding what the switch touches are not made.
+ */
+void idmap_exclude(uint64_t start, uint64_t size)
+{
+	if (idmap_excluded_cnt == IDMAP_MAX_EXCLUDE)
+		return;
+
+	idmap_excluded[idmap_excluded_cnt].start = start;
+	idmap_excluded[idmap_excluded_cnt].end = start + size;
+	idmap_excluded_cnt++;
+}
+
+static BOOLEAN idmap_is_excluded(uint64_t start, uint64_t end)
+{
+	int i;
+
+	if (idmap_stack - IDMAP_STACK < end && idmap_stack + IDMAP_STACK > start)
+		return TRUE;
+
+	for (i = 0; i < idmap_excluded_cnt; ++i)
+		if (idmap_excluded[i].start < end && idmap_excluded[i].end > start)
+			return TRUE;
+
+	return FALSE;
+}
+
+/* RAM, the only memory worth merging for the flush. */
+static BOOLEAN idmap_is_ram(EFI_MEMORY_DESCRIPTOR *desc)
+{
+	if (!(desc->Attribute & EFI_MEMORY_WB))
+		return FALSE;
+
+	switch (desc->Type) {
+	case EfiLoaderCode:
+	case EfiLoaderData:
+	case EfiBootServicesCode:
+	case EfiBootServicesData:
+	case EfiRuntimeServicesCode:
+	case EfiRuntimeServicesData:
+	case EfiConventionalMemory:
+	case EfiACPIReclaimMemory:
+	case EfiACPIMemoryNVS:
+	case EfiPersistentMemory:
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static uint64_t *idmap_table_copy(const uint64_t *src, int count)
+{
+	uint64_t *table;
+
+	if (idmap_used == IDMAP_PAGES)
+		return NULL;
+
+	table = idmap_tables + idmap_used++ * IDMAP_ENTRIES;
+	CopyMem(table, src, count * sizeof(*table));
+	SetMem(table + count, (IDMAP_ENTRIES - count) * sizeof(*table), 0);
+
+	return table;
+}
+
+static BOOLEAN idmap_is_ours(uint64_t pte)
+{
+	uint64_t addr = pte & PTE_ADDR_MASK;
+
+	return addr >= (uint64_t)idmap_tables &&
+	       addr < (uint64_t)idmap_tables + IDMAP_PAGES * EFI_PAGE_SIZE;
+}
+
+/**
+ * idmap_mergeable() - Check if @table maps @va onwards like one block would.
+ * @table: Table at @level, covering a block of @level - 1.
+ * @attrs: Attributes of the entries, set on success.
+ *
+ * All entries must be valid, map the same addresses as their VAs and
+ * have the same attributes, except for the access flag and the
+ * contiguous hint. Tables at @level are checked recursively, so a 1G
+ * block can be made from 2M blocks and pages.
+ *
+ * The memory map only tells which attributes the memory supports, not
+ * which ones the firmware uses, so they are only taken from the tables.
+ */
+static BOOLEAN idmap_mergeable(const uint64_t *table, int level, uint64_t va, uint64_t *attrs)
+{
+	uint64_t size = 1ull << IDMAP_LEVEL_SHIFT(level);
+	uint64_t pte, sub_attrs;
+	int i;
+
+	for (i = 0; i < IDMAP_ENTRIES; ++i, va += size) {
+		pte = table[i];
+		if (!(pte & PTE_VALID))
+			return FALSE;
+
+		if (level < 3 && (pte & PTE_TABLE)) {
+			if (!idmap_mergeable((uint64_t *)(pte & PTE_ADDR_MASK), level + 1, va, &sub_attrs))
+				return FALSE;
+		} else {
+			/* A page at level 3, a block above. */
+			if (level == 3 && !(pte & PTE_TABLE))
+				return FALSE;
+			if ((pte & PTE_ADDR_MASK) != va)
+				return FALSE;
+			sub_attrs = pte & PTE_ATTRS_MASK;
+		}
+
+		if (i == 0)
+			*attrs = sub_attrs;
+		else if (sub_attrs != *attrs)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * idmap_map() - Replace the tables under [start, end) with blocks where possible.
+ * @table: Our copy of the table at @level, covering VAs from @base.
+ *
+ * Only the firmware's table entries that are fully covered by RAM, map
+ * it as one block would and don't hold anything excluded are replaced.
+ * Its blocks, invalid entries and all other tables are left as they
+ * are, so everything stays mapped the way the firmware wants it.
+ *
+ * Return: -1 if we ran out of pages for the table copies.
+ */
+static int idmap_map(uint64_t *table, int level, uint64_t base, uint64_t start, uint64_t end)
+{
+	uint64_t shift = IDMAP_LEVEL_SHIFT(level);
+	uint64_t size = 1ull << shift;
+	uint64_t idx = (start - base) >> shift;
+	uint64_t va, pte, attrs, *sub;
+
+	for (va = base + (idx << shift); va < end; va += size, idx++) {
+		pte = table[idx];
+		if (level == 3 || !(pte & PTE_VALID) || !(pte & PTE_TABLE))
+			continue;
+
+		if (level > 0 && va >= start && va + size <= end &&
+		    !idmap_is_excluded(va, va + size) &&
+		    idmap_mergeable((uint64_t *)(pte & PTE_ADDR_MASK), level + 1, va, &attrs)) {
+			table[idx] = va | attrs | PTE_AF | PTE_VALID;
+			idmap_blocks[level - 1]++;
+			continue;
+		}
+
+		/* Below 2M, the firmware's pages are used as is. */
+		if (level == 2)
+			continue;
+
+		if (idmap_is_ours(pte)) {
+			sub = (uint64_t *)(pte & PTE_ADDR_MASK);
+		} else {
+			sub = idmap_table_copy((uint64_t *)(pte & PTE_ADDR_MASK), IDMAP_ENTRIES);
+			if (!sub)
+				return -1;
+
+			table[idx] = (pte & ~PTE_ADDR_MASK) | (uint64_t)sub;
+		}
+
+		if (idmap_map(sub, level + 1, va, va > start ? va : start,
+			      va + size < end ? va + size : end))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * idmap_enter() - Switch to a block-mapped copy of the identity map.
+ *
+ * RAM in @map is mapped with 1G and 2M blocks wherever the firmware
+ * used tables that map it the same way, everything else is translated
+ * the same as before. The same TCR_EL1 is used, only TTBR0_EL1
+ * changes. If there are not enough pages for the copy, the firmware's
+ * tables stay in use.
+ */
+void idmap_enter(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	uint64_t tcr = read_sysreg(tcr_el1);
+	uint64_t va_bits, va_end, start = 0, end = 0, t;
+	EFI_MEMORY_DESCRIPTOR *desc;
+	uint64_t *root;
+	int i, level;
+
+	if (!idmap_tables || idmap_on || !idmap_tcr_usable(tcr))
+		return;
+
+	t = arch_counter();
+
+	va_bits = 64 - TCR_T0SZ(tcr);
+	va_end = 1ull << va_bits;
+	level = idmap_root_level(va_bits);
+
+	/* The hook runs on the loader's stack, it's only known now. */
+	idmap_stack = (uint64_t)__builtin_frame_address(0);
+
+	idmap_fw_ttbr = read_sysreg(ttbr0_el1);
+	idmap_used = 0;
+	idmap_blocks[0] = idmap_blocks[1] = 0;
+
+	root = idmap_table_copy((uint64_t *)(idmap_fw_ttbr & TTBR_BADDR_MASK),
+				1 << (va_bits - IDMAP_LEVEL_SHIFT(level)));
+
+	/* Adjacent RAM entries are mapped as one range. */
+	for (i = 0; i <= map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+
+		if (i < map_size / desc_size) {
+			if (!idmap_is_ram(desc))
+				continue;
+
+			if (end > start && desc->PhysicalStart == end) {
+				end += desc->NumberOfPages * EFI_PAGE_SIZE;
+				continue;
+			}
+		}
+
+		if (end > va_end)
+			end = va_end;
+
+		if (end > start && idmap_map(root, level, 0, start, end)) {
+			Dbg(L"Not enough pages for the block-mapped flush\n");
+			return;
+		}
+
+		if (i < map_size / desc_size) {
+			start = desc->PhysicalStart;
+			end = start + desc->NumberOfPages * EFI_PAGE_SIZE;
+		}
+	}
+
+	if (!idmap_blocks[0] && !idmap_blocks[1])
+		return;
+
+	/* The walker may not snoop the caches. */
+	clean_dcache_range((uint64_t)idmap_tables, idmap_used * EFI_PAGE_SIZE);
+
+	mmu_hw_set_ttbr0((idmap_fw_ttbr & ~TTBR_BADDR_MASK) | (uint64_t)root);
+	idmap_on = TRUE;
+
+	Trace(TRACE_IDMAP, idmap_blocks[0], idmap_blocks[1], idmap_used, arch_counter() - t);
+}
+
+/**
+ * idmap_exit() - Go back to the firmware's identity map.
+ */
+void idmap_exit(void)
+{
+	if (!idmap_on)
+		return;
+
+	mmu_hw_set_ttbr0(idmap_fw_ttbr);
+	idmap_on = FALSE;
+}
+
+#endif
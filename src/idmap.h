@@ -0,0 +1,27 @@
+#ifndef IDMAP_H
+#define IDMAP_H
+
+#include <stdint.h>
+#include <efi.h>
+
+/*
+ * Block-mapped copy of the firmware's identity map for the EBS flush,
+ * built with SLBOUNCE_IDMAP. RAM is mapped with 1G and 2M blocks so
+ * the flush by VA doesn't take a TLB miss every 4K page.
+ */
+
+#define IDMAP_PAGES		64	/* Translation tables available for the copy. */
+
+#ifdef SLBOUNCE_IDMAP
+EFI_STATUS idmap_init(void);
+void idmap_exclude(uint64_t start, uint64_t size);
+void idmap_enter(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+void idmap_exit(void);
+#else
+static inline EFI_STATUS idmap_init(void) { return EFI_UNSUPPORTED; }
+static inline void idmap_exclude(uint64_t start, uint64_t size) { }
+static inline void idmap_enter(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size) { }
+static inline void idmap_exit(void) { }
+#endif
+
+#endif
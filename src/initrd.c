@@ -0,0 +1,118 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "arch.h"
+#include "flush.h"
+#include "initrd.h"
+
+/* Small enough to still be in the cache when we clean it. */
+#define INITRD_CHUNK	(256 * 1024)
+
+static EFI_FILE_HANDLE initrd_file;
+static UINT64 initrd_size;
+
+/*
+ * Linux EFI stub looks up the initrd by this vendor media
+ * device path and loads it via LoadFile2 on the same handle.
+ */
+static struct {
+	VENDOR_DEVICE_PATH vendor;
+	EFI_DEVICE_PATH end;
+} __attribute__((packed)) initrd_device_path = {
+	.vendor = {
+		.Header = {
+			.Type = MEDIA_DEVICE_PATH,
+			.SubType = MEDIA_VENDOR_DP,
+			.Length = { sizeof(VENDOR_DEVICE_PATH), 0 },
+		},
+		.Guid = LINUX_EFI_INITRD_MEDIA_GUID,
+	},
+	.end = {
+		.Type = END_DEVICE_PATH_TYPE,
+		.SubType = END_ENTIRE_DEVICE_PATH_SUBTYPE,
+		.Length = { sizeof(EFI_DEVICE_PATH), 0 },
+	},
+};
+
+/**
+ * initrd_load_file() - LoadFile2 implementation for the initrd.
+ *
+ * The file is streamed straight into the loader's buffer and each
+ * chunk is cleaned to PoC while it's still hot in the cache, so the
+ * EBS hook doesn't need to flush the initrd again. Only the last
+ * buffer is skipped, and only if the loader hasn't freed it.
+ */
+static EFI_STATUS EFIAPI initrd_load_file(EFI_LOAD_FILE_PROTOCOL *This, EFI_DEVICE_PATH *FilePath,
+					  BOOLEAN BootPolicy, UINTN *BufferSize, VOID *Buffer)
+{
+	UINT8 *buf = Buffer;
+	EFI_STATUS status;
+	UINT64 off, len;
+
+	if (BootPolicy)
+		return EFI_UNSUPPORTED;
+
+	if (!BufferSize)
+		return EFI_INVALID_PARAMETER;
+
+	if (!Buffer || *BufferSize < initrd_size) {
+		*BufferSize = initrd_size;
+		return EFI_BUFFER_TOO_SMALL;
+	}
+
+	/* The loader might ask us more than once. */
+	status = uefi_call_wrapper(initrd_file->SetPosition, 2, initrd_file, 0);
+	if (EFI_ERROR(status))
+		return status;
+
+	for (off = 0; off < initrd_size; off += len) {
+		len = initrd_size - off;
+		if (len > INITRD_CHUNK)
+			len = INITRD_CHUNK;
+
+		if (FileRead(initrd_file, buf + off, len) != len)
+			return EFI_LOAD_ERROR;
+
+		clear_dcache_range((uint64_t)buf + off, len);
+	}
+
+	flush_mark_clean(FLUSH_CLEAN_INITRD, (uint64_t)buf, initrd_size);
+	*BufferSize = initrd_size;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_LOAD_FILE_PROTOCOL initrd_load_file2 = {
+	.LoadFile = initrd_load_file,
+};
+
+/**
+ * initrd_install() - Provide the initrd to the Linux EFI stub.
+ */
+EFI_STATUS initrd_install(EFI_FILE_HANDLE volume, CHAR16 *name)
+{
+	EFI_GUID DevicePathGuid = EFI_DEVICE_PATH_PROTOCOL_GUID;
+	EFI_GUID LoadFile2Guid = EFI_LOAD_FILE2_PROTOCOL_GUID;
+	EFI_HANDLE handle = NULL;
+
+	initrd_file = FileOpen(volume, name);
+	if (!initrd_file) {
+		Print(L"Opening file \"%s\" failed.\n", name);
+		return EFI_NOT_FOUND;
+	}
+
+	initrd_size = FileSize(initrd_file);
+
+	Dbg(L"Providing initrd \"%s\" with size %d\n", name, initrd_size);
+
+	return uefi_call_wrapper(BS->InstallMultipleProtocolInterfaces, 6, &handle,
+				 &DevicePathGuid, &initrd_device_path,
+				 &LoadFile2Guid, &initrd_load_file2,
+				 NULL);
+}
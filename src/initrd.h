@@ -0,0 +1,16 @@
+#ifndef INITRD_H
+#define INITRD_H
+
+#include <efi.h>
+
+#define LINUX_EFI_INITRD_MEDIA_GUID \
+    { 0x5568e427, 0x68fc, 0x4f3d, {0xac, 0x74, 0xca, 0x55, 0x52, 0x31, 0xcc, 0x68} }
+
+#ifndef EFI_LOAD_FILE2_PROTOCOL_GUID
+#define EFI_LOAD_FILE2_PROTOCOL_GUID \
+    { 0x4006c0c1, 0xfcb3, 0x403e, {0x99, 0x6d, 0x4a, 0x6c, 0x87, 0x24, 0xe0, 0x6d} }
+#endif
+
+EFI_STATUS initrd_install(EFI_FILE_HANDLE volume, CHAR16 *name);
+
+#endif
@@ -0,0 +1,447 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "lz4.h"
+
+/*
+ * Minimal streaming decoder for the LZ4 frame format.
+ *
+ * See https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+ *
+ * Only the subset produced by "lz4 --content-size" with default
+ * settings is supported: independent blocks, known content size,
+ * no dictionary. Checksums are skipped, not verified.
+ */
+
+#define LZ4_FLG_VERSION_MASK	(3 << 6)
+#define LZ4_FLG_VERSION		(1 << 6)
+#define LZ4_FLG_BLOCK_INDEP	(1 << 5)
+#define LZ4_FLG_BLOCK_CSUM	(1 << 4)
+#define LZ4_FLG_CONTENT_SIZE	(1 << 3)
+#define LZ4_FLG_CONTENT_CSUM	(1 << 2)
+#define LZ4_FLG_DICT_ID		(1 << 0)
+
+#define LZ4_BLOCK_UNCOMPRESSED	(1U << 31)
+
+#define LZ4_MIN_MATCH		4
+
+static UINT32 get_le32(const UINT8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((UINT32)p[3] << 24);
+}
+
+static UINT64 get_le64(const UINT8 *p)
+{
+	return get_le32(p) | ((UINT64)get_le32(p + 4) << 32);
+}
+
+/**
+ * Lz4DecompressBlock() - Decode one LZ4 block.
+ *
+ * Returns the number of decoded bytes or -1 if the block is
+ * malformed or doesn't fit into dst.
+ */
+INTN Lz4DecompressBlock(const UINT8 *src, UINTN src_size, UINT8 *dst, UINTN dst_size)
+{
+	const UINT8 *ip = src, *iend = src + src_size;
+	UINT8 *op = dst, *oend = dst + dst_size;
+	UINTN len, off;
+	UINT8 token, b;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		/* Literals */
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+
+		if (len > (UINTN)(iend - ip) || len > (UINTN)(oend - op))
+			return -1;
+
+		CopyMem(op, (VOID *)ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence only has literals. */
+		if (ip == iend)
+			break;
+
+		/* Match */
+		if (iend - ip < 2)
+			return -1;
+
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (off == 0 || off > (UINTN)(op - dst))
+			return -1;
+
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					return -1;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		}
+		len += LZ4_MIN_MATCH;
+
+		if (len > (UINTN)(oend - op))
+			return -1;
+
+		if (off >= len) {
+			CopyMem(op, op - off, len);
+			op += len;
+		} else {
+			/* Overlapping match, has to go byte by byte. */
+			UINT8 *match = op - off;
+
+			while (len--)
+				*op++ = *match++;
+		}
+	}
+
+	return op - dst;
+}
+
+struct lz4_file {
+	/* Must be first since we hand out a pointer to it. */
+	EFI_FILE_PROTOCOL proto;
+	EFI_FILE_HANDLE raw;
+
+	UINT64 content_size;
+	UINT64 pos;
+	UINT32 block_max;
+	UINT8 flg;
+	BOOLEAN done;
+
+	UINT8 *in;		/* Compressed block staging. */
+	UINT8 *out;		/* Decoded block that didn't fit the caller buffer. */
+	UINT32 out_len;
+	UINT32 out_pos;
+};
+
+static EFI_STATUS lz4_read_raw(struct lz4_file *f, VOID *buf, UINTN size)
+{
+	UINTN read = size;
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(f->raw->Read, 3, f->raw, &read, buf);
+	if (EFI_ERROR(status))
+		return status;
+
+	if (read != size)
+		return EFI_END_OF_FILE;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS lz4_read_header(struct lz4_file *f)
+{
+	UINT8 hdr[6 + 8 + 1];
+	EFI_STATUS status;
+	UINT8 bsid;
+
+	status = lz4_read_raw(f, hdr, 6);
+	if (EFI_ERROR(status))
+		return status;
+
+	if (get_le32(hdr) != LZ4_FRAME_MAGIC)
+		return EFI_UNSUPPORTED;
+
+	f->flg = hdr[4];
+	bsid = (hdr[5] >> 4) & 7;
+
+	if ((f->flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION || bsid < 4)
+		return EFI_UNSUPPORTED;
+
+	/*
+	 * Linked blocks would need a history window outside of the
+	 * caller buffer, and we need the size upfront for FileSize().
+	 */
+	if (!(f->flg & LZ4_FLG_BLOCK_INDEP) || !(f->flg & LZ4_FLG_CONTENT_SIZE) || (f->flg & LZ4_FLG_DICT_ID)) {
+		Print(L"lz4: Unsupported frame flags 0x%x, use \"lz4 --content-size\"\n", f->flg);
+		return EFI_UNSUPPORTED;
+	}
+
+	status = lz4_read_raw(f, hdr + 6, 8 + 1);
+	if (EFI_ERROR(status))
+		return status;
+
+	f->content_size = get_le64(hdr + 6);
+	f->block_max = 1 << (8 + 2 * bsid);
+	f->pos = 0;
+	f->done = FALSE;
+	f->out_len = 0;
+	f->out_pos = 0;
+
+	Dbg(L"lz4: content size %d, max block %d\n", f->content_size, f->block_max);
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * lz4_next_block() - Decode the next block from the stream.
+ *
+ * If dst is given and the block fits, it's decoded there directly,
+ * otherwise it's stashed in f->out for the following reads.
+ */
+static EFI_STATUS lz4_next_block(struct lz4_file *f, UINT8 *dst, UINTN dst_size, UINTN *produced)
+{
+	EFI_STATUS status;
+	UINT32 word, size;
+	UINT8 tmp[4];
+	INTN ret;
+
+	*produced = 0;
+
+	status = lz4_read_raw(f, tmp, 4);
+	if (EFI_ERROR(status))
+		return status;
+
+	word = get_le32(tmp);
+	size = word & ~LZ4_BLOCK_UNCOMPRESSED;
+
+	if (size == 0) {
+		/* EndMark */
+		if (f->flg & LZ4_FLG_CONTENT_CSUM)
+			lz4_read_raw(f, tmp, 4);
+		f->done = TRUE;
+		return EFI_SUCCESS;
+	}
+
+	if (size > f->block_max)
+		return EFI_VOLUME_CORRUPTED;
+
+	if (word & LZ4_BLOCK_UNCOMPRESSED) {
+		if (!dst || size > dst_size)
+			dst = NULL;
+
+		status = lz4_read_raw(f, dst ? dst : f->out, size);
+		if (EFI_ERROR(status))
+			return status;
+
+		ret = size;
+	} else {
+		if (!dst)
+			dst_size = f->block_max;
+
+		status = lz4_read_raw(f, f->in, size);
+		if (EFI_ERROR(status))
+			return status;
+
+		ret = Lz4DecompressBlock(f->in, size, dst ? dst : f->out, dst_size);
+		if (ret < 0)
+			return EFI_VOLUME_CORRUPTED;
+	}
+
+	if (f->flg & LZ4_FLG_BLOCK_CSUM) {
+		status = lz4_read_raw(f, tmp, 4);
+		if (EFI_ERROR(status))
+			return status;
+	}
+
+	if (dst) {
+		*produced = ret;
+	} else {
+		f->out_len = ret;
+		f->out_pos = 0;
+	}
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI lz4_file_read(EFI_FILE_HANDLE This, UINTN *BufferSize, VOID *Buffer)
+{
+	struct lz4_file *f = (struct lz4_file *)This;
+	EFI_STATUS status = EFI_SUCCESS;
+	UINTN want = *BufferSize, done = 0, left, n;
+	UINT8 *buf = Buffer;
+
+	while (done < want) {
+		/* Drain the leftovers of a previous block first. */
+		if (f->out_pos < f->out_len) {
+			n = f->out_len - f->out_pos;
+			if (n > want - done)
+				n = want - done;
+			CopyMem(buf + done, f->out + f->out_pos, n);
+			f->out_pos += n;
+			done += n;
+			continue;
+		}
+
+		if (f->done)
+			break;
+
+		/*
+		 * The block can only land in the caller buffer if it's
+		 * guaranteed to fit, which is the common case of reading
+		 * the whole file at once.
+		 */
+		left = want - done;
+		if (left >= f->block_max || left >= f->content_size - (f->pos + done))
+			status = lz4_next_block(f, buf + done, left, &n);
+		else
+			status = lz4_next_block(f, NULL, 0, &n);
+
+		if (EFI_ERROR(status))
+			break;
+
+		done += n;
+	}
+
+	f->pos += done;
+	*BufferSize = done;
+
+	return status;
+}
+
+static EFI_STATUS EFIAPI lz4_file_get_info(EFI_FILE_HANDLE This, EFI_GUID *InformationType, UINTN *BufferSize, VOID *Buffer)
+{
+	struct lz4_file *f = (struct lz4_file *)This;
+	EFI_GUID info_guid = EFI_FILE_INFO_ID;
+	EFI_FILE_INFO *info = Buffer;
+	EFI_STATUS status;
+
+	status = uefi_call_wrapper(f->raw->GetInfo, 4, f->raw, InformationType, BufferSize, Buffer);
+	if (EFI_ERROR(status) || CompareGuid(InformationType, &info_guid))
+		return status;
+
+	/* Pretend to be the decompressed file so FileSize() just works. */
+	info->FileSize = f->content_size;
+	info->Attribute |= EFI_FILE_READ_ONLY;
+
+	return status;
+}
+
+static EFI_STATUS EFIAPI lz4_file_get_position(EFI_FILE_HANDLE This, UINT64 *Position)
+{
+	struct lz4_file *f = (struct lz4_file *)This;
+
+	*Position = f->pos;
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI lz4_file_set_position(EFI_FILE_HANDLE This, UINT64 Position)
+{
+	struct lz4_file *f = (struct lz4_file *)This;
+	EFI_STATUS status;
+
+	if (Position == f->pos)
+		return EFI_SUCCESS;
+
+	/* Only rewinding is supported. */
+	if (Position != 0)
+		return EFI_UNSUPPORTED;
+
+	status = uefi_call_wrapper(f->raw->SetPosition, 2, f->raw, 0);
+	if (EFI_ERROR(status))
+		return status;
+
+	return lz4_read_header(f);
+}
+
+static EFI_STATUS EFIAPI lz4_file_close(EFI_FILE_HANDLE This)
+{
+	struct lz4_file *f = (struct lz4_file *)This;
+
+	uefi_call_wrapper(f->raw->Close, 1, f->raw);
+
+	FreePool(f->in);
+	FreePool(f->out);
+	FreePool(f);
+
+	return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI lz4_file_delete(EFI_FILE_HANDLE This)
+{
+	lz4_file_close(This);
+
+	return EFI_WARN_DELETE_FAILURE;
+}
+
+static EFI_STATUS EFIAPI lz4_file_open(EFI_FILE_HANDLE This, EFI_FILE_HANDLE *NewHandle, CHAR16 *FileName, UINT64 OpenMode, UINT64 Attributes)
+{
+	return EFI_UNSUPPORTED;
+}
+
+static EFI_STATUS EFIAPI lz4_file_write(EFI_FILE_HANDLE This, UINTN *BufferSize, VOID *Buffer)
+{
+	return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI lz4_file_set_info(EFI_FILE_HANDLE This, EFI_GUID *InformationType, UINTN BufferSize, VOID *Buffer)
+{
+	return EFI_WRITE_PROTECTED;
+}
+
+static EFI_STATUS EFIAPI lz4_file_flush(EFI_FILE_HANDLE This)
+{
+	return EFI_SUCCESS;
+}
+
+/**
+ * Lz4FileWrap() - Wrap a handle to an lz4 frame into a decompressing one.
+ *
+ * The returned handle behaves like a read-only file with decompressed
+ * content and takes ownership of the raw handle. On failure NULL is
+ * returned and the raw handle is left to the caller.
+ */
+EFI_FILE_HANDLE Lz4FileWrap(EFI_FILE_HANDLE RawHandle)
+{
+	struct lz4_file *f;
+
+	f = AllocateZeroPool(sizeof(*f));
+	if (!f)
+		return NULL;
+
+	f->raw = RawHandle;
+
+	if (EFI_ERROR(lz4_read_header(f)))
+		goto error;
+
+	f->in  = AllocatePool(f->block_max);
+	f->out = AllocatePool(f->block_max);
+	if (!f->in || !f->out)
+		goto error;
+
+	/*
+	 * Revision 1 so nobody tries to use the async *Ex() calls
+	 * we don't implement.
+	 */
+	f->proto.Revision    = EFI_FILE_HANDLE_REVISION;
+	f->proto.Open        = lz4_file_open;
+	f->proto.Close       = lz4_file_close;
+	f->proto.Delete      = lz4_file_delete;
+	f->proto.Read        = lz4_file_read;
+	f->proto.Write       = lz4_file_write;
+	f->proto.GetPosition = lz4_file_get_position;
+	f->proto.SetPosition = lz4_file_set_position;
+	f->proto.GetInfo     = lz4_file_get_info;
+	f->proto.SetInfo     = lz4_file_set_info;
+	f->proto.Flush       = lz4_file_flush;
+
+	return &f->proto;
+
+error:
+	if (f->in)
+		FreePool(f->in);
+	if (f->out)
+		FreePool(f->out);
+	FreePool(f);
+	return NULL;
+}
@@ -0,0 +1,11 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <efi.h>
+
+#define LZ4_FRAME_MAGIC		0x184d2204
+
+INTN Lz4DecompressBlock(const UINT8 *src, UINTN src_size, UINT8 *dst, UINTN dst_size);
+EFI_FILE_HANDLE Lz4FileWrap(EFI_FILE_HANDLE RawHandle);
+
+#endif
@@ -0,0 +1,113 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "arch.h"
+#include "trace.h"
+#include "pmu.h"
+
+#ifdef SLBOUNCE_PMU
+
+/* Common PMUv3 events, unsupported ones just count nothing. */
+static const uint16_t pmu_events[PMU_EVENTS] = {
+	0x03,	/* L1D_CACHE_REFILL */
+	0x17,	/* L2D_CACHE_REFILL */
+	0x37,	/* LL_CACHE_MISS_RD */
+	0x19,	/* BUS_ACCESS */
+	0x24,	/* STALL_BACKEND */
+};
+
+/* Event counters in use, -1 if not started or there is no PMU. */
+static int pmu_count = -1;
+/* Same, but kept after pmu_stop() for pmu_get(). */
+static int pmu_used = 0;
+
+static struct pmu_counts pmu_counts[PMU_REGIONS];
+static uint64_t pmu_begin_vals[PMU_REGIONS][PMU_EVENTS + 1];
+
+/**
+ * pmu_start() - Program the counters.
+ *
+ * The previous counter state is kept and put back by pmu_stop(), which
+ * must be called before the OS gets control.
+ */
+void pmu_start(void)
+{
+	if (pmu_count >= 0)
+		return;
+
+	pmu_count = pmu_hw_init(pmu_events, PMU_EVENTS);
+	if (pmu_count > pmu_used)
+		pmu_used = pmu_count;
+}
+
+/**
+ * pmu_stop() - Restore the counters, the collected counts stay.
+ */
+void pmu_stop(void)
+{
+	if (pmu_count < 0)
+		return;
+
+	pmu_hw_restore();
+	pmu_count = -1;
+}
+
+void pmu_begin(enum pmu_region region)
+{
+	if (pmu_count < 0)
+		return;
+
+	pmu_hw_read(pmu_begin_vals[region], pmu_count);
+}
+
+/**
+ * pmu_end() - Account the counts since pmu_begin() of the region.
+ *
+ * Event counters are 32 bit, a region must not take long enough to
+ * overflow them twice.
+ */
+void pmu_end(enum pmu_region region)
+{
+	struct pmu_counts *c = &pmu_counts[region];
+	uint64_t *begin = pmu_begin_vals[region];
+	uint64_t now[PMU_EVENTS + 1];
+	uint64_t delta[PMU_EVENTS + 1] = { 0 };
+	int i;
+
+	if (pmu_count < 0)
+		return;
+
+	pmu_hw_read(now, pmu_count);
+
+	delta[0] = now[0] - begin[0];
+	for (i = 1; i <= pmu_count; i++)
+		delta[i] = (uint32_t)(now[i] - begin[i]);
+
+	c->calls++;
+	c->cycles += delta[0];
+	for (i = 0; i < PMU_EVENTS; i++)
+		c->events[i] += delta[i + 1];
+
+	Trace(TRACE_PMU, region, delta[0], delta[1], delta[2]);
+	Trace(TRACE_PMU_MORE, region, delta[3], delta[4], delta[5]);
+}
+
+/**
+ * pmu_get() - The counts per region and the events that were counted.
+ *
+ * Return: Number of event counters in use, 0 if there is no PMU.
+ */
+int pmu_get(const struct pmu_counts **counts, const uint16_t **events)
+{
+	*counts = pmu_counts;
+	*events = pmu_events;
+
+	return pmu_used;
+}
+
+#endif
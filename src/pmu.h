@@ -0,0 +1,41 @@
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+
+/*
+ * PMUv3 counters around the hot paths, built with SLBOUNCE_PMU. The
+ * deltas are summed per region, recorded into the trace for every
+ * sample and copied into the telemetry record.
+ */
+
+enum pmu_region {
+	PMU_FLUSH,			/* The memory map flush. */
+	PMU_COPY,			/* Copying tcblaunch.exe sections. */
+	PMU_SMC,			/* Secure Launch SMCs. */
+	PMU_EBS,			/* The real ExitBootServices(). */
+	PMU_REGIONS,
+};
+
+#define PMU_EVENTS		5
+
+struct pmu_counts {
+	uint64_t calls;
+	uint64_t cycles;
+	uint64_t events[PMU_EVENTS];
+};
+
+#ifdef SLBOUNCE_PMU
+void pmu_start(void);
+void pmu_stop(void);
+void pmu_begin(enum pmu_region region);
+void pmu_end(enum pmu_region region);
+int pmu_get(const struct pmu_counts **counts, const uint16_t **events);
+#else
+static inline void pmu_start(void) { }
+static inline void pmu_stop(void) { }
+static inline void pmu_begin(enum pmu_region region) { }
+static inline void pmu_end(enum pmu_region region) { }
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+#include "resmem.h"
+
+static struct resmem resmem_regions[RESMEM_MAX];
+static int resmem_cnt = 0;
+
+/**
+ * resmem_add() - Describe a region someone else allocated.
+ *
+ * For regions left by an earlier image, i.e. found in a config table.
+ * Adding the same region twice is fine.
+ */
+EFI_STATUS resmem_add(const char *name, const char *compatible, EFI_PHYSICAL_ADDRESS base, UINTN size)
+{
+	struct resmem *r;
+	int i;
+
+	for (i = 0; i < resmem_cnt; i++)
+		if (resmem_regions[i].base == base)
+			return EFI_SUCCESS;
+
+	if (resmem_cnt == RESMEM_MAX)
+		return EFI_OUT_OF_RESOURCES;
+
+	r = &resmem_regions[resmem_cnt++];
+	r->name = name;
+	r->compatible = compatible;
+	r->base = base;
+	r->size = size;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * resmem_alloc() - Allocate a zeroed region to pass to the OS.
+ * @name:       Name of the /reserved-memory node.
+ * @compatible: Compatible of the node.
+ * @size:       Size of the region, rounded up to pages.
+ * @table:      If not NULL, also install the region as this config table.
+ * @data:       Returns the region.
+ */
+EFI_STATUS resmem_alloc(const char *name, const char *compatible, UINTN size,
+			EFI_GUID *table, VOID **data)
+{
+	struct resmem *r;
+	EFI_STATUS status;
+	UINTN pages = (size + 4095) / 4096;
+
+	if (resmem_cnt == RESMEM_MAX)
+		return EFI_OUT_OF_RESOURCES;
+
+	r = &resmem_regions[resmem_cnt];
+	r->name = name;
+	r->compatible = compatible;
+	r->size = pages * 4096;
+
+	status = uefi_call_wrapper(BS->AllocatePages, 4, AllocateAnyPages, EfiReservedMemoryType,
+				   pages, &r->base);
+	if (EFI_ERROR(status))
+		return status;
+
+	ZeroMem((VOID *)r->base, r->size);
+
+	if (table) {
+		status = uefi_call_wrapper(BS->InstallConfigurationTable, 2, table, (VOID *)r->base);
+		if (EFI_ERROR(status)) {
+			FreePages(r->base, pages);
+			return status;
+		}
+	}
+
+	resmem_cnt++;
+	*data = (VOID *)r->base;
+
+	return EFI_SUCCESS;
+}
+
+static void resmem_node_name(char *buf, const char *name, uint64_t addr)
+{
+	int i = 0, shift;
+
+	while (*name)
+		buf[i++] = *name++;
+	buf[i++] = '@';
+
+	for (shift = 60; shift > 0 && !(addr >> shift); shift -= 4)
+		;
+	for (; shift >= 0; shift -= 4)
+		buf[i++] = "0123456789abcdef"[(addr >> shift) & 0xf];
+
+	buf[i] = '\0';
+}
+
+static int resmem_fdt_parent(VOID *fdt)
+{
+	int offset, ret;
+
+	offset = fdt_path_offset(fdt, "/reserved-memory");
+	if (offset >= 0)
+		return offset;
+
+	offset = fdt_add_subnode(fdt, 0, "reserved-memory");
+	if (offset < 0)
+		return offset;
+
+	ret = fdt_setprop_u32(fdt, offset, "#address-cells", 2);
+	if (ret)
+		return ret;
+
+	ret = fdt_setprop_u32(fdt, offset, "#size-cells", 2);
+	if (ret)
+		return ret;
+
+	ret = fdt_setprop_empty(fdt, offset, "ranges");
+	if (ret)
+		return ret;
+
+	return offset;
+}
+
+/**
+ * resmem_fdt_add() - Describe all regions in the dtb.
+ *
+ * The dtb must be open with enough room for the nodes. Regions that
+ * are already described are skipped, so this can be called on the
+ * same dtb more than once.
+ */
+EFI_STATUS resmem_fdt_add(VOID *fdt)
+{
+	char name[64];
+	int parent, offset, ret, i;
+
+	if (!resmem_cnt)
+		return EFI_SUCCESS;
+
+	parent = resmem_fdt_parent(fdt);
+	if (parent < 0) {
+		Print(L"Failed to find /reserved-memory: %d\n", parent);
+		return EFI_LOAD_ERROR;
+	}
+
+	for (i = 0; i < resmem_cnt; i++) {
+		struct resmem *r = &resmem_regions[i];
+
+		resmem_node_name(name, r->name, r->base);
+		if (fdt_subnode_offset(fdt, parent, name) >= 0)
+			continue;
+
+		offset = fdt_add_subnode(fdt, parent, name);
+		if (offset < 0) {
+			Print(L"Failed to add reserved-memory node: %d\n", offset);
+			return EFI_LOAD_ERROR;
+		}
+
+		ret = fdt_setprop_string(fdt, offset, "compatible", r->compatible);
+		if (!ret)
+			ret = fdt_setprop_empty(fdt, offset, "no-map");
+		if (!ret)
+			ret = fdt_appendprop_addrrange(fdt, parent, offset, "reg", r->base, r->size);
+		if (ret) {
+			Print(L"Failed to describe reserved-memory node: %d\n", ret);
+			return EFI_LOAD_ERROR;
+		}
+	}
+
+	return EFI_SUCCESS;
+}
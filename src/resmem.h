@@ -0,0 +1,27 @@
+#ifndef RESMEM_H
+#define RESMEM_H
+
+#include <efi.h>
+
+#define RESMEM_MAX	8
+
+/*
+ * Memory that is handed over to the OS with some data in it.
+ *
+ * Regions are allocated as EfiReservedMemoryType so nothing reuses
+ * them, optionally installed as a configuration table, and described
+ * as no-map nodes under /reserved-memory of the dtbs we fix up.
+ */
+struct resmem {
+	const char *name;		/* Node name, the unit address is added. */
+	const char *compatible;
+	EFI_PHYSICAL_ADDRESS base;
+	UINTN size;
+};
+
+EFI_STATUS resmem_add(const char *name, const char *compatible, EFI_PHYSICAL_ADDRESS base, UINTN size);
+EFI_STATUS resmem_alloc(const char *name, const char *compatible, UINTN size,
+			EFI_GUID *table, VOID **data);
+EFI_STATUS resmem_fdt_add(VOID *fdt);
+
+#endif
@@ -15,6 +15,8 @@
 #include "util.h"
 #include "arch.h"
 #include "sl.h"
+#include "trace.h"
+#include "pmu.h"
 
 /**
  * sl_get_cert_entry() - Get a pointer to the start of the security structure in PE.
@@ -39,14 +41,14 @@ EFI_STATUS sl_get_cert_entry(UINT8 *tcb_data, UINT8 **data, UINT64 *size)
 
 	PIMAGE_DATA_DIRECTORY security = &nt->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_SECURITY];
 
-	Dbg(L"Security entry at offt 0x%x with size 0x%x\n", security->VirtualAddress, security->Size);
+	Trace(TRACE_PE_SECURITY, security->VirtualAddress, security->Size, 0, 0);
 
 	*data = (UINT8 *)pe + security->VirtualAddress;
 	*size = security->Size;
 
 	PWIN_CERTIFICATE cert = (PWIN_CERTIFICATE)*data;
 
-	Dbg(L"Cert: Len=0x%x, Rev=0x%x, Type=0x%x\n", cert->dwLength, cert->wRevision, cert->wCertificateType);
+	Trace(TRACE_PE_CERT, cert->dwLength, cert->wRevision, cert->wCertificateType, 0);
 
 	if (cert->wRevision != 0x200 || cert->wCertificateType != 2)
 		return EFI_INVALID_PARAMETER;
@@ -84,7 +86,9 @@ EFI_STATUS sl_load_pe(UINT8 *load_addr, UINT64 load_size, UINT8 *pe_data, UINT64
 
 	SetMem(load_addr, load_size, 0);
 
-	Dbg(L"Loadint PE header with %d bytes to 0x%x\n", nt->OptionalHeader.SizeOfHeaders, load_addr);
+	pmu_begin(PMU_COPY);
+
+	Trace(TRACE_PE_HEADER, nt->OptionalHeader.SizeOfHeaders, load_addr, 0, 0);
 
 	CopyMem(load_addr, pe, nt->OptionalHeader.SizeOfHeaders); // Header
 
@@ -93,10 +97,9 @@ EFI_STATUS sl_load_pe(UINT8 *load_addr, UINT64 load_size, UINT8 *pe_data, UINT64
 
 	// FIXME this should probably handle errors better...
 	for (int i = 0; i < header_count; ++i) {
-		Dbg(L" - Loading section '%.*a' with %d bytes from offt=0x%x to 0x%x\n",
-			8, headers[i].Name, headers[i].SizeOfRawData,
-			headers[i].PointerToRawData,
-			load_addr + headers[i].VirtualAddress);
+		Trace(TRACE_PE_SECTION, trace_str8(headers[i].Name), headers[i].SizeOfRawData,
+		      headers[i].PointerToRawData,
+		      load_addr + headers[i].VirtualAddress);
 
 		ASSERT(headers[i].VirtualAddress + headers[i].SizeOfRawData < load_size);
 
@@ -105,11 +108,119 @@ EFI_STATUS sl_load_pe(UINT8 *load_addr, UINT64 load_size, UINT8 *pe_data, UINT64
 			headers[i].SizeOfRawData); // I hope rawdata size is correct, this is how much is hashed...
 	}
 
+	pmu_end(PMU_COPY);
+
 	return EFI_SUCCESS;
 }
 
+struct sl_report sl_report;
+
+/* Start of the phase that is recorded next, 0 if not set. */
+static uint64_t sl_report_start = 0;
+
+static void sl_report_init(void)
+{
+	if (sl_report.magic == SL_REPORT_MAGIC)
+		return;
+
+	sl_report.magic = SL_REPORT_MAGIC;
+	sl_report.count = 0;
+	sl_report.freq = read_sysreg(cntfrq_el0);
+	sl_report.hist.count = 0;
+}
+
+static void sl_report_copy_name(char *dst, const char *name)
+{
+	int i;
+
+	for (i = 0; i < SL_REPORT_NAME - 1 && name[i]; i++)
+		dst[i] = name[i];
+	dst[i] = '\0';
+}
+
+/**
+ * sl_report_begin() - Mark the start of the phase recorded next.
+ *
+ * Without it a phase starts when the previous one was recorded.
+ */
+void sl_report_begin(void)
+{
+	sl_report_start = read_sysreg(cntvct_el0);
+}
+
+/**
+ * sl_report_add() - Record a bounce phase with the current time.
+ * @name:  Short name of the phase.
+ * @value: Return code of the phase.
+ *
+ * Doesn't flush the report, the caller is expected to do it once
+ * before the LAUNCH call.
+ */
+void sl_report_add(const char *name, uint64_t value)
+{
+	struct sl_report_entry *ent;
+	uint64_t now = read_sysreg(cntvct_el0);
+
+	sl_report_init();
+
+	if (sl_report.count >= SL_REPORT_MAX)
+		return;
+
+	ent = &sl_report.entries[sl_report.count];
+	sl_report_copy_name(ent->name, name);
+	ent->value = value;
+	ent->time = now;
+
+	if (sl_report_start)
+		ent->start = sl_report_start;
+	else if (sl_report.count)
+		ent->start = sl_report.entries[sl_report.count - 1].time;
+	else
+		ent->start = now;
+
+	sl_report_start = 0;
+	sl_report.count++;
+}
+
+/**
+ * sl_report_hist_add() - Add a sample to the latency histogram.
+ * @name:  Name of the measured call, only one call is tracked.
+ * @ticks: Duration in arch timer ticks.
+ */
+void sl_report_hist_add(const char *name, uint64_t ticks)
+{
+	struct sl_report_hist *hist = &sl_report.hist;
+	uint64_t us;
+	int i;
+
+	sl_report_init();
+
+	if (!hist->count) {
+		sl_report_copy_name(hist->name, name);
+		for (i = 0; i < SL_REPORT_HIST; i++)
+			hist->buckets[i] = 0;
+		hist->min = ticks;
+		hist->max = ticks;
+		hist->total = 0;
+	}
+
+	us = arch_ticks_to_ns(ticks) / 1000;
+	for (i = 0; i < SL_REPORT_HIST - 1 && us >> (i + 1); i++)
+		;
+
+	hist->buckets[i]++;
+	hist->count++;
+	hist->total += ticks;
+	if (ticks < hist->min)
+		hist->min = ticks;
+	if (ticks > hist->max)
+		hist->max = ticks;
+}
+
 uint64_t sl_smc(struct sl_smc_params *smc_data, enum sl_cmd cmd, uint64_t pe_data, uint64_t pe_size, uint64_t arg_data, uint64_t arg_size)
 {
+	uint64_t ret;
+
 	/*
 	 * Some versions of the hyp will clean the memory before
 	 * unmapping it from EL2. We need to recreate the smc_data
@@ -126,7 +237,13 @@ uint64_t sl_smc(struct sl_smc_params *smc_data, enum sl_cmd cmd, uint64_t pe_dat
 	smc_data->num = cmd;
 	clear_dcache_range((uint64_t)smc_data, 4096 * 1);
 
-	return smc(SMC_SL_ID, (uint64_t)smc_data, smc_data->num, 0);
+	Trace(TRACE_SMC, cmd, pe_data, arg_data, 0);
+	pmu_begin(PMU_SMC);
+	ret = smc(SMC_SL_ID, (uint64_t)smc_data, smc_data->num, 0);
+	pmu_end(PMU_SMC);
+	Trace(TRACE_SMC_RET, cmd, ret, 0, 0);
+
+	return ret;
 }
 
 EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcdata, uint64_t *pe_data, uint64_t *pe_size, uint64_t *arg_data, uint64_t *arg_size)
@@ -143,7 +260,7 @@ EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcd
 	if (EFI_ERROR(ret))
 		goto exit;
 
-	Dbg(L"Allocated %d pages at 0x%x (TCB)\n", tcb_pages, tcb_phys);
+	Trace(TRACE_ALLOC, TRACE_ALLOC_TCB, tcb_pages, tcb_phys, 0);
 
 	UINT8 *tcb_data = (UINT8 *)tcb_phys;
 
@@ -153,11 +270,14 @@ EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcd
 		goto exit_tcb;
 	}
 
+	sl_report_begin();
 	UINT64 read_tcb_size = FileRead(tcblaunch, tcb_tmp_file, tcb_size);
+	sl_report_add("READ", read_tcb_size != tcb_size);
 	ASSERT(read_tcb_size == tcb_size);
 
 	/* Load the PE into memory */
 	ret = sl_load_pe(tcb_data, tcb_pages * 4096, tcb_tmp_file, tcb_size);
+	sl_report_add("PE", ret);
 	if (EFI_ERROR(ret)) {
 		Print(L"PE format is invalid.\n");
 		goto exit_tcb;
@@ -184,7 +304,7 @@ EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcd
 	if (EFI_ERROR(ret))
 		goto exit_tcb;
 
-	Dbg(L"Allocated %d pages at 0x%x (data, cert pages = %d)\n", buf_pages, buf_phys, cert_pages);
+	Trace(TRACE_ALLOC, TRACE_ALLOC_DATA, buf_pages, buf_phys, cert_pages);
 
 	/*
 	 * Our memory map for pages in this buffer is:
@@ -235,8 +355,11 @@ EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcd
 	tz_data->tb_size = 4096 * 2;
 	tz_data->tb_data.mair = (uint64_t)tb_jmp_buf;
 
-	Dbg(L"TB entrypoint is 0x%x, Image is at 0x%x, size= 0x%x, data[0]= 0x%x\n",
-		tz_data->tb_entry_point, tz_data->tb_virt, tz_data->tb_size, tz_data->tb_data.mair);
+	/* tb_longjmp() always sets E2H, see trans.s */
+	el2_state_init(1);
+
+	Trace(TRACE_TB_SETUP, tz_data->tb_entry_point, tz_data->tb_virt,
+	      tz_data->tb_size, tz_data->tb_data.mair);
 
 	/* Allocate (bogus) boot parameters for tcb. */
 
@@ -247,7 +370,7 @@ EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcd
 	if (EFI_ERROR(ret))
 		goto exit_buf;
 
-	Dbg(L"Allocated %d pages at 0x%x (bootparams)\n", bootparams_pages, bootparams_phys);
+	Trace(TRACE_ALLOC, TRACE_ALLOC_BOOTPARAMS, bootparams_pages, bootparams_phys, 0);
 
 	struct sl_boot_params *bootparams = (struct sl_boot_params *)bootparams_phys;
 	/*
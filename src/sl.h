@@ -2,7 +2,6 @@
 #define SL_H
 
 #include <stdint.h>
-#include <efi.h>
 
 #define __PACKED __attribute__((packed))
 
@@ -119,7 +118,52 @@ struct sl_boot_params {
 	uint32_t unk5;				// 0x10
 } __PACKED;
 
+#define SL_REPORT_MAGIC		0x50524c53	// 'SLRP'
+#define SL_REPORT_MAX		12
+#define SL_REPORT_NAME		16
+#define SL_REPORT_HIST		12	// Buckets of [2^n, 2^(n+1)) us, the last takes the rest.
+
+/*
+ * Phases of the bounce, recorded in EL1 and shown by tb_report()
+ * from EL2. Read with MMU off, so must be flushed before LAUNCH.
+ */
+struct sl_report_entry {
+	char name[SL_REPORT_NAME];
+	uint64_t value;
+	uint64_t start;			// cntvct_el0, sl_report_begin() or the previous phase
+	uint64_t time;			// cntvct_el0
+};
+
+/* Latency of a call that was repeated, see sltest --timing. */
+struct sl_report_hist {
+	char name[SL_REPORT_NAME];
+	uint32_t count;
+	uint32_t buckets[SL_REPORT_HIST];
+	uint64_t min, max, total;	// cntvct_el0 ticks
+};
+
+struct sl_report {
+	uint32_t magic;
+	uint32_t count;
+	uint64_t freq;			// cntfrq_el0
+	struct sl_report_entry entries[SL_REPORT_MAX];
+	struct sl_report_hist hist;
+};
+
+#ifndef SL_FORMAT_ONLY
+#include <efi.h>
+
+extern struct sl_report sl_report;
+
+void sl_report_begin(void);
+void sl_report_add(const char *name, uint64_t value);
+void sl_report_hist_add(const char *name, uint64_t ticks);
+
+EFI_STATUS sl_get_cert_entry(UINT8 *tcb_data, UINT8 **data, UINT64 *size);
+EFI_STATUS sl_load_pe(UINT8 *load_addr, UINT64 load_size, UINT8 *pe_data, UINT64 pe_size);
+
 uint64_t sl_smc(struct sl_smc_params *smc_data, enum sl_cmd cmd, uint64_t pe_data, uint64_t pe_size, uint64_t arg_data, uint64_t arg_size);
 EFI_STATUS sl_create_data(EFI_FILE_HANDLE tcblaunch, struct sl_smc_params **smcdata, uint64_t *pe_data, uint64_t *pe_size, uint64_t *arg_data, uint64_t *arg_size);
+#endif
 
 #endif
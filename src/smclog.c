@@ -0,0 +1,265 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "arch.h"
+#include "sl.h"
+#include "resmem.h"
+#include "smclog.h"
+
+static struct smclog_header *smclog = NULL;
+static smc_backend_t smclog_next;
+static BOOLEAN smclog_authed = FALSE;
+
+static const struct smclog_header *replay = NULL;
+static BOOLEAN replay_delay;
+static UINTN replay_next, replay_mismatches, replay_reported;
+
+/* The first call that didn't match, for smclog_replay_report(). */
+static struct {
+	UINTN call;
+	uint64_t fid, cmd;
+	const struct smclog_entry *e;	/* NULL if past the end of the log. */
+} replay_mismatch;
+
+static inline struct smclog_entry *smclog_entries(const struct smclog_header *log)
+{
+	return (struct smclog_entry *)((UINT8 *)log + sizeof(*log));
+}
+
+static inline void smclog_clean(VOID *ptr, UINTN size)
+{
+	clear_dcache_range((uint64_t)ptr, size);
+}
+
+/*
+ * Copy the SL structures the call is going to look at. Once AUTH
+ * succeeded the tz data belongs to the hyp and touching it may be
+ * fatal, so only the params that sl_smc() rewrites are taken then.
+ */
+static void smclog_snapshot(struct smclog_entry *e)
+{
+	struct sl_smc_params *params = (struct sl_smc_params *)e->args[1];
+
+	if (e->args[0] != SMC_SL_ID || !params)
+		return;
+
+	CopyMem(&e->params, params, sizeof(e->params));
+	e->flags |= SMCLOG_F_SL;
+
+	if (smclog_authed || !params->arg_data || params->arg_size < sizeof(e->tz))
+		return;
+
+	CopyMem(&e->tz, (VOID *)params->arg_data, sizeof(e->tz));
+	e->flags |= SMCLOG_F_TZ;
+}
+
+static uint64_t smclog_record(const uint64_t args[6])
+{
+	struct smclog_entry *e;
+	uint64_t ret;
+	int i;
+
+	if (smclog->size + sizeof(*e) > SMCLOG_SIZE) {
+		smclog->dropped++;
+		smclog_clean(smclog, sizeof(*smclog));
+		return smclog_next(args);
+	}
+
+	e = (struct smclog_entry *)((UINT8 *)smclog + smclog->size);
+	ZeroMem(e, sizeof(*e));
+	for (i = 0; i < 6; i++)
+		e->args[i] = args[i];
+	smclog_snapshot(e);
+
+	smclog->count++;
+	smclog->size += sizeof(*e);
+
+	/* LAUNCH doesn't come back here, push the entry out first. */
+	smclog_clean(smclog, sizeof(*smclog));
+	smclog_clean(e, sizeof(*e));
+
+	e->time = arch_counter();
+	ret = smclog_next(args);
+	e->ticks = arch_counter() - e->time;
+
+	e->ret = ret;
+	e->flags |= SMCLOG_F_DONE;
+	smclog_clean(e, sizeof(*e));
+
+	if (args[0] == SMC_SL_ID && args[2] == SL_CMD_AUTH && !ret)
+		smclog_authed = TRUE;
+
+	return ret;
+}
+
+/**
+ * smclog_record_init() - Start logging all SMCs.
+ *
+ * The log is placed in a reserved-memory region that is also
+ * installed as SMCLOG_GUID config table. Calls are still passed
+ * to the backend that was active before.
+ */
+EFI_STATUS smclog_record_init(void)
+{
+	EFI_GUID SmclogGuid = SMCLOG_GUID;
+	EFI_STATUS status;
+	VOID *data;
+
+	if (smclog)
+		return EFI_SUCCESS;
+
+	status = resmem_alloc("slbounce-smclog", SMCLOG_COMPATIBLE, SMCLOG_SIZE, &SmclogGuid, &data);
+	if (EFI_ERROR(status))
+		return status;
+
+	smclog = data;
+	smclog->magic = SMCLOG_MAGIC;
+	smclog->version = SMCLOG_VERSION;
+	smclog->size = sizeof(*smclog);
+	smclog->freq = read_sysreg(cntfrq_el0);
+	smclog->entry_size = sizeof(struct smclog_entry);
+
+	smclog_next = smc_set_backend(smclog_record);
+
+	Dbg(L"Recording SMCs to 0x%lx\n", (uint64_t)smclog);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * smclog_get() - Get the log being recorded, NULL if not recording.
+ */
+const struct smclog_header *smclog_get(void)
+{
+	return smclog;
+}
+
+static void smclog_replay_mismatch(const uint64_t args[6], const struct smclog_entry *e)
+{
+	if (!replay_mismatches++) {
+		replay_mismatch.call = replay_next;
+		replay_mismatch.fid = args[0];
+		replay_mismatch.cmd = args[2];
+		replay_mismatch.e = e;
+	}
+}
+
+static uint64_t smclog_replay(const uint64_t args[6])
+{
+	const struct smclog_entry *e;
+	uint64_t start = arch_counter();
+	uint64_t wait;
+
+	/*
+	 * This may run after EBS, so mismatches are only recorded and
+	 * printed by smclog_replay_report() later.
+	 */
+	if (replay_next == replay->count) {
+		smclog_replay_mismatch(args, NULL);
+		return (uint64_t)-1;
+	}
+
+	e = &smclog_entries(replay)[replay_next];
+
+	if (e->args[0] != args[0] || (args[0] == SMC_SL_ID && e->args[2] != args[2]))
+		smclog_replay_mismatch(args, e);
+
+	replay_next++;
+
+	/* The call never returned on the device, as with a good LAUNCH. */
+	if (!(e->flags & SMCLOG_F_DONE))
+		return (uint64_t)-1;
+
+	if (replay_delay) {
+		wait = e->ticks * read_sysreg(cntfrq_el0) / replay->freq;
+		while (arch_counter() - start < wait)
+			;
+	}
+
+	return e->ret;
+}
+
+/**
+ * smclog_replay_init() - Answer all SMCs from a recorded log.
+ * @log:   The log, as found in the reserved-memory region.
+ * @size:  Size of the buffer with the log.
+ * @delay: Also take as long as the calls took on the device.
+ *
+ * The calls are expected to come in the same order as they were
+ * recorded. Calls that differ in function ID or SL command are
+ * counted as mismatches but still answered from the log.
+ * smclog_replay_report() prints them.
+ */
+EFI_STATUS smclog_replay_init(const VOID *log, UINTN size, BOOLEAN delay)
+{
+	const struct smclog_header *h = log;
+
+	if (size < sizeof(*h) || h->magic != SMCLOG_MAGIC)
+		return EFI_INVALID_PARAMETER;
+
+	if (h->version != SMCLOG_VERSION || h->entry_size != sizeof(struct smclog_entry))
+		return EFI_INCOMPATIBLE_VERSION;
+
+	if (h->size > size || !h->freq ||
+	    sizeof(*h) + (UINT64)h->count * h->entry_size > h->size)
+		return EFI_INVALID_PARAMETER;
+
+	replay = h;
+	replay_delay = delay;
+	replay_next = 0;
+	replay_mismatches = 0;
+	replay_reported = 0;
+
+	smc_set_backend(smclog_replay);
+
+	Dbg(L"Replaying %d SMCs from 0x%lx\n", h->count, (uint64_t)h);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * smclog_replay_rewind() - Answer the next SMC from the start of the log.
+ */
+void smclog_replay_rewind(void)
+{
+	replay_next = 0;
+}
+
+/**
+ * smclog_replay_mismatches() - Number of calls that didn't match the log.
+ */
+UINTN smclog_replay_mismatches(void)
+{
+	return replay_mismatches;
+}
+
+/**
+ * smclog_replay_report() - Print the calls that didn't match the log so far.
+ *
+ * Needs the boot services, the replay itself may run after EBS. The
+ * mismatches reported by an earlier call are not repeated.
+ */
+void smclog_replay_report(void)
+{
+	if (replay_mismatches == replay_reported)
+		return;
+
+	if (!replay_reported) {
+		if (replay_mismatch.e)
+			Print(L"smclog: call %d is 0x%lx/%ld, the log has 0x%lx/%ld\n",
+			      replay_mismatch.call, replay_mismatch.fid, replay_mismatch.cmd,
+			      replay_mismatch.e->args[0], replay_mismatch.e->args[2]);
+		else
+			Print(L"smclog: call %d (0x%lx) is past the end of the log\n",
+			      replay_mismatch.call, replay_mismatch.fid);
+	}
+
+	Print(L"smclog: %d calls didn't match the log\n", replay_mismatches);
+	replay_reported = replay_mismatches;
+}
@@ -0,0 +1,64 @@
+#ifndef SMCLOG_H
+#define SMCLOG_H
+
+#include <stdint.h>
+
+#ifdef SMCLOG_FORMAT_ONLY
+#define SL_FORMAT_ONLY
+#endif
+#include "sl.h"
+
+/*
+ * Log of the SMCs made by slbounce, recorded on a device into a
+ * reserved-memory region and replayed in the host harness or qemu.
+ * The layout is shared with tools/smclog.c, which builds with
+ * SMCLOG_FORMAT_ONLY.
+ */
+
+#define SMCLOG_MAGIC		0x474f4c434d534c53ull	// 'SLSMCLOG'
+#define SMCLOG_VERSION		1
+#define SMCLOG_SIZE		(64 * 1024)
+#define SMCLOG_COMPATIBLE	"slbounce,smclog"
+
+#define SMCLOG_GUID \
+    { 0x3c6e91d4, 0x27a8, 0x4f0b, {0xb5, 0x13, 0x6e, 0x90, 0x2d, 0xc4, 0x7a, 0x1f} }
+
+#define SMCLOG_F_DONE		(1 << 0)	/* The call returned. */
+#define SMCLOG_F_SL		(1 << 1)	/* params and tz are valid. */
+#define SMCLOG_F_TZ		(1 << 2)	/* tz is valid. */
+
+struct smclog_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t size;			/* Bytes used, including the header. */
+	uint64_t freq;			/* cntfrq_el0 */
+	uint32_t entry_size;
+	uint32_t count;
+	uint32_t dropped;		/* Calls that didn't fit. */
+	uint32_t pad;
+};
+
+/* One smc6() call, the SL structures are copied before the call. */
+struct smclog_entry {
+	uint64_t args[6];
+	uint64_t ret;
+	uint64_t time;			/* cntvct_el0 before the call. */
+	uint64_t ticks;			/* Latency of the call. */
+	uint32_t flags;
+	uint32_t pad;
+	struct sl_smc_params params;
+	struct sl_tz_data tz;
+};
+
+#ifndef SMCLOG_FORMAT_ONLY
+#include <efi.h>
+
+EFI_STATUS smclog_record_init(void);
+EFI_STATUS smclog_replay_init(const VOID *log, UINTN size, BOOLEAN delay);
+void smclog_replay_rewind(void);
+UINTN smclog_replay_mismatches(void);
+void smclog_replay_report(void);
+const struct smclog_header *smclog_get(void);
+#endif
+
+#endif
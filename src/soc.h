@@ -0,0 +1,25 @@
+#ifndef SOC_H
+#define SOC_H
+
+/*
+ * Per-SoC builds (slbounce-<soc>.efi) pass SOC_HEADER pointing to one
+ * of src/soc/<soc>.h. The generic build leaves it undefined and all of
+ * the below is detected at runtime instead.
+ *
+ * A SoC header may define:
+ *  SOC_COMPATIBLE	- Root compatible of the SoC.
+ *  SOC_DCACHE_LINE	- D-cache line size in bytes, replaces CTR_EL0 reads.
+ *  SOC_QUIRKS		- Mask of SOC_QUIRK_* the SoC needs.
+ *  SOC_DTBO_SYMBOLS	- Embedded symbols overlay, if the dtbs may lack them.
+ *  SOC_DTBO_EL2	- Embedded EL2 overlay.
+ */
+
+#define SOC_QUIRK_CMD_DB	(1 << 0)	/* Relocate cmd-db memory. */
+#define SOC_QUIRK_RMTFS		(1 << 1)	/* Assign rmtfs memory to the modem. */
+#define SOC_QUIRK_ZAP_SHADER	(1 << 2)	/* Drop gpu/zap-shader node. */
+
+#ifdef SOC_HEADER
+#include SOC_HEADER
+#endif
+
+#endif
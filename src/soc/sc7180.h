@@ -0,0 +1,7 @@
+/* Snapdragon 7c/7c Gen 2 */
+
+#define SOC_COMPATIBLE		"qcom,sc7180"
+#define SOC_DCACHE_LINE		64
+#define SOC_QUIRKS		(SOC_QUIRK_CMD_DB | SOC_QUIRK_RMTFS | SOC_QUIRK_ZAP_SHADER)
+#define SOC_DTBO_SYMBOLS	dtbo_sc7180_symbols
+#define SOC_DTBO_EL2		dtbo_sc7180_el2
@@ -0,0 +1,7 @@
+/* Snapdragon 8cx Gen 3 */
+
+#define SOC_COMPATIBLE		"qcom,sc8280xp"
+#define SOC_DCACHE_LINE		64
+#define SOC_QUIRKS		(SOC_QUIRK_ZAP_SHADER)
+#define SOC_DTBO_SYMBOLS	dtbo_sc8280xp_symbols
+#define SOC_DTBO_EL2		dtbo_sc8280xp_el2
@@ -0,0 +1,7 @@
+/* Snapdragon X Elite/Plus */
+
+#define SOC_COMPATIBLE		"qcom,x1e80100"
+#define SOC_DCACHE_LINE		64
+#define SOC_QUIRKS		(SOC_QUIRK_ZAP_SHADER)
+#define SOC_DTBO_SYMBOLS	NULL
+#define SOC_DTBO_EL2		dtbo_x1e_el2
@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include <string.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+#include "arch.h"
+#include "sl.h"
+#include "resmem.h"
+#include "pmu.h"
+#include "telemetry.h"
+
+static struct telemetry_record *telemetry = NULL;
+
+/* sl_create_data() records its steps in sl_report, see sl.c */
+static const struct {
+	const char *name;
+	enum telemetry_event ev;
+} telemetry_report_map[] = {
+	{ "READ",	TELEMETRY_CREATE_READ },
+	{ "PE",		TELEMETRY_CREATE_PE },
+};
+
+/**
+ * telemetry_init() - Find or allocate the telemetry record.
+ *
+ * If dtbhack (or an earlier run) already left a record in the config
+ * table, it's kept so one record covers the whole boot. Otherwise a
+ * new one is allocated and installed as TELEMETRY_GUID config table.
+ */
+EFI_STATUS telemetry_init(void)
+{
+	EFI_GUID TelemetryGuid = TELEMETRY_GUID;
+	struct telemetry_record *rec;
+	EFI_STATUS status;
+	VOID *data;
+
+	if (telemetry)
+		return EFI_SUCCESS;
+
+	status = LibGetSystemConfigurationTable(&TelemetryGuid, &data);
+	if (!EFI_ERROR(status)) {
+		rec = data;
+		if (rec->magic != TELEMETRY_MAGIC || rec->version != TELEMETRY_VERSION ||
+		    rec->size != sizeof(*rec))
+			return EFI_INCOMPATIBLE_VERSION;
+
+		status = resmem_add("slbounce-telemetry", TELEMETRY_COMPATIBLE,
+				    (EFI_PHYSICAL_ADDRESS)data, TELEMETRY_SIZE);
+		if (EFI_ERROR(status))
+			return status;
+
+		telemetry = rec;
+		return EFI_SUCCESS;
+	}
+
+	status = resmem_alloc("slbounce-telemetry", TELEMETRY_COMPATIBLE, TELEMETRY_SIZE, &TelemetryGuid, &data);
+	if (EFI_ERROR(status))
+		return status;
+
+	rec = data;
+	rec->magic = TELEMETRY_MAGIC;
+	rec->version = TELEMETRY_VERSION;
+	rec->size = sizeof(*rec);
+	rec->freq = read_sysreg(cntfrq_el0);
+
+	telemetry = rec;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * telemetry_get() - The record, NULL if telemetry_init() failed.
+ */
+const struct telemetry_record *telemetry_get(void)
+{
+	return telemetry;
+}
+
+/**
+ * telemetry_begin() - Record the start of a boot phase.
+ *
+ * Phases that happen more than once are counted, the last one wins.
+ */
+void telemetry_begin(enum telemetry_event ev)
+{
+	struct telemetry_event_rec *e;
+
+	if (!telemetry)
+		return;
+
+	e = &telemetry->events[ev];
+	e->start = arch_counter();
+	e->end = 0;
+	e->count++;
+}
+
+/**
+ * telemetry_end() - Record the end of a boot phase and its result.
+ */
+void telemetry_end(enum telemetry_event ev, uint64_t value)
+{
+	struct telemetry_event_rec *e;
+
+	if (!telemetry)
+		return;
+
+	e = &telemetry->events[ev];
+	e->end = arch_counter();
+	e->value = value;
+}
+
+/**
+ * telemetry_import_report() - Take the sl_create_data() steps from sl_report.
+ *
+ * sl.c is shared with sltest, which has no telemetry, so the steps are
+ * only recorded in the report and copied here afterwards.
+ */
+void telemetry_import_report(const struct sl_report *rep)
+{
+	const struct sl_report_entry *ent;
+	struct telemetry_event_rec *e;
+	int i, j;
+
+	if (!telemetry || rep->magic != SL_REPORT_MAGIC)
+		return;
+
+	for (i = 0; i < rep->count && i < SL_REPORT_MAX; i++) {
+		ent = &rep->entries[i];
+
+		for (j = 0; j < sizeof(telemetry_report_map) / sizeof(telemetry_report_map[0]); j++) {
+			if (strncmp(ent->name, telemetry_report_map[j].name, SL_REPORT_NAME))
+				continue;
+
+			e = &telemetry->events[telemetry_report_map[j].ev];
+			e->start = ent->start;
+			e->end = ent->time;
+			e->value = ent->value;
+			e->count++;
+		}
+	}
+}
+
+/**
+ * telemetry_add_flush() - Account one range of the EBS flush.
+ */
+void telemetry_add_flush(uint32_t type, uint64_t bytes, uint64_t ticks)
+{
+	struct telemetry_flush_rec *f;
+
+	if (!telemetry)
+		return;
+
+	if (type >= TELEMETRY_MEM_TYPES)
+		type = TELEMETRY_MEM_TYPES - 1;
+
+	f = &telemetry->flush[type];
+	f->bytes += bytes;
+	f->ticks += ticks;
+	f->ranges++;
+}
+
+/**
+ * telemetry_set_flush_plan() - Record the flush strategy and its prediction.
+ */
+void telemetry_set_flush_plan(uint32_t strategy, uint32_t cached, uint64_t predicted_ns)
+{
+	if (!telemetry)
+		return;
+
+	telemetry->flush_strategy = strategy;
+	telemetry->flush_cached = cached;
+	telemetry->flush_predicted_ns = predicted_ns;
+}
+
+/**
+ * telemetry_sync() - Push the record to memory.
+ *
+ * The region is not part of the memory map flush, so this has to be
+ * called after the last write that should survive the switch, and
+ * again after the switch. The PMU counts are taken here as well.
+ */
+void telemetry_sync(void)
+{
+#ifdef SLBOUNCE_PMU
+	const struct pmu_counts *counts;
+	const uint16_t *events;
+	int i, j;
+#endif
+
+	if (!telemetry)
+		return;
+
+#ifdef SLBOUNCE_PMU
+	telemetry->pmu_count = pmu_get(&counts, &events);
+
+	for (i = 0; i < TELEMETRY_PMU_EVENTS; i++)
+		telemetry->pmu_events[i] = events[i];
+
+	for (i = 0; i < TELEMETRY_PMU_REGIONS; i++) {
+		telemetry->pmu[i].calls = counts[i].calls;
+		telemetry->pmu[i].cycles = counts[i].cycles;
+		for (j = 0; j < TELEMETRY_PMU_EVENTS; j++)
+			telemetry->pmu[i].events[j] = counts[i].events[j];
+	}
+#endif
+
+	clear_dcache_range((uint64_t)telemetry, sizeof(*telemetry));
+}
+
+/**
+ * telemetry_fdt_add() - Point /chosen of the dtb at the record.
+ *
+ * The dtb must be open with enough room for the property. The region
+ * itself is described in /reserved-memory by resmem_fdt_add().
+ */
+EFI_STATUS telemetry_fdt_add(VOID *fdt)
+{
+	fdt64_t prop[2];
+	int offset, ret;
+
+	if (!telemetry)
+		return EFI_SUCCESS;
+
+	offset = fdt_path_offset(fdt, "/chosen");
+	if (offset < 0)
+		offset = fdt_add_subnode(fdt, 0, "chosen");
+	if (offset < 0)
+		return EFI_LOAD_ERROR;
+
+	prop[0] = cpu_to_fdt64((uint64_t)telemetry);
+	prop[1] = cpu_to_fdt64(TELEMETRY_SIZE);
+
+	ret = fdt_setprop(fdt, offset, TELEMETRY_CHOSEN_PROP, prop, sizeof(prop));
+	if (ret) {
+		Print(L"Failed to add the telemetry to /chosen: %d\n", ret);
+		return EFI_LOAD_ERROR;
+	}
+
+	return EFI_SUCCESS;
+}
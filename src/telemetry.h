@@ -0,0 +1,98 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+/*
+ * Boot-phase timestamps and counters, left in a reserved-memory region
+ * for the OS and pointed at from /chosen. The layout is shared with
+ * tools/sltelemetry.c, which builds with TELEMETRY_FORMAT_ONLY.
+ */
+
+#define TELEMETRY_MAGIC		0x4d4c455442534c53ull	// 'SLSBTELM'
+#define TELEMETRY_VERSION	3
+#define TELEMETRY_SIZE		4096
+#define TELEMETRY_COMPATIBLE	"slbounce,telemetry"
+#define TELEMETRY_CHOSEN_PROP	"slbounce,telemetry"	/* <address size>, 64 bit each. */
+
+#define TELEMETRY_GUID \
+    { 0x5e2b7a90, 0xc4d1, 0x4a36, {0x8f, 0x07, 0x1b, 0x6c, 0xe2, 0x94, 0x3d, 0x58} }
+
+#define TELEMETRY_MEM_TYPES	16	/* By EFI memory type, the last one takes the rest. */
+#define TELEMETRY_PMU_REGIONS	4	/* enum pmu_region */
+#define TELEMETRY_PMU_EVENTS	5
+
+/* Never renumber, the reader only knows the numbers. */
+enum telemetry_event {
+	TELEMETRY_LOAD		= 0,	/* slbounce.efi, from efi_main() to returning. */
+	TELEMETRY_CREATE	= 1,	/* sl_create_data() */
+	TELEMETRY_CREATE_READ	= 2,	/* Reading tcblaunch.exe */
+	TELEMETRY_CREATE_PE	= 3,	/* Loading the PE, value is the status. */
+	TELEMETRY_AVAILABLE	= 4,	/* SL_CMD_IS_AVAILABLE, value is the result. */
+	TELEMETRY_DT_FIXUP	= 5,	/* EFI_DT_FIXUP_PROTOCOL, value is the status. */
+	TELEMETRY_EBS_HOOK	= 6,	/* The loader called ExitBootServices(). */
+	TELEMETRY_POLICY	= 7,	/* sl_is_allowed_by_fdt(), value is the status. */
+	TELEMETRY_FLUSH		= 8,	/* The memory map flush. */
+	TELEMETRY_EBS		= 9,	/* The real ExitBootServices(), value is the status. */
+	TELEMETRY_AUTH		= 10,	/* SL_CMD_AUTH, value is the result. */
+	TELEMETRY_LAUNCH	= 11,	/* From SL_CMD_LAUNCH to the longjmp, value is the EL. */
+	TELEMETRY_DTBHACK	= 12,	/* dtbhack.efi, value is the status. */
+	TELEMETRY_BOOTI		= 13,	/* Loading the kernel, initrd and dtb for booti. */
+	TELEMETRY_EVENTS	= 16,
+};
+
+struct telemetry_event_rec {
+	uint64_t start;			/* cntvct_el0, 0 if it didn't happen. */
+	uint64_t end;			/* cntvct_el0, 0 if it didn't finish. */
+	uint64_t value;
+	uint32_t count;			/* Times it happened, only the last is timed. */
+	uint32_t pad;
+};
+
+struct telemetry_flush_rec {
+	uint64_t bytes;
+	uint64_t ticks;
+	uint32_t ranges;
+	uint32_t pad;
+};
+
+/* PMU counts of a region, only with SLBOUNCE_PMU. */
+struct telemetry_pmu_rec {
+	uint64_t calls;
+	uint64_t cycles;
+	uint64_t events[TELEMETRY_PMU_EVENTS];
+};
+
+struct telemetry_record {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t size;			/* sizeof(struct telemetry_record) */
+	uint64_t freq;			/* cntfrq_el0 */
+	struct telemetry_event_rec events[TELEMETRY_EVENTS];
+	struct telemetry_flush_rec flush[TELEMETRY_MEM_TYPES];
+	uint16_t pmu_events[TELEMETRY_PMU_EVENTS];	/* PMUv3 event numbers. */
+	uint16_t pmu_count;		/* Event counters used, 0 without PMU. */
+	uint16_t pad[2];
+	struct telemetry_pmu_rec pmu[TELEMETRY_PMU_REGIONS];
+	uint32_t flush_strategy;	/* enum flush_strategy, only with SLBOUNCE_TUNE. */
+	uint32_t flush_cached;		/* The calibration came from the NV cache. */
+	uint64_t flush_predicted_ns;	/* 0 if the flush was not tuned. */
+};
+
+#ifndef TELEMETRY_FORMAT_ONLY
+#include <efi.h>
+
+#include "sl.h"
+
+EFI_STATUS telemetry_init(void);
+const struct telemetry_record *telemetry_get(void);
+void telemetry_begin(enum telemetry_event ev);
+void telemetry_end(enum telemetry_event ev, uint64_t value);
+void telemetry_import_report(const struct sl_report *rep);
+void telemetry_add_flush(uint32_t type, uint64_t bytes, uint64_t ticks);
+void telemetry_set_flush_plan(uint32_t strategy, uint32_t cached, uint64_t predicted_ns);
+void telemetry_sync(void);
+EFI_STATUS telemetry_fdt_add(VOID *fdt);
+#endif
+
+#endif
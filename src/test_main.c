@@ -11,6 +11,74 @@
 #include "util.h"
 #include "arch.h"
 #include "sl.h"
+#include "trace.h"
+
+#define SLTEST_TIMING_DEFAULT	64
+
+/* IS_AVAILABLE calls for the histogram, 0 if not in --timing mode. */
+static UINTN sltest_timing = 0;
+
+static uint64_t ticks_to_us(uint64_t ticks)
+{
+	return arch_ticks_to_ns(ticks) / 1000;
+}
+
+/**
+ * sl_test_print_report() - Show the phases recorded so far.
+ *
+ * The rest of the report can only be seen after the switch, drawn by
+ * tb_report().
+ */
+static void sl_test_print_report(void)
+{
+	struct sl_report_hist *hist = &sl_report.hist;
+	struct sl_report_entry *ent;
+	int i;
+
+	Print(L"\n  %-12a %-10a %10a\n", "phase", "ret", "us");
+	for (i = 0; i < sl_report.count; i++) {
+		ent = &sl_report.entries[i];
+		Print(L"  %-12a 0x%-8lx %10lu\n", ent->name, ent->value, ticks_to_us(ent->time - ent->start));
+	}
+
+	if (!hist->count)
+		return;
+
+	Print(L"\n  %a x%d: min %lu us, avg %lu us, max %lu us\n", hist->name, hist->count,
+	      ticks_to_us(hist->min), ticks_to_us(hist->total / hist->count), ticks_to_us(hist->max));
+
+	for (i = 0; i < SL_REPORT_HIST; i++) {
+		if (!hist->buckets[i])
+			continue;
+
+		if (i == SL_REPORT_HIST - 1)
+			Print(L"  %6lu+      us: %d\n", 1ull << i, hist->buckets[i]);
+		else
+			Print(L"  %6lu-%-6lu us: %d\n", i ? 1ull << i : 0, (1ull << (i + 1)) - 1, hist->buckets[i]);
+	}
+	Print(L"\n");
+}
+
+/*
+ * IS_AVAILABLE has no side effects and is the only call that can be
+ * repeated, so its latency stands in for the SL round trip.
+ */
+static uint64_t sl_test_available_hist(struct sl_smc_params *smc_data, uint64_t pe_data, uint64_t pe_size,
+				       uint64_t arg_data, uint64_t arg_size)
+{
+	uint64_t smcret, t;
+	UINTN i;
+
+	for (i = 0; i < sltest_timing; i++) {
+		t = arch_counter();
+		smcret = sl_smc(smc_data, SL_CMD_IS_AVAILABLE, pe_data, pe_size, arg_data, arg_size);
+		sl_report_hist_add("AVAILABLE", arch_counter() - t);
+		if (smcret)
+			return smcret;
+	}
+
+	return 0;
+}
 
 EFI_STATUS sl_test(EFI_FILE_HANDLE tcblaunch, EFI_HANDLE ImageHandle)
 {
@@ -20,7 +88,13 @@ EFI_STATUS sl_test(EFI_FILE_HANDLE tcblaunch, EFI_HANDLE ImageHandle)
 	struct sl_smc_params *smc_data;
 	struct sl_tz_data *tz_data;
 
+	sl_report_add("START", 0);
+
 	ret = sl_create_data(tcblaunch, &smc_data, &pe_data, &pe_size, &arg_data, &arg_size);
+	sl_report_add("CREATE", ret);
+#ifdef SLBOUNCE_TRACE
+	trace_dump();
+#endif
 	if (EFI_ERROR(ret)) {
 		Print(L"Failed to prepare data for Secure-Launch: %d\n", ret);
 		return ret;
@@ -33,26 +107,48 @@ EFI_STATUS sl_test(EFI_FILE_HANDLE tcblaunch, EFI_HANDLE ImageHandle)
 
 	EFI_GUID gopGuid = EFI_GRAPHICS_OUTPUT_PROTOCOL_GUID;
 	EFI_GRAPHICS_OUTPUT_PROTOCOL *gop;
+	sl_report_begin();
 	ret = uefi_call_wrapper(BS->LocateProtocol, 3, &gopGuid, NULL, (void**)&gop);
 	if(EFI_ERROR(ret)) {
 		Print(L"Unable to locate GOP\n");
 		return ret;
 	}
 
+	EFI_GUID lipGuid = EFI_LOADED_IMAGE_PROTOCOL_GUID;
+	EFI_LOADED_IMAGE *loaded_image;
+	ret = uefi_call_wrapper(BS->HandleProtocol, 3, ImageHandle, &lipGuid, (void **)&loaded_image);
+	if (EFI_ERROR(ret)) {
+		Print(L"Unable to get the loaded image\n");
+		return ret;
+	}
+	sl_report_add("GOP", ret);
+
 	tz_data = (struct sl_tz_data *)arg_data;
 	tz_data->tb_data.sp  = gop->Mode->FrameBufferBase;		// base
-	tz_data->tb_data.tcr = gop->Mode->Info->HorizontalResolution;	// stride
+	tz_data->tb_data.tcr = gop->Mode->Info->PixelsPerScanLine;	// stride
 
 	Print(L"Data creation is done. Trying to perform Secure-Launch...\n");
 
 	Print(L" == Available: ");
+	sl_report_begin();
 	smcret = sl_smc(smc_data, SL_CMD_IS_AVAILABLE, pe_data, pe_size, arg_data, arg_size);
+	sl_report_add("AVAILABLE", smcret);
 	Print(L"0x%x\n", smcret);
 	if (smcret) {
 		Print(L"This device does not support Secure-Launch.\n");
 		return EFI_UNSUPPORTED;
 	}
 
+	if (sltest_timing) {
+		smcret = sl_test_available_hist(smc_data, pe_data, pe_size, arg_data, arg_size);
+		if (smcret) {
+			Print(L"Repeated IS_AVAILABLE failed with 0x%lx\n", smcret);
+			return EFI_UNSUPPORTED;
+		}
+
+		sl_test_print_report();
+	}
+
 	/*
 	 * From this point onward it's not safe to return to UEFI
 	 * unless we succeed. If the hyp encounters an error, and
@@ -62,7 +158,9 @@ EFI_STATUS sl_test(EFI_FILE_HANDLE tcblaunch, EFI_HANDLE ImageHandle)
 	 */
 
 	Print(L" == Auth: ");
+	sl_report_begin();
 	smcret = sl_smc(smc_data, SL_CMD_AUTH, pe_data, pe_size, arg_data, arg_size);
+	sl_report_add("AUTH", smcret);
 	Print(L"0x%x\n", smcret);
 	if (smcret)
 		goto exit_corrupted;
@@ -81,12 +179,22 @@ EFI_STATUS sl_test(EFI_FILE_HANDLE tcblaunch, EFI_HANDLE ImageHandle)
 	UINTN MemoryMapSize = 1024*512, MapKey, DescriptorSize;
 	EFI_MEMORY_DESCRIPTOR *MemoryMap = AllocatePool(MemoryMapSize);
 	UINT32 DescriptorVersion;
+	sl_report_begin();
 	ret = uefi_call_wrapper(BS->GetMemoryMap, 6, &MemoryMapSize, MemoryMap, &MapKey, &DescriptorSize, &DescriptorVersion);
 	ret = uefi_call_wrapper(BS->ExitBootServices, 2, ImageHandle, MapKey);
+	sl_report_add("EBS", ret);
+
+	/*
+	 * tb_report() runs with MMU off, make sure it sees our code,
+	 * the font and the report.
+	 */
+	clear_dcache_range((uint64_t)loaded_image->ImageBase, loaded_image->ImageSize);
 
 	/* We set a special longjmp point here in hopes SL gets us back. */
 	if (tb_setjmp(tb_jmp_buf) == 0) {
 		clear_dcache_range((uint64_t)tb_jmp_buf, 8*21);
+		sl_report_add("LAUNCH", 0);
+		clear_dcache_range((uint64_t)&sl_report, sizeof(sl_report));
 		smcret = sl_smc(smc_data, SL_CMD_LAUNCH, pe_data, pe_size, arg_data, arg_size);
 		if (smcret)
 			psci_reboot(); // Indicate a fatal error with a reboot.
@@ -94,8 +202,12 @@ EFI_STATUS sl_test(EFI_FILE_HANDLE tcblaunch, EFI_HANDLE ImageHandle)
 
 	/*
 	 * We just turn the device off here since it's the most
-	 * reliable way to assert that we got to this code.
+	 * reliable way to assert that we got to this code. If EL2
+	 * was left with unexpected traps, reboot instead.
 	 */
+	if (el2_check_state(NULL, 0))
+		psci_reboot();
+
 	psci_off();
 
 	return EFI_SUCCESS;
@@ -114,10 +226,39 @@ exit_corrupted:
 	return EFI_UNSUPPORTED;
 }
 
+/**
+ * el2_self_test() - Apply and check the EL2 handoff state in place.
+ *
+ * When the firmware already runs in EL2 (i.e. in QEMU with
+ * virtualization=on) we can exercise the same code tb_longjmp()
+ * uses and see the result without doing Secure-Launch.
+ */
+static EFI_STATUS el2_self_test(void)
+{
+	struct el2_check regs[EL2_STATE_CNT] = {0};
+	int e2h = !!(read_sysreg(hcr_el2) & HCR_EL2_E2H);
+	int i, bad;
+
+	el2_state_init(e2h);
+	tb_el2_setup();
+	bad = el2_check_state(regs, EL2_STATE_CNT);
+
+	Print(L"EL2 state (E2H=%d):\n", e2h);
+	for (i = 0; i < EL2_STATE_CNT && regs[i].name; i++) {
+		Print(L"  %-12s 0x%016lx%s\n", regs[i].name, regs[i].actual,
+		      regs[i].actual == regs[i].expected ? L"" : L" MISMATCH");
+		if (regs[i].actual != regs[i].expected)
+			Print(L"  %-12s 0x%016lx expected\n", L"", regs[i].expected);
+	}
+	Print(L"%d mismatching registers\n\n", bad);
+
+	return bad ? EFI_DEVICE_ERROR : EFI_SUCCESS;
+}
+
 EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 {
 	EFI_FILE_HANDLE volume, file;
-	CHAR16 **argv;
+	CHAR16 **argv, *tcb_name;
 	INTN argc;
 	EFI_STATUS ret;
 
@@ -129,16 +270,32 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 
 	if (read_currentel().el != 1) {
 		Print(L"Already in EL2!\n\n");
-		return EFI_SUCCESS;
+		return el2_self_test();
 	}
 
-	if (argc != 2) {
-		Print(L"Usage: slbounce.efi tcblaunch.exe\n\n");
+	if (argc == 3 && !StrnCmp(argv[1], L"--timing", 8)) {
+		if (argv[1][8] == L'=')
+			sltest_timing = Atoi(argv[1] + 9);
+		else if (argv[1][8] == L'\0')
+			sltest_timing = SLTEST_TIMING_DEFAULT;
+	}
+
+	if (argc != (sltest_timing ? 3 : 2)) {
+		Print(L"Usage: sltest.efi [--timing[=N]] tcblaunch.exe\n\n");
 		return EFI_INVALID_PARAMETER;
 	}
 
+	tcb_name = argv[argc - 1];
+
+#ifdef SLBOUNCE_TRACE
+	/* Only dumped here, so a pool is good enough. */
+	ret = trace_start(AllocatePool(TRACE_SIZE), TRACE_SIZE);
+	if (EFI_ERROR(ret))
+		Print(L"Failed to set up the trace: %d\n", ret);
+#endif
+
 	Print(L"We are %s\n", argv[0]);
-	Print(L"Launching using %s\n", argv[1]);
+	Print(L"Launching using %s\n", tcb_name);
 
 	volume = GetVolume(ImageHandle);
 	if (!volume) {
@@ -146,7 +303,7 @@ EFI_STATUS efi_main(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable)
 		return EFI_INVALID_PARAMETER;
 	}
 
-	file = FileOpen(volume, argv[1]);
+	file = FileOpen(volume, tcb_name);
 	if (!file) {
 		Print(L"Opening file failed.\n");
 		return EFI_INVALID_PARAMETER;
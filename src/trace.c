@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "arch.h"
+#include "trace.h"
+
+static struct trace_header *trace = NULL;
+
+static inline struct trace_entry *trace_entries(void)
+{
+	return (struct trace_entry *)(trace + 1);
+}
+
+/**
+ * trace_start() - Start recording into a buffer.
+ * @buf: Buffer for the ring, slbounce uses a reserved-memory region.
+ * @size: Size of the buffer.
+ *
+ * The buffer must stay mapped and cacheable for as long as events
+ * are recorded.
+ */
+EFI_STATUS trace_start(VOID *buf, UINTN size)
+{
+	struct trace_header *hdr = buf;
+	UINTN entries = 1;
+
+	if (!buf || size < sizeof(*hdr) + sizeof(struct trace_entry))
+		return EFI_INVALID_PARAMETER;
+
+	while (entries * 2 <= (size - sizeof(*hdr)) / sizeof(struct trace_entry))
+		entries *= 2;
+
+	SetMem(buf, size, 0);
+
+	hdr->magic = TRACE_MAGIC;
+	hdr->version = TRACE_VERSION;
+	hdr->size = sizeof(*hdr) + entries * sizeof(struct trace_entry);
+	hdr->freq = read_sysreg(cntfrq_el0);
+	hdr->entry_size = sizeof(struct trace_entry);
+	hdr->entries = entries;
+	hdr->head = 0;
+
+	trace = hdr;
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * trace_event() - Record an event.
+ *
+ * Lock-free, a slot is claimed by bumping the head and the sequence
+ * number is written last, so a reader can tell torn records apart.
+ * Old records are overwritten once the ring is full.
+ */
+void trace_event(enum trace_event ev, uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+{
+	struct trace_entry *e;
+	uint64_t idx;
+
+	if (!trace)
+		return;
+
+	idx = arch_fetch_add(&trace->head, 1);
+	e = &trace_entries()[idx & (trace->entries - 1)];
+
+	e->seq = 0;
+	e->time = arch_counter();
+	e->event = ev;
+	e->cpu = read_sysreg(mpidr_el1) & 0xffff;
+	e->args[0] = a;
+	e->args[1] = b;
+	e->args[2] = c;
+	e->args[3] = d;
+
+	__atomic_store_n(&e->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * trace_sync() - Push the ring to memory.
+ *
+ * Must be called before anything reads the ring with the MMU off,
+ * i.e. before the launch.
+ */
+void trace_sync(void)
+{
+	if (!trace)
+		return;
+
+	clear_dcache_range((uint64_t)trace, trace->size);
+}
+
+/**
+ * trace_dump() - Print the ring on the console, oldest record first.
+ */
+void trace_dump(void)
+{
+	struct trace_entry *e;
+	uint64_t first, idx, start = 0;
+	const char *name;
+
+	if (!trace)
+		return;
+
+	if (trace->head > trace->entries)
+		start = trace->head - trace->entries;
+
+	Print(L"Trace: %ld records, %ld overwritten\n", trace->head, start);
+
+	first = trace_entries()[start & (trace->entries - 1)].time;
+
+	for (idx = start; idx < trace->head; idx++) {
+		e = &trace_entries()[idx & (trace->entries - 1)];
+		if (e->seq != idx + 1)
+			continue;
+
+		name = "?";
+		if (e->event < TRACE_EVENT_CNT)
+			name = trace_event_names[e->event];
+
+		Print(L"%5ld %8ld us cpu%x %-12a %lx %lx %lx %lx\n", idx,
+		      (e->time - first) * 1000000 / trace->freq, e->cpu, name,
+		      e->args[0], e->args[1], e->args[2], e->args[3]);
+	}
+}
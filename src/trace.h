@@ -0,0 +1,128 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*
+ * Binary trace ring, for the places where formatting a message with
+ * Print() would change the timing or is not possible at all (after
+ * EBS, in EL2). Each record is an event id, a timestamp and up to 4
+ * arguments, nothing is formatted until the ring is dumped on the
+ * console or read back by tools/sltrace.c, which builds with
+ * TRACE_FORMAT_ONLY.
+ */
+
+#define TRACE_MAGIC		0x4543415254534c53ull	// 'SLSTRACE'
+#define TRACE_VERSION		1
+#define TRACE_SIZE		(64 * 1024)
+#define TRACE_COMPATIBLE	"slbounce,trace"
+
+#define TRACE_GUID \
+    { 0x9d4b62e1, 0x3a7c, 0x4e15, {0xa2, 0x86, 0x5f, 0x0c, 0xd9, 0x41, 0xb7, 0x2e} }
+
+/* Never renumber, dumps only have the numbers. */
+enum trace_event {
+	TRACE_NONE		= 0,
+	TRACE_PE_SECURITY	= 1,	/* offset, size */
+	TRACE_PE_CERT		= 2,	/* length, revision, type */
+	TRACE_PE_HEADER		= 3,	/* size, address */
+	TRACE_PE_SECTION	= 4,	/* name (8 chars), size, file offset, address */
+	TRACE_ALLOC		= 5,	/* enum trace_alloc, pages, address, cert pages */
+	TRACE_TB_SETUP		= 6,	/* entry, image, size, data[0] */
+	TRACE_SMC		= 7,	/* cmd, pe_data, arg_data */
+	TRACE_SMC_RET		= 8,	/* cmd, result */
+	TRACE_EBS_HOOK		= 9,	/* map key */
+	TRACE_FLUSH		= 10,	/* start, size, ticks, EFI memory type */
+	TRACE_EBS		= 11,	/* status */
+	TRACE_EL2		= 12,	/* EL after the bounce */
+	TRACE_BOOTI_KERNEL	= 13,	/* base, text_offset, image_size */
+	TRACE_BOOTI_INITRD	= 14,	/* base, size */
+	TRACE_DT_FIXUP		= 15,	/* status */
+	TRACE_PMU		= 16,	/* enum pmu_region, cycles, PMU event 0, 1 */
+	TRACE_PMU_MORE		= 17,	/* enum pmu_region, PMU event 2, 3, 4 */
+	TRACE_DIRTY		= 18,	/* leaves armed, blocks among them, tcr_el1 */
+	TRACE_VERIFY		= 19,	/* chunks, mismatches, skipped, bytes checked */
+	TRACE_TUNE		= 20,	/* enum flush_strategy, predicted ns, safe, cached */
+	TRACE_IDMAP		= 21,	/* 1G blocks, 2M blocks, tables used, ticks */
+	TRACE_EVENT_CNT,
+};
+
+enum trace_alloc {
+	TRACE_ALLOC_TCB,
+	TRACE_ALLOC_DATA,
+	TRACE_ALLOC_BOOTPARAMS,
+};
+
+static const char *const trace_event_names[TRACE_EVENT_CNT] = {
+	[TRACE_NONE]		= "none",
+	[TRACE_PE_SECURITY]	= "pe-security",
+	[TRACE_PE_CERT]		= "pe-cert",
+	[TRACE_PE_HEADER]	= "pe-header",
+	[TRACE_PE_SECTION]	= "pe-section",
+	[TRACE_ALLOC]		= "alloc",
+	[TRACE_TB_SETUP]	= "tb-setup",
+	[TRACE_SMC]		= "smc",
+	[TRACE_SMC_RET]		= "smc-ret",
+	[TRACE_EBS_HOOK]	= "ebs-hook",
+	[TRACE_FLUSH]		= "flush",
+	[TRACE_EBS]		= "ebs",
+	[TRACE_EL2]		= "el2",
+	[TRACE_BOOTI_KERNEL]	= "booti-kernel",
+	[TRACE_BOOTI_INITRD]	= "booti-initrd",
+	[TRACE_DT_FIXUP]	= "dt-fixup",
+	[TRACE_PMU]		= "pmu",
+	[TRACE_PMU_MORE]	= "pmu-more",
+	[TRACE_DIRTY]		= "dirty",
+	[TRACE_VERIFY]		= "verify",
+	[TRACE_TUNE]		= "tune",
+	[TRACE_IDMAP]		= "idmap",
+};
+
+struct trace_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t size;			/* Of the whole ring, including the header. */
+	uint64_t freq;			/* cntfrq_el0 */
+	uint32_t entry_size;
+	uint32_t entries;		/* Slots in the ring, a power of 2. */
+	uint64_t head;			/* Records ever written, next one goes to head % entries. */
+};
+
+struct trace_entry {
+	uint64_t seq;			/* Index + 1, written last. 0 if torn. */
+	uint64_t time;			/* cntvct_el0 */
+	uint32_t event;
+	uint32_t cpu;			/* MPIDR_EL1 Aff1:Aff0 */
+	uint64_t args[4];
+};
+
+#ifndef TRACE_FORMAT_ONLY
+#include <efi.h>
+
+#ifdef SLBOUNCE_TRACE
+	#define Trace(ev, a, b, c, d) \
+		trace_event(ev, (uint64_t)(a), (uint64_t)(b), (uint64_t)(c), (uint64_t)(d))
+#else
+	#define Trace(...)
+#endif
+
+/* Pack up to 8 chars into an argument, in memory order. */
+static inline uint64_t trace_str8(const void *str)
+{
+	const uint8_t *p = str;
+	uint64_t val = 0;
+	int i;
+
+	for (i = 0; i < 8 && p[i]; i++)
+		val |= (uint64_t)p[i] << (i * 8);
+
+	return val;
+}
+
+EFI_STATUS trace_start(VOID *buf, UINTN size);
+void trace_event(enum trace_event ev, uint64_t a, uint64_t b, uint64_t c, uint64_t d);
+void trace_sync(void);
+void trace_dump(void);
+#endif
+
+#endif
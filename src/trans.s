@@ -5,10 +5,19 @@
 .equ	SCTLR_EL2_RES0,		0b1111111111111111111011111111111100000101000100001100011110000000
 .equ	SCTLR_EL2_RES1,		0b0000000000000000000000000000000000110000110001010000100000110000
 .equ	SCTLR_EL2_M,		1 << 0	/* MPU enable. */
-
-/* Counter-timer Hypervisor Control Register */
-.equ	CNTHCTL_EL2_EL1PCTEN,	1 << 0	/* Traps accesses to the EL1 physical counter register to EL2. */
-.equ	CNTHCTL_EL2_EL1PCEN,	1 << 1	/* Traps accesses to the EL1 physical timer registers to EL2. */
+.equ	SCTLR_EL2_C,		1 << 2	/* Cacheability control, for data accesses. */
+
+/* Layout of tb_el2_state, see enum el2_state_idx in arch.h */
+.equ	TB_EL2_CPTR,		8 * 0
+.equ	TB_EL2_CNTHCTL,		8 * 1
+.equ	TB_EL2_CNTVOFF,		8 * 2
+.equ	TB_EL2_MDCR,		8 * 3
+.equ	TB_EL2_HSTR,		8 * 4
+.equ	TB_EL2_VTTBR,		8 * 5
+.equ	TB_EL2_ZCR,		8 * 6
+.equ	TB_EL2_FLAGS,		8 * 7
+.equ	TB_EL2_F_SVE,		0	/* Bit: ZCR_EL2 is implemented. */
+.equ	TB_EL2_F_PMU,		1	/* Bit: Take MDCR_EL2.HPMN from PMCR_EL0.N */
 
 /* Hypervisor Configuration Register (EL2) */
 .equ	HCR_EL2_TGE,		1 << 27	/* Traps general exceptions. */
@@ -34,8 +43,7 @@ tb_entry:
 	msr	daifset, #0b1111
 
 	ldr	x1, [x9, #8]		// tb_data->sp holds framebuffer base
-	ldr	x2, [x9, #16]		// tb_data->tcr holds framebuffer stride
-	cbnz	x1, draw_on_screen	// If we have a framebuffer, draw on it and hang.
+	cbnz	x1, show_report		// If we have a framebuffer, draw on it and hang.
 
 	ldr	x0, [x9]		// tb_data->mair holds a pointer to our tb_jmp_buf
 	mov	x1, #1
@@ -43,15 +51,12 @@ tb_entry:
 
 	b	_psci_off
 
-draw_on_screen:
-	mov	x0, #(16 * 4)
-	mov	x4, #0x0000FF00
-	mul	x0, x0, x2
-
-draw_loop:
-	str	w4, [x1, x0]
-	sub	x0, x0, #4
-	cbnz	x0, draw_loop
+show_report:
+	adrp	x0, tb_report_stack_top
+	add	x0, x0, :lo12:tb_report_stack_top
+	mov	sp, x0
+	mov	x0, x9
+	bl	tb_report		// See fbcon.c
 
 	b	halt
 
@@ -154,18 +159,20 @@ tb_longjmp:
 	ld_sys	vbar_el2,  #104
 	ld_sys	tpidr_el0, #112
 
-		//cptr_el2
-
 	/* ArchInitialize() */
 	movq	x2, (HCR_EL2_TGE | HCR_EL2_E2H)
 	msr	hcr_el2, x2
 	isb
 
-	mov	x2, #(CNTHCTL_EL2_EL1PCTEN | CNTHCTL_EL2_EL1PCEN)
-	msr	cnthctl_el2, x2
-
 	/* ArmLibSupport.S */
 	ld_sys	cpacr_el1, #120
+
+	/*
+	 * With E2H set, the cpacr_el1 write above went to cptr_el2, so
+	 * the trap controls have to be written after it.
+	 */
+	bl	tb_el2_setup
+
 	ld_sys	ttbr0_el2, #128
 	ld_sys	tcr_el2,   #136
 	ld_sys	mair_el2,  #144
@@ -200,6 +207,77 @@ tb_longjmp:
 	br	x30
 
 
+/*
+ * tb_el2_setup() - Write EL2 trap and timer controls from tb_el2_state.
+ *
+ * The values are prepared by el2_state_init() so that this code and
+ * el2_check_state() always agree on what EL2 should look like.
+ * Only clobbers x2-x4, doesn't use the stack.
+ */
+.global tb_el2_setup
+tb_el2_setup:
+	adrp	x4, tb_el2_state
+	add	x4, x4, :lo12:tb_el2_state
+
+	ldr	x2, [x4, #TB_EL2_CPTR]
+	msr	cptr_el2, x2
+	isb
+
+	ldr	x2, [x4, #TB_EL2_CNTHCTL]
+	msr	cnthctl_el2, x2
+	ldr	x2, [x4, #TB_EL2_CNTVOFF]
+	msr	cntvoff_el2, x2
+	ldr	x2, [x4, #TB_EL2_HSTR]
+	msr	hstr_el2, x2
+	ldr	x2, [x4, #TB_EL2_VTTBR]
+	msr	vttbr_el2, x2
+
+	ldr	x3, [x4, #TB_EL2_FLAGS]
+	tbz	x3, #TB_EL2_F_SVE, 1f
+	ldr	x2, [x4, #TB_EL2_ZCR]
+	msr	S3_4_C1_C2_0, x2	// zcr_el2, needs cptr_el2.ZEN set above.
+1:
+	ldr	x2, [x4, #TB_EL2_MDCR]
+	tbz	x3, #TB_EL2_F_PMU, 2f
+	mrs	x3, pmcr_el0
+	ubfx	x3, x3, #11, #5		// PMCR_EL0.N
+	orr	x2, x2, x3		// MDCR_EL2.HPMN, give all counters to the host.
+2:
+	msr	mdcr_el2, x2
+	isb
+	ret
+
+
+/*
+ * booti_enter() - Jump to the arm64 Image entry point.
+ * x0: Entry point.
+ * x1: Pointer to the dtb.
+ *
+ * The kernel wants to be entered with MMU and D-cache off.
+ */
+.global booti_enter
+booti_enter:
+	mov	x9, x0
+	mov	x0, x1
+	mov	x1, xzr
+	mov	x2, xzr
+	mov	x3, xzr
+
+	msr	daifset, #0b1111
+
+	mrs	x4, sctlr_el2
+	bic	x4, x4, #SCTLR_EL2_M
+	bic	x4, x4, #SCTLR_EL2_C
+	msr	sctlr_el2, x4
+	isb
+
+	ic	iallu
+	dsb	ish
+	isb
+
+	br	x9
+
+
 .data
 
 .align	3
@@ -208,3 +286,14 @@ tb_jmp_buf:
 	.zero	8 * 12	// x19-x30 - callee saved registers.
 	.zero	8 * 1	// x31 - sp
 	.zero	8 * 8	// System registers
+
+.align	3
+.global tb_el2_state
+tb_el2_state:
+	.zero	8 * 8	// See enum el2_state_idx
+
+/* Stack for tb_report(), the one tcblaunch left us is not usable. */
+.align	4
+tb_report_stack:
+	.zero	4096
+tb_report_stack_top:
@@ -0,0 +1,306 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "arch.h"
+#include "flush.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "tune.h"
+
+#define TUNE_VAR_ATTRS \
+	(EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS | EFI_VARIABLE_RUNTIME_ACCESS)
+
+#define TUNE_BUF_SIZE		(1024 * 1024)
+#define TUNE_RANGES		256
+#define TUNE_RUNS		3
+
+/* Strategies that can't lose data, see flush_set_strategy(). */
+static const BOOLEAN tune_safe[FLUSH_STRATEGIES] = {
+	[FLUSH_PER_VA]		= TRUE,
+	[FLUSH_COALESCED]	= TRUE,
+#ifdef SLBOUNCE_FLUSH_CLEAN
+	/* Only once SLBOUNCE_VERIFY showed the switch doesn't need the invalidate. */
+	[FLUSH_CLEAN]		= TRUE,
+#endif
+};
+
+/*
+ * Coalescing flushes the same lines as per-VA in at most as many
+ * ranges, so unless clean-only is an option, only dc civac is timed
+ * to predict it, without the cvac sweeps and the set/way pass.
+ */
+#define TUNE_HAS_CHOICE		(tune_safe[FLUSH_CLEAN])
+
+static struct tune_cal tune_cal;
+static BOOLEAN tune_cached = FALSE;
+static BOOLEAN tune_ready = FALSE;
+static enum flush_strategy tune_strategy = FLUSH_PER_VA;
+
+static uint32_t tune_hash(const CHAR16 *str)
+{
+	uint32_t hash = 2166136261u;
+
+	while (str && *str) {
+		hash ^= *str++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static uint64_t tune_ps(uint64_t ticks, uint64_t count)
+{
+	return arch_ticks_to_ns(ticks) * 1000 / count;
+}
+
+typedef void (*tune_fn)(UINT8 *buf);
+
+static void tune_dirty(UINT8 *buf)
+{
+	SetMem(buf, TUNE_BUF_SIZE, 0x5a);
+}
+
+static void tune_clean(UINT8 *buf)
+{
+	tune_dirty(buf);
+	clean_dcache_range((uint64_t)buf, TUNE_BUF_SIZE);
+}
+
+static void tune_civac(UINT8 *buf)
+{
+	clear_dcache_range((uint64_t)buf, TUNE_BUF_SIZE);
+}
+
+static void tune_cvac(UINT8 *buf)
+{
+	clean_dcache_range((uint64_t)buf, TUNE_BUF_SIZE);
+}
+
+static void tune_ranges(UINT8 *buf)
+{
+	uint64_t line = dcache_line_size();
+	int i;
+
+	for (i = 0; i < TUNE_RANGES; ++i)
+		clear_dcache_range((uint64_t)buf + i * line, line);
+}
+
+static void tune_set_way(UINT8 *buf)
+{
+	clear_dcache_all();
+}
+
+/**
+ * tune_time() - Shortest of a few runs of @op, in ticks.
+ * @prep: Puts the buffer into the state @op is measured in.
+ */
+static uint64_t tune_time(UINT8 *buf, tune_fn prep, tune_fn op)
+{
+	uint64_t t, best = ~0ull;
+	int i;
+
+	for (i = 0; i < TUNE_RUNS; ++i) {
+		prep(buf);
+
+		t = arch_counter();
+		op(buf);
+		t = arch_counter() - t;
+
+		if (t < best)
+			best = t;
+	}
+
+	return best;
+}
+
+/**
+ * tune_calibrate() - Measure the cache maintenance on a scratch buffer.
+ * @full: Also measure dc cvac and set/way, not only dc civac.
+ *
+ * The buffer is small enough that this takes a few milliseconds, so
+ * the costs are only as good as the counter resolution allows.
+ */
+static EFI_STATUS tune_calibrate(struct tune_cal *cal, BOOLEAN full)
+{
+	uint64_t lines = TUNE_BUF_SIZE / dcache_line_size();
+	uint64_t range;
+	UINT8 *buf;
+
+	buf = AllocatePool(TUNE_BUF_SIZE);
+	if (!buf)
+		return EFI_OUT_OF_RESOURCES;
+
+	cal->civac_dirty_ps = tune_ps(tune_time(buf, tune_dirty, tune_civac), lines);
+	cal->civac_ps = tune_ps(tune_time(buf, tune_civac, tune_civac), lines);
+	if (full) {
+		cal->cvac_dirty_ps = tune_ps(tune_time(buf, tune_dirty, tune_cvac), lines);
+		cal->cvac_ps = tune_ps(tune_time(buf, tune_clean, tune_cvac), lines);
+		cal->set_way_ps = tune_ps(tune_time(buf, tune_dirty, tune_set_way), 1);
+		cal->full = TRUE;
+	}
+
+	/* A range of one line, without the line. */
+	range = tune_ps(tune_time(buf, tune_civac, tune_ranges), TUNE_RANGES);
+	cal->range_ps = range > cal->civac_ps ? range - cal->civac_ps : 0;
+
+	FreePool(buf);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * tune_init() - Get the calibration, from the NV cache if it's ours.
+ *
+ * The cache is only used on the same cpu and firmware version, a
+ * firmware update may change the cache setup. If coalesced is going
+ * to be picked anyway, only what its prediction needs is measured.
+ */
+EFI_STATUS tune_init(void)
+{
+	EFI_GUID TuneGuid = TUNE_VAR_GUID;
+	struct tune_cal cal = { 0 };
+	UINTN size = sizeof(cal);
+	EFI_STATUS status;
+	UINT32 attrs;
+
+	if (tune_ready)
+		return EFI_SUCCESS;
+
+	cal.magic = TUNE_MAGIC;
+	cal.version = TUNE_VERSION;
+	cal.line_size = dcache_line_size();
+	cal.midr = read_sysreg(midr_el1);
+	cal.fw_revision = ST->FirmwareRevision;
+	cal.fw_vendor = tune_hash(ST->FirmwareVendor);
+	cal.cache_size = dcache_total_size();
+
+	status = uefi_call_wrapper(RT->GetVariable, 5, TUNE_VAR_NAME, &TuneGuid, &attrs, &size, &tune_cal);
+	if (!EFI_ERROR(status) && size == sizeof(tune_cal) && tune_cal.magic == cal.magic &&
+	    tune_cal.version == cal.version && tune_cal.line_size == cal.line_size &&
+	    tune_cal.midr == cal.midr && tune_cal.fw_revision == cal.fw_revision &&
+	    tune_cal.fw_vendor == cal.fw_vendor && tune_cal.cache_size == cal.cache_size &&
+	    (tune_cal.full || !TUNE_HAS_CHOICE)) {
+		tune_cached = TRUE;
+		tune_ready = TRUE;
+		return EFI_SUCCESS;
+	}
+
+	status = tune_calibrate(&cal, TUNE_HAS_CHOICE);
+	if (EFI_ERROR(status))
+		return status;
+
+	tune_cal = cal;
+	tune_ready = TRUE;
+
+	status = uefi_call_wrapper(RT->SetVariable, 5, TUNE_VAR_NAME, &TuneGuid,
+				   TUNE_VAR_ATTRS, sizeof(tune_cal), &tune_cal);
+	if (EFI_ERROR(status))
+		Dbg(L"Failed to cache the flush calibration: %d\n", status);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * tune_predict() - Estimate the EBS flush of a memory map, in ns.
+ *
+ * At most as many lines as the caches hold can be dirty, the rest
+ * is flushed at the cost of a clean line.
+ */
+uint64_t tune_predict(enum flush_strategy strategy, EFI_MEMORY_DESCRIPTOR *map,
+		      UINTN map_size, UINTN desc_size)
+{
+	uint64_t ranges = 0, lines = 0, dirty, end = 0, line_ps, dirty_ps, ps;
+	EFI_MEMORY_DESCRIPTOR *desc;
+	int i;
+
+	if (!tune_ready || (!tune_cal.full && strategy > FLUSH_COALESCED))
+		return 0;
+
+	for (i = 0; i < map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+		if (!flush_type_needed(desc->Type))
+			continue;
+
+		if (strategy == FLUSH_PER_VA || desc->PhysicalStart != end)
+			ranges++;
+
+		end = desc->PhysicalStart + desc->NumberOfPages * 4096;
+		lines += desc->NumberOfPages * 4096 / tune_cal.line_size;
+	}
+
+	dirty = tune_cal.cache_size / tune_cal.line_size;
+	if (dirty > lines)
+		dirty = lines;
+
+	switch (strategy) {
+	case FLUSH_PER_VA:
+	case FLUSH_COALESCED:
+		line_ps = tune_cal.civac_ps;
+		dirty_ps = tune_cal.civac_dirty_ps;
+		break;
+	case FLUSH_CLEAN:
+		line_ps = tune_cal.cvac_ps;
+		dirty_ps = tune_cal.cvac_dirty_ps;
+		break;
+	default:
+		return tune_cal.set_way_ps / 1000;
+	}
+
+	ps = ranges * tune_cal.range_ps + lines * line_ps;
+	if (dirty_ps > line_ps)
+		ps += dirty * (dirty_ps - line_ps);
+
+	return ps / 1000;
+}
+
+/**
+ * tune_pick() - Choose the cheapest safe strategy for a memory map.
+ *
+ * All predictions go to the trace, the pick to the telemetry. Only
+ * per-VA and coalesced are predicted without a full calibration.
+ */
+enum flush_strategy tune_pick(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	uint64_t ns, best_ns = ~0ull;
+	int s;
+
+	tune_strategy = TUNE_HAS_CHOICE ? FLUSH_PER_VA : FLUSH_COALESCED;
+
+	if (!tune_ready)
+		return tune_strategy;
+
+	for (s = 0; s < FLUSH_STRATEGIES; ++s) {
+		ns = tune_predict(s, map, map_size, desc_size);
+		Trace(TRACE_TUNE, s, ns, tune_safe[s], tune_cached);
+		Dbg(L"Flush strategy %d: %ld us%s\n", s, ns / 1000, tune_safe[s] ? L"" : L" (unsafe)");
+
+		if (tune_safe[s] && ns < best_ns) {
+			best_ns = ns;
+			tune_strategy = s;
+		}
+	}
+
+	telemetry_set_flush_plan(tune_strategy, tune_cached, best_ns);
+
+	return tune_strategy;
+}
+
+/**
+ * tune_report() - Predict the flush of the final map for the telemetry.
+ *
+ * The strategy stays the one tune_pick() chose.
+ */
+void tune_report(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	if (!tune_ready)
+		return;
+
+	telemetry_set_flush_plan(tune_strategy, tune_cached,
+				 tune_predict(tune_strategy, map, map_size, desc_size));
+}
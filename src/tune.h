@@ -0,0 +1,48 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stdint.h>
+#include <efi.h>
+
+#include "flush.h"
+
+/*
+ * Flush strategy auto-tuning, built with SLBOUNCE_TUNE. The cost of
+ * the cache maintenance operations is measured once per firmware
+ * version and cpu and kept in an NV variable, then used to predict
+ * the EBS flush of a memory map with each strategy.
+ */
+
+#define TUNE_MAGIC		0x4e544c53	// 'SLTN'
+#define TUNE_VERSION		2
+#define TUNE_VAR_NAME		L"SlbounceTune"
+
+#define TUNE_VAR_GUID \
+    { 0x6a0c93e4, 0x2f7d, 0x4b18, {0x9e, 0x53, 0xc1, 0x8a, 0x47, 0x06, 0xdb, 0x2f} }
+
+/* Costs are in picoseconds, per line unless noted. */
+struct tune_cal {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t line_size;
+	uint64_t midr;			/* midr_el1 */
+	uint32_t fw_revision;		/* ST->FirmwareRevision */
+	uint32_t fw_vendor;		/* Hash of ST->FirmwareVendor */
+	uint64_t cache_size;		/* dcache_total_size() */
+	uint64_t range_ps;		/* Fixed cost of one range. */
+	uint64_t civac_ps;		/* dc civac of a line that is not dirty... */
+	uint64_t civac_dirty_ps;	/* ...and of one that is. */
+	uint64_t cvac_ps;
+	uint64_t cvac_dirty_ps;
+	uint64_t set_way_ps;		/* The whole clear_dcache_all(). */
+	uint32_t full;			/* cvac and set/way were measured too. */
+	uint32_t pad;
+};
+
+EFI_STATUS tune_init(void);
+uint64_t tune_predict(enum flush_strategy strategy, EFI_MEMORY_DESCRIPTOR *map,
+		      UINTN map_size, UINTN desc_size);
+enum flush_strategy tune_pick(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+void tune_report(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+
+#endif
@@ -5,6 +5,7 @@
 #include <efilib.h>
 
 #include "util.h"
+#include "lz4.h"
 
 EFI_FILE_HANDLE GetVolume(EFI_HANDLE image)
 {
@@ -32,7 +33,7 @@ EFI_FILE_HANDLE GetVolume(EFI_HANDLE image)
 	return Volume;
 }
 
-EFI_FILE_HANDLE FileOpen(EFI_FILE_HANDLE Volume, CHAR16 *FileName)
+static EFI_FILE_HANDLE FileOpenRaw(EFI_FILE_HANDLE Volume, CHAR16 *FileName)
 {
 	EFI_STATUS status;
 	EFI_FILE_HANDLE     FileHandle;
@@ -45,6 +46,55 @@ EFI_FILE_HANDLE FileOpen(EFI_FILE_HANDLE Volume, CHAR16 *FileName)
 	return FileHandle;
 }
 
+static EFI_FILE_HANDLE FileOpenLz4(EFI_FILE_HANDLE Volume, CHAR16 *FileName)
+{
+	EFI_FILE_HANDLE raw, FileHandle;
+
+	raw = FileOpenRaw(Volume, FileName);
+	if (!raw)
+		return NULL;
+
+	FileHandle = Lz4FileWrap(raw);
+	if (!FileHandle)
+		FileClose(raw);
+
+	return FileHandle;
+}
+
+/**
+ * FileOpen() - Open a file for reading.
+ *
+ * Compressed files are handled transparently: "foo.lz4" is opened
+ * as a decompressing handle and if "foo" doesn't exist, "foo.lz4"
+ * is tried instead. FileSize() and FileRead() then operate on the
+ * decompressed content.
+ */
+EFI_FILE_HANDLE FileOpen(EFI_FILE_HANDLE Volume, CHAR16 *FileName)
+{
+	EFI_FILE_HANDLE FileHandle;
+	UINTN len = StrLen(FileName);
+	CHAR16 *name;
+
+	if (len > 4 && !StriCmp(FileName + len - 4, L".lz4"))
+		return FileOpenLz4(Volume, FileName);
+
+	FileHandle = FileOpenRaw(Volume, FileName);
+	if (FileHandle)
+		return FileHandle;
+
+	name = AllocatePool((len + 5) * sizeof(CHAR16));
+	if (!name)
+		return NULL;
+
+	StrCpy(name, FileName);
+	StrCat(name, L".lz4");
+
+	FileHandle = FileOpenLz4(Volume, name);
+	FreePool(name);
+
+	return FileHandle;
+}
+
 UINT64 FileSize(EFI_FILE_HANDLE FileHandle)
 {
 	UINT64 ret;
@@ -67,6 +117,42 @@ void FileClose(EFI_FILE_HANDLE FileHandle)
 	uefi_call_wrapper(FileHandle->Close, 1, FileHandle);
 }
 
+/**
+ * FileCreate() - Open a file for writing, dropping the old content.
+ */
+EFI_FILE_HANDLE FileCreate(EFI_FILE_HANDLE Volume, CHAR16 *FileName)
+{
+	EFI_STATUS status;
+	EFI_FILE_HANDLE FileHandle;
+
+	status = uefi_call_wrapper(Volume->Open, 5, Volume, &FileHandle, FileName,
+				   EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+	if (EFI_ERROR(status))
+		return NULL;
+
+	/* The FAT driver keeps the old size otherwise. */
+	status = uefi_call_wrapper(FileHandle->Delete, 1, FileHandle);
+	if (EFI_ERROR(status))
+		return NULL;
+
+	status = uefi_call_wrapper(Volume->Open, 5, Volume, &FileHandle, FileName,
+				   EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE | EFI_FILE_MODE_CREATE, 0);
+	if (EFI_ERROR(status))
+		return NULL;
+
+	return FileHandle;
+}
+
+UINT64 FileWrite(EFI_FILE_HANDLE FileHandle, const UINT8 *Buffer, UINT64 WriteSize)
+{
+	EFI_STATUS status = uefi_call_wrapper(FileHandle->Write, 3, FileHandle, &WriteSize, (VOID *)Buffer);
+
+	if (EFI_ERROR(status))
+		return 0;
+
+	return WriteSize;
+}
+
 void WaitKey(EFI_SYSTEM_TABLE *SystemTable, int line)
 {
 	UINTN Event;
@@ -14,6 +14,8 @@ EFI_FILE_HANDLE FileOpen(EFI_FILE_HANDLE Volume, CHAR16 *FileName);
 UINT64 FileSize(EFI_FILE_HANDLE FileHandle);
 UINT64 FileRead(EFI_FILE_HANDLE FileHandle, UINT8 *Buffer, UINT64 ReadSize);
 void FileClose(EFI_FILE_HANDLE FileHandle);
+EFI_FILE_HANDLE FileCreate(EFI_FILE_HANDLE Volume, CHAR16 *FileName);
+UINT64 FileWrite(EFI_FILE_HANDLE FileHandle, const UINT8 *Buffer, UINT64 WriteSize);
 void WaitKey(EFI_SYSTEM_TABLE *SystemTable, int line);
 
 EFI_STATUS AllocateZeroPages(UINT64 page_count, EFI_PHYSICAL_ADDRESS *addr);
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+#include <stdint.h>
+
+#include <efi.h>
+#include <efilib.h>
+
+#include "util.h"
+#include "arch.h"
+#include "resmem.h"
+#include "flush.h"
+#include "trace.h"
+#include "verify.h"
+
+#define VERIFY_MAX_EXCLUDE	8
+
+static struct verify_header *verify = NULL;
+
+/* Ranges we keep writing to after the sums, i.e. our image, stack and the SL buffers. */
+static struct {
+	uint64_t start;
+	uint64_t end;
+} verify_excluded[VERIFY_MAX_EXCLUDE];
+static int verify_excluded_cnt = 0;
+
+static inline struct verify_chunk *verify_chunks(void)
+{
+	return (struct verify_chunk *)(verify + 1);
+}
+
+/**
+ * verify_init() - Allocate the verify region.
+ *
+ * The region is found after boot the same way as the memory map
+ * capture, by the VERIFY_GUID config table or in /reserved-memory.
+ */
+EFI_STATUS verify_init(void)
+{
+	EFI_GUID VerifyGuid = VERIFY_GUID;
+	EFI_STATUS status;
+	VOID *data;
+
+	if (!crc32_hw_supported())
+		return EFI_UNSUPPORTED;
+
+	status = resmem_alloc("slbounce-verify", VERIFY_COMPATIBLE, VERIFY_SIZE, &VerifyGuid, &data);
+	if (EFI_ERROR(status))
+		return status;
+
+	verify = data;
+	verify->magic = VERIFY_MAGIC;
+	verify->version = VERIFY_VERSION;
+	verify->size = sizeof(*verify);
+	verify->freq = read_sysreg(cntfrq_el0);
+	verify->chunk_size = VERIFY_CHUNK;
+
+	Dbg(L"Verifying the EBS flush to 0x%lx\n", (uint64_t)verify);
+
+	return EFI_SUCCESS;
+}
+
+/**
+ * verify_exclude() - Don't check a range that is legitimately written later.
+ */
+void verify_exclude(uint64_t start, uint64_t size)
+{
+	if (verify_excluded_cnt == VERIFY_MAX_EXCLUDE)
+		return;
+
+	verify_excluded[verify_excluded_cnt].start = start;
+	verify_excluded[verify_excluded_cnt].end = start + size;
+	verify_excluded_cnt++;
+}
+
+static BOOLEAN verify_is_excluded(uint64_t start, uint64_t end)
+{
+	int i;
+
+	for (i = 0; i < verify_excluded_cnt; ++i)
+		if (verify_excluded[i].start < end && verify_excluded[i].end > start)
+			return TRUE;
+
+	return FALSE;
+}
+
+/**
+ * verify_sum() - Checksum the memory the EBS flush covers.
+ *
+ * Must be called after the real EBS succeeded, when neither the loader
+ * nor the firmware writes memory anymore, and before SL_CMD_AUTH. Only
+ * the excluded ranges may be written afterwards. Doesn't use the boot
+ * services.
+ */
+void verify_sum(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size)
+{
+	UINTN room = (VERIFY_SIZE - sizeof(*verify)) / sizeof(struct verify_chunk);
+	EFI_MEMORY_DESCRIPTOR *desc;
+	struct verify_chunk *c;
+	uint64_t start, end, t;
+	int i;
+
+	if (!verify)
+		return;
+
+	t = arch_counter();
+
+	verify->count = 0;
+	verify->dropped = 0;
+	verify->skipped = 0;
+	verify->bytes = 0;
+
+	for (i = 0; i < map_size / desc_size; ++i) {
+		desc = (EFI_MEMORY_DESCRIPTOR *)((UINT8 *)map + desc_size * i);
+		if (!flush_type_needed(desc->Type))
+			continue;
+
+		end = desc->PhysicalStart + desc->NumberOfPages * 4096;
+
+		for (start = desc->PhysicalStart; start < end; start += VERIFY_CHUNK) {
+			if (verify->count == room) {
+				verify->dropped++;
+				continue;
+			}
+
+			c = &verify_chunks()[verify->count++];
+			c->start = start;
+			c->size = end - start < VERIFY_CHUNK ? end - start : VERIFY_CHUNK;
+			c->type = desc->Type;
+			c->after = 0;
+
+			if (verify_is_excluded(c->start, c->start + c->size)) {
+				c->flags = VERIFY_F_SKIPPED;
+				c->before = 0;
+				verify->skipped++;
+				continue;
+			}
+
+			c->flags = 0;
+			c->before = crc32_hw(0, c->start, c->size);
+			verify->bytes += c->size;
+		}
+	}
+
+	verify->size = sizeof(*verify) + verify->count * sizeof(struct verify_chunk);
+	verify->state = VERIFY_SUMMED;
+	verify->sum_ticks = arch_counter() - t;
+
+	clear_dcache_range((uint64_t)verify, verify->size);
+}
+
+/**
+ * verify_check() - Checksum again after the switch and record mismatches.
+ */
+void verify_check(void)
+{
+	struct verify_chunk *c;
+	uint64_t t;
+	int i;
+
+	if (!verify || verify->state != VERIFY_SUMMED)
+		return;
+
+	t = arch_counter();
+
+	verify->mismatches = 0;
+
+	for (i = 0; i < verify->count; ++i) {
+		c = &verify_chunks()[i];
+		if (c->flags & VERIFY_F_SKIPPED)
+			continue;
+
+		c->after = crc32_hw(0, c->start, c->size);
+		if (c->after != c->before) {
+			c->flags |= VERIFY_F_MISMATCH;
+			verify->mismatches++;
+		}
+	}
+
+	verify->state = VERIFY_CHECKED;
+	verify->check_ticks = arch_counter() - t;
+
+	Trace(TRACE_VERIFY, verify->count, verify->mismatches, verify->skipped, verify->bytes);
+
+	clear_dcache_range((uint64_t)verify, verify->size);
+}
@@ -0,0 +1,67 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+
+/*
+ * Flush-miss detector, built with SLBOUNCE_VERIFY. Memory the EBS flush
+ * is meant to cover is checksummed right after the real EBS and again
+ * in EL2 after the longjmp, a chunk that changed was most likely not
+ * flushed. The results are left in a reserved-memory region, the layout
+ * is shared with tools/slverify.c, which builds with VERIFY_FORMAT_ONLY.
+ */
+
+#define VERIFY_MAGIC		0x5946524556424c53ull	// 'SLBVERFY'
+#define VERIFY_VERSION		1
+#define VERIFY_SIZE		(256 * 1024)
+#define VERIFY_COMPATIBLE	"slbounce,verify"
+#define VERIFY_CHUNK		(1024 * 1024)	/* Largest range one checksum covers. */
+
+#define VERIFY_GUID \
+    { 0x3c8e51a7, 0xd06b, 0x4f92, {0x86, 0x1d, 0xe4, 0x2b, 0x97, 0x5a, 0x0c, 0x63} }
+
+enum verify_state {
+	VERIFY_NONE,
+	VERIFY_SUMMED,			/* Checksummed, the switch didn't come back. */
+	VERIFY_CHECKED,			/* Checked again in EL2. */
+};
+
+#define VERIFY_F_SKIPPED	(1 << 0)	/* Written by us after the sums. */
+#define VERIFY_F_MISMATCH	(1 << 1)
+
+struct verify_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t size;			/* Bytes used, including the header. */
+	uint64_t freq;			/* cntfrq_el0 */
+	uint32_t state;			/* enum verify_state */
+	uint32_t chunk_size;		/* VERIFY_CHUNK */
+	uint32_t count;			/* struct verify_chunk[] after the header. */
+	uint32_t dropped;		/* Chunks that didn't fit. */
+	uint32_t mismatches;
+	uint32_t skipped;
+	uint64_t bytes;			/* Checksummed, without the skipped chunks. */
+	uint64_t sum_ticks;		/* Time the checksums took before the switch... */
+	uint64_t check_ticks;		/* ...and after it. */
+};
+
+struct verify_chunk {
+	uint64_t start;
+	uint32_t size;
+	uint32_t type;			/* EFI memory type of the range. */
+	uint32_t before;		/* CRC-32 after the real EBS */
+	uint32_t after;			/* CRC-32 in EL2 */
+	uint32_t flags;
+	uint32_t pad;
+};
+
+#ifndef VERIFY_FORMAT_ONLY
+#include <efi.h>
+
+EFI_STATUS verify_init(void);
+void verify_exclude(uint64_t start, uint64_t size);
+void verify_sum(EFI_MEMORY_DESCRIPTOR *map, UINTN map_size, UINTN desc_size);
+void verify_check(void);
+#endif
+
+#endif
@@ -0,0 +1,339 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * flushmodel - Replay captured EBS flushes against a cost model.
+ *
+ * Takes a set of capture region dumps (see "Memory map capture" in
+ * README.md) and estimates how long each flush strategy would take on
+ * every captured device, so defaults can be picked per device model.
+ *
+ * Usage: flushmodel [options] capture.bin...
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPTURE_FORMAT_ONLY
+#include "capture.h"
+
+struct model {
+	double line_ns;		/* dc civac of one line. */
+	double range_ns;	/* Fixed cost of a range (call, dsb). */
+	double sw_line_ns;	/* dc cisw of one line. */
+	double bw_gbps;		/* Write-back bandwidth to DRAM. */
+	double dirty;		/* Fraction of flushed memory that is dirty. */
+	double cache_kb;	/* Cache covered by set/way operations. */
+	double track_ns;	/* Cost of checking one page when tracking. */
+	double gap_kb;		/* Largest gap merged when coalescing. */
+	int cores;
+	int fit;		/* Take line_ns from the capture timings. */
+};
+
+struct strategy {
+	const char *name;
+	double (*cost)(const struct capture_header *c, const struct model *m);
+};
+
+struct summary {
+	char model[64];
+	double total[8];
+	int count;
+};
+
+static const struct capture_range *ranges(const struct capture_header *c)
+{
+	return (const void *)((const uint8_t *)c + c->range_offset);
+}
+
+static uint64_t range_lines(const struct capture_header *c, uint64_t start, uint64_t size)
+{
+	uint64_t line = c->line_size;
+	uint64_t first = start & ~(line - 1);
+
+	return (start + size - first + line - 1) / line;
+}
+
+static double writeback_ns(const struct model *m, double bytes)
+{
+	return bytes * m->dirty / m->bw_gbps;	/* GB/s is bytes per ns. */
+}
+
+/* What slbounce does now: every range by VA. */
+static double cost_per_va(const struct capture_header *c, const struct model *m)
+{
+	const struct capture_range *r = ranges(c);
+	double ns = 0, bytes = 0;
+	uint32_t i;
+
+	for (i = 0; i < c->range_count; i++) {
+		ns += m->range_ns + range_lines(c, r[i].start, r[i].size) * m->line_ns;
+		bytes += r[i].size;
+	}
+
+	return ns + writeback_ns(m, bytes);
+}
+
+/* Merge ranges that are close, flushing the gaps too. */
+static double cost_coalesced(const struct capture_header *c, const struct model *m)
+{
+	const struct capture_range *r = ranges(c);
+	uint64_t gap = m->gap_kb * 1024;
+	uint64_t start = 0, end = 0;
+	double ns = 0, bytes = 0;
+	uint32_t i;
+
+	for (i = 0; i <= c->range_count; i++) {
+		if (i < c->range_count && end && r[i].start >= end && r[i].start - end <= gap) {
+			end = r[i].start + r[i].size;
+			bytes += r[i].size;
+			continue;
+		}
+
+		if (end)
+			ns += m->range_ns + range_lines(c, start, end - start) * m->line_ns;
+
+		if (i < c->range_count) {
+			start = r[i].start;
+			end = start + r[i].size;
+			bytes += r[i].size;
+		}
+	}
+
+	return ns + writeback_ns(m, bytes);
+}
+
+/*
+ * Clean the caches by set/way. Only as much dirty data as the caches
+ * can hold needs to be written back. Doesn't cover system caches.
+ */
+static double cost_set_way(const struct capture_header *c, const struct model *m)
+{
+	const struct capture_range *r = ranges(c);
+	double bytes = 0, cache = m->cache_kb * 1024;
+	uint32_t i;
+
+	for (i = 0; i < c->range_count; i++)
+		bytes += r[i].size;
+
+	if (bytes * m->dirty > cache)
+		bytes = cache / m->dirty;
+
+	return m->range_ns + cache / c->line_size * m->sw_line_ns + writeback_ns(m, bytes);
+}
+
+/* Only flush the pages that were written, at the cost of checking every page. */
+static double cost_tracked(const struct capture_header *c, const struct model *m)
+{
+	const struct capture_range *r = ranges(c);
+	double ns = 0, bytes = 0;
+	uint32_t i;
+
+	for (i = 0; i < c->range_count; i++) {
+		ns += r[i].size / 4096 * m->track_ns;
+		ns += range_lines(c, r[i].start, r[i].size) * m->dirty * m->line_ns;
+		bytes += r[i].size;
+	}
+
+	return ns + writeback_ns(m, bytes);
+}
+
+/* Per-VA split over all cores, still bound by the bandwidth. */
+static double cost_parallel(const struct capture_header *c, const struct model *m)
+{
+	const struct capture_range *r = ranges(c);
+	double ns = 0, bytes = 0, wb;
+	uint32_t i;
+
+	for (i = 0; i < c->range_count; i++) {
+		ns += m->range_ns + range_lines(c, r[i].start, r[i].size) * m->line_ns;
+		bytes += r[i].size;
+	}
+
+	ns /= m->cores;
+	wb = writeback_ns(m, bytes);
+
+	/* Bringing up and syncing the cores isn't free either. */
+	return (ns > wb ? ns : wb) + m->cores * 20000;
+}
+
+static const struct strategy strategies[] = {
+	{ "per-va",	cost_per_va },
+	{ "coalesced",	cost_coalesced },
+	{ "set-way",	cost_set_way },
+	{ "tracked",	cost_tracked },
+	{ "parallel",	cost_parallel },
+};
+
+#define STRATEGY_CNT	(sizeof(strategies) / sizeof(strategies[0]))
+
+static struct capture_header *load_capture(const char *path)
+{
+	struct capture_header *c;
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+
+	c = calloc(1, CAPTURE_SIZE);
+	len = fread(c, 1, CAPTURE_SIZE, f);
+	fclose(f);
+
+	if (len < sizeof(*c) || c->magic != CAPTURE_MAGIC || c->version != CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not a capture\n", path);
+		goto err;
+	}
+
+	if (c->size > len || c->range_offset > c->size || !c->line_size ||
+	    c->range_offset + (uint64_t)c->range_count * sizeof(struct capture_range) > c->size) {
+		fprintf(stderr, "%s: truncated capture\n", path);
+		goto err;
+	}
+
+	c->model[sizeof(c->model) - 1] = '\0';
+
+	return c;
+
+err:
+	free(c);
+	return NULL;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [options] capture.bin...\n"
+		"  -l NS   ns per dc civac line (default: fit from the capture, else 2)\n"
+		"  -r NS   ns per range (default 200)\n"
+		"  -s NS   ns per dc cisw line (default 1.5)\n"
+		"  -b GBPS write-back bandwidth (default 10)\n"
+		"  -d FRAC dirty fraction of flushed memory (default 0.05)\n"
+		"  -k KB   cache size covered by set/way (default 12288)\n"
+		"  -t NS   ns per page when tracking writes (default 15)\n"
+		"  -g KB   largest gap to coalesce (default 64)\n"
+		"  -c N    cores for the parallel flush (default 8)\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct model m = {
+		.line_ns = 2, .range_ns = 200, .sw_line_ns = 1.5, .bw_gbps = 10,
+		.dirty = 0.05, .cache_kb = 12288, .track_ns = 15, .gap_kb = 64,
+		.cores = 8, .fit = 1,
+	};
+	struct summary *sum;
+	int nsum = 0, loaded = 0;
+	int opt, i, j;
+
+	while ((opt = getopt(argc, argv, "l:r:s:b:d:k:t:g:c:h")) != -1) {
+		switch (opt) {
+		case 'l': m.line_ns = atof(optarg); m.fit = 0; break;
+		case 'r': m.range_ns = atof(optarg); break;
+		case 's': m.sw_line_ns = atof(optarg); break;
+		case 'b': m.bw_gbps = atof(optarg); break;
+		case 'd': m.dirty = atof(optarg); break;
+		case 'k': m.cache_kb = atof(optarg); break;
+		case 't': m.track_ns = atof(optarg); break;
+		case 'g': m.gap_kb = atof(optarg); break;
+		case 'c': m.cores = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc || m.bw_gbps <= 0 || m.dirty <= 0 || m.cores <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	sum = calloc(argc, sizeof(*sum));
+
+	for (i = optind; i < argc; i++) {
+		struct capture_header *c = load_capture(argv[i]);
+		const struct capture_range *r;
+		struct model cm = m;
+		uint64_t ticks = 0, lines = 0, bytes = 0;
+		double measured, best = 0;
+		int best_idx = 0;
+
+		if (!c)
+			continue;
+
+		loaded++;
+		r = ranges(c);
+		for (j = 0; j < c->range_count; j++) {
+			ticks += r[j].ticks;
+			lines += range_lines(c, r[j].start, r[j].size);
+			bytes += r[j].size;
+		}
+		measured = c->freq ? (double)(c->flush_end - c->flush_start) * 1e9 / c->freq : 0;
+
+		/* The measured flush already includes the write-back. */
+		if (m.fit && lines && ticks && c->freq)
+			cm.line_ns = (ticks * 1e9 / c->freq - c->range_count * m.range_ns) / lines;
+		if (cm.line_ns < 0)
+			cm.line_ns = 0;
+
+		printf("%s: %s\n", argv[i], c->model[0] ? c->model : "(no model)");
+		printf("  %u descriptors, %u ranges, %llu MiB, %llu lines of %u bytes\n",
+		       c->map_count, c->range_count, (unsigned long long)(bytes >> 20),
+		       (unsigned long long)lines, c->line_size);
+		if (c->map_dropped || c->range_dropped)
+			printf("  WARNING: %u descriptors and %u ranges didn't fit\n",
+			       c->map_dropped, c->range_dropped);
+		printf("  measured %.3f ms, %.3f ns/line\n", measured / 1e6, cm.line_ns);
+
+		for (j = 0; j < nsum; j++)
+			if (!strcmp(sum[j].model, c->model))
+				break;
+		if (j == nsum)
+			strcpy(sum[nsum++].model, c->model);
+		sum[j].count++;
+
+		for (j = 0; j < STRATEGY_CNT; j++) {
+			double ns = strategies[j].cost(c, &cm);
+			int k;
+
+			for (k = 0; k < nsum; k++)
+				if (!strcmp(sum[k].model, c->model))
+					sum[k].total[j] += ns;
+
+			if (j == 0 || ns < best) {
+				best = ns;
+				best_idx = j;
+			}
+			printf("  %-10s %10.3f ms\n", strategies[j].name, ns / 1e6);
+		}
+		printf("  best: %s\n\n", strategies[best_idx].name);
+
+		free(c);
+	}
+
+	if (nsum)
+		printf("Per model average:\n");
+	for (i = 0; i < nsum; i++) {
+		int best_idx = 0;
+
+		printf("  %s (%d captures)\n", sum[i].model[0] ? sum[i].model : "(no model)", sum[i].count);
+		for (j = 0; j < STRATEGY_CNT; j++) {
+			printf("    %-10s %10.3f ms\n", strategies[j].name,
+			       sum[i].total[j] / sum[i].count / 1e6);
+			if (sum[i].total[j] < sum[i].total[best_idx])
+				best_idx = j;
+		}
+		printf("    best: %s\n", strategies[best_idx].name);
+	}
+
+	free(sum);
+
+	return loaded ? 0 : 1;
+}
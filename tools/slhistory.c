@@ -0,0 +1,192 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * slhistory - Print the boot history slbounce keeps in an NV variable.
+ *
+ * Without a file, the variable is read from efivarfs. The attempts
+ * are listed oldest first, phases that took over 1.5 times their
+ * median over the history are marked with '!', and a run of attempts
+ * at the end that didn't reach EL2 is reported as a likely reboot
+ * loop. The exit code is 2 in that case, so it can be scripted.
+ *
+ * Usage: slhistory [history.bin]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HISTORY_FORMAT_ONLY
+#include "history.h"
+
+#define EFIVARS_DIR	"/sys/firmware/efi/efivars/"
+
+static const char *const phase_names[HISTORY_PHASES] = {
+	[HISTORY_CREATE]	= "create",
+	[HISTORY_DT_FIXUP]	= "fixup",
+	[HISTORY_POLICY]	= "policy",
+	[HISTORY_FLUSH]		= "flush",
+	[HISTORY_EBS]		= "ebs",
+	[HISTORY_AUTH]		= "auth",
+	[HISTORY_LAUNCH]	= "launch",
+};
+
+static const struct {
+	uint32_t a;
+	uint16_t b, c;
+	uint8_t d[8];
+} history_guid = HISTORY_VAR_GUID;
+
+static int load_var(const char *path, struct history_var *var)
+{
+	unsigned char buf[sizeof(*var) + 4];
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	/* efivarfs puts the attributes first. */
+	if (len == sizeof(*var) + 4)
+		memcpy(var, buf + 4, sizeof(*var));
+	else if (len == sizeof(*var))
+		memcpy(var, buf, sizeof(*var));
+	else
+		goto bad;
+
+	if (var->hdr.magic != HISTORY_MAGIC || var->hdr.version != HISTORY_VERSION ||
+	    var->hdr.records != HISTORY_RECORDS || var->hdr.next >= HISTORY_RECORDS)
+		goto bad;
+
+	return 0;
+
+bad:
+	fprintf(stderr, "%s: not an slbounce boot history\n", path);
+	return -1;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static uint32_t median(const struct history_var *var, int phase)
+{
+	uint32_t vals[HISTORY_RECORDS];
+	int i, n = 0;
+
+	for (i = 0; i < HISTORY_RECORDS; i++) {
+		const struct history_rec *r = &var->recs[i];
+
+		if (r->stamp && r->us[phase] && r->us[phase] != HISTORY_UNFINISHED)
+			vals[n++] = r->us[phase];
+	}
+
+	if (!n)
+		return 0;
+
+	qsort(vals, n, sizeof(vals[0]), cmp_u32);
+
+	return vals[n / 2];
+}
+
+static const char *outcome(const struct history_rec *r)
+{
+	if (!(r->flags & HISTORY_F_FOUND))
+		return "unknown";
+	if (r->flags & HISTORY_F_EL2)
+		return "el2";
+	if (r->flags & HISTORY_F_LAUNCH)
+		return "launch-failed";
+	if (r->auth)
+		return "auth-failed";
+	if (r->available)
+		return "unavailable";
+
+	return "no-switch";
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t med[HISTORY_PHASES];
+	struct history_var var;
+	char path[256];
+	int i, j, loop = 0;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: %s [history.bin]\n", argv[0]);
+		return 1;
+	}
+
+	if (argc == 2) {
+		snprintf(path, sizeof(path), "%s", argv[1]);
+	} else {
+		snprintf(path, sizeof(path),
+			 EFIVARS_DIR "SlbounceHistory-%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+			 history_guid.a, history_guid.b, history_guid.c,
+			 history_guid.d[0], history_guid.d[1], history_guid.d[2], history_guid.d[3],
+			 history_guid.d[4], history_guid.d[5], history_guid.d[6], history_guid.d[7]);
+	}
+
+	if (load_var(path, &var))
+		return 1;
+
+	for (j = 0; j < HISTORY_PHASES; j++)
+		med[j] = median(&var, j);
+
+	printf("%u attempts recorded\n\n", var.hdr.boots);
+	printf("%-14s %12s %6s %6s %10s", "outcome", "start", "avail", "auth", "ebs");
+	for (j = 0; j < HISTORY_PHASES; j++)
+		printf(" %9s", phase_names[j]);
+	printf(" %10s %7s\n", "flush MiB", "ranges");
+
+	for (i = 0; i < HISTORY_RECORDS; i++) {
+		const struct history_rec *r = &var.recs[(var.hdr.next + i) % HISTORY_RECORDS];
+
+		if (!r->stamp)
+			continue;
+
+		/* Only the trailing run counts as a loop. */
+		if (r->flags & HISTORY_F_EL2)
+			loop = 0;
+		else
+			loop++;
+
+		printf("%-14s %12llu", outcome(r), (unsigned long long)r->stamp / 1000);
+		if (!(r->flags & HISTORY_F_FOUND)) {
+			printf("\n");
+			continue;
+		}
+
+		printf(" %6x %6x %10x", r->available, r->auth, r->ebs);
+		for (j = 0; j < HISTORY_PHASES; j++) {
+			if (!r->us[j])
+				printf(" %9s", "-");
+			else if (r->us[j] == HISTORY_UNFINISHED)
+				printf(" %9s", "hung");
+			else
+				printf(" %8.1f%c", r->us[j] / 1000.0,
+				       med[j] && r->us[j] * 2ull > med[j] * 3ull ? '!' : ' ');
+		}
+		printf(" %10.1f %7u\n", r->flush_bytes / 1048576.0, r->flush_ranges);
+	}
+
+	printf("\nstart is the counter at load / 1000, phases are in ms.\n");
+
+	if (loop > 1) {
+		printf("The last %d attempts didn't reach EL2, likely a reboot loop.\n", loop);
+		return 2;
+	}
+
+	return 0;
+}
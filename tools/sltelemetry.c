@@ -0,0 +1,391 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * sltelemetry - Print the boot telemetry slbounce left for the OS.
+ *
+ * Without a file, the record is found via /chosen/slbounce,telemetry
+ * and read from /dev/mem, which needs root and a kernel that allows
+ * reading reserved memory. A dump of the region works as well.
+ * With -p the output is in the Prometheus text format, so it can be
+ * dropped into a node_exporter textfile directory. The PMU counts are
+ * only there if slbounce was built with SLBOUNCE_PMU.
+ *
+ * Usage: sltelemetry [-p] [dump.bin]
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define TELEMETRY_FORMAT_ONLY
+#include "telemetry.h"
+
+#define CHOSEN_PATH	"/proc/device-tree/chosen/" TELEMETRY_CHOSEN_PROP
+
+static const char *const event_names[TELEMETRY_EVENTS] = {
+	[TELEMETRY_LOAD]	= "load",
+	[TELEMETRY_CREATE]	= "create",
+	[TELEMETRY_CREATE_READ]	= "create_read",
+	[TELEMETRY_CREATE_PE]	= "create_pe",
+	[TELEMETRY_AVAILABLE]	= "available",
+	[TELEMETRY_DT_FIXUP]	= "dt_fixup",
+	[TELEMETRY_EBS_HOOK]	= "ebs_hook",
+	[TELEMETRY_POLICY]	= "policy",
+	[TELEMETRY_FLUSH]	= "flush",
+	[TELEMETRY_EBS]		= "ebs",
+	[TELEMETRY_AUTH]	= "auth",
+	[TELEMETRY_LAUNCH]	= "launch",
+	[TELEMETRY_DTBHACK]	= "dtbhack",
+	[TELEMETRY_BOOTI]	= "booti",
+};
+
+static const char *const mem_names[TELEMETRY_MEM_TYPES] = {
+	"Reserved", "LoaderCode", "LoaderData", "BootServicesCode",
+	"BootServicesData", "RuntimeServicesCode", "RuntimeServicesData",
+	"Conventional", "Unusable", "ACPIReclaim", "ACPINVS", "MMIO",
+	"MMIOPortSpace", "PalCode", "Persistent", "Other",
+};
+
+/* enum flush_strategy */
+static const char *const strategy_names[] = {
+	"per-va", "coalesced", "clean", "set-way",
+};
+
+#define STRATEGY_CNT	(sizeof(strategy_names) / sizeof(strategy_names[0]))
+
+static const char *strategy_name(uint32_t strategy)
+{
+	return strategy < STRATEGY_CNT ? strategy_names[strategy] : "?";
+}
+
+static const char *const pmu_region_names[TELEMETRY_PMU_REGIONS] = {
+	"flush", "copy", "smc", "ebs",
+};
+
+static const char *pmu_event_name(uint16_t event)
+{
+	switch (event) {
+	case 0x03: return "l1d_refill";
+	case 0x17: return "l2d_refill";
+	case 0x37: return "llc_miss_rd";
+	case 0x19: return "bus_access";
+	case 0x24: return "stall_backend";
+	}
+
+	return NULL;
+}
+
+static int has_pmu(const struct telemetry_record *rec)
+{
+	int i;
+
+	for (i = 0; i < TELEMETRY_PMU_REGIONS; i++)
+		if (rec->pmu[i].calls)
+			return 1;
+
+	return 0;
+}
+
+static uint64_t be64(const unsigned char *p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < 8; i++)
+		v = (v << 8) | p[i];
+
+	return v;
+}
+
+static struct telemetry_record *load_file(const char *path)
+{
+	struct telemetry_record *rec;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+
+	rec = calloc(1, sizeof(*rec));
+	if (fread(rec, 1, sizeof(*rec), f) != sizeof(*rec)) {
+		fprintf(stderr, "%s: too short\n", path);
+		free(rec);
+		rec = NULL;
+	}
+	fclose(f);
+
+	return rec;
+}
+
+static struct telemetry_record *load_mem(void)
+{
+	struct telemetry_record *rec;
+	unsigned char prop[16];
+	uint64_t addr, size;
+	long page = sysconf(_SC_PAGESIZE);
+	void *map;
+	FILE *f;
+	int fd;
+
+	f = fopen(CHOSEN_PATH, "rb");
+	if (!f) {
+		perror(CHOSEN_PATH);
+		return NULL;
+	}
+
+	if (fread(prop, 1, sizeof(prop), f) != sizeof(prop)) {
+		fprintf(stderr, "%s: bad property\n", CHOSEN_PATH);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+
+	addr = be64(prop);
+	size = be64(prop + 8);
+	if (size < sizeof(*rec) || addr % page) {
+		fprintf(stderr, "bad region 0x%llx+0x%llx\n",
+			(unsigned long long)addr, (unsigned long long)size);
+		return NULL;
+	}
+
+	fd = open("/dev/mem", O_RDONLY | O_SYNC);
+	if (fd < 0) {
+		perror("/dev/mem");
+		return NULL;
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, addr);
+	close(fd);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return NULL;
+	}
+
+	rec = calloc(1, sizeof(*rec));
+	memcpy(rec, map, sizeof(*rec));
+	munmap(map, size);
+
+	return rec;
+}
+
+static double ticks_ms(const struct telemetry_record *rec, uint64_t ticks)
+{
+	return (double)ticks * 1e3 / rec->freq;
+}
+
+static void print_text(const struct telemetry_record *rec)
+{
+	const struct telemetry_event_rec *e;
+	const struct telemetry_flush_rec *f;
+	const struct telemetry_pmu_rec *p;
+	int i, j;
+
+	printf("%-12s %12s %12s %18s %6s\n", "phase", "start ms", "took ms", "value", "count");
+
+	for (i = 0; i < TELEMETRY_EVENTS; i++) {
+		e = &rec->events[i];
+		if (!e->count)
+			continue;
+
+		printf("%-12s %12.3f ", event_names[i] ? event_names[i] : "?", ticks_ms(rec, e->start));
+		if (e->end)
+			printf("%12.3f ", ticks_ms(rec, e->end - e->start));
+		else
+			printf("%12s ", "unfinished");
+		printf("%18llx %6u\n", (unsigned long long)e->value, e->count);
+	}
+
+	printf("\n%-20s %12s %8s %12s\n", "flushed", "bytes", "ranges", "took ms");
+
+	for (i = 0; i < TELEMETRY_MEM_TYPES; i++) {
+		f = &rec->flush[i];
+		if (!f->ranges)
+			continue;
+
+		printf("%-20s %12llu %8u %12.3f\n", mem_names[i], (unsigned long long)f->bytes,
+		       f->ranges, ticks_ms(rec, f->ticks));
+	}
+
+	e = &rec->events[TELEMETRY_FLUSH];
+	/* Coalesced is picked without a prediction if it's the only choice. */
+	if (rec->flush_predicted_ns || rec->flush_strategy) {
+		printf("\nflush strategy %s%s", strategy_name(rec->flush_strategy),
+		       rec->flush_cached ? " (cached calibration)" : "");
+		if (rec->flush_predicted_ns)
+			printf(", predicted %.3f ms", rec->flush_predicted_ns / 1e6);
+		if (e->count && e->end)
+			printf(", took %.3f ms", ticks_ms(rec, e->end - e->start));
+		printf("\n");
+	}
+
+	if (!has_pmu(rec))
+		return;
+
+	printf("\n%-8s %8s %14s", "pmu", "calls", "cycles");
+	for (j = 0; j < rec->pmu_count && j < TELEMETRY_PMU_EVENTS; j++) {
+		if (pmu_event_name(rec->pmu_events[j]))
+			printf(" %14s", pmu_event_name(rec->pmu_events[j]));
+		else
+			printf("      event 0x%02x", rec->pmu_events[j]);
+	}
+	printf("\n");
+
+	for (i = 0; i < TELEMETRY_PMU_REGIONS; i++) {
+		p = &rec->pmu[i];
+		if (!p->calls)
+			continue;
+
+		printf("%-8s %8llu %14llu", pmu_region_names[i], (unsigned long long)p->calls,
+		       (unsigned long long)p->cycles);
+		for (j = 0; j < rec->pmu_count && j < TELEMETRY_PMU_EVENTS; j++)
+			printf(" %14llu", (unsigned long long)p->events[j]);
+		printf("\n");
+	}
+}
+
+static void print_prometheus(const struct telemetry_record *rec)
+{
+	const struct telemetry_event_rec *e;
+	const struct telemetry_flush_rec *f;
+	const struct telemetry_pmu_rec *p;
+	int i, j;
+
+	printf("# HELP slbounce_phase_seconds Time a boot phase took.\n");
+	printf("# TYPE slbounce_phase_seconds gauge\n");
+	for (i = 0; i < TELEMETRY_EVENTS; i++) {
+		e = &rec->events[i];
+		if (!e->count || !e->end || !event_names[i])
+			continue;
+		printf("slbounce_phase_seconds{phase=\"%s\"} %.9f\n", event_names[i],
+		       (double)(e->end - e->start) / rec->freq);
+	}
+
+	printf("# HELP slbounce_phase_start_seconds Counter value at the start of a boot phase.\n");
+	printf("# TYPE slbounce_phase_start_seconds gauge\n");
+	for (i = 0; i < TELEMETRY_EVENTS; i++) {
+		e = &rec->events[i];
+		if (!e->count || !event_names[i])
+			continue;
+		printf("slbounce_phase_start_seconds{phase=\"%s\"} %.9f\n", event_names[i],
+		       (double)e->start / rec->freq);
+	}
+
+	printf("# HELP slbounce_phase_value Result of a boot phase.\n");
+	printf("# TYPE slbounce_phase_value gauge\n");
+	for (i = 0; i < TELEMETRY_EVENTS; i++) {
+		e = &rec->events[i];
+		if (!e->count || !event_names[i])
+			continue;
+		printf("slbounce_phase_value{phase=\"%s\"} %llu\n", event_names[i],
+		       (unsigned long long)e->value);
+	}
+
+	printf("# HELP slbounce_flush_bytes Bytes flushed before the launch.\n");
+	printf("# TYPE slbounce_flush_bytes gauge\n");
+	for (i = 0; i < TELEMETRY_MEM_TYPES; i++) {
+		f = &rec->flush[i];
+		if (f->ranges)
+			printf("slbounce_flush_bytes{type=\"%s\"} %llu\n", mem_names[i],
+			       (unsigned long long)f->bytes);
+	}
+
+	printf("# HELP slbounce_flush_seconds Time spent flushing before the launch.\n");
+	printf("# TYPE slbounce_flush_seconds gauge\n");
+	for (i = 0; i < TELEMETRY_MEM_TYPES; i++) {
+		f = &rec->flush[i];
+		if (f->ranges)
+			printf("slbounce_flush_seconds{type=\"%s\"} %.9f\n", mem_names[i],
+			       (double)f->ticks / rec->freq);
+	}
+
+	if (rec->flush_predicted_ns) {
+		printf("# HELP slbounce_flush_predicted_seconds Flush time the tuner predicted.\n");
+		printf("# TYPE slbounce_flush_predicted_seconds gauge\n");
+		printf("slbounce_flush_predicted_seconds{strategy=\"%s\"} %.9f\n",
+		       strategy_name(rec->flush_strategy), rec->flush_predicted_ns / 1e9);
+	}
+
+	if (!has_pmu(rec))
+		return;
+
+	printf("# HELP slbounce_pmu_cycles CPU cycles spent in a region.\n");
+	printf("# TYPE slbounce_pmu_cycles gauge\n");
+	for (i = 0; i < TELEMETRY_PMU_REGIONS; i++) {
+		p = &rec->pmu[i];
+		if (p->calls)
+			printf("slbounce_pmu_cycles{region=\"%s\"} %llu\n", pmu_region_names[i],
+			       (unsigned long long)p->cycles);
+	}
+
+	printf("# HELP slbounce_pmu_events PMUv3 events counted in a region.\n");
+	printf("# TYPE slbounce_pmu_events gauge\n");
+	for (i = 0; i < TELEMETRY_PMU_REGIONS; i++) {
+		p = &rec->pmu[i];
+		if (!p->calls)
+			continue;
+		for (j = 0; j < rec->pmu_count && j < TELEMETRY_PMU_EVENTS; j++)
+			printf("slbounce_pmu_events{region=\"%s\",event=\"0x%02x\"} %llu\n",
+			       pmu_region_names[i], rec->pmu_events[j],
+			       (unsigned long long)p->events[j]);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-p] [dump.bin]\n"
+		"  -p      print in the Prometheus text format\n"
+		"Without a dump, the record is read via /dev/mem.\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct telemetry_record *rec;
+	int opt, prom = 0;
+
+	while ((opt = getopt(argc, argv, "ph")) != -1) {
+		switch (opt) {
+		case 'p': prom = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind > 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (optind < argc)
+		rec = load_file(argv[optind]);
+	else
+		rec = load_mem();
+	if (!rec)
+		return 1;
+
+	if (rec->magic != TELEMETRY_MAGIC || rec->version != TELEMETRY_VERSION ||
+	    rec->size != sizeof(*rec) || !rec->freq) {
+		fprintf(stderr, "not an slbounce telemetry record\n");
+		free(rec);
+		return 1;
+	}
+
+	if (prom)
+		print_prometheus(rec);
+	else
+		print_text(rec);
+
+	free(rec);
+
+	return 0;
+}
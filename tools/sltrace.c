@@ -0,0 +1,273 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * sltrace - Print a trace ring recorded with SLBOUNCE_TRACE.
+ *
+ * The records are listed oldest first, with -j they are written as
+ * Chrome trace JSON instead, which chrome://tracing and Perfetto can
+ * open. SMCs become duration events, the flushed ranges complete
+ * events and everything else instant events.
+ *
+ * Usage: sltrace [-j] trace.bin
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TRACE_FORMAT_ONLY
+#include "trace.h"
+
+#define SL_FORMAT_ONLY
+#include "sl.h"
+
+static const char *const sl_cmd_names[] = {
+	[SL_CMD_IS_AVAILABLE]	= "IS_AVAILABLE",
+	[SL_CMD_AUTH]		= "AUTH",
+	[SL_CMD_RESERVE_MEM]	= "RESERVE_MEM",
+	[SL_CMD_LAUNCH]		= "LAUNCH",
+	[SL_CMD_UNMAP_ALL]	= "UNMAP_ALL",
+};
+
+#define SL_CMD_CNT	(sizeof(sl_cmd_names) / sizeof(sl_cmd_names[0]))
+
+static const struct trace_entry *entries(const struct trace_header *ring)
+{
+	return (const void *)(ring + 1);
+}
+
+static const struct trace_entry *entry(const struct trace_header *ring, uint64_t idx)
+{
+	const struct trace_entry *e = &entries(ring)[idx & (ring->entries - 1)];
+
+	/* Torn or overwritten while the ring was copied. */
+	if (e->seq != idx + 1)
+		return NULL;
+
+	return e;
+}
+
+static const char *event_name(const struct trace_entry *e)
+{
+	if (e->event < TRACE_EVENT_CNT)
+		return trace_event_names[e->event];
+
+	return "?";
+}
+
+static const char *cmd_name(uint64_t cmd)
+{
+	if (cmd < SL_CMD_CNT && sl_cmd_names[cmd])
+		return sl_cmd_names[cmd];
+
+	return "SL_?";
+}
+
+static struct trace_header *load_ring(const char *path)
+{
+	struct trace_header *ring;
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+
+	ring = calloc(1, TRACE_SIZE);
+	len = fread(ring, 1, TRACE_SIZE, f);
+	fclose(f);
+
+	if (len < sizeof(*ring) || ring->magic != TRACE_MAGIC || ring->version != TRACE_VERSION ||
+	    ring->entry_size != sizeof(struct trace_entry)) {
+		fprintf(stderr, "%s: not a trace ring\n", path);
+		goto err;
+	}
+
+	if (!ring->freq || !ring->entries || (ring->entries & (ring->entries - 1)) ||
+	    ring->size > len || sizeof(*ring) + (uint64_t)ring->entries * ring->entry_size > ring->size) {
+		fprintf(stderr, "%s: truncated trace ring\n", path);
+		goto err;
+	}
+
+	return ring;
+
+err:
+	free(ring);
+	return NULL;
+}
+
+static double ticks_us(const struct trace_header *ring, uint64_t ticks)
+{
+	return (double)ticks * 1e6 / ring->freq;
+}
+
+static uint64_t first_index(const struct trace_header *ring)
+{
+	if (ring->head > ring->entries)
+		return ring->head - ring->entries;
+
+	return 0;
+}
+
+static uint64_t first_time(const struct trace_header *ring)
+{
+	const struct trace_entry *e;
+	uint64_t idx;
+
+	for (idx = first_index(ring); idx < ring->head; idx++) {
+		e = entry(ring, idx);
+		if (e)
+			return e->time;
+	}
+
+	return 0;
+}
+
+static void print_name8(uint64_t val)
+{
+	int i;
+
+	for (i = 0; i < 8 && (val >> (i * 8)) & 0xff; i++)
+		putchar((val >> (i * 8)) & 0xff);
+}
+
+static void print_ring(const char *path, const struct trace_header *ring)
+{
+	uint64_t idx, start = first_index(ring), t0 = first_time(ring);
+	const struct trace_entry *e;
+	int i;
+
+	printf("%s: %llu records, %llu overwritten, %llu Hz\n", path,
+	       (unsigned long long)ring->head, (unsigned long long)start,
+	       (unsigned long long)ring->freq);
+
+	for (idx = start; idx < ring->head; idx++) {
+		e = entry(ring, idx);
+		if (!e) {
+			printf("%5llu torn\n", (unsigned long long)idx);
+			continue;
+		}
+
+		printf("%5llu %12.1f cpu%-4x %-12s", (unsigned long long)idx,
+		       ticks_us(ring, e->time - t0), e->cpu, event_name(e));
+
+		switch (e->event) {
+		case TRACE_PE_SECTION:
+			printf(" '");
+			print_name8(e->args[0]);
+			printf("' %llu bytes from 0x%llx to 0x%llx\n", (unsigned long long)e->args[1],
+			       (unsigned long long)e->args[2], (unsigned long long)e->args[3]);
+			break;
+		case TRACE_SMC:
+			printf(" %s\n", cmd_name(e->args[0]));
+			break;
+		case TRACE_SMC_RET:
+			printf(" %s = 0x%llx\n", cmd_name(e->args[0]), (unsigned long long)e->args[1]);
+			break;
+		case TRACE_FLUSH:
+			printf(" 0x%llx+0x%llx type %llu in %.1f us\n", (unsigned long long)e->args[0],
+			       (unsigned long long)e->args[1], (unsigned long long)e->args[3],
+			       ticks_us(ring, e->args[2]));
+			break;
+		default:
+			for (i = 0; i < 4; i++)
+				printf(" %llx", (unsigned long long)e->args[i]);
+			printf("\n");
+			break;
+		}
+	}
+}
+
+static void print_chrome(const struct trace_header *ring)
+{
+	uint64_t idx, t0 = first_time(ring);
+	const struct trace_entry *e;
+	const char *sep = "";
+	double ts;
+
+	printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+	for (idx = first_index(ring); idx < ring->head; idx++) {
+		e = entry(ring, idx);
+		if (!e)
+			continue;
+
+		ts = ticks_us(ring, e->time - t0);
+		printf("%s{\"pid\":0,\"tid\":%u,", sep, e->cpu);
+		sep = ",\n";
+
+		switch (e->event) {
+		case TRACE_SMC:
+			printf("\"ph\":\"B\",\"ts\":%.3f,\"name\":\"%s\",\"args\":{\"pe\":\"0x%llx\",\"arg\":\"0x%llx\"}}",
+			       ts, cmd_name(e->args[0]),
+			       (unsigned long long)e->args[1], (unsigned long long)e->args[2]);
+			break;
+		case TRACE_SMC_RET:
+			printf("\"ph\":\"E\",\"ts\":%.3f,\"name\":\"%s\",\"args\":{\"ret\":\"0x%llx\"}}",
+			       ts, cmd_name(e->args[0]), (unsigned long long)e->args[1]);
+			break;
+		case TRACE_FLUSH:
+			/* Recorded after the range was flushed. */
+			printf("\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"name\":\"flush\","
+			       "\"args\":{\"start\":\"0x%llx\",\"size\":%llu,\"type\":%llu}}",
+			       ts - ticks_us(ring, e->args[2]), ticks_us(ring, e->args[2]),
+			       (unsigned long long)e->args[0], (unsigned long long)e->args[1],
+			       (unsigned long long)e->args[3]);
+			break;
+		default:
+			printf("\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"name\":\"%s\","
+			       "\"args\":{\"a\":\"0x%llx\",\"b\":\"0x%llx\",\"c\":\"0x%llx\",\"d\":\"0x%llx\"}}",
+			       ts, event_name(e),
+			       (unsigned long long)e->args[0], (unsigned long long)e->args[1],
+			       (unsigned long long)e->args[2], (unsigned long long)e->args[3]);
+			break;
+		}
+	}
+
+	printf("\n]}\n");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-j] trace.bin\n"
+		"  -j      write Chrome trace JSON\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct trace_header *ring;
+	int opt, json = 0;
+
+	while ((opt = getopt(argc, argv, "jh")) != -1) {
+		switch (opt) {
+		case 'j': json = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	ring = load_ring(argv[optind]);
+	if (!ring)
+		return 1;
+
+	if (json)
+		print_chrome(ring);
+	else
+		print_ring(argv[optind], ring);
+
+	free(ring);
+
+	return 0;
+}
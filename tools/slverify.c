@@ -0,0 +1,189 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * slverify - Report the flush misses found with SLBOUNCE_VERIFY.
+ *
+ * Takes a dump of the verify region (found the same way as the memory
+ * map capture, see README.md) and summarizes the checked memory and
+ * the chunks whose checksum changed over the switch by EFI memory
+ * type, then lists the mismatching chunks. With -a all chunks are
+ * listed. The exit code is 2 if there were mismatches, so it can be
+ * scripted.
+ *
+ * Usage: slverify [-a] verify.bin
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define VERIFY_FORMAT_ONLY
+#include "verify.h"
+
+#define MEM_TYPES	16	/* The last one takes the rest. */
+
+static const char *const mem_names[MEM_TYPES] = {
+	"Reserved", "LoaderCode", "LoaderData", "BootServicesCode",
+	"BootServicesData", "RuntimeServicesCode", "RuntimeServicesData",
+	"Conventional", "Unusable", "ACPIReclaim", "ACPINVS", "MMIO",
+	"MMIOPortSpace", "PalCode", "Persistent", "Other",
+};
+
+struct type_sum {
+	uint64_t checked;
+	uint64_t missed;
+	uint32_t chunks;
+	uint32_t mismatches;
+	uint32_t skipped;
+};
+
+static const struct verify_chunk *chunks(const struct verify_header *v)
+{
+	return (const void *)(v + 1);
+}
+
+static const char *type_name(uint32_t type)
+{
+	return mem_names[type < MEM_TYPES ? type : MEM_TYPES - 1];
+}
+
+static struct verify_header *load_region(const char *path)
+{
+	struct verify_header *v;
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+
+	v = calloc(1, VERIFY_SIZE);
+	len = fread(v, 1, VERIFY_SIZE, f);
+	fclose(f);
+
+	if (len < sizeof(*v) || v->magic != VERIFY_MAGIC || v->version != VERIFY_VERSION) {
+		fprintf(stderr, "%s: not a verify region\n", path);
+		goto err;
+	}
+
+	if (v->size > len || sizeof(*v) + (uint64_t)v->count * sizeof(struct verify_chunk) > v->size) {
+		fprintf(stderr, "%s: truncated verify region\n", path);
+		goto err;
+	}
+
+	return v;
+
+err:
+	free(v);
+	return NULL;
+}
+
+static void print_chunk(const struct verify_chunk *c)
+{
+	printf("0x%012llx %8u %-20s %08x %08x%s\n", (unsigned long long)c->start, c->size,
+	       type_name(c->type), c->before, c->after,
+	       c->flags & VERIFY_F_SKIPPED ? " skipped" :
+	       c->flags & VERIFY_F_MISMATCH ? " MISMATCH" : "");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-a] verify.bin\n"
+		"  -a      list all chunks, not only the mismatching ones\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct type_sum sums[MEM_TYPES] = { 0 };
+	const struct verify_chunk *c;
+	struct verify_header *v;
+	int opt, all = 0, ret;
+	uint32_t i, t;
+
+	while ((opt = getopt(argc, argv, "ah")) != -1) {
+		switch (opt) {
+		case 'a': all = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (argc - optind != 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	v = load_region(argv[optind]);
+	if (!v)
+		return 1;
+
+	switch (v->state) {
+	case VERIFY_CHECKED:
+		break;
+	case VERIFY_SUMMED:
+		fprintf(stderr, "Checksummed but never checked, the switch didn't come back.\n");
+		free(v);
+		return 1;
+	default:
+		fprintf(stderr, "Nothing was checked, the EBS hook didn't get to the switch.\n");
+		free(v);
+		return 1;
+	}
+
+	for (i = 0; i < v->count; i++) {
+		c = &chunks(v)[i];
+		t = c->type < MEM_TYPES ? c->type : MEM_TYPES - 1;
+
+		sums[t].chunks++;
+		if (c->flags & VERIFY_F_SKIPPED) {
+			sums[t].skipped++;
+			continue;
+		}
+
+		sums[t].checked += c->size;
+		if (c->flags & VERIFY_F_MISMATCH) {
+			sums[t].mismatches++;
+			sums[t].missed += c->size;
+		}
+	}
+
+	printf("%u chunks of up to %u KiB, %.1f MiB checked, %u skipped, %u dropped\n",
+	       v->count, v->chunk_size / 1024, v->bytes / 1048576.0, v->skipped, v->dropped);
+	printf("checksums took %.3f ms before the switch and %.3f ms after\n\n",
+	       v->sum_ticks * 1e3 / v->freq, v->check_ticks * 1e3 / v->freq);
+
+	printf("%-20s %8s %12s %10s %12s %8s\n", "type", "chunks", "checked MiB", "mismatches",
+	       "missed MiB", "skipped");
+	for (t = 0; t < MEM_TYPES; t++) {
+		if (!sums[t].chunks)
+			continue;
+
+		printf("%-20s %8u %12.1f %10u %12.1f %8u\n", mem_names[t], sums[t].chunks,
+		       sums[t].checked / 1048576.0, sums[t].mismatches, sums[t].missed / 1048576.0,
+		       sums[t].skipped);
+	}
+
+	if (v->mismatches || all) {
+		printf("\n%-14s %8s %-20s %8s %8s\n", "start", "size", "type", "before", "after");
+		for (i = 0; i < v->count; i++) {
+			c = &chunks(v)[i];
+			if (all || (c->flags & VERIFY_F_MISMATCH))
+				print_chunk(c);
+		}
+	}
+
+	ret = v->mismatches ? 2 : 0;
+	if (v->mismatches)
+		printf("\n%u chunks changed over the switch, the flush missed something.\n", v->mismatches);
+
+	free(v);
+
+	return ret;
+}
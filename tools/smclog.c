@@ -0,0 +1,228 @@
+// SPDX-License-Identifier: BSD-3-Clause
+/* Copyright (c) 2024 Nikita Travkin <nikita@trvn.ru> */
+
+/*
+ * smclog - Print or compare SMC logs recorded with SLBOUNCE_SMCLOG.
+ *
+ * With one log the calls are listed, with -t also the Secure Launch
+ * data that was passed in. With two logs the calls are compared
+ * pairwise and the exit code says whether they differ, which is
+ * what a replayed run needs to be checked against its source.
+ *
+ * Usage: smclog [-t] log.bin [other.bin]
+ */
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SMCLOG_FORMAT_ONLY
+#include "smclog.h"
+
+static const char *const sl_cmd_names[] = {
+	[SL_CMD_IS_AVAILABLE]	= "IS_AVAILABLE",
+	[SL_CMD_AUTH]		= "AUTH",
+	[SL_CMD_RESERVE_MEM]	= "RESERVE_MEM",
+	[SL_CMD_LAUNCH]		= "LAUNCH",
+	[SL_CMD_UNMAP_ALL]	= "UNMAP_ALL",
+};
+
+#define SL_CMD_CNT	(sizeof(sl_cmd_names) / sizeof(sl_cmd_names[0]))
+
+static const struct smclog_entry *entries(const struct smclog_header *log)
+{
+	return (const void *)(log + 1);
+}
+
+static const char *call_name(const struct smclog_entry *e)
+{
+	if (e->args[0] != SMC_SL_ID)
+		return "";
+
+	if (e->args[2] < SL_CMD_CNT && sl_cmd_names[e->args[2]])
+		return sl_cmd_names[e->args[2]];
+
+	return "SL_?";
+}
+
+static struct smclog_header *load_log(const char *path)
+{
+	struct smclog_header *log;
+	size_t len;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return NULL;
+	}
+
+	log = calloc(1, SMCLOG_SIZE);
+	len = fread(log, 1, SMCLOG_SIZE, f);
+	fclose(f);
+
+	if (len < sizeof(*log) || log->magic != SMCLOG_MAGIC || log->version != SMCLOG_VERSION ||
+	    log->entry_size != sizeof(struct smclog_entry)) {
+		fprintf(stderr, "%s: not an smc log\n", path);
+		goto err;
+	}
+
+	if (log->size > len || !log->freq ||
+	    sizeof(*log) + (uint64_t)log->count * log->entry_size > log->size) {
+		fprintf(stderr, "%s: truncated smc log\n", path);
+		goto err;
+	}
+
+	return log;
+
+err:
+	free(log);
+	return NULL;
+}
+
+static double ticks_us(const struct smclog_header *log, uint64_t ticks)
+{
+	return (double)ticks * 1e6 / log->freq;
+}
+
+static void print_tz(const struct sl_tz_data *tz)
+{
+	printf("      tz: version %u, this 0x%llx+0x%llx, cert 0x%x+0x%x, tcg 0x%x+0x%x\n",
+	       tz->version, (unsigned long long)tz->this_phys, (unsigned long long)tz->this_size,
+	       tz->cert_offt, tz->cert_size, tz->tcg_offt, tz->tcg_size);
+	printf("          crt 0x%x x%u pages, boot params 0x%llx+0x%x\n",
+	       tz->crt_offt, tz->crt_pages_cnt,
+	       (unsigned long long)tz->boot_params, tz->boot_params_size);
+	printf("          tb entry 0x%llx, virt 0x%llx, phys 0x%llx, size 0x%llx\n",
+	       (unsigned long long)tz->tb_entry_point, (unsigned long long)tz->tb_virt,
+	       (unsigned long long)tz->tb_phys, (unsigned long long)tz->tb_size);
+	printf("          mair 0x%llx, tcr 0x%llx, ttbr0 0x%llx, ttbr1 0x%llx, sp 0x%llx\n",
+	       (unsigned long long)tz->tb_data.mair, (unsigned long long)tz->tb_data.tcr,
+	       (unsigned long long)tz->tb_data.ttbr0, (unsigned long long)tz->tb_data.ttbr1,
+	       (unsigned long long)tz->tb_data.sp);
+}
+
+static void print_log(const char *path, const struct smclog_header *log, int tz)
+{
+	const struct smclog_entry *e = entries(log);
+	uint64_t first = log->count ? e[0].time : 0;
+	uint32_t i;
+	int j;
+
+	printf("%s: %u calls, %u dropped, %llu Hz\n", path, log->count, log->dropped,
+	       (unsigned long long)log->freq);
+
+	for (i = 0; i < log->count; i++, e++) {
+		printf("%4u %10.1f  %-12s", i, ticks_us(log, e->time - first), call_name(e));
+		for (j = 0; j < 6; j++)
+			printf(" %llx", (unsigned long long)e->args[j]);
+
+		if (e->flags & SMCLOG_F_DONE)
+			printf(" = 0x%llx in %.1f us\n", (unsigned long long)e->ret, ticks_us(log, e->ticks));
+		else
+			printf(" didn't return\n");
+
+		if (!tz)
+			continue;
+
+		if (e->flags & SMCLOG_F_SL)
+			printf("      params: %u.%u v0x%x num %u, pe 0x%llx+0x%llx, arg 0x%llx+0x%llx\n",
+			       e->params.a, e->params.b, e->params.version, e->params.num,
+			       (unsigned long long)e->params.pe_data, (unsigned long long)e->params.pe_size,
+			       (unsigned long long)e->params.arg_data, (unsigned long long)e->params.arg_size);
+		if (e->flags & SMCLOG_F_TZ)
+			print_tz(&e->tz);
+	}
+}
+
+/*
+ * Addresses differ between a device and a replay, so only the
+ * calls, the results and the things that are not pointers count.
+ */
+static int compare_logs(const struct smclog_header *a, const struct smclog_header *b)
+{
+	const struct smclog_entry *ea = entries(a), *eb = entries(b);
+	uint32_t i, n = a->count < b->count ? a->count : b->count;
+	int diff = 0;
+
+	for (i = 0; i < n; i++) {
+		const struct smclog_entry *x = &ea[i], *y = &eb[i];
+		const char *what = NULL;
+
+		if (x->args[0] != y->args[0] || call_name(x) != call_name(y))
+			what = "call";
+		else if ((x->flags & SMCLOG_F_DONE) != (y->flags & SMCLOG_F_DONE) || x->ret != y->ret)
+			what = "result";
+		else if ((x->flags & SMCLOG_F_SL) && (y->flags & SMCLOG_F_SL) &&
+			 (x->params.num != y->params.num || x->params.version != y->params.version ||
+			  x->params.pe_size != y->params.pe_size || x->params.arg_size != y->params.arg_size))
+			what = "params";
+		else if ((x->flags & SMCLOG_F_TZ) && (y->flags & SMCLOG_F_TZ) &&
+			 (x->tz.version != y->tz.version || x->tz.cert_size != y->tz.cert_size ||
+			  x->tz.tcg_size != y->tz.tcg_size || x->tz.crt_pages_cnt != y->tz.crt_pages_cnt ||
+			  x->tz.this_size != y->tz.this_size || x->tz.tb_size != y->tz.tb_size))
+			what = "tz data";
+
+		printf("%4u %-12s %10.1f us %10.1f us%s%s\n", i, call_name(x),
+		       ticks_us(a, x->ticks), ticks_us(b, y->ticks),
+		       what ? "  differs: " : "", what ? what : "");
+		if (what)
+			diff = 1;
+	}
+
+	if (a->count != b->count) {
+		printf("%u vs %u calls\n", a->count, b->count);
+		diff = 1;
+	}
+
+	return diff;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-t] log.bin [other.bin]\n"
+		"  -t      also print the SL params and tz data\n"
+		"With two logs, compare them and exit with 2 if they differ.\n",
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	struct smclog_header *a, *b;
+	int opt, tz = 0, ret;
+
+	while ((opt = getopt(argc, argv, "th")) != -1) {
+		switch (opt) {
+		case 't': tz = 1; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind >= argc || argc - optind > 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	a = load_log(argv[optind]);
+	if (!a)
+		return 1;
+
+	if (argc - optind == 1) {
+		print_log(argv[optind], a, tz);
+		return 0;
+	}
+
+	b = load_log(argv[optind + 1]);
+	if (!b)
+		return 1;
+
+	ret = compare_logs(a, b);
+	free(a);
+	free(b);
+
+	return ret ? 2 : 0;
+}